@@ -0,0 +1,123 @@
+// Minimal MessagePack decoder for ESP2GO API responses.
+//
+// MsgPack.fetch() is a drop-in for fetch() on /_api/* endpoints: it asks the
+// device for MessagePack (Accept: application/msgpack) and returns a
+// Response-like object whose json() resolves to the decoded value. Replies
+// that come back as JSON are passed through unchanged.
+//
+// apiBatch() runs several API calls in one /_api/batch round trip:
+//   const [info, wifi] = await apiBatch([
+//       { path: '/_api/system/info' },
+//       { method: 'POST', path: '/_api/files/move', args: { source, destination } }
+//   ]);
+// Each result is { status, body }. Longer lists are sent in chunks of 16.
+(function (global) {
+    const BATCH_MAX_OPS = 16;
+
+    const textDecoder = new TextDecoder();
+
+    function decode(buffer) {
+        const bytes = new Uint8Array(buffer);
+        const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+        let pos = 0;
+
+        function str(length) {
+            const value = textDecoder.decode(bytes.subarray(pos, pos + length));
+            pos += length;
+            return value;
+        }
+
+        function array(length) {
+            const value = new Array(length);
+            for (let i = 0; i < length; i++) value[i] = read();
+            return value;
+        }
+
+        function map(length) {
+            const value = {};
+            for (let i = 0; i < length; i++) {
+                const key = read();
+                value[key] = read();
+            }
+            return value;
+        }
+
+        function read() {
+            const type = bytes[pos++];
+            let value;
+
+            if (type <= 0x7f) return type;
+            if (type >= 0xe0) return type - 0x100;
+            if ((type & 0xf0) === 0x80) return map(type & 0x0f);
+            if ((type & 0xf0) === 0x90) return array(type & 0x0f);
+            if ((type & 0xe0) === 0xa0) return str(type & 0x1f);
+
+            switch (type) {
+                case 0xc0: return null;
+                case 0xc2: return false;
+                case 0xc3: return true;
+                case 0xc4: value = bytes.slice(pos + 1, pos + 1 + bytes[pos]); pos += 1 + value.length; return value;
+                case 0xc5: value = bytes.slice(pos + 2, pos + 2 + view.getUint16(pos)); pos += 2 + value.length; return value;
+                case 0xc6: value = bytes.slice(pos + 4, pos + 4 + view.getUint32(pos)); pos += 4 + value.length; return value;
+                case 0xca: value = view.getFloat32(pos); pos += 4; return value;
+                case 0xcb: value = view.getFloat64(pos); pos += 8; return value;
+                case 0xcc: return bytes[pos++];
+                case 0xcd: value = view.getUint16(pos); pos += 2; return value;
+                case 0xce: value = view.getUint32(pos); pos += 4; return value;
+                case 0xcf: value = Number(view.getBigUint64(pos)); pos += 8; return value;
+                case 0xd0: value = view.getInt8(pos); pos += 1; return value;
+                case 0xd1: value = view.getInt16(pos); pos += 2; return value;
+                case 0xd2: value = view.getInt32(pos); pos += 4; return value;
+                case 0xd3: value = Number(view.getBigInt64(pos)); pos += 8; return value;
+                case 0xd9: return str(bytes[pos++]);
+                case 0xda: value = view.getUint16(pos); pos += 2; return str(value);
+                case 0xdb: value = view.getUint32(pos); pos += 4; return str(value);
+                case 0xdc: value = view.getUint16(pos); pos += 2; return array(value);
+                case 0xdd: value = view.getUint32(pos); pos += 4; return array(value);
+                case 0xde: value = view.getUint16(pos); pos += 2; return map(value);
+                case 0xdf: value = view.getUint32(pos); pos += 4; return map(value);
+            }
+            throw new Error('Unsupported MessagePack type 0x' + type.toString(16));
+        }
+
+        return read();
+    }
+
+    async function msgpackFetch(url, options = {}) {
+        const headers = Object.assign({ 'Accept': 'application/msgpack' }, options.headers);
+        const response = await fetch(url, Object.assign({}, options, { headers }));
+        const type = response.headers.get('Content-Type') || '';
+        if (!type.includes('msgpack')) return response;
+
+        const data = decode(await response.arrayBuffer());
+        return {
+            ok: response.ok,
+            status: response.status,
+            headers: response.headers,
+            json: () => Promise.resolve(data)
+        };
+    }
+
+    async function apiBatch(ops, options = {}) {
+        const results = [];
+        for (let i = 0; i < ops.length; i += BATCH_MAX_OPS) {
+            const response = await msgpackFetch('/_api/batch', {
+                method: 'POST',
+                headers: { 'Content-Type': 'application/json' },
+                body: JSON.stringify({
+                    ops: ops.slice(i, i + BATCH_MAX_OPS),
+                    stop_on_error: !!options.stopOnError
+                })
+            });
+            const data = await response.json();
+            if (!response.ok) throw new Error(data.error || 'Batch failed');
+
+            results.push(...data.results);
+            if (data.stopped || (options.stopOnError && data.results.some(r => r.status >= 400))) break;
+        }
+        return results;
+    }
+
+    global.MsgPack = { decode, fetch: msgpackFetch };
+    global.apiBatch = apiBatch;
+})(window);
@@ -0,0 +1,145 @@
+#include "api_codec.h"
+#include "config.h"
+
+static uint32_t jsonResponses = 0;
+static uint32_t msgpackResponses = 0;
+static uint32_t msgpackBodies = 0;
+
+static bool isMsgPackType(const String& type) {
+  return type.indexOf(API_MIME_MSGPACK) >= 0 || type.indexOf("application/x-msgpack") >= 0;
+}
+
+bool wantsMsgPack(AsyncWebServerRequest *request) {
+  return request->hasHeader("Accept") && isMsgPackType(request->getHeader("Accept")->value());
+}
+
+void sendApiDocument(AsyncWebServerRequest *request, int code, JsonVariantConst doc) {
+  if (wantsMsgPack(request)) {
+    AsyncResponseStream *response = request->beginResponseStream(API_MIME_MSGPACK);
+    response->setCode(code);
+    response->addHeader("Vary", "Accept");
+    serializeMsgPack(doc, *response);
+    request->send(response);
+    msgpackResponses++;
+    return;
+  }
+
+  String response;
+  serializeJson(doc, response);
+  request->send(code, "application/json", response);
+  jsonResponses++;
+}
+
+void sendApiJson(AsyncWebServerRequest *request, int code, const String& json) {
+  if (wantsMsgPack(request)) {
+    JsonDocument doc;
+    if (!deserializeJson(doc, json)) {
+      sendApiDocument(request, code, doc);
+      return;
+    }
+  }
+
+  request->send(code, "application/json", json);
+  jsonResponses++;
+}
+
+bool hasMsgPackBody(AsyncWebServerRequest *request) {
+  return isMsgPackType(request->contentType());
+}
+
+DeserializationError deserializeApiBody(AsyncWebServerRequest *request, JsonDocument& doc,
+                                        const uint8_t *data, size_t len) {
+  if (hasMsgPackBody(request)) {
+    msgpackBodies++;
+    return deserializeMsgPack(doc, data, len);
+  }
+  return deserializeJson(doc, data, len);
+}
+
+void getApiCodecStats(JsonObject out) {
+  out["json_responses"] = jsonResponses;
+  out["msgpack_responses"] = msgpackResponses;
+  out["msgpack_bodies"] = msgpackBodies;
+}
+
+// ============================================
+// Benchmark
+// ============================================
+
+static void buildListingSample(JsonDocument& doc) {
+  JsonArray files = doc["files"].to<JsonArray>();
+  for (int i = 0; i < 48; i++) {
+    JsonObject file = files.add<JsonObject>();
+    file["name"] = "recording_" + String(1000 + i) + ".wav";
+    file["path"] = "/data/recordings/recording_" + String(1000 + i) + ".wav";
+    file["type"] = i % 8 ? "file" : "dir";
+    file["size"] = 48000 + i * 1531;
+    file["modified"] = 1760000000 + i * 60;
+  }
+}
+
+static void buildTelemetrySample(JsonDocument& doc) {
+  doc["uptime"] = 86400;
+  doc["free_heap"] = 143212;
+  doc["min_free_heap"] = 98304;
+  doc["cpu_mhz"] = 240;
+  doc["rssi"] = -61;
+  doc["audio_level"] = 0.4375;
+  JsonArray samples = doc["samples"].to<JsonArray>();
+  for (int i = 0; i < 32; i++) {
+    samples.add(i * 97 % 4096);
+  }
+}
+
+static void benchmarkSample(const JsonDocument& sample, uint32_t iterations, JsonObject out) {
+  size_t jsonSize = measureJson(sample);
+  size_t msgpackSize = measureMsgPack(sample);
+  uint8_t *buffer = (uint8_t*)malloc(max(jsonSize, msgpackSize) + 1);
+  if (!buffer) {
+    out["error"] = "Out of memory";
+    return;
+  }
+
+  JsonDocument decoded;
+  uint32_t mhz = ESP.getCpuFreqMHz();
+
+  uint32_t start = ESP.getCycleCount();
+  for (uint32_t n = 0; n < iterations; n++) serializeJson(sample, (char*)buffer, jsonSize + 1);
+  uint32_t jsonEncode = ESP.getCycleCount() - start;
+
+  start = ESP.getCycleCount();
+  for (uint32_t n = 0; n < iterations; n++) deserializeJson(decoded, buffer, jsonSize);
+  uint32_t jsonDecode = ESP.getCycleCount() - start;
+
+  start = ESP.getCycleCount();
+  for (uint32_t n = 0; n < iterations; n++) serializeMsgPack(sample, buffer, msgpackSize);
+  uint32_t msgpackEncode = ESP.getCycleCount() - start;
+
+  start = ESP.getCycleCount();
+  for (uint32_t n = 0; n < iterations; n++) deserializeMsgPack(decoded, buffer, msgpackSize);
+  uint32_t msgpackDecode = ESP.getCycleCount() - start;
+
+  free(buffer);
+
+  JsonObject json = out["json"].to<JsonObject>();
+  json["bytes"] = jsonSize;
+  json["encode_us"] = jsonEncode / mhz / iterations;
+  json["decode_us"] = jsonDecode / mhz / iterations;
+
+  JsonObject msgpack = out["msgpack"].to<JsonObject>();
+  msgpack["bytes"] = msgpackSize;
+  msgpack["encode_us"] = msgpackEncode / mhz / iterations;
+  msgpack["decode_us"] = msgpackDecode / mhz / iterations;
+}
+
+void runApiCodecBenchmark(uint32_t iterations, JsonObject out) {
+  out["iterations"] = iterations;
+
+  JsonDocument listing;
+  buildListingSample(listing);
+  benchmarkSample(listing, iterations, out["listing"].to<JsonObject>());
+
+  JsonDocument telemetry;
+  buildTelemetrySample(telemetry);
+  benchmarkSample(telemetry, iterations, out["telemetry"].to<JsonObject>());
+}
@@ -0,0 +1,31 @@
+#ifndef API_CODEC_H
+#define API_CODEC_H
+
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+
+// Wire format for /_api/* payloads. Handlers build a JsonDocument and hand
+// it to sendApiDocument(); the client picks the encoding:
+//   Accept: application/msgpack       -> MessagePack response
+//   Content-Type: application/msgpack -> MessagePack request body
+// Anything else gets JSON, exactly as before.
+#define API_MIME_MSGPACK "application/msgpack"
+
+bool wantsMsgPack(AsyncWebServerRequest *request);
+
+void sendApiDocument(AsyncWebServerRequest *request, int code, JsonVariantConst doc);
+
+// For handlers that answer with a fixed JSON literal; re-encoded only when
+// the client asked for MessagePack
+void sendApiJson(AsyncWebServerRequest *request, int code, const String& json);
+
+bool hasMsgPackBody(AsyncWebServerRequest *request);
+DeserializationError deserializeApiBody(AsyncWebServerRequest *request, JsonDocument& doc,
+                                        const uint8_t *data, size_t len);
+
+void getApiCodecStats(JsonObject out);
+
+// Encodes and decodes a file listing and a telemetry sample in both formats
+void runApiCodecBenchmark(uint32_t iterations, JsonObject out);
+
+#endif
@@ -0,0 +1,382 @@
+#include "api_router.h"
+#include "api_codec.h"
+#include "config.h"
+#include "mime_types.h"
+#include "request_governor.h"
+#include "route_table.h"
+#include <algorithm>
+
+static_assert(API_MAX_ROUTES <= ROUTE_TABLE_MAX, "API_MAX_ROUTES does not fit the route index");
+
+static ApiRoute routes[API_MAX_ROUTES];
+static size_t routeCount = 0;
+static RouteTable routeTable;
+static bool routerStarted = false;
+
+// Dispatch accounting (CPU cycles spent in route lookup)
+static uint32_t dispatchCount = 0;
+static uint32_t notFoundCount = 0;
+static uint64_t dispatchCycles = 0;
+
+// A route that cannot be registered is a build mistake, not a runtime
+// condition: stop at boot rather than serve without the endpoint
+static void failRouteTable(const char* reason, const char* uri) {
+  LOG_ERROR("API router: %s: %s", reason, uri);
+  abort();
+}
+
+static ApiRoute* addRoute(const char* uri, WebRequestMethodComposite method,
+                          ArRequestHandlerFunction onRequest,
+                          ArUploadHandlerFunction onUpload,
+                          ArBodyHandlerFunction onBody) {
+  if (routerStarted) {
+    failRouteTable("route registered after start", uri);
+  }
+  if (routeCount >= API_MAX_ROUTES) {
+    failRouteTable("route table full, raise API_MAX_ROUTES", uri);
+  }
+
+  ApiRoute& route = routes[routeCount++];
+  route.uri = uri;
+  route.method = method;
+  route.onRequest = onRequest;
+  route.onUpload = onUpload;
+  route.onBody = onBody;
+  route.operation = nullptr;
+  route.hits = 0;
+  return &route;
+}
+
+void apiRoute(const char* uri, WebRequestMethodComposite method,
+              ArRequestHandlerFunction onRequest,
+              ArUploadHandlerFunction onUpload,
+              ArBodyHandlerFunction onBody) {
+  addRoute(uri, method, onRequest, onUpload, onBody);
+}
+
+static ApiRoute* findRoute(const char* uri, WebRequestMethodComposite method, bool& pathFound) {
+  int first = findRoutePath(routeTable, uri);
+  pathFound = first >= 0;
+  if (first < 0) {
+    return nullptr;
+  }
+
+  // Routes sharing a path are adjacent after sorting
+  for (size_t i = first; i < routeCount; i++) {
+    if (i != (size_t)first && strcmp(routes[i].uri, uri) != 0) break;
+    if (routes[i].method & method) return &routes[i];
+  }
+  return nullptr;
+}
+
+const ApiRoute* findApiRoute(const char* uri, WebRequestMethodComposite method) {
+  bool pathFound;
+  return findRoute(uri, method, pathFound);
+}
+
+static void handleApiRequest(AsyncWebServerRequest *request) {
+  if (!admitRequest(request)) return;
+
+  uint32_t start = ESP.getCycleCount();
+  bool pathFound;
+  ApiRoute* route = findRoute(request->url().c_str(), request->method(), pathFound);
+  dispatchCycles += ESP.getCycleCount() - start;
+  dispatchCount++;
+
+  if (!route) {
+    notFoundCount++;
+    if (pathFound) {
+      sendApiJson(request, 405, "{\"error\":\"Method not allowed\"}");
+    } else {
+      LOG_WARN("Unknown API endpoint: %s", request->url().c_str());
+      sendApiJson(request, 404, "{\"error\":\"Unknown API endpoint\"}");
+    }
+    return;
+  }
+
+  route->hits++;
+  if (route->onRequest) {
+    route->onRequest(request);
+  }
+}
+
+static void handleApiUpload(AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t *data, size_t len, bool final) {
+  if (!admitRequest(request, true)) return;
+
+  bool pathFound;
+  ApiRoute* route = findRoute(request->url().c_str(), request->method(), pathFound);
+  if (route && route->onUpload) {
+    route->onUpload(request, filename, index, data, len, final);
+  }
+}
+
+static void handleApiBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  if (!admitRequest(request, total > GOV_LARGE_FILE_BYTES)) return;
+
+  bool pathFound;
+  ApiRoute* route = findRoute(request->url().c_str(), request->method(), pathFound);
+  if (route && route->onBody) {
+    route->onBody(request, data, len, index, total);
+  }
+}
+
+void beginApiRouter(AsyncWebServer& server) {
+  std::stable_sort(routes, routes + routeCount, [](const ApiRoute& a, const ApiRoute& b) {
+    return strcmp(a.uri, b.uri) < 0;
+  });
+
+  for (size_t i = 0; i < routeCount; i++) {
+    routeTable.paths[i] = routes[i].uri;
+  }
+  buildRouteTable(routeTable, routeCount);
+
+  routerStarted = true;
+  server.on(API_PREFIX "*", HTTP_ANY, handleApiRequest, handleApiUpload, handleApiBody);
+  LOG_INFO("API router ready: %d routes, %d paths", routeCount, routeTable.distinct);
+}
+
+const char* collectRequestBody(AsyncWebServerRequest *request, uint8_t *data, size_t len,
+                               size_t index, size_t total, size_t maxSize) {
+  if (total > maxSize) {
+    if (index == 0) {
+      sendApiJson(request, 413, "{\"error\":\"Request body too large\"}");
+    }
+    return nullptr;
+  }
+
+  if (index == 0) {
+    request->_tempObject = malloc(total + 1);
+    if (!request->_tempObject) {
+      sendApiJson(request, 503, "{\"error\":\"Out of memory\"}");
+      return nullptr;
+    }
+  }
+  if (!request->_tempObject || index + len > total) return nullptr;
+
+  char* body = (char*)request->_tempObject;
+  memcpy(body + index, data, len);
+  if (index + len < total) return nullptr;
+
+  body[total] = '\0';
+  return body;
+}
+
+void rejectEmptyBody(AsyncWebServerRequest *request) {
+  if (request->contentLength() == 0) {
+    sendApiJson(request, 400, "{\"error\":\"Empty body\"}");
+  }
+}
+
+void getApiRouterStats(JsonObject out) {
+  out["routes"] = routeCount;
+  out["dispatched"] = dispatchCount;
+  out["not_found"] = notFoundCount;
+  out["avg_dispatch_ns"] = dispatchCount ?
+    (uint32_t)(dispatchCycles * 1000 / dispatchCount / ESP.getCpuFreqMHz()) : 0;
+
+  JsonArray list = out["table"].to<JsonArray>();
+  for (size_t i = 0; i < routeCount; i++) {
+    JsonObject entry = list.add<JsonObject>();
+    entry["uri"] = routes[i].uri;
+    entry["method"] = routes[i].method;
+    entry["hits"] = routes[i].hits;
+  }
+}
+
+// Compares table dispatch against the linear first-match walk AsyncWebServer
+// does over its handler list, and times the MIME lookup used for static files.
+void runApiRouterBenchmark(uint32_t iterations, JsonObject out) {
+  static const char* mimeSamples[] = {
+    "/index.html", "/apps/led_app.html", "/docs/openapi.yaml", "/img/logo.png", "/firmware.bin"
+  };
+  const size_t mimeSampleCount = sizeof(mimeSamples) / sizeof(mimeSamples[0]);
+  volatile uintptr_t sink = 0;
+
+  uint32_t start = ESP.getCycleCount();
+  for (uint32_t n = 0; n < iterations; n++) {
+    for (size_t i = 0; i < routeCount; i++) {
+      sink += (uintptr_t)findApiRoute(routes[i].uri, routes[i].method);
+    }
+  }
+  uint32_t tableCycles = ESP.getCycleCount() - start;
+
+  start = ESP.getCycleCount();
+  for (uint32_t n = 0; n < iterations; n++) {
+    for (size_t i = 0; i < routeCount; i++) {
+      for (size_t j = 0; j < routeCount; j++) {
+        if ((routes[j].method & routes[i].method) && strcmp(routes[j].uri, routes[i].uri) == 0) {
+          sink += j;
+          break;
+        }
+      }
+    }
+  }
+  uint32_t linearCycles = ESP.getCycleCount() - start;
+
+  start = ESP.getCycleCount();
+  for (uint32_t n = 0; n < iterations; n++) {
+    for (size_t i = 0; i < mimeSampleCount; i++) {
+      sink += (uintptr_t)getMimeType(mimeSamples[i]);
+    }
+  }
+  uint32_t mimeCycles = ESP.getCycleCount() - start;
+
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  uint64_t lookups = (uint64_t)iterations * (routeCount ? routeCount : 1);
+  out["iterations"] = iterations;
+  out["routes"] = routeCount;
+  out["table_ns"] = (uint32_t)((uint64_t)tableCycles * 1000 / mhz / lookups);
+  out["linear_ns"] = (uint32_t)((uint64_t)linearCycles * 1000 / mhz / lookups);
+  out["mime_ns"] = (uint32_t)((uint64_t)mimeCycles * 1000 / mhz / ((uint64_t)iterations * mimeSampleCount));
+}
+
+// ============================================
+// Operations and batching
+// ============================================
+
+int apiError(JsonDocument& result, int code, const char* message) {
+  result["error"] = message;
+  return code;
+}
+
+int apiArgInt(JsonVariantConst value, int fallback) {
+  if (value.is<int>()) return value.as<int>();
+  if (value.is<const char*>()) {
+    const char* text = value.as<const char*>();
+    return *text ? atoi(text) : fallback;
+  }
+  return fallback;
+}
+
+static void addRequestParams(AsyncWebServerRequest *request, JsonObject args) {
+  for (size_t i = 0; i < request->params(); i++) {
+    const AsyncWebParameter* param = request->getParam(i);
+    if (param->isFile() || !args[param->name()].isNull()) continue;
+    args[param->name()] = param->value();
+  }
+}
+
+void apiOperation(const char* uri, WebRequestMethodComposite method, ApiOperation operation) {
+  // The body callback only buffers; the work runs once the request is complete
+  ApiRoute* route = addRoute(uri, method,
+    [operation](AsyncWebServerRequest *request) {
+      JsonDocument args;
+      if (request->_tempObject) {
+        const uint8_t* body = (const uint8_t*)request->_tempObject;
+        if (deserializeApiBody(request, args, body, request->contentLength()) || !args.is<JsonObject>()) {
+          sendApiJson(request, 400, "{\"error\":\"Invalid JSON\"}");
+          return;
+        }
+      } else if (request->contentLength() > 0 &&
+                 request->contentType().indexOf("application/x-www-form-urlencoded") < 0) {
+        return;  // body was refused by collectRequestBody(), which already answered
+      }
+      if (args.isNull()) args.to<JsonObject>();
+      addRequestParams(request, args.as<JsonObject>());
+
+      JsonDocument result;
+      int code = operation(args.as<JsonVariantConst>(), result);
+      sendApiDocument(request, code, result);
+    },
+    nullptr,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+      collectRequestBody(request, data, len, index, total, API_OPERATION_MAX_BODY);
+    });
+
+  if (route) route->operation = operation;
+}
+
+static WebRequestMethodComposite parseMethod(const char* name) {
+  if (strcmp(name, "GET") == 0) return HTTP_GET;
+  if (strcmp(name, "POST") == 0) return HTTP_POST;
+  if (strcmp(name, "DELETE") == 0) return HTTP_DELETE;
+  if (strcmp(name, "PUT") == 0) return HTTP_PUT;
+  if (strcmp(name, "PATCH") == 0) return HTTP_PATCH;
+  return 0;
+}
+
+static String urlDecode(const String& text) {
+  String decoded;
+  decoded.reserve(text.length());
+  for (size_t i = 0; i < text.length(); i++) {
+    char c = text[i];
+    if (c == '+') {
+      decoded += ' ';
+    } else if (c == '%' && i + 2 < text.length()) {
+      char hex[3] = {text[i + 1], text[i + 2], 0};
+      decoded += (char)strtol(hex, nullptr, 16);
+      i += 2;
+    } else {
+      decoded += c;
+    }
+  }
+  return decoded;
+}
+
+// "a=1&b=x%2Fy" -> args, without overwriting keys the op already set
+static void addQueryString(const String& query, JsonObject args) {
+  int start = 0;
+  while (start < (int)query.length()) {
+    int end = query.indexOf('&', start);
+    if (end < 0) end = query.length();
+    String pair = query.substring(start, end);
+    int eq = pair.indexOf('=');
+    String name = urlDecode(eq < 0 ? pair : pair.substring(0, eq));
+    if (name.length() > 0 && args[name].isNull()) {
+      args[name] = eq < 0 ? String() : urlDecode(pair.substring(eq + 1));
+    }
+    start = end + 1;
+  }
+}
+
+static int runBatchOp(JsonObjectConst op, JsonDocument& result) {
+  const char* methodName = op["method"] | "GET";
+  String path = op["path"] | "";
+  WebRequestMethodComposite method = parseMethod(methodName);
+  if (method == 0) return apiError(result, 400, "Invalid method");
+
+  JsonDocument args;
+  if (op["args"].is<JsonObjectConst>()) {
+    args.set(op["args"]);
+  } else {
+    args.to<JsonObject>();
+  }
+  int query = path.indexOf('?');
+  if (query >= 0) {
+    addQueryString(path.substring(query + 1), args.as<JsonObject>());
+    path = path.substring(0, query);
+  }
+
+  bool pathFound;
+  ApiRoute* route = findRoute(path.c_str(), method, pathFound);
+  if (!route) return apiError(result, pathFound ? 405 : 404, pathFound ? "Method not allowed" : "Unknown API endpoint");
+  if (!route->operation) return apiError(result, 400, "Endpoint cannot be batched");
+
+  route->hits++;
+  return route->operation(args.as<JsonVariantConst>(), result);
+}
+
+void runApiBatch(JsonArrayConst ops, bool stopOnError, JsonObject out) {
+  JsonArray results = out["results"].to<JsonArray>();
+  size_t completed = 0;
+  bool stopped = false;
+
+  for (JsonObjectConst op : ops) {
+    JsonDocument result;
+    int code = runBatchOp(op, result);
+
+    JsonObject entry = results.add<JsonObject>();
+    entry["status"] = code;
+    entry["body"] = result;
+    completed++;
+
+    if (stopOnError && code >= 400) {
+      stopped = completed < ops.size();
+      break;
+    }
+    yield();
+  }
+
+  out["completed"] = completed;
+  out["stopped"] = stopped;
+}
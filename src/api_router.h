@@ -0,0 +1,72 @@
+#ifndef API_ROUTER_H
+#define API_ROUTER_H
+
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+#include <functional>
+
+#define API_PREFIX "/_api/"
+#define API_MAX_ROUTES 128
+#define API_OPERATION_MAX_BODY 4096
+#define API_BATCH_MAX_OPS 16
+#define API_BATCH_MAX_BODY 8192
+
+// Endpoint logic shared by HTTP and /_api/batch. Reads its arguments from
+// args, fills result and returns the HTTP status code.
+typedef std::function<int(JsonVariantConst args, JsonDocument& result)> ApiOperation;
+
+// All /_api/* endpoints live in one table behind a single server handler.
+// Routes are sorted and hashed by beginApiRouter() (see route_table.h), so
+// dispatch costs one hash lookup instead of a walk over every registered
+// handler. Registering more than API_MAX_ROUTES, or after the router has
+// started, stops the firmware at boot instead of dropping the route.
+struct ApiRoute {
+  const char* uri;  // must outlive the router (string literal)
+  WebRequestMethodComposite method;
+  ArRequestHandlerFunction onRequest;
+  ArUploadHandlerFunction onUpload;
+  ArBodyHandlerFunction onBody;
+  ApiOperation operation;  // set for routes registered with apiOperation()
+  uint32_t hits;
+};
+
+// Same shape as AsyncWebServer::on(); call before beginApiRouter()
+void apiRoute(const char* uri, WebRequestMethodComposite method,
+              ArRequestHandlerFunction onRequest,
+              ArUploadHandlerFunction onUpload = nullptr,
+              ArBodyHandlerFunction onBody = nullptr);
+
+// Registers a route backed by an ApiOperation. Over HTTP its args are the
+// query (or form) parameters merged with a JSON/MessagePack body object,
+// body fields taking precedence; /_api/batch passes an op's args directly.
+void apiOperation(const char* uri, WebRequestMethodComposite method, ApiOperation operation);
+
+// Helpers for operations: `return apiError(result, 404, "Not found");`
+int apiError(JsonDocument& result, int code, const char* message);
+// Integer argument that may arrive as a query string or a JSON number
+int apiArgInt(JsonVariantConst value, int fallback = 0);
+
+// Runs ops in order: [{"method":"GET","path":"/_api/x?a=b","args":{...}}].
+// Each result is {"status":code,"body":{...}}; with stopOnError the batch
+// ends after the first status >= 400.
+void runApiBatch(JsonArrayConst ops, bool stopOnError, JsonObject out);
+
+void beginApiRouter(AsyncWebServer& server);
+const ApiRoute* findApiRoute(const char* uri, WebRequestMethodComposite method);
+
+// Accumulates a body that arrives over several onBody calls into
+// request->_tempObject (freed with the request). Returns the NUL-terminated
+// body on the final chunk, nullptr before that. Bodies over maxSize or that
+// cannot be allocated are answered with an error here.
+const char* collectRequestBody(AsyncWebServerRequest *request, uint8_t *data, size_t len,
+                               size_t index, size_t total, size_t maxSize);
+
+// onRequest handler for routes that answer from their body callback: a
+// request without a body never reaches that callback, so it is answered
+// here instead of being left to time out.
+void rejectEmptyBody(AsyncWebServerRequest *request);
+
+void getApiRouterStats(JsonObject out);
+void runApiRouterBenchmark(uint32_t iterations, JsonObject out);
+
+#endif
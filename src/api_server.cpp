@@ -1,11 +1,35 @@
 #include "api_server.h"
+#include "api_router.h"
+#include "api_codec.h"
 #include "config.h"
+#include "mime_types.h"
+#include "template_engine.h"
+#include "web_templates.h"
 #include "hardware.h"
 #include "storage.h"
+#include "sd_bench.h"
+#include "tar_archive.h"
+#include "file_jobs.h"
+#include "timeseries.h"
+#include "kv_store.h"
+#include "rules_engine.h"
+#include "request_governor.h"
+#include "asset_cache.h"
+#include "flash_bundle.h"
+#include "file_manifest.h"
+#include "webdav.h"
+#include "waveform_peaks.h"
+#include "logic_analyzer.h"
+#include "led_effects.h"
+#include "sensors.h"
+#include "scheduler.h"
+#include "power_manager.h"
 #include "ota.h"
+#include "recording_durability.h"
 #include <WiFi.h>
 #include <SD.h>
 #include <ArduinoJson.h>
+#include <memory>
 
 static AsyncWebServer server(80);
 
@@ -17,281 +41,464 @@ void stopWebServer() {
   server.end();
 }
 
-// Recursive directory deletion helper
-bool deleteRecursive(const String& path) {
-  File file = SD.open(path);
-  if (!file) {
-    return false;
-  }
-  
-  if (!file.isDirectory()) {
-    file.close();
-    return SD.remove(path);
-  }
+void setupAPIEndpoints() {
+  apiOperation("/_api/system/info", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    doc["chip"] = ESP.getChipModel();
+    doc["revision"] = ESP.getChipRevision();
+    doc["cpu_freq"] = ESP.getCpuFreqMHz();
+    doc["free_heap"] = ESP.getFreeHeap();
+    doc["flash_size"] = ESP.getFlashChipSize();
+    doc["uptime"] = millis() / 1000;
+    return 200;
+  });
   
-  file.rewindDirectory();
-  File entry = file.openNextFile();
-  while (entry) {
-    String entryPath = String(path);
-    if (!entryPath.endsWith("/")) {
-      entryPath += "/";
+  apiRoute("/_api/system/routes", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonDocument doc;
+    getApiRouterStats(doc["stats"].to<JsonObject>());
+    
+    if (request->hasParam("bench")) {
+      uint32_t iterations = constrain(request->getParam("bench")->value().toInt(), 1, 1000);
+      runApiRouterBenchmark(iterations, doc["bench"].to<JsonObject>());
     }
-    entryPath += entry.name();
     
-    if (entry.isDirectory()) {
-      entry.close();
-      if (!deleteRecursive(entryPath)) {
-        file.close();
-        return false;
-      }
-    } else {
-      entry.close();
-      if (!SD.remove(entryPath)) {
-        LOG_WARN("Failed to delete file: %s", entryPath.c_str());
-        file.close();
-        return false;
-      }
+    sendApiDocument(request, 200, doc);
+  });
+  
+  apiRoute("/_api/system/codec", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonDocument doc;
+    getApiCodecStats(doc["stats"].to<JsonObject>());
+    
+    if (request->hasParam("bench")) {
+      uint32_t iterations = constrain(request->getParam("bench")->value().toInt(), 1, 1000);
+      runApiCodecBenchmark(iterations, doc["bench"].to<JsonObject>());
     }
     
-    entry = file.openNextFile();
-  }
+    sendApiDocument(request, 200, doc);
+  });
   
-  file.close();
-  return SD.rmdir(path);
-}
-
-// Helper to create directory path recursively
-void createDirectoryPath(const String& path) {
-  if (path.length() == 0 || path == "/") return;
-  if (SD.exists(path)) return;
-  
-  int lastSlash = path.lastIndexOf('/');
-  if (lastSlash > 0) {
-    String parentPath = path.substring(0, lastSlash);
-    createDirectoryPath(parentPath);
-  }
+  apiRoute("/_api/system/governor", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonDocument doc;
+    getGovernorStats(doc.to<JsonObject>());
+    
+    sendApiDocument(request, 200, doc);
+  });
   
-  SD.mkdir(path);
-  LOG_INFO("Created directory: %s", path.c_str());
-}
-
-void setupAPIEndpoints() {
-  server.on("/_api/system/info", HTTP_GET, [](AsyncWebServerRequest *request) {
+  apiRoute("/_api/system/cache", HTTP_GET, [](AsyncWebServerRequest *request) {
     JsonDocument doc;
-    doc["chip"] = ESP.getChipModel();
-    doc["revision"] = ESP.getChipRevision();
-    doc["cpu_freq"] = ESP.getCpuFreqMHz();
-    doc["free_heap"] = ESP.getFreeHeap();
-    doc["flash_size"] = ESP.getFlashChipSize();
-    doc["uptime"] = millis() / 1000;
+    getAssetCacheStats(doc.to<JsonObject>());
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    sendApiDocument(request, 200, doc);
+  });
+  
+  apiRoute("/_api/system/cache", HTTP_DELETE, [](AsyncWebServerRequest *request) {
+    clearAssetCache();
+    sendApiJson(request, 200, "{\"status\":\"cleared\"}");
   });
   
-  server.on("/_api/storage/info", HTTP_GET, [](AsyncWebServerRequest *request) {
+  apiRoute("/_api/system/bundle", HTTP_GET, [](AsyncWebServerRequest *request) {
     JsonDocument doc;
-    doc["total"] = SD.totalBytes();
-    doc["used"] = SD.usedBytes();
-    doc["free"] = SD.totalBytes() - SD.usedBytes();
+    getFlashBundleInfo(doc.to<JsonObject>(), request->hasParam("list"));
+    
+    sendApiDocument(request, 200, doc);
+  });
+  
+  apiOperation("/_api/system/scheduler", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    getSchedulerStats(doc.to<JsonObject>());
+    return 200;
+  });
+  
+  apiOperation("/_api/system/power", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    getPowerStats(doc["stats"].to<JsonObject>());
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    int iterations = apiArgInt(args["bench"]);
+    if (iterations > 0) {
+      runPowerBenchmark(min(iterations, POWER_BENCH_MAX), doc["bench"].to<JsonObject>());
+    }
+    return 200;
   });
   
-  server.on("/_api/wifi/status", HTTP_GET, [](AsyncWebServerRequest *request) {
+  apiOperation("/_api/system/power", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    String mode = args["mode"] | "";
+    if (!setPowerMode(mode)) {
+      return apiError(doc, 400, "mode must be auto, performance, balanced or idle");
+    }
+    
+    doc["status"] = "ok";
+    doc["mode"] = mode;
+    return 200;
+  });
+  
+  // Runs several batchable endpoints in one round trip; see runApiBatch()
+  apiRoute("/_api/batch", HTTP_POST, rejectEmptyBody, NULL,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    const char* body = collectRequestBody(request, data, len, index, total, API_BATCH_MAX_BODY);
+    if (!body) return;
+    
     JsonDocument doc;
+    if (deserializeApiBody(request, doc, (const uint8_t*)body, total)) {
+      sendApiJson(request, 400, "{\"error\":\"Invalid JSON\"}");
+      return;
+    }
+    
+    JsonArrayConst ops = doc["ops"];
+    if (ops.size() == 0 || ops.size() > API_BATCH_MAX_OPS) {
+      sendApiJson(request, 400, "{\"error\":\"Batch must hold 1-" + String(API_BATCH_MAX_OPS) + " operations\"}");
+      return;
+    }
+    
+    JsonDocument result;
+    runApiBatch(ops, doc["stop_on_error"] | false, result.to<JsonObject>());
+    sendApiDocument(request, 200, result);
+  });
+  
+  // Cached figures only; the FAT is never scanned on the HTTP task
+  apiOperation("/_api/storage/info", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    if (!args["refresh"].isNull()) {
+      requestSDCardRescan();
+    }
+    getSDCardUsage(doc.to<JsonObject>());
+    getWebDAVStats(doc["webdav"].to<JsonObject>());
+    return 200;
+  });
+  
+  apiOperation("/_api/storage/bench", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    getSDBenchStatus(doc.to<JsonObject>());
+    return 200;
+  });
+  
+  // Both modes hammer the card (tune also reboots), so not during a recording
+  apiOperation("/_api/storage/bench", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    String mode = args["mode"] | "bench";
+    if (mode != "bench" && mode != "tune") {
+      return apiError(doc, 400, "mode must be bench or tune");
+    }
+    if (isRecording()) {
+      return apiError(doc, 409, "Recording in progress");
+    }
+    
+    if (mode == "tune") {
+      if (!scheduleSDClockTune()) {
+        return apiError(doc, 500, "Cannot write tune request");
+      }
+      LOG_INFO("/_api/storage/bench: SD clock tune scheduled, restarting");
+      doc["status"] = "restarting";
+      return 202;
+    }
+    
+    if (!startSDBench()) {
+      return apiError(doc, 409, "Benchmark already running");
+    }
+    doc["status"] = "started";
+    return 202;
+  });
+  
+  apiOperation("/_api/wifi/status", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
     doc["connected"] = WiFi.status() == WL_CONNECTED;
     doc["ssid"] = WiFi.SSID();
     doc["ip"] = WiFi.localIP().toString();
     doc["rssi"] = WiFi.RSSI();
     doc["mac"] = WiFi.macAddress();
-    
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    return 200;
   });
   
-  server.on("/_api/led/set", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
-    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-      JsonDocument doc;
-      deserializeJson(doc, data, len);
-      
-      int r = doc["r"] | 0;
-      int g = doc["g"] | 0;
-      int b = doc["b"] | 0;
-      
-      rgbLedWrite(35, r, g, b);
-      
-      LOG_INFO("LED set to RGB(%d, %d, %d)", r, g, b);
-      request->send(200, "application/json", "{\"status\":\"ok\"}");
-    });
+  apiOperation("/_api/led/set", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    int r = apiArgInt(args["r"]);
+    int g = apiArgInt(args["g"]);
+    int b = apiArgInt(args["b"]);
+    
+    stopLedEffect();
+    setLED(r, g, b);
+    
+    LOG_INFO("LED set to RGB(%d, %d, %d)", r, g, b);
+    doc["status"] = "ok";
+    return 200;
+  });
+
+  apiOperation("/_api/led/effect", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    String error;
+    if (!playLedEffect(args, error)) {
+      return apiError(doc, 400, error.c_str());
+    }
+    getLedEffectStatus(doc.to<JsonObject>());
+    return 200;
+  });
+
+  apiOperation("/_api/led/effect", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    getLedEffectStatus(doc.to<JsonObject>());
+    return 200;
+  });
   
-  server.on("/_api/mic/level", HTTP_GET, [](AsyncWebServerRequest *request) {
+  apiOperation("/_api/sensors", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    bool history = args["history"].is<bool>() ? args["history"].as<bool>()
+                                              : apiArgInt(args["history"]) != 0;
+    getSensorReadings(doc.to<JsonObject>(), args["name"] | "", history);
+    return 200;
+  });
+
+  apiOperation("/_api/sensors/reload", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    reloadSensors();
+    doc["status"] = "reloading";
+    return 202;
+  });
+
+  apiOperation("/_api/mic/level", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
     int level = readMicrophoneLevel();
     
-    JsonDocument doc;
     doc["level"] = level;
     doc["initialized"] = isMicrophoneInitialized();
     doc["recording"] = isRecording();
     if (isRecording()) {
       doc["duration"] = getRecordingDuration();
     }
-    
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    return 200;
   });
   
-  server.on("/_api/mic/record/start", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
-    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-      JsonDocument doc;
-      deserializeJson(doc, data, len);
-      
-      String filename = doc["filename"] | "recording.wav";
-      if (!filename.endsWith(".wav")) {
-        filename += ".wav";
-      }
-      
-      bool success = startRecording(filename.c_str());
-      
-      if (success) {
-        LOG_INFO("Recording started: %s", filename.c_str());
-        request->send(200, "application/json", "{\"status\":\"recording\"}");
-      } else {
-        request->send(500, "application/json", "{\"error\":\"Failed to start recording\"}");
+  apiOperation("/_api/mic/format", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    bool bench = args["bench"].is<bool>() ? args["bench"].as<bool>() : apiArgInt(args["bench"]) != 0;
+    getMicFormat(doc.to<JsonObject>());
+    if (bench) {
+      benchmarkMicResampler(doc["bench"].to<JsonObject>());
+    }
+    return 200;
+  });
+  
+  apiOperation("/_api/mic/format", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    String error;
+    int code = setMicFormat(args, true, error);
+    if (code != 202) {
+      return apiError(doc, code, error.c_str());
+    }
+    doc["status"] = "applying";
+    return 202;
+  });
+  
+  apiOperation("/_api/mic/durability", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    getRecordingDurability(doc.to<JsonObject>());
+    return 200;
+  });
+  
+  apiOperation("/_api/mic/durability", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    String error;
+    int code = setRecordingDurability(args, error);
+    if (code != 200) {
+      return apiError(doc, code, error.c_str());
+    }
+    getRecordingDurability(doc.to<JsonObject>());
+    return 200;
+  });
+  
+  apiOperation("/_api/mic/record/start", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    String filename = args["filename"] | "recording.wav";
+    if (!filename.endsWith(".wav")) {
+      filename += ".wav";
+    }
+    
+    // Format fields apply to this and later recordings but are not saved
+    if (!args["sample_rate"].isNull() || !args["bits"].isNull() ||
+        !args["source_rate"].isNull() || !args["latency_ms"].isNull()) {
+      String error;
+      int code = setMicFormat(args, false, error);
+      if (code != 202) {
+        return apiError(doc, code, error.c_str());
       }
-    });
+    }
+    
+    // Queued behind any format change; failures show in record/status
+    if (!startRecording(filename.c_str())) {
+      return apiError(doc, 500, "Failed to start recording");
+    }
+    LOG_INFO("Recording queued: %s", filename.c_str());
+    doc["status"] = "starting";
+    return 202;
+  });
   
-  server.on("/_api/mic/record/stop", HTTP_POST, [](AsyncWebServerRequest *request) {
+  apiRoute("/_api/mic/record/stop", HTTP_POST, [](AsyncWebServerRequest *request) {
     stopRecording();
-    LOG_INFO("Recording stopped");
-    request->send(200, "application/json", "{\"status\":\"stopped\"}");
+    LOG_INFO("Recording stop queued");
+    sendApiJson(request, 202, "{\"status\":\"stopping\"}");
   });
   
-  server.on("/_api/mic/record/status", HTTP_GET, [](AsyncWebServerRequest *request) {
+  apiRoute("/_api/mic/record/status", HTTP_GET, [](AsyncWebServerRequest *request) {
     JsonDocument doc;
-    doc["recording"] = isRecording();
-    if (isRecording()) {
-      doc["duration"] = getRecordingDuration();
-    }
-    
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    getHardwareStatus(doc.to<JsonObject>());
+    sendApiDocument(request, 200, doc);
   });
   
-  server.on("/_api/button/status", HTTP_GET, [](AsyncWebServerRequest *request) {
-    pinMode(41, INPUT_PULLUP);
-    bool pressed = digitalRead(41) == LOW;
+  // Waveform overview from the peak file next to a recording. Without zoom
+  // it describes the levels; with zoom it streams that level's int8
+  // min/max pairs. A missing peak file is queued for backfill (202).
+  apiRoute("/_api/mic/peaks", HTTP_GET, [](AsyncWebServerRequest *request) {
+    static String backfillPath;
+    static uint32_t backfillJob = 0;
     
-    JsonDocument doc;
-    doc["pressed"] = pressed;
+    if (!request->hasParam("file")) {
+      sendApiJson(request, 400, "{\"error\":\"Missing file\"}");
+      return;
+    }
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
-  });
-}
-
-void setupGPIOEndpoints() {
-  server.on("/_api/gpio/mode", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
-    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-      JsonDocument doc;
-      deserializeJson(doc, data, len);
-      
-      if (!doc["pin"].is<int>() || !doc["mode"].is<const char*>()) {
-        request->send(400, "application/json", "{\"error\":\"Missing pin or mode\"}");
-        return;
-      }
-      
-      int pin = doc["pin"];
-      String mode = doc["mode"].as<String>();
-      
-      if (isReservedPin(pin)) {
-        request->send(403, "application/json", "{\"error\":\"Pin is reserved for system use\"}");
-        return;
-      }
-      
-      if (mode == "INPUT") {
-        pinMode(pin, INPUT);
-      } else if (mode == "INPUT_PULLUP") {
-        pinMode(pin, INPUT_PULLUP);
-      } else if (mode == "INPUT_PULLDOWN") {
-        pinMode(pin, INPUT_PULLDOWN);
-      } else if (mode == "OUTPUT") {
-        pinMode(pin, OUTPUT);
-      } else {
-        request->send(400, "application/json", "{\"error\":\"Invalid mode\"}");
+    String file = request->getParam("file")->value();
+    String path = file.startsWith("/") ? file : "/recordings/" + file;
+    if (path.indexOf("..") >= 0 || !path.endsWith(".wav")) {
+      sendApiJson(request, 400, "{\"error\":\"Invalid file\"}");
+      return;
+    }
+    
+    if (!SD.exists(path)) {
+      sendApiJson(request, 404, "{\"error\":\"Recording not found\"}");
+      return;
+    }
+    
+    PeakFileHeader header;
+    if (!readPeakHeader(path, header)) {
+      if (path == getRecordingPath()) {
+        sendApiJson(request, 409, "{\"error\":\"Recording in progress\"}");
         return;
       }
       
-      LOG_INFO("GPIO %d set to mode: %s", pin, mode.c_str());
-      request->send(200, "application/json", "{\"status\":\"ok\"}");
-    });
-  
-  server.on("/_api/gpio/write", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
-    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+      // Polling clients get the job already building this file
       JsonDocument doc;
-      deserializeJson(doc, data, len);
-      
-      if (!doc["pin"].is<int>() || !doc["value"].is<int>()) {
-        request->send(400, "application/json", "{\"error\":\"Missing pin or value\"}");
-        return;
+      JsonObject job = doc["job"].to<JsonObject>();
+      bool pending = backfillPath == path && getFileJobStatus(backfillJob, job) &&
+                     (job["state"] == "queued" || job["state"] == "running");
+      if (!pending) {
+        uint32_t id = submitFileJob(JOB_PEAKS, path, "");
+        if (id == 0) {
+          sendApiJson(request, 503, "{\"error\":\"Job queue full\"}");
+          return;
+        }
+        backfillPath = path;
+        backfillJob = id;
+        getFileJobStatus(id, job);
       }
-      
-      int pin = doc["pin"];
-      int value = doc["value"];
-      
-      if (isReservedPin(pin)) {
-        request->send(403, "application/json", "{\"error\":\"Pin is reserved for system use\"}");
-        return;
+      doc["status"] = "building";
+      sendApiDocument(request, 202, doc);
+      return;
+    }
+    
+    if (!request->hasParam("zoom")) {
+      JsonDocument doc;
+      doc["file"] = path;
+      doc["sample_rate"] = header.sampleRate;
+      doc["samples"] = header.samples;
+      doc["duration_ms"] = header.sampleRate ? (uint64_t)header.samples * 1000 / header.sampleRate : 0;
+      JsonArray levels = doc["levels"].to<JsonArray>();
+      uint32_t span = PEAKS_BASE_SAMPLES;
+      for (uint8_t level = 0; level < PEAKS_LEVELS; level++) {
+        JsonObject entry = levels.add<JsonObject>();
+        entry["zoom"] = level;
+        entry["samples_per_peak"] = span;
+        entry["peaks"] = getPeakPairCount(header, level);
+        span *= PEAKS_LEVEL_FACTOR;
       }
-      
-      digitalWrite(pin, value ? HIGH : LOW);
-      LOG_INFO("GPIO %d set to: %d", pin, value);
-      request->send(200, "application/json", "{\"status\":\"ok\"}");
-    });
-  
-  server.on("/_api/gpio/read", HTTP_GET, [](AsyncWebServerRequest *request) {
-    if (!request->hasParam("pin")) {
-      request->send(400, "application/json", "{\"error\":\"Missing pin parameter\"}");
+      sendApiDocument(request, 200, doc);
       return;
     }
     
-    int pin = request->getParam("pin")->value().toInt();
-    int value = digitalRead(pin);
+    int zoom = request->getParam("zoom")->value().toInt();
+    if (zoom < 0 || zoom >= PEAKS_LEVELS) {
+      sendApiJson(request, 400, "{\"error\":\"zoom out of range\"}");
+      return;
+    }
     
-    JsonDocument doc;
-    doc["pin"] = pin;
-    doc["value"] = value;
+    std::shared_ptr<File> peaks = std::make_shared<File>(SD.open(peakPathFor(path), FILE_READ));
+    if (!*peaks) {
+      sendApiJson(request, 500, "{\"error\":\"Cannot open peak file\"}");
+      return;
+    }
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    uint32_t count = getPeakPairCount(header, zoom);
+    uint32_t span = PEAKS_BASE_SAMPLES;
+    for (int level = 0; level < zoom; level++) span *= PEAKS_LEVEL_FACTOR;
+    AsyncWebServerResponse *response = request->beginResponse("application/octet-stream", count * 2,
+      [peaks, header, zoom](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        size_t n = readPeakBytes(*peaks, header, zoom, index, buffer, maxLen);
+        if (n == 0) peaks->close();
+        return n;
+      });
+    response->addHeader("X-Peaks-Count", String(count));
+    response->addHeader("X-Samples-Per-Peak", String(span));
+    response->addHeader("X-Sample-Rate", String(header.sampleRate));
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
   });
   
-  server.on("/_api/gpio/analog", HTTP_GET, [](AsyncWebServerRequest *request) {
-    if (!request->hasParam("pin")) {
-      request->send(400, "application/json", "{\"error\":\"Missing pin parameter\"}");
-      return;
+  apiOperation("/_api/button/status", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    pinMode(41, INPUT_PULLUP);
+    doc["pressed"] = digitalRead(41) == LOW;
+    return 200;
+  });
+}
+
+void setupGPIOEndpoints() {
+  apiOperation("/_api/gpio/mode", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    if (args["pin"].isNull() || !args["mode"].is<const char*>()) {
+      return apiError(doc, 400, "Missing pin or mode");
     }
     
-    int pin = request->getParam("pin")->value().toInt();
-    int value = analogRead(pin);
+    int pin = apiArgInt(args["pin"]);
+    String mode = args["mode"].as<String>();
     
-    JsonDocument doc;
+    if (isReservedPin(pin)) {
+      return apiError(doc, 403, "Pin is reserved for system use");
+    }
+    
+    if (!isValidGPIOMode(mode)) {
+      return apiError(doc, 400, "Invalid mode");
+    }
+    
+    if (!setGPIOMode(pin, mode)) {
+      return apiError(doc, 503, "Hardware queue full");
+    }
+    
+    LOG_INFO("GPIO %d set to mode: %s", pin, mode.c_str());
+    doc["status"] = "ok";
+    return 200;
+  });
+  
+  apiOperation("/_api/gpio/write", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    if (args["pin"].isNull() || args["value"].isNull()) {
+      return apiError(doc, 400, "Missing pin or value");
+    }
+    
+    int pin = apiArgInt(args["pin"]);
+    int value = apiArgInt(args["value"]);
+    
+    if (isReservedPin(pin)) {
+      return apiError(doc, 403, "Pin is reserved for system use");
+    }
+    
+    if (!writeGPIO(pin, value)) {
+      return apiError(doc, 503, "Hardware queue full");
+    }
+    
+    LOG_INFO("GPIO %d set to: %d", pin, value);
+    doc["status"] = "ok";
+    return 200;
+  });
+  
+  apiOperation("/_api/gpio/read", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    if (args["pin"].isNull()) {
+      return apiError(doc, 400, "Missing pin parameter");
+    }
+    
+    int pin = apiArgInt(args["pin"]);
     doc["pin"] = pin;
-    doc["value"] = value;
+    doc["value"] = readGPIO(pin);
+    return 200;
+  });
+  
+  apiOperation("/_api/gpio/analog", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    if (args["pin"].isNull()) {
+      return apiError(doc, 400, "Missing pin parameter");
+    }
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    int pin = apiArgInt(args["pin"]);
+    doc["pin"] = pin;
+    doc["value"] = readAnalogGPIO(pin);
+    return 200;
   });
   
-  server.on("/_api/gpio/pins", HTTP_GET, [](AsyncWebServerRequest *request) {
+  apiRoute("/_api/gpio/pins", HTTP_GET, [](AsyncWebServerRequest *request) {
     JsonDocument doc;
     JsonArray available = doc["available"].to<JsonArray>();
     JsonArray reserved = doc["reserved"].to<JsonArray>();
@@ -305,34 +512,83 @@ void setupGPIOEndpoints() {
     reserved.add(SDCARD_SCK);
     reserved.add(SDCARD_CS);
     
-    int availablePins[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 15, 16, 18, 21, 43, 44, 45, 46, 47, 48};
-    for (int pin : availablePins) {
-      available.add(pin);
+    for (int pin = 0; pin < 49; pin++) {
+      if (isUserPin(pin)) available.add(pin);
     }
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    sendApiDocument(request, 200, doc);
+  });
+
+  apiOperation("/_api/logic/capture", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    String error;
+    int code = startLogicCapture(args, error);
+    if (code != 202) {
+      return apiError(doc, code, error.c_str());
+    }
+    getLogicCaptureStatus(doc.to<JsonObject>());
+    return 202;
+  });
+
+  apiOperation("/_api/logic/status", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    getLogicCaptureStatus(doc.to<JsonObject>());
+    return 200;
+  });
+
+  apiOperation("/_api/logic/cancel", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    if (!cancelLogicCapture()) {
+      return apiError(doc, 409, "No capture is waiting for its trigger");
+    }
+    doc["status"] = "cancelling";
+    return 202;
   });
 }
 
+// Tar extraction accepts either a raw application/x-tar body or a multipart
+// "file" field. One archive is extracted at a time, owned by its request.
+static TarExtractor extractor;
+static AsyncWebServerRequest *extractOwner = nullptr;
+
+static void extractTarChunk(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index) {
+  if (index == 0 && extractOwner == nullptr) {
+    String dest = request->hasParam("path") ? request->getParam("path")->value() : "/";
+    if (dest.length() == 0 || dest.indexOf("..") >= 0) {
+      return;
+    }
+    
+    extractOwner = request;
+    onRequestClosed(request, [request]() {
+      if (extractOwner == request) {
+        LOG_WARN("/_api/files/extract: Client disconnected mid-archive");
+        finishTarExtractor(extractor);
+        noteSDCardTreeChange(extractor.destPath);
+        extractOwner = nullptr;
+      }
+    });
+    
+    createDirectoryPath(dest);
+    beginTarExtractor(extractor, dest);
+    LOG_INFO("/_api/files/extract: Started into %s", dest.c_str());
+  }
+  
+  if (extractOwner == request && len > 0) {
+    writeTarExtractor(extractor, data, len);
+  }
+}
+
 void setupFileEndpoints() {
-  server.on("/_api/files/list", HTTP_GET, [](AsyncWebServerRequest *request) {
-    String path = request->hasParam("path") ? request->getParam("path")->value() : "/";
+  apiOperation("/_api/files/list", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    String path = args["path"] | "/";
     
     if (!SD.exists(path)) {
-      request->send(404, "application/json", "{\"error\":\"Path not found\"}");
-      return;
+      return apiError(doc, 404, "Path not found");
     }
     
     File dir = SD.open(path);
     if (!dir || !dir.isDirectory()) {
       dir.close();
-      request->send(400, "application/json", "{\"error\":\"Not a directory\"}");
-      return;
+      return apiError(doc, 400, "Not a directory");
     }
     
-    JsonDocument doc;
     JsonArray files = doc["files"].to<JsonArray>();
     
     File file = dir.openNextFile();
@@ -348,202 +604,187 @@ void setupFileEndpoints() {
     
     doc["path"] = path;
     doc["count"] = files.size();
+    return 200;
+  });
+  
+  // Hashes for delta sync; see tools/sync.py
+  apiOperation("/_api/files/manifest", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    String path = args["path"] | "/";
+    if (path.length() == 0 || path.indexOf("..") >= 0) {
+      return apiError(doc, 400, "Invalid path");
+    }
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    if (!buildFileManifest(path, apiArgInt(args["offset"]), doc.to<JsonObject>())) {
+      return apiError(doc, 404, "Path not found");
+    }
+    getFileManifestStats(doc["cache"].to<JsonObject>());
+    return 200;
   });
   
-  server.on("/_api/files/info", HTTP_GET, [](AsyncWebServerRequest *request) {
-    if (!request->hasParam("path")) {
-      request->send(400, "application/json", "{\"error\":\"Missing path\"}");
-      return;
+  apiOperation("/_api/files/info", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    if (!args["path"].is<const char*>()) {
+      return apiError(doc, 400, "Missing path");
     }
     
-    String path = request->getParam("path")->value();
+    String path = args["path"].as<String>();
     if (!SD.exists(path)) {
-      request->send(404, "application/json", "{\"error\":\"File not found\"}");
-      return;
+      return apiError(doc, 404, "File not found");
     }
     
     File file = SD.open(path);
-    JsonDocument doc;
     doc["name"] = String(file.name());
     doc["size"] = file.size();
     doc["isDir"] = file.isDirectory();
     doc["path"] = path;
     file.close();
-    
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    return 200;
   });
   
-  server.on("/_api/files/mkdir", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL, 
-    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-    if (index == 0) {
-      String body = "";
-      for (size_t i = 0; i < len; i++) {
-        body += (char)data[i];
-      }
-      
-      JsonDocument doc;
-      DeserializationError error = deserializeJson(doc, body);
-      
-      if (error) {
-        LOG_WARN("/_api/files/mkdir: Invalid JSON");
-        request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
-        return;
-      }
-      
-      if (!doc.containsKey("path")) {
-        LOG_WARN("/_api/files/mkdir: Missing path parameter");
-        request->send(400, "application/json", "{\"error\":\"Missing path parameter\"}");
-        return;
-      }
-      
-      String path = doc["path"].as<String>();
-      LOG_INFO("/_api/files/mkdir: Creating %s", path.c_str());
-      
-      if (path.length() == 0 || path.indexOf("..") >= 0) {
-        LOG_WARN("/_api/files/mkdir: Invalid path: %s", path.c_str());
-        request->send(400, "application/json", "{\"error\":\"Invalid path\"}");
-        return;
-      }
-      
-      if (SD.exists(path)) {
-        LOG_WARN("/_api/files/mkdir: Path already exists: %s", path.c_str());
-        request->send(409, "application/json", "{\"error\":\"Path already exists\"}");
-        return;
-      }
-      
-      createDirectoryPath(path);
-      
-      if (SD.exists(path)) {
-        LOG_INFO("/_api/files/mkdir: Successfully created: %s", path.c_str());
-        request->send(200, "application/json", "{\"status\":\"created\"}");
-      } else {
-        LOG_ERROR("/_api/files/mkdir: Failed to create: %s", path.c_str());
-        request->send(500, "application/json", "{\"error\":\"Failed to create directory\"}");
-      }
+  apiOperation("/_api/files/mkdir", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    if (!args["path"].is<const char*>()) {
+      LOG_WARN("/_api/files/mkdir: Missing path parameter");
+      return apiError(doc, 400, "Missing path parameter");
+    }
+    
+    String path = args["path"].as<String>();
+    LOG_INFO("/_api/files/mkdir: Creating %s", path.c_str());
+    
+    if (path.length() == 0 || path.indexOf("..") >= 0) {
+      LOG_WARN("/_api/files/mkdir: Invalid path: %s", path.c_str());
+      return apiError(doc, 400, "Invalid path");
     }
+    
+    if (SD.exists(path)) {
+      LOG_WARN("/_api/files/mkdir: Path already exists: %s", path.c_str());
+      return apiError(doc, 409, "Path already exists");
+    }
+    
+    createDirectoryPath(path);
+    
+    if (!SD.exists(path)) {
+      LOG_ERROR("/_api/files/mkdir: Failed to create: %s", path.c_str());
+      return apiError(doc, 500, "Failed to create directory");
+    }
+    
+    LOG_INFO("/_api/files/mkdir: Successfully created: %s", path.c_str());
+    doc["status"] = "created";
+    return 200;
   });
-  
-  server.on("/_api/files/move", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
-    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-    if (index == 0) {
-      String body = "";
-      for (size_t i = 0; i < len; i++) {
-        body += (char)data[i];
-      }
-      
-      JsonDocument doc;
-      DeserializationError error = deserializeJson(doc, body);
-      
-      if (error) {
-        LOG_WARN("/_api/files/move: Invalid JSON");
-        request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
-        return;
-      }
-      
-      if (!doc.containsKey("source") || !doc.containsKey("destination")) {
-        LOG_WARN("/_api/files/move: Missing parameters");
-        request->send(400, "application/json", "{\"error\":\"Missing source or destination parameter\"}");
-        return;
-      }
-      
-      String source = doc["source"].as<String>();
-      String destination = doc["destination"].as<String>();
-      
-      LOG_INFO("/_api/files/move: %s -> %s", source.c_str(), destination.c_str());
-      
-      // Validation
-      if (source.length() == 0 || destination.length() == 0 || 
-          source.indexOf("..") >= 0 || destination.indexOf("..") >= 0) {
-        LOG_WARN("/_api/files/move: Invalid paths");
-        request->send(400, "application/json", "{\"error\":\"Invalid paths\"}");
-        return;
-      }
-      
-      if (source == "/" || source == "/index.html") {
-        LOG_WARN("/_api/files/move: Cannot move protected file: %s", source.c_str());
-        request->send(403, "application/json", "{\"error\":\"Cannot move protected file\"}");
-        return;
-      }
-      
-      if (!SD.exists(source)) {
-        LOG_WARN("/_api/files/move: Source not found: %s", source.c_str());
-        request->send(404, "application/json", "{\"error\":\"Source file not found\"}");
-        return;
-      }
-      
-      if (SD.exists(destination)) {
-        LOG_WARN("/_api/files/move: Destination already exists: %s", destination.c_str());
-        request->send(409, "application/json", "{\"error\":\"Destination already exists\"}");
-        return;
-      }
-      
-      // Ensure destination parent directory exists
-      int lastSlash = destination.lastIndexOf('/');
-      if (lastSlash > 0) {
-        String destDir = destination.substring(0, lastSlash);
-        if (!SD.exists(destDir)) {
-          createDirectoryPath(destDir);
-        }
-      }
-      
-      // Perform rename/move
-      if (SD.rename(source, destination)) {
-        LOG_INFO("/_api/files/move: Success");
-        request->send(200, "application/json", "{\"status\":\"moved\"}");
-      } else {
-        LOG_ERROR("/_api/files/move: Failed");
-        request->send(500, "application/json", "{\"error\":\"Move operation failed\"}");
+  
+  apiOperation("/_api/files/move", HTTP_POST, [](JsonVariantConst args, JsonDocument& doc) {
+    if (!args["source"].is<const char*>() || !args["destination"].is<const char*>()) {
+      LOG_WARN("/_api/files/move: Missing parameters");
+      return apiError(doc, 400, "Missing source or destination parameter");
+    }
+    
+    String source = args["source"].as<String>();
+    String destination = args["destination"].as<String>();
+    
+    LOG_INFO("/_api/files/move: %s -> %s", source.c_str(), destination.c_str());
+    
+    // Validation
+    if (source.length() == 0 || destination.length() == 0 || 
+        source.indexOf("..") >= 0 || destination.indexOf("..") >= 0) {
+      LOG_WARN("/_api/files/move: Invalid paths");
+      return apiError(doc, 400, "Invalid paths");
+    }
+    
+    if (source == "/" || source == "/index.html") {
+      LOG_WARN("/_api/files/move: Cannot move protected file: %s", source.c_str());
+      return apiError(doc, 403, "Cannot move protected file");
+    }
+    
+    if (!SD.exists(source)) {
+      LOG_WARN("/_api/files/move: Source not found: %s", source.c_str());
+      return apiError(doc, 404, "Source file not found");
+    }
+    
+    if (SD.exists(destination)) {
+      LOG_WARN("/_api/files/move: Destination already exists: %s", destination.c_str());
+      return apiError(doc, 409, "Destination already exists");
+    }
+    
+    // Ensure destination parent directory exists
+    int lastSlash = destination.lastIndexOf('/');
+    if (lastSlash > 0) {
+      String destDir = destination.substring(0, lastSlash);
+      if (!SD.exists(destDir)) {
+        createDirectoryPath(destDir);
       }
     }
+    
+    File entry = SD.open(source);
+    uint64_t size = entry && !entry.isDirectory() ? entry.size() : 0;
+    entry.close();
+    
+    // Perform rename/move
+    if (!SD.rename(source, destination)) {
+      LOG_ERROR("/_api/files/move: Failed");
+      return apiError(doc, 500, "Move operation failed");
+    }
+    
+    noteSDCardMove(source, destination, size);
+    LOG_INFO("/_api/files/move: Success");
+    doc["status"] = "moved";
+    return 200;
   });
 
-  server.on("/_api/files/delete", HTTP_DELETE, [](AsyncWebServerRequest *request) {
-    if (!request->hasParam("path")) {
+  apiOperation("/_api/files/delete", HTTP_DELETE, [](JsonVariantConst args, JsonDocument& doc) {
+    if (!args["path"].is<const char*>()) {
       LOG_WARN("/_api/files/delete: Missing path parameter");
-      request->send(400, "application/json", "{\"error\":\"Missing path\"}");
-      return;
+      return apiError(doc, 400, "Missing path");
     }
     
-    String path = request->getParam("path")->value();
-    LOG_INFO("/_api/files/delete: Request for %s from %s", path.c_str(), request->client()->remoteIP().toString().c_str());
+    String path = args["path"].as<String>();
+    LOG_INFO("/_api/files/delete: Request for %s", path.c_str());
     
     if (path.length() == 0 || path.indexOf("..") >= 0) {
       LOG_WARN("/_api/files/delete: Invalid path: %s", path.c_str());
-      request->send(400, "application/json", "{\"error\":\"Invalid path\"}");
-      return;
+      return apiError(doc, 400, "Invalid path");
     }
     
     if (path == "/" || path == "/index.html") {
       LOG_WARN("/_api/files/delete: Attempted to delete protected file: %s", path.c_str());
-      request->send(403, "application/json", "{\"error\":\"Cannot delete protected file\"}");
-      return;
+      return apiError(doc, 403, "Cannot delete protected file");
     }
     
     if (!SD.exists(path)) {
       LOG_WARN("/_api/files/delete: File not found: %s", path.c_str());
-      request->send(404, "application/json", "{\"error\":\"File not found\"}");
-      return;
+      return apiError(doc, 404, "File not found");
+    }
+    
+    File file = SD.open(path);
+    bool isDir = file && file.isDirectory();
+    uint64_t size = file && !isDir ? file.size() : 0;
+    file.close();
+    
+    // Directory trees can take seconds to remove; hand them to the job engine
+    if (isDir) {
+      uint32_t jobId = submitFileJob(JOB_DELETE, path, "");
+      if (jobId == 0) {
+        return apiError(doc, 503, "Job queue full");
+      }
+      LOG_INFO("/_api/files/delete: Queued job %d for %s", jobId, path.c_str());
+      doc["status"] = "queued";
+      doc["job"] = jobId;
+      return 202;
     }
     
-    if (deleteRecursive(path)) {
-      LOG_INFO("/_api/files/delete: Successfully deleted: %s", path.c_str());
-      request->send(200, "application/json", "{\"status\":\"deleted\"}");
-    } else {
+    if (!SD.remove(path)) {
       LOG_ERROR("/_api/files/delete: Failed to delete: %s", path.c_str());
-      request->send(500, "application/json", "{\"error\":\"Failed to delete\"}");
+      return apiError(doc, 500, "Failed to delete");
     }
+    
+    adjustSDCardUsage(path, -(int64_t)size);
+    LOG_INFO("/_api/files/delete: Successfully deleted: %s", path.c_str());
+    doc["status"] = "deleted";
+    return 200;
   });
   
-  server.on("/_api/files/upload", HTTP_POST,
+  apiRoute("/_api/files/upload", HTTP_POST,
     [](AsyncWebServerRequest *request) {
       LOG_INFO("/_api/files/upload: POST handler called - upload complete");
-      request->send(200, "application/json", "{\"status\":\"uploaded\"}");
+      sendApiJson(request, 200, "{\"status\":\"uploaded\"}");
     },
     [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
       static File uploadFile;
@@ -589,9 +830,16 @@ void setupFileEndpoints() {
           uploadFile.close();
         }
         
+        int64_t removed = 0;
         if (SD.exists(uploadPath)) {
-          SD.remove(uploadPath);
+          File existing = SD.open(uploadPath);
+          int64_t existingSize = existing ? existing.size() : 0;
+          existing.close();
+          if (SD.remove(uploadPath)) {
+            removed = existingSize;
+          }
         }
+        adjustSDCardUsage(uploadPath, -removed);
         
         uploadFile = SD.open(uploadPath, FILE_WRITE);
         if (!uploadFile) {
@@ -616,11 +864,13 @@ void setupFileEndpoints() {
         
         size_t written = uploadFile.write(data, len);
         totalUploaded += written;
+        adjustSDCardUsage(uploadPath, written);
         
         if (written != len) {
           LOG_ERROR("/_api/files/upload: Write error at chunk %d - wrote %d of %d bytes", index, written, len);
           uploadFile.close();
           SD.remove(uploadPath);
+          adjustSDCardUsage(uploadPath, -(int64_t)totalUploaded);
           uploadInProgress = false;
           return;
         }
@@ -642,15 +892,17 @@ void setupFileEndpoints() {
           uploadFile.close();
           LOG_INFO("/_api/files/upload: Complete: %s (%d bytes)", uploadPath.c_str(), totalUploaded);
         }
+        // A hit between open and close could have cached a partial file
+        adjustSDCardUsage(uploadPath, 0);
         totalUploaded = 0;
         uploadInProgress = false;
       }
     });
   
-  server.on("/_api/files/download", HTTP_GET, [](AsyncWebServerRequest *request) {
+  apiRoute("/_api/files/download", HTTP_GET, [](AsyncWebServerRequest *request) {
     if (!request->hasParam("path")) {
       LOG_WARN("/_api/files/download: Missing path parameter");
-      request->send(400, "application/json", "{\"error\":\"Missing path\"}");
+      sendApiJson(request, 400, "{\"error\":\"Missing path\"}");
       return;
     }
     
@@ -659,48 +911,527 @@ void setupFileEndpoints() {
     
     if (path.length() == 0 || path.indexOf("..") >= 0) {
       LOG_WARN("/_api/files/download: Invalid path: %s", path.c_str());
-      request->send(400, "application/json", "{\"error\":\"Invalid path\"}");
+      sendApiJson(request, 400, "{\"error\":\"Invalid path\"}");
       return;
     }
     
     if (!SD.exists(path)) {
       LOG_WARN("/_api/files/download: File not found: %s", path.c_str());
-      request->send(404, "application/json", "{\"error\":\"File not found\"}");
+      sendApiJson(request, 404, "{\"error\":\"File not found\"}");
       return;
     }
     
     File file = SD.open(path, FILE_READ);
     if (!file) {
       LOG_ERROR("/_api/files/download: Failed to open file: %s", path.c_str());
-      request->send(500, "application/json", "{\"error\":\"Failed to open file\"}");
+      sendApiJson(request, 500, "{\"error\":\"Failed to open file\"}");
       return;
     }
     
     if (file.isDirectory()) {
       file.close();
       LOG_WARN("/_api/files/download: Cannot download directory: %s", path.c_str());
-      request->send(400, "application/json", "{\"error\":\"Cannot download directory\"}");
+      sendApiJson(request, 400, "{\"error\":\"Cannot download directory\"}");
       return;
     }
     
+    size_t fileSize = file.size();
     file.close();
+    if (!admitRequest(request, fileSize > GOV_LARGE_FILE_BYTES)) return;
+    
     LOG_INFO("/_api/files/download: Serving %s", path.c_str());
     request->send(SD, path, String(), true);
   });
+  
+  apiRoute("/_api/files/archive", HTTP_GET, [](AsyncWebServerRequest *request) {
+    String path = request->hasParam("path") ? request->getParam("path")->value() : "/";
+    LOG_INFO("/_api/files/archive: Request for %s from %s", path.c_str(), request->client()->remoteIP().toString().c_str());
+    
+    if (path.length() == 0 || path.indexOf("..") >= 0) {
+      LOG_WARN("/_api/files/archive: Invalid path: %s", path.c_str());
+      sendApiJson(request, 400, "{\"error\":\"Invalid path\"}");
+      return;
+    }
+    
+    if (!admitRequest(request, true)) return;
+    
+    std::shared_ptr<TarWriter> writer = std::make_shared<TarWriter>();
+    if (!beginTarWriter(*writer, path)) {
+      if (writer->error.length() > 0) {
+        LOG_WARN("/_api/files/archive: %s", writer->error.c_str());
+        JsonDocument doc;
+        apiError(doc, 400, writer->error.c_str());
+        sendApiDocument(request, 400, doc);
+        return;
+      }
+      LOG_WARN("/_api/files/archive: Path not found: %s", path.c_str());
+      sendApiJson(request, 404, "{\"error\":\"Path not found\"}");
+      return;
+    }
+    
+    String archiveName = writer->archiveBase.length() > 0 ? writer->archiveBase : "sdcard";
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/x-tar",
+      [writer, request](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        size_t len = readTarWriter(*writer, buffer, maxLen);
+        if (writer->failed) {
+          // Reset instead of ending the chunked body, so the client sees a
+          // failed transfer rather than a short archive. abort() only queues
+          // the disconnect; the request is freed after this callback returns.
+          LOG_ERROR("/_api/files/archive: Aborted %s after %d bytes: %s", writer->rootPath.c_str(), index,
+                    writer->error.c_str());
+          request->client()->abort();
+          return RESPONSE_TRY_AGAIN;
+        }
+        if (len == 0) {
+          LOG_INFO("/_api/files/archive: Complete: %s (%d entries, %d bytes)", writer->rootPath.c_str(), writer->entries, index);
+        }
+        return len;
+      });
+    response->addHeader("Content-Disposition", "attachment; filename=\"" + archiveName + ".tar\"");
+    request->send(response);
+  });
+  
+  apiRoute("/_api/files/extract", HTTP_POST,
+    [](AsyncWebServerRequest *request) {
+      String dest = request->hasParam("path") ? request->getParam("path")->value() : "/";
+      if (dest.length() == 0 || dest.indexOf("..") >= 0) {
+        LOG_WARN("/_api/files/extract: Invalid path: %s", dest.c_str());
+        sendApiJson(request, 400, "{\"error\":\"Invalid path\"}");
+        return;
+      }
+      
+      if (extractOwner != request) {
+        if (extractOwner) {
+          sendApiJson(request, 409, "{\"error\":\"Extraction already in progress\"}");
+        } else {
+          sendApiJson(request, 400, "{\"error\":\"Empty archive\"}");
+        }
+        return;
+      }
+      
+      bool ok = finishTarExtractor(extractor);
+      // Archives can overwrite and spread over many directories
+      noteSDCardTreeChange(extractor.destPath);
+      extractOwner = nullptr;
+      
+      JsonDocument doc;
+      doc["files"] = extractor.files;
+      doc["dirs"] = extractor.dirs;
+      doc["skipped"] = extractor.skipped;
+      doc["bytes"] = extractor.bytes;
+      
+      if (ok) {
+        doc["status"] = "extracted";
+        LOG_INFO("/_api/files/extract: Complete: %d files, %d dirs into %s", extractor.files, extractor.dirs, extractor.destPath.c_str());
+      } else {
+        doc["error"] = extractor.error;
+      }
+      
+      sendApiDocument(request, ok ? 200 : 500, doc);
+    },
+    [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
+      extractTarChunk(request, data, len, index);
+    },
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+      extractTarChunk(request, data, len, index);
+    });
+}
+
+void setupJobEndpoints() {
+  apiRoute("/_api/jobs", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonDocument doc;
+    listFileJobs(doc["jobs"].to<JsonArray>());
+    
+    sendApiDocument(request, 200, doc);
+  });
+  
+  apiRoute("/_api/jobs", HTTP_POST, rejectEmptyBody, NULL,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    const char* body = collectRequestBody(request, data, len, index, total, 1024);
+    if (!body) return;
+    
+    JsonDocument doc;
+    DeserializationError error = deserializeApiBody(request, doc, (const uint8_t*)body, total);
+    
+    if (error) {
+      sendApiJson(request, 400, "{\"error\":\"Invalid JSON\"}");
+      return;
+    }
+    
+    FileJobType type;
+    if (!parseFileJobType(doc["type"] | "", type)) {
+      sendApiJson(request, 400, "{\"error\":\"Unknown job type\"}");
+      return;
+    }
+    
+    String source = doc["source"] | "";
+    String destination = doc["destination"] | "";
+    bool needsDestination = type == JOB_COPY || type == JOB_MOVE;
+    
+    if (source.length() == 0 || source.indexOf("..") >= 0 ||
+        (needsDestination && (destination.length() == 0 || destination.indexOf("..") >= 0))) {
+      sendApiJson(request, 400, "{\"error\":\"Invalid paths\"}");
+      return;
+    }
+    
+    if ((type == JOB_DELETE || type == JOB_MOVE) && (source == "/" || source == "/index.html")) {
+      sendApiJson(request, 403, "{\"error\":\"Cannot modify protected file\"}");
+      return;
+    }
+    
+    if (!SD.exists(source)) {
+      sendApiJson(request, 404, "{\"error\":\"Source not found\"}");
+      return;
+    }
+    
+    if (needsDestination) {
+      if (SD.exists(destination)) {
+        sendApiJson(request, 409, "{\"error\":\"Destination already exists\"}");
+        return;
+      }
+      if (destination.startsWith(source + "/")) {
+        sendApiJson(request, 400, "{\"error\":\"Destination is inside source\"}");
+        return;
+      }
+    }
+    
+    uint32_t jobId = submitFileJob(type, source, needsDestination ? destination : String());
+    if (jobId == 0) {
+      sendApiJson(request, 503, "{\"error\":\"Job queue full\"}");
+      return;
+    }
+    
+    LOG_INFO("/_api/jobs: Queued job %d (%s %s)", jobId, doc["type"].as<const char*>(), source.c_str());
+    sendApiJson(request, 202, "{\"status\":\"queued\",\"job\":" + String(jobId) + "}");
+  });
+  
+  apiOperation("/_api/jobs/status", HTTP_GET, [](JsonVariantConst args, JsonDocument& doc) {
+    if (args["id"].isNull()) {
+      return apiError(doc, 400, "Missing id parameter");
+    }
+    
+    if (!getFileJobStatus(apiArgInt(args["id"]), doc.to<JsonObject>())) {
+      doc.clear();
+      return apiError(doc, 404, "Job not found");
+    }
+    return 200;
+  });
+  
+  apiRoute("/_api/jobs/cancel", HTTP_POST, [](AsyncWebServerRequest *request) {
+    if (!request->hasParam("id")) {
+      sendApiJson(request, 400, "{\"error\":\"Missing id parameter\"}");
+      return;
+    }
+    
+    if (!cancelFileJob(request->getParam("id")->value().toInt())) {
+      sendApiJson(request, 404, "{\"error\":\"Job not found\"}");
+      return;
+    }
+    
+    sendApiJson(request, 200, "{\"status\":\"cancelling\"}");
+  });
+}
+
+void setupTimeSeriesEndpoints() {
+  apiRoute("/_api/ts/list", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonDocument doc;
+    listTimeSeries(doc["series"].to<JsonArray>());
+    
+    sendApiDocument(request, 200, doc);
+  });
+  
+  apiRoute("/_api/ts/write", HTTP_POST, rejectEmptyBody, NULL,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    const char* body = collectRequestBody(request, data, len, index, total, TS_MAX_WRITE_BODY);
+    if (!body) return;
+    
+    JsonDocument doc;
+    DeserializationError error = deserializeApiBody(request, doc, (const uint8_t*)body, total);
+    if (error) {
+      sendApiJson(request, 400, "{\"error\":\"Invalid JSON\"}");
+      return;
+    }
+    
+    String name = doc["series"] | "";
+    if (!isValidSeriesName(name)) {
+      sendApiJson(request, 400, "{\"error\":\"Invalid series name\"}");
+      return;
+    }
+    
+    // Either explicit [ts, value] pairs, or values at a fixed interval from ts
+    JsonArray points = doc["points"];
+    JsonArray values = doc["values"];
+    int64_t start = doc["ts"] | (int64_t)millis();
+    int64_t interval = doc["interval"] | 1000;
+    size_t count = points ? points.size() : (values ? values.size() : 0);
+    if (count == 0) {
+      sendApiJson(request, 400, "{\"error\":\"No points\"}");
+      return;
+    }
+    
+    // Handlers all run on the async_tcp task, whose stack is small;
+    // writeTimeSeries() writes from this buffer without copying it
+    static TsRecord batch[TS_WRITE_BATCH];
+    size_t batched = 0;
+    size_t accepted = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (points) {
+        batch[batched].ts = points[i][0].as<int64_t>();
+        batch[batched].value = points[i][1].as<float>();
+      } else {
+        batch[batched].ts = start + (int64_t)i * interval;
+        batch[batched].value = values[i].as<float>();
+      }
+      if (++batched == TS_WRITE_BATCH || i + 1 == count) {
+        accepted += writeTimeSeries(name, batch, batched);
+        batched = 0;
+      }
+    }
+    
+    JsonDocument result;
+    result["series"] = name;
+    result["received"] = count;
+    result["written"] = accepted;
+    
+    sendApiDocument(request, 200, result);
+  });
+  
+  apiRoute("/_api/ts/query", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!request->hasParam("series")) {
+      sendApiJson(request, 400, "{\"error\":\"Missing series parameter\"}");
+      return;
+    }
+    
+    String name = request->getParam("series")->value();
+    if (!isValidSeriesName(name)) {
+      sendApiJson(request, 400, "{\"error\":\"Invalid series name\"}");
+      return;
+    }
+    
+    int64_t from = request->hasParam("from") ? atoll(request->getParam("from")->value().c_str()) : 0;
+    int64_t to = request->hasParam("to") ? atoll(request->getParam("to")->value().c_str()) : INT64_MAX / 2;
+    int64_t step = request->hasParam("step") ? atoll(request->getParam("step")->value().c_str()) : 0;
+    
+    JsonDocument doc;
+    String error;
+    if (!queryTimeSeries(name, from, to, step, doc.to<JsonObject>(), error)) {
+      sendApiJson(request, error == "Series not found" ? 404 : 400,
+                  "{\"error\":\"" + error + "\"}");
+      return;
+    }
+    
+    sendApiDocument(request, 200, doc);
+  });
+}
+
+static int kvErrorStatus(const String& error) {
+  if (error == "Key not found") return 404;
+  if (error == "Value too large") return 413;
+  if (error == "Store full") return 507;
+  if (error == "Store unavailable") return 503;
+  if (error == "Write failed") return 500;
+  return 400;
+}
+
+void setupKvEndpoints() {
+  apiRoute("/_api/kv", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!request->hasParam("key")) {
+      sendApiJson(request, 400, "{\"error\":\"Missing key parameter\"}");
+      return;
+    }
+    
+    String key = request->getParam("key")->value();
+    JsonDocument doc;
+    doc["key"] = key;
+    if (!getKvValue(key, doc["value"].to<JsonVariant>())) {
+      sendApiJson(request, 404, "{\"error\":\"Key not found\"}");
+      return;
+    }
+    
+    sendApiDocument(request, 200, doc);
+  });
+  
+  apiRoute("/_api/kv", HTTP_POST, rejectEmptyBody, NULL,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    const char* body = collectRequestBody(request, data, len, index, total, KV_MAX_VALUE + 256);
+    if (!body) return;
+    
+    JsonDocument doc;
+    if (deserializeApiBody(request, doc, (const uint8_t*)body, total)) {
+      sendApiJson(request, 400, "{\"error\":\"Invalid JSON\"}");
+      return;
+    }
+    
+    String key = doc["key"] | "";
+    if (!isValidKvKey(key)) {
+      sendApiJson(request, 400, "{\"error\":\"Invalid key\"}");
+      return;
+    }
+    if (doc["value"].isNull()) {
+      sendApiJson(request, 400, "{\"error\":\"Missing value\"}");
+      return;
+    }
+    
+    // Values are stored as JSON text so any JSON type round-trips
+    String value;
+    serializeJson(doc["value"], value);
+    
+    String error;
+    if (!putKvValue(key, value, error)) {
+      sendApiJson(request, kvErrorStatus(error), "{\"error\":\"" + error + "\"}");
+      return;
+    }
+    sendApiJson(request, 200, "{\"status\":\"ok\"}");
+  });
+  
+  apiRoute("/_api/kv", HTTP_DELETE, [](AsyncWebServerRequest *request) {
+    if (!request->hasParam("key")) {
+      sendApiJson(request, 400, "{\"error\":\"Missing key parameter\"}");
+      return;
+    }
+    
+    String error;
+    if (!deleteKvValue(request->getParam("key")->value(), error)) {
+      sendApiJson(request, kvErrorStatus(error), "{\"error\":\"" + error + "\"}");
+      return;
+    }
+    sendApiJson(request, 200, "{\"status\":\"deleted\"}");
+  });
+  
+  apiRoute("/_api/kv/list", HTTP_GET, [](AsyncWebServerRequest *request) {
+    String prefix = request->hasParam("prefix") ? request->getParam("prefix")->value() : "";
+    bool withValues = request->hasParam("values") && request->getParam("values")->value() == "1";
+    
+    JsonDocument doc;
+    JsonArray keys = doc["keys"].to<JsonArray>();
+    listKvKeys(prefix, keys);
+    
+    if (withValues) {
+      JsonObject values = doc["values"].to<JsonObject>();
+      for (JsonVariant key : keys) {
+        String name = key.as<String>();
+        if (!getKvValue(name, values[name].to<JsonVariant>())) values.remove(name);
+      }
+    }
+    
+    sendApiDocument(request, 200, doc);
+  });
+  
+  apiRoute("/_api/kv/batch", HTTP_POST, rejectEmptyBody, NULL,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    const char* body = collectRequestBody(request, data, len, index, total, 16384);
+    if (!body) return;
+    
+    JsonDocument doc;
+    if (deserializeApiBody(request, doc, (const uint8_t*)body, total)) {
+      sendApiJson(request, 400, "{\"error\":\"Invalid JSON\"}");
+      return;
+    }
+    
+    JsonObject puts = doc["put"];
+    JsonArray deletes = doc["delete"];
+    size_t count = puts.size() + deletes.size();
+    if (count == 0 || count > KV_MAX_BATCH) {
+      sendApiJson(request, 400, "{\"error\":\"Batch must hold 1-" + String(KV_MAX_BATCH) + " operations\"}");
+      return;
+    }
+    
+    std::unique_ptr<KvOp[]> ops(new KvOp[count]);
+    size_t n = 0;
+    for (JsonPair put : puts) {
+      ops[n].key = put.key().c_str();
+      serializeJson(put.value(), ops[n].value);
+      ops[n++].remove = false;
+    }
+    for (JsonVariant key : deletes) {
+      ops[n].key = key.as<String>();
+      ops[n++].remove = true;
+    }
+    
+    String error;
+    if (!applyKvBatch(ops.get(), count, error)) {
+      sendApiJson(request, kvErrorStatus(error), "{\"error\":\"" + error + "\"}");
+      return;
+    }
+    sendApiJson(request, 200, "{\"status\":\"ok\",\"applied\":" + String(count) + "}");
+  });
+  
+  apiRoute("/_api/kv/stats", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonDocument doc;
+    getKvStats(doc.to<JsonObject>());
+    
+    sendApiDocument(request, 200, doc);
+  });
+}
+
+void setupRulesEndpoints() {
+  apiRoute("/_api/rules", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonDocument doc;
+    getRulesStatus(doc.to<JsonObject>());
+    
+    sendApiDocument(request, 200, doc);
+  });
+  
+  apiRoute("/_api/rules", HTTP_POST, rejectEmptyBody, NULL,
+    [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    const char* body = collectRequestBody(request, data, len, index, total, 16384);
+    if (!body) return;
+    
+    JsonDocument doc;
+    if (deserializeApiBody(request, doc, (const uint8_t*)body, total)) {
+      sendApiJson(request, 400, "{\"error\":\"Invalid JSON\"}");
+      return;
+    }
+    
+    JsonDocument result;
+    JsonArray errors = result["details"].to<JsonArray>();
+    if (!loadRules(doc, errors)) {
+      result["error"] = "Invalid rules";
+      sendApiDocument(request, 400, result);
+      return;
+    }
+    
+    // Persist only rules that compiled, so a reboot never loads a broken set
+    // The file stays JSON text even when the rules arrived as MessagePack
+    File file = SD.open(PATH_RULES, FILE_WRITE);
+    bool saved = false;
+    if (file) {
+      saved = hasMsgPackBody(request) ? serializeJsonPretty(doc, file) > 0
+                                      : file.write((const uint8_t*)body, total) == total;
+      file.close();
+    }
+    adjustSDCardUsage(PATH_RULES, 0);
+    if (!saved) {
+      LOG_ERROR("/_api/rules: Cannot save %s", PATH_RULES);
+    }
+    
+    sendApiJson(request, 200, "{\"status\":\"loaded\",\"saved\":" + String(saved ? "true" : "false") + "}");
+  });
+  
+  apiRoute("/_api/rules/reload", HTTP_POST, [](AsyncWebServerRequest *request) {
+    JsonDocument result;
+    JsonArray errors = result["details"].to<JsonArray>();
+    if (!reloadRulesFromFile(errors)) {
+      result["error"] = "Cannot load rules";
+      sendApiDocument(request, 400, result);
+      return;
+    }
+    sendApiJson(request, 200, "{\"status\":\"loaded\"}");
+  });
 }
 
 void setupOTAEndpoint() {
-  server.on("/_api/ota/update", HTTP_POST, 
+  apiRoute("/_api/ota/update", HTTP_POST, 
     [](AsyncWebServerRequest *request) {
       #ifdef OTA_PASSWORD
       if (!request->hasHeader("X-OTA-Password")) {
-        request->send(401, "application/json", "{\"status\":\"error\",\"message\":\"Password required\"}");
+        sendApiJson(request, 401, "{\"status\":\"error\",\"message\":\"Password required\"}");
         return;
       }
       String password = request->header("X-OTA-Password");
       if (password != String(OTA_PASSWORD)) {
         LOG_WARN("Invalid OTA password attempt from %s", request->client()->remoteIP().toString().c_str());
-        request->send(403, "application/json", "{\"status\":\"error\",\"message\":\"Invalid password\"}");
+        sendApiJson(request, 403, "{\"status\":\"error\",\"message\":\"Invalid password\"}");
         return;
       }
       #endif
@@ -714,21 +1445,25 @@ void setupOTAEndpoint() {
       }
       
       if (!SD.exists(firmwarePath)) {
-        request->send(404, "application/json", "{\"status\":\"error\",\"message\":\"Firmware file not found on SD card\"}");
+        sendApiJson(request, 404, "{\"status\":\"error\",\"message\":\"Firmware file not found on SD card\"}");
         LOG_ERROR("Firmware file not found: %s", firmwarePath.c_str());
         return;
       }
       
       scheduleOTAUpdate(firmwarePath);
-      request->send(200, "application/json", "{\"status\":\"ok\",\"message\":\"OTA update will start shortly...\"}");
+      sendApiJson(request, 200, "{\"status\":\"ok\",\"message\":\"OTA update will start shortly...\"}");
     }
   );
 }
 
 void setupWebUIEndpoints() {
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (!admitRequest(request)) return;
     LOG_DEBUG("Request: / from %s", request->client()->remoteIP().toString().c_str());
     
+    // The card's copy wins so an edited index.html shows up at once
+    if (serveCachedAsset(request, PATH_INDEX)) return;
+    
     bool indexExists = SD.exists(PATH_INDEX);
     
     if (indexExists) {
@@ -741,6 +1476,7 @@ void setupWebUIEndpoints() {
           if (fileSize > 100000) {
             LOG_INFO("Serving large index.html: %d bytes", fileSize);
           }
+          if (cacheAndServeAsset(request, PATH_INDEX, fileSize)) return;
           request->send(SD, PATH_INDEX, "text/html");
           return;
         } else {
@@ -752,184 +1488,35 @@ void setupWebUIEndpoints() {
       }
     }
     
+    if (serveFromBundle(request, PATH_INDEX)) return;
+    
     LOG_DEBUG("Serving fallback interface");
     
-    uint8_t cardType = SD.cardType();
-    bool sdMounted = (cardType != CARD_NONE);
-    uint64_t cardSize = sdMounted ? SD.cardSize() / (1024 * 1024) : 0;
-    uint64_t usedBytes = sdMounted ? SD.usedBytes() / (1024 * 1024) : 0;
-    
-    String html = R"rawliteral(
-<!DOCTYPE html>
-<html>
-<head>
-    <title>ESP2GO Manager - Fallback</title>
-    <meta name="viewport" content="width=device-width, initial-scale=1">
-    <link href="https://cdn.jsdelivr.net/npm/bootstrap@5.3.2/dist/css/bootstrap.min.css" rel="stylesheet">
-</head>
-<body class="bg-light">
-    <div class="container my-4">
-        <div class="card shadow">
-            <div class="card-header bg-primary text-white">
-                <h1 class="h3 mb-0">ESP2GO Manager</h1>
-                <small>Fallback Interface</small>
-            </div>
-            <div class="card-body">
-                <div class="alert alert-warning">
-                    <strong>⚠️ Using Fallback Interface</strong><br>
-                    No custom index.html found on SD card. Upload one to customize!
-                </div>
-                
-                <h5 class="mt-4">📊 System Status</h5>
-                <table class="table table-sm">
-                    <tbody>
-                        <tr>
-                            <td class="fw-bold">SD Card Status:</td>
-                            <td>)rawliteral";
-    
-    if (sdMounted) {
-      html += "<span class='text-success'>✅ Mounted</span>";
-    } else {
-      html += "<span class='text-danger'>❌ Not Mounted</span>";
-    }
-    
-    html += R"rawliteral(</td>
-                        </tr>
-                        <tr>
-                            <td class="fw-bold">SD Card Size:</td>
-                            <td>)rawliteral";
-    
-    html += String(cardSize) + " MB";
-    
-    html += R"rawliteral(</td>
-                        </tr>
-                        <tr>
-                            <td class="fw-bold">Used Space:</td>
-                            <td>)rawliteral";
-    
-    html += String(usedBytes) + " MB";
-    
-    html += R"rawliteral(</td>
-                        </tr>
-                        <tr>
-                            <td class="fw-bold">index.html exists:</td>
-                            <td>)rawliteral";
-    
-    if (SD.exists("/index.html")) {
-      html += "<span class='text-success'>✅ Yes</span>";
-    } else {
-      html += "<span class='text-warning'>⚠️ No (using fallback)</span>";
-    }
-    
-    html += R"rawliteral(</td>
-                        </tr>
-                    </tbody>
-                </table>
-                
-                <h5 class="mt-4">📤 Upload File</h5>
-                <form id="uploadForm" enctype="multipart/form-data" class="mb-3">
-                    <div class="input-group">
-                        <input type="file" class="form-control" id="fileInput" name="file">
-                        <button type="submit" class="btn btn-primary">Upload</button>
-                    </div>
-                </form>
-                
-                <h5 class="mt-4">📁 Files</h5>
-                <div id="fileList" class="list-group"></div>
-            </div>
-        </div>
-    </div>
-    <script>
-        function loadFiles() {
-            fetch('/list')
-                .then(response => response.json())
-                .then(data => {
-                    const fileList = document.getElementById('fileList');
-                    if (data.files.length === 0) {
-                        fileList.innerHTML = '<div class="alert alert-info">No files on SD card</div>';
-                        return;
-                    }
-                    fileList.innerHTML = '';
-                    data.files.forEach(file => {
-                        const div = document.createElement('div');
-                        div.className = 'list-group-item d-flex justify-content-between align-items-center';
-                        
-                        const info = document.createElement('div');
-                        const icon = file.isDir ? '📁' : '📄';
-                        info.innerHTML = '<strong>' + icon + ' ' + escapeHtml(file.name) + '</strong> <small class="text-muted">(' + formatBytes(file.size) + ')</small>';
-                        
-                        const btnGroup = document.createElement('div');
-                        btnGroup.className = 'btn-group btn-group-sm';
-                        
-                        if (!file.isDir) {
-                            const downloadBtn = document.createElement('button');
-                            downloadBtn.className = 'btn btn-outline-primary';
-                            downloadBtn.textContent = 'Download';
-                            downloadBtn.onclick = function() { downloadFile(file.path); };
-                            btnGroup.appendChild(downloadBtn);
-                        }
-                        
-                        const deleteBtn = document.createElement('button');
-                        deleteBtn.className = 'btn btn-outline-danger';
-                        deleteBtn.textContent = 'Delete';
-                        deleteBtn.onclick = function() { deleteFile(file.path); };
-                        btnGroup.appendChild(deleteBtn);
-                        
-                        div.appendChild(info);
-                        div.appendChild(btnGroup);
-                        fileList.appendChild(div);
-                    });
-                });
-        }
+    // Values are resolved lazily as the chunked response reaches each placeholder
+    request->send(beginTemplateResponse(request, "text/html", FALLBACK_PAGE_TEMPLATE,
+      [indexExists](const String& name) -> String {
+        bool sdMounted = isSDCardMounted();
         
-        function formatBytes(bytes) {
-            if (bytes === 0) return '0 Bytes';
-            const k = 1024;
-            const sizes = ['Bytes', 'KB', 'MB', 'GB'];
-            const i = Math.floor(Math.log(bytes) / Math.log(k));
-            return Math.round(bytes / Math.pow(k, i) * 100) / 100 + ' ' + sizes[i];
+        if (name == "sd_status") {
+          return sdMounted ? "<span class='text-success'>✅ Mounted</span>"
+                           : "<span class='text-danger'>❌ Not Mounted</span>";
         }
-        
-        function escapeHtml(text) {
-            const div = document.createElement('div');
-            div.textContent = text;
-            return div.innerHTML;
+        if (name == "sd_size") {
+          return String(sdMounted ? getSDCardSize() / (1024 * 1024) : 0) + " MB";
         }
-        
-        function downloadFile(path) {
-            window.location.href = '/download?path=' + encodeURIComponent(path);
+        if (name == "sd_used") {
+          return String(sdMounted ? getSDCardUsed() / (1024 * 1024) : 0) + " MB";
         }
-        
-        function deleteFile(path) {
-            if (confirm('Delete ' + path + '?')) {
-                fetch('/delete?path=' + encodeURIComponent(path), {method: 'DELETE'})
-                    .then(() => loadFiles());
-            }
+        if (name == "index_status") {
+          return indexExists ? "<span class='text-success'>✅ Yes</span>"
+                             : "<span class='text-warning'>⚠️ No (using fallback)</span>";
         }
-        
-        document.getElementById('uploadForm').onsubmit = function(e) {
-            e.preventDefault();
-            const formData = new FormData();
-            formData.append('file', document.getElementById('fileInput').files[0]);
-            fetch('/upload', {
-                method: 'POST',
-                body: formData
-            }).then(() => {
-                loadFiles();
-                document.getElementById('fileInput').value = '';
-                alert('Upload complete! Refresh the page if you uploaded index.html');
-            });
-        };
-        
-        loadFiles();
-    </script>
-</body>
-</html>
-)rawliteral";
-    request->send(200, "text/html", html);
+        return String();
+      }));
   });
 
   server.onNotFound([](AsyncWebServerRequest *request) {
+    if (!admitRequest(request)) return;
     String path = request->url();
     LOG_DEBUG("404 handler: %s from %s", path.c_str(), request->client()->remoteIP().toString().c_str());
     
@@ -939,7 +1526,12 @@ void setupWebUIEndpoints() {
       return;
     }
     
-    if (!SD.exists(path)) {
+    // Files on the card win so edits and synced apps show up at once; hot
+    // ones come from RAM. The flash bundle covers what the card lacks.
+    if (serveCachedAsset(request, path)) return;
+    
+    if (!isSDCardMounted() || !SD.exists(path)) {
+      if (serveFromBundle(request, path)) return;
       LOG_WARN("404: File not found: %s", path.c_str());
       request->send(404, "text/plain", "File not found: " + path);
       return;
@@ -959,27 +1551,13 @@ void setupWebUIEndpoints() {
       return;
     }
     
+    size_t fileSize = file.size();
     file.close();
+    if (!admitRequest(request, fileSize > GOV_LARGE_FILE_BYTES)) return;
+    
+    if (fileSize <= ASSET_CACHE_MAX_FILE && cacheAndServeAsset(request, path, fileSize)) return;
     
-    String contentType = "application/octet-stream";
-    if (path.endsWith(".html") || path.endsWith(".htm")) contentType = "text/html";
-    else if (path.endsWith(".css")) contentType = "text/css";
-    else if (path.endsWith(".js")) contentType = "application/javascript";
-    else if (path.endsWith(".json")) contentType = "application/json";
-    else if (path.endsWith(".png")) contentType = "image/png";
-    else if (path.endsWith(".jpg") || path.endsWith(".jpeg")) contentType = "image/jpeg";
-    else if (path.endsWith(".gif")) contentType = "image/gif";
-    else if (path.endsWith(".svg")) contentType = "image/svg+xml";
-    else if (path.endsWith(".ico")) contentType = "image/x-icon";
-    else if (path.endsWith(".txt")) contentType = "text/plain";
-    else if (path.endsWith(".pdf")) contentType = "application/pdf";
-    else if (path.endsWith(".xml")) contentType = "text/xml";
-    else if (path.endsWith(".zip")) contentType = "application/zip";
-    else if (path.endsWith(".mp3")) contentType = "audio/mpeg";
-    else if (path.endsWith(".mp4")) contentType = "video/mp4";
-    else if (path.endsWith(".woff")) contentType = "font/woff";
-    else if (path.endsWith(".woff2")) contentType = "font/woff2";
-    else if (path.endsWith(".ttf")) contentType = "font/ttf";
+    String contentType = getMimeType(path.c_str());
     
     LOG_INFO("Serving static file: %s (%s)", path.c_str(), contentType.c_str());
     request->send(SD, path, contentType);
@@ -992,9 +1570,15 @@ void setupWebServer() {
   setupAPIEndpoints();
   setupGPIOEndpoints();
   setupFileEndpoints();
+  setupJobEndpoints();
+  setupTimeSeriesEndpoints();
+  setupKvEndpoints();
+  setupRulesEndpoints();
   setupOTAEndpoint();
   setupWebUIEndpoints();
+  setupWebDAV(server);
   
+  beginApiRouter(server);
   server.begin();
   LOG_INFO("Web server started successfully");
 }
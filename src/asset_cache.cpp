@@ -0,0 +1,213 @@
+#include "asset_cache.h"
+#include "config.h"
+#include "mime_types.h"
+#include <SD.h>
+#include <memory>
+
+struct CachedAsset {
+  String path;
+  bool gzip;
+  const char* contentType;
+  std::shared_ptr<uint8_t> data;  // kept alive by in-flight responses after eviction
+  size_t size;
+  uint32_t lastUsed;
+  uint32_t hits;
+};
+
+static CachedAsset assets[ASSET_CACHE_MAX_ENTRIES];
+static size_t bytesUsed = 0;
+static uint32_t hitCount = 0;
+static uint32_t missCount = 0;
+static uint64_t bytesSaved = 0;
+static uint32_t evictionCount = 0;
+static uint32_t invalidationCount = 0;
+static SemaphoreHandle_t cacheMutex = NULL;
+
+static size_t currentBudget() {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (freeHeap <= ASSET_CACHE_HEAP_RESERVE) return 0;
+  size_t budget = (freeHeap - ASSET_CACHE_HEAP_RESERVE) / 2 + bytesUsed;
+  return budget < ASSET_CACHE_MAX_BUDGET ? budget : ASSET_CACHE_MAX_BUDGET;
+}
+
+static bool acceptsGzip(AsyncWebServerRequest *request) {
+  return request->hasHeader("Accept-Encoding") &&
+         request->getHeader("Accept-Encoding")->value().indexOf("gzip") >= 0;
+}
+
+static void dropAsset(CachedAsset& asset) {
+  bytesUsed -= asset.size;
+  asset.path = "";
+  asset.data.reset();
+  asset.size = 0;
+}
+
+static CachedAsset* findAsset(const String& path, bool gzip) {
+  for (size_t i = 0; i < ASSET_CACHE_MAX_ENTRIES; i++) {
+    if (assets[i].data && assets[i].gzip == gzip && assets[i].path == path) return &assets[i];
+  }
+  return nullptr;
+}
+
+// Evicts least recently used entries until 'needed' more bytes fit the budget
+static CachedAsset* makeRoom(size_t needed) {
+  size_t budget = currentBudget();
+  if (needed > budget) return nullptr;
+
+  while (true) {
+    CachedAsset* empty = nullptr;
+    CachedAsset* oldest = nullptr;
+    for (size_t i = 0; i < ASSET_CACHE_MAX_ENTRIES; i++) {
+      if (!assets[i].data) {
+        if (!empty) empty = &assets[i];
+      } else if (!oldest || assets[i].lastUsed < oldest->lastUsed) {
+        oldest = &assets[i];
+      }
+    }
+    if (empty && bytesUsed + needed <= budget) return empty;
+    if (!oldest) return nullptr;
+    dropAsset(*oldest);
+    evictionCount++;
+  }
+}
+
+static void sendAsset(AsyncWebServerRequest *request, const CachedAsset& asset, const char* cacheStatus) {
+  std::shared_ptr<uint8_t> data = asset.data;
+  size_t size = asset.size;
+  AsyncWebServerResponse *response = request->beginResponse(asset.contentType, size,
+    [data, size](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      size_t len = min(maxLen, size - index);
+      memcpy(buffer, data.get() + index, len);
+      return len;
+    });
+  if (asset.gzip) {
+    response->addHeader("Content-Encoding", "gzip");
+  }
+  response->addHeader("X-Cache", cacheStatus);
+  request->send(response);
+}
+
+void initAssetCache() {
+  cacheMutex = xSemaphoreCreateMutex();
+  if (!cacheMutex) {
+    LOG_ERROR("Failed to create asset cache mutex");
+  }
+}
+
+bool serveCachedAsset(AsyncWebServerRequest *request, const String& path) {
+  if (!cacheMutex) return false;
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  CachedAsset* asset = acceptsGzip(request) ? findAsset(path, true) : nullptr;
+  if (!asset) asset = findAsset(path, false);
+
+  if (!asset) {
+    missCount++;
+    xSemaphoreGive(cacheMutex);
+    return false;
+  }
+
+  asset->lastUsed = millis();
+  asset->hits++;
+  hitCount++;
+  bytesSaved += asset->size;
+  CachedAsset hit = *asset;
+  xSemaphoreGive(cacheMutex);
+
+  sendAsset(request, hit, "HIT");
+  return true;
+}
+
+bool cacheAndServeAsset(AsyncWebServerRequest *request, const String& path, size_t size) {
+  if (!cacheMutex) return false;
+
+  String source = path;
+  bool gzip = false;
+  if (acceptsGzip(request)) {
+    String gzPath = path + ".gz";
+    File gz = SD.open(gzPath, FILE_READ);
+    if (gz && !gz.isDirectory() && gz.size() <= ASSET_CACHE_MAX_FILE) {
+      source = gzPath;
+      size = gz.size();
+      gzip = true;
+    }
+    if (gz) gz.close();
+  }
+  if (size == 0 || size > ASSET_CACHE_MAX_FILE) return false;
+
+  uint8_t* buffer = (uint8_t*)malloc(size);
+  if (!buffer) return false;
+  std::shared_ptr<uint8_t> data(buffer, free);
+
+  File file = SD.open(source, FILE_READ);
+  if (!file) return false;
+  size_t read = file.read(buffer, size);
+  file.close();
+  if (read != size) return false;
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  CachedAsset* asset = findAsset(path, gzip);
+  if (asset) dropAsset(*asset);
+  asset = makeRoom(size);
+
+  CachedAsset loaded = {path, gzip, getMimeType(path.c_str()), data, size, (uint32_t)millis(), 0};
+  if (asset) {
+    *asset = loaded;
+    bytesUsed += size;
+  }
+  xSemaphoreGive(cacheMutex);
+
+  // Serve from the buffer we just read even if the budget had no room for it
+  sendAsset(request, loaded, "MISS");
+  return true;
+}
+
+void invalidateAssetCache(const String& path) {
+  if (!cacheMutex) return;
+
+  String prefix = path.endsWith("/") ? path : path + "/";
+  String gzPath = path + ".gz";
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  for (size_t i = 0; i < ASSET_CACHE_MAX_ENTRIES; i++) {
+    if (!assets[i].data) continue;
+    const String& cached = assets[i].path;
+    if (cached == path || cached == gzPath || cached.startsWith(prefix) ||
+        (path.endsWith(".gz") && cached + ".gz" == path)) {
+      dropAsset(assets[i]);
+      invalidationCount++;
+    }
+  }
+  xSemaphoreGive(cacheMutex);
+}
+
+void clearAssetCache() {
+  invalidateAssetCache("/");
+}
+
+void getAssetCacheStats(JsonObject out) {
+  if (!cacheMutex) return;
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  uint32_t lookups = hitCount + missCount;
+  out["hits"] = hitCount;
+  out["misses"] = missCount;
+  out["hit_ratio"] = lookups ? (float)hitCount / lookups : 0.0f;
+  out["bytes_saved"] = bytesSaved;
+  out["bytes_used"] = bytesUsed;
+  out["budget"] = currentBudget();
+  out["max_file"] = ASSET_CACHE_MAX_FILE;
+  out["evictions"] = evictionCount;
+  out["invalidations"] = invalidationCount;
+
+  JsonArray list = out["entries"].to<JsonArray>();
+  for (size_t i = 0; i < ASSET_CACHE_MAX_ENTRIES; i++) {
+    if (!assets[i].data) continue;
+    JsonObject entry = list.add<JsonObject>();
+    entry["path"] = assets[i].path;
+    entry["size"] = assets[i].size;
+    entry["gzip"] = assets[i].gzip;
+    entry["hits"] = assets[i].hits;
+  }
+  xSemaphoreGive(cacheMutex);
+}
@@ -0,0 +1,35 @@
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+
+// LRU cache of small static files served straight from RAM.
+//
+// The byte budget follows free heap: half of what is left above
+// ASSET_CACHE_HEAP_RESERVE, capped at ASSET_CACHE_MAX_BUDGET, re-evaluated
+// on every insert. When the client accepts gzip and "<file>.gz" exists,
+// the compressed form is cached and served instead. Writers report to
+// storage (adjustSDCardUsage() and friends), which calls
+// invalidateAssetCache() for the paths they touch.
+#define ASSET_CACHE_MAX_ENTRIES 16
+#define ASSET_CACHE_MAX_FILE 16384
+#define ASSET_CACHE_MAX_BUDGET 98304
+#define ASSET_CACHE_HEAP_RESERVE 65536
+
+void initAssetCache();
+
+// Serves a cached copy; returns false on a miss without touching the card
+bool serveCachedAsset(AsyncWebServerRequest *request, const String& path);
+
+// Loads a file of the given size into the cache and serves it from RAM.
+// Returns false if it is too big or cannot be cached right now.
+bool cacheAndServeAsset(AsyncWebServerRequest *request, const String& path, size_t size);
+
+// Drops path, its .gz sibling, and everything below it if it is a directory
+void invalidateAssetCache(const String& path);
+void clearAssetCache();
+
+void getAssetCacheStats(JsonObject out);
+
+#endif
@@ -0,0 +1,155 @@
+#include "audio_resampler.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RESAMPLER_OUT_SHIFT (RESAMPLER_COEF_BITS - 8)
+#define RESAMPLER_OUT_MAX 8388607
+#define RESAMPLER_OUT_MIN (-8388608)
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+  while (b) {
+    uint32_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// Reduced ratio and per-phase filter length; false when unsupported
+static bool planResampler(uint32_t inRate, uint32_t outRate,
+                          uint16_t& up, uint16_t& down, uint16_t& taps) {
+  if (inRate == 0 || outRate == 0) return false;
+  uint32_t g = gcd(inRate, outRate);
+  uint32_t l = outRate / g;
+  uint32_t m = inRate / g;
+  if (l > RESAMPLER_MAX_PHASES || l > m * RESAMPLER_MAX_RATIO || m > l * RESAMPLER_MAX_RATIO) {
+    return false;
+  }
+
+  // Scale with the decimation so the transition band keeps its width
+  // relative to the output rate; a multiple of 4 for the unrolled loop
+  uint32_t n = (RESAMPLER_TAPS * (l > m ? l : m) + l - 1) / l;
+  n = (n + 3) & ~3u;
+  if (n > RESAMPLER_MAX_TAPS) return false;
+
+  up = l;
+  down = m;
+  taps = n;
+  return true;
+}
+
+static float besselI0(float x) {
+  float sum = 1, term = 1, half = x / 2;
+  for (int k = 1; k < 32; k++) {
+    term *= (half / k) * (half / k);
+    sum += term;
+    if (term < sum * 1e-7f) break;
+  }
+  return sum;
+}
+
+// Windowed sinc at the upsampled rate, one phase at a time. Every phase is
+// scaled to sum to exactly 1.0 in Q14 so a constant input passes unchanged
+// whichever phase lands on it.
+static void designFilter(Resampler& rs) {
+  const uint32_t total = (uint32_t)rs.up * rs.taps;
+  const float fc = RESAMPLER_CUTOFF * 0.5f / (rs.up > rs.down ? rs.up : rs.down);
+  const float center = (total - 1) / 2.0f;
+  const float windowNorm = besselI0(RESAMPLER_KAISER_BETA);
+  float h[RESAMPLER_MAX_TAPS];
+
+  for (uint16_t p = 0; p < rs.up; p++) {
+    float sum = 0;
+    for (uint16_t k = 0; k < rs.taps; k++) {
+      float x = (float)(p + (uint32_t)k * rs.up) - center;
+      float r = x / center;
+      float window = besselI0(RESAMPLER_KAISER_BETA * sqrtf(fmaxf(0.0f, 1.0f - r * r))) / windowNorm;
+      float sinc = fabsf(x) < 1e-6f ? 2 * fc : sinf(2 * (float)M_PI * fc * x) / ((float)M_PI * x);
+      h[k] = sinc * window;
+      sum += h[k];
+    }
+
+    int16_t* coefs = rs.coefs + (uint32_t)p * rs.taps;
+    int32_t quantized = 0;
+    uint16_t largest = 0;
+    for (uint16_t k = 0; k < rs.taps; k++) {
+      coefs[k] = (int16_t)lroundf(h[k] / sum * (1 << RESAMPLER_COEF_BITS));
+      quantized += coefs[k];
+      if (abs(coefs[k]) > abs(coefs[largest])) largest = k;
+    }
+    // Put the rounding error where it matters least
+    coefs[largest] += (1 << RESAMPLER_COEF_BITS) - quantized;
+  }
+}
+
+// ============================================
+// Public API
+// ============================================
+
+size_t getResamplerBytes(uint32_t inRate, uint32_t outRate) {
+  uint16_t up, down, taps;
+  if (!planResampler(inRate, outRate, up, down, taps)) return 0;
+  return ((size_t)up * taps + 2 * taps) * sizeof(int16_t);
+}
+
+bool beginResampler(Resampler& rs, uint32_t inRate, uint32_t outRate) {
+  memset(&rs, 0, sizeof(rs));
+  if (!planResampler(inRate, outRate, rs.up, rs.down, rs.taps)) return false;
+
+  rs.coefs = (int16_t*)malloc((size_t)rs.up * rs.taps * sizeof(int16_t));
+  rs.delay = (int16_t*)malloc(2 * rs.taps * sizeof(int16_t));
+  if (!rs.coefs || !rs.delay) {
+    endResampler(rs);
+    return false;
+  }
+
+  designFilter(rs);
+  resetResampler(rs);
+  return true;
+}
+
+void endResampler(Resampler& rs) {
+  free(rs.coefs);
+  free(rs.delay);
+  rs.coefs = nullptr;
+  rs.delay = nullptr;
+}
+
+void resetResampler(Resampler& rs) {
+  rs.phase = 0;
+  rs.pos = 0;
+  if (rs.delay) memset(rs.delay, 0, 2 * rs.taps * sizeof(int16_t));
+}
+
+size_t getResamplerMaxOutput(const Resampler& rs, size_t inCount) {
+  return (inCount * rs.up + rs.down - 1) / rs.down + 1;
+}
+
+size_t runResampler(Resampler& rs, const int16_t* in, size_t inCount, int32_t* out) {
+  const uint16_t taps = rs.taps;
+  size_t produced = 0;
+
+  for (size_t i = 0; i < inCount; i++) {
+    // Each sample is stored twice so the newest `taps` are always contiguous
+    rs.pos = rs.pos ? rs.pos - 1 : taps - 1;
+    rs.delay[rs.pos] = rs.delay[rs.pos + taps] = in[i];
+    const int16_t* window = rs.delay + rs.pos;
+
+    // Outputs whose upsampled position falls on this input sample
+    while (rs.phase < rs.up) {
+      const int16_t* h = rs.coefs + (uint32_t)rs.phase * taps;
+      int32_t acc = 0;
+      for (uint16_t k = 0; k < taps; k += 4) {
+        acc += h[k] * window[k] + h[k + 1] * window[k + 1] +
+               h[k + 2] * window[k + 2] + h[k + 3] * window[k + 3];
+      }
+      int32_t sample = (acc + (1 << (RESAMPLER_OUT_SHIFT - 1))) >> RESAMPLER_OUT_SHIFT;
+      out[produced++] = sample > RESAMPLER_OUT_MAX ? RESAMPLER_OUT_MAX
+                      : sample < RESAMPLER_OUT_MIN ? RESAMPLER_OUT_MIN : sample;
+      rs.phase += rs.down;
+    }
+    rs.phase -= rs.up;
+  }
+  return produced;
+}
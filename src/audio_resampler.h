@@ -0,0 +1,55 @@
+#ifndef AUDIO_RESAMPLER_H
+#define AUDIO_RESAMPLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fixed-point polyphase resampler for the capture path, for output rates
+// the PDM microphone cannot run at directly.
+//
+// The rate ratio is reduced to up/down (e.g. 16000 -> 8000 is 1/2, 48000
+// -> 44100 is 147/160). One Kaiser-windowed sinc low-pass is designed at
+// begin for the upsampled rate and split into `up` phases of `taps` Q14
+// coefficients each; every output sample is a single dot product against
+// the newest input samples, so no zero-stuffed or discarded samples are
+// ever computed. The filter gets longer as the cutoff drops below the
+// input Nyquist rate, which keeps the work per input sample constant.
+// Each phase is normalized to unity DC gain.
+//
+// Output samples carry 8 fractional bits beyond int16 (24-bit scale), so a
+// 24-bit capture keeps the filter's extra precision. Builds without Arduino
+// and runs on the host.
+#define RESAMPLER_TAPS 24           // per phase when not decimating
+#define RESAMPLER_MAX_TAPS 160
+#define RESAMPLER_MAX_PHASES 160
+#define RESAMPLER_MAX_RATIO 6
+#define RESAMPLER_COEF_BITS 14
+#define RESAMPLER_CUTOFF 0.90f      // -6 dB point as a fraction of the lower Nyquist rate
+#define RESAMPLER_KAISER_BETA 7.0f  // about 70 dB stopband
+
+struct Resampler {
+  uint16_t up;
+  uint16_t down;
+  uint16_t taps;
+  uint16_t phase;        // next output's offset within the newest input, 0..up-1
+  uint16_t pos;          // newest sample in the doubled delay line
+  int16_t* coefs;        // [phase][tap]
+  int16_t* delay;        // 2 * taps, newest first from pos
+};
+
+// False when the ratio is unsupported or allocation fails
+bool beginResampler(Resampler& rs, uint32_t inRate, uint32_t outRate);
+void endResampler(Resampler& rs);
+void resetResampler(Resampler& rs);
+
+// Upper bound on the outputs produced from inCount inputs
+size_t getResamplerMaxOutput(const Resampler& rs, size_t inCount);
+
+// Consumes all inCount inputs and returns the outputs written (24-bit
+// scale). out must hold getResamplerMaxOutput(rs, inCount) samples.
+size_t runResampler(Resampler& rs, const int16_t* in, size_t inCount, int32_t* out);
+
+// Coefficient and delay-line bytes begin would allocate, 0 if unsupported
+size_t getResamplerBytes(uint32_t inRate, uint32_t outRate);
+
+#endif
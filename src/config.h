@@ -22,10 +22,19 @@
 #define PATH_WIFI_CONFIG "/os/wifi_config.json"
 #define PATH_OTA_UPDATE "/os/ota_update.html"
 #define PATH_FIRMWARE_DEFAULT "/firmware.bin"
+#define PATH_KV_LOG "/os/kv.log"
+#define PATH_RULES "/os/rules.json"
+#define PATH_SENSORS "/os/sensors.json"
+#define PATH_MIC_FORMAT "/os/mic.json"
+#define PATH_RECORDING_DURABILITY "/os/recording.json"
+#define PATH_SD_TUNE "/os/sd_tune.json"
+#define PATH_SD_BENCH "/os/.sd_bench.tmp"
+#define PATH_HASH_CACHE "/os/.hash_cache"
 
 #define DIR_APPS "/apps"
 #define DIR_DOCS "/docs"
 #define DIR_OS "/os"
+#define DIR_TIMESERIES "/data/ts"
 
 #define LOG_TAG "[ESP2GO]"
 #define LOG_ERROR(fmt, ...) Serial.printf("❌ ERROR %s: " fmt "\n", LOG_TAG, ##__VA_ARGS__)
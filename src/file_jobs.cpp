@@ -0,0 +1,542 @@
+#include "file_jobs.h"
+#include "config.h"
+#include "storage.h"
+#include "waveform_peaks.h"
+#include "hardware.h"
+#include <SD.h>
+#include <mbedtls/sha256.h>
+
+#define FILE_JOB_TASK_STACK 8192
+#define FILE_JOB_TASK_PRIORITY 1
+#define FILE_JOB_TASK_CORE 0
+
+struct FileJob {
+  uint32_t id;
+  FileJobType type;
+  volatile FileJobState state;
+  volatile bool cancelRequested;
+  String source;
+  String destination;
+  uint64_t bytesTotal;
+  uint64_t bytesDone;
+  uint32_t filesTotal;
+  uint32_t filesDone;
+  uint32_t createdAt;
+  uint32_t finishedAt;
+  String error;
+  String checksum;
+};
+
+static FileJob jobs[FILE_JOB_SLOTS];
+static uint32_t nextJobId = 1;
+static SemaphoreHandle_t jobsMutex = NULL;
+static QueueHandle_t jobQueue = NULL;
+
+static const char* jobTypeName(FileJobType type) {
+  switch (type) {
+    case JOB_DELETE: return "delete";
+    case JOB_COPY: return "copy";
+    case JOB_MOVE: return "move";
+    case JOB_CHECKSUM: return "checksum";
+    case JOB_PEAKS: return "peaks";
+  }
+  return "unknown";
+}
+
+static const char* jobStateName(FileJobState state) {
+  switch (state) {
+    case JOB_EMPTY: return "empty";
+    case JOB_QUEUED: return "queued";
+    case JOB_RUNNING: return "running";
+    case JOB_DONE: return "done";
+    case JOB_FAILED: return "failed";
+    case JOB_CANCELLED: return "cancelled";
+  }
+  return "unknown";
+}
+
+bool parseFileJobType(const String& name, FileJobType& type) {
+  if (name == "delete") type = JOB_DELETE;
+  else if (name == "copy") type = JOB_COPY;
+  else if (name == "move") type = JOB_MOVE;
+  else if (name == "checksum") type = JOB_CHECKSUM;
+  else if (name == "peaks") type = JOB_PEAKS;
+  else return false;
+  return true;
+}
+
+static String joinPath(const String& dir, const char* name) {
+  return dir.endsWith("/") ? dir + name : dir + "/" + name;
+}
+
+// ============================================
+// Tree walkers (run on the job task)
+// ============================================
+
+static void scanTree(const String& path, uint64_t& bytes, uint32_t& files, int depth) {
+  File entry = SD.open(path);
+  if (!entry) return;
+
+  if (!entry.isDirectory()) {
+    bytes += entry.size();
+    files++;
+    entry.close();
+    return;
+  }
+
+  if (depth >= FILE_JOB_MAX_DEPTH) {
+    entry.close();
+    return;
+  }
+
+  File child = entry.openNextFile();
+  while (child) {
+    String childPath = joinPath(path, child.name());
+    child.close();
+    scanTree(childPath, bytes, files, depth + 1);
+    child = entry.openNextFile();
+  }
+  entry.close();
+}
+
+// Strings are read by status handlers, so they are only written under the mutex
+static bool failJob(FileJob& job, const String& error) {
+  xSemaphoreTake(jobsMutex, portMAX_DELAY);
+  job.error = error;
+  xSemaphoreGive(jobsMutex);
+  LOG_WARN("Job %d (%s): %s", job.id, jobTypeName(job.type), error.c_str());
+  return false;
+}
+
+static bool deleteTree(FileJob& job, const String& path, int depth) {
+  if (job.cancelRequested) return failJob(job, "Cancelled");
+
+  File entry = SD.open(path);
+  if (!entry) return failJob(job, "Cannot open " + path);
+
+  if (!entry.isDirectory()) {
+    int64_t size = entry.size();
+    entry.close();
+    if (!SD.remove(path)) return failJob(job, "Failed to delete " + path);
+    adjustSDCardUsage(path, -size);
+    job.filesDone++;
+    return true;
+  }
+
+  if (depth >= FILE_JOB_MAX_DEPTH) {
+    entry.close();
+    return failJob(job, "Directory tree too deep: " + path);
+  }
+
+  File child = entry.openNextFile();
+  while (child) {
+    String childPath = joinPath(path, child.name());
+    child.close();
+    if (!deleteTree(job, childPath, depth + 1)) {
+      entry.close();
+      return false;
+    }
+    child = entry.openNextFile();
+  }
+  entry.close();
+
+  if (!SD.rmdir(path)) return failJob(job, "Failed to remove directory " + path);
+  return true;
+}
+
+static bool copyFile(FileJob& job, const String& source, const String& destination, uint8_t* buffer) {
+  File in = SD.open(source, FILE_READ);
+  if (!in) return failJob(job, "Cannot open " + source);
+
+  // FILE_WRITE truncates a file already at the destination
+  File existing = SD.open(destination, FILE_READ);
+  int64_t replaced = existing && !existing.isDirectory() ? existing.size() : 0;
+  existing.close();
+
+  File out = SD.open(destination, FILE_WRITE);
+  if (!out) {
+    in.close();
+    return failJob(job, "Cannot create " + destination);
+  }
+
+  bool ok = true;
+  int64_t copied = 0;
+  while (true) {
+    if (job.cancelRequested) {
+      ok = failJob(job, "Cancelled");
+      break;
+    }
+
+    size_t n = in.read(buffer, FILE_JOB_COPY_BUFFER);
+    if (n == 0) break;
+
+    if (out.write(buffer, n) != n) {
+      ok = failJob(job, "Write failed: " + destination);
+      break;
+    }
+    job.bytesDone += n;
+    copied += n;
+  }
+
+  in.close();
+  out.close();
+
+  if (!ok) {
+    SD.remove(destination);
+    adjustSDCardUsage(destination, -replaced);
+    return false;
+  }
+  adjustSDCardUsage(destination, copied - replaced);
+  job.filesDone++;
+  return true;
+}
+
+static bool copyTree(FileJob& job, const String& source, const String& destination, uint8_t* buffer, int depth) {
+  if (job.cancelRequested) return failJob(job, "Cancelled");
+
+  File entry = SD.open(source);
+  if (!entry) return failJob(job, "Cannot open " + source);
+
+  if (!entry.isDirectory()) {
+    entry.close();
+    return copyFile(job, source, destination, buffer);
+  }
+
+  if (depth >= FILE_JOB_MAX_DEPTH) {
+    entry.close();
+    return failJob(job, "Directory tree too deep: " + source);
+  }
+
+  if (!SD.exists(destination) && !SD.mkdir(destination)) {
+    entry.close();
+    return failJob(job, "Cannot create directory " + destination);
+  }
+
+  File child = entry.openNextFile();
+  while (child) {
+    String name = child.name();
+    child.close();
+    if (!copyTree(job, joinPath(source, name.c_str()), joinPath(destination, name.c_str()), buffer, depth + 1)) {
+      entry.close();
+      return false;
+    }
+    child = entry.openNextFile();
+  }
+  entry.close();
+  return true;
+}
+
+static bool checksumFile(FileJob& job, uint8_t* buffer) {
+  File in = SD.open(job.source, FILE_READ);
+  if (!in || in.isDirectory()) return failJob(job, "Checksum requires a file");
+
+  // mbedtls routes SHA-256 through the ESP32 hardware accelerator
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts(&ctx, 0);
+
+  bool ok = true;
+  while (true) {
+    if (job.cancelRequested) {
+      ok = failJob(job, "Cancelled");
+      break;
+    }
+    size_t n = in.read(buffer, FILE_JOB_COPY_BUFFER);
+    if (n == 0) break;
+    mbedtls_sha256_update(&ctx, buffer, n);
+    job.bytesDone += n;
+  }
+  in.close();
+
+  uint8_t digest[32];
+  mbedtls_sha256_finish(&ctx, digest);
+  mbedtls_sha256_free(&ctx);
+  if (!ok) return false;
+
+  char hex[65];
+  for (int i = 0; i < 32; i++) {
+    sprintf(hex + i * 2, "%02x", digest[i]);
+  }
+  xSemaphoreTake(jobsMutex, portMAX_DELAY);
+  job.checksum = hex;
+  xSemaphoreGive(jobsMutex);
+  job.filesDone = 1;
+  return true;
+}
+
+static bool needsPeaks(const String& path) {
+  PeakFileHeader header;
+  return path.endsWith(".wav") && path != getRecordingPath() && !readPeakHeader(path, header);
+}
+
+// Counts (build = false) or generates missing peak files for WAVs in a tree
+static bool peaksTree(FileJob& job, const String& path, uint8_t* buffer, int depth, bool build) {
+  if (job.cancelRequested) return failJob(job, "Cancelled");
+
+  File entry = SD.open(path);
+  if (!entry) return failJob(job, "Cannot open " + path);
+
+  if (!entry.isDirectory()) {
+    uint64_t size = entry.size();
+    entry.close();
+    if (!needsPeaks(path)) return true;
+    if (!build) {
+      job.filesTotal++;
+      job.bytesTotal += size;
+      return true;
+    }
+
+    String error;
+    if (!buildPeakFile(path, buffer, FILE_JOB_COPY_BUFFER, job.cancelRequested, job.bytesDone, error)) {
+      if (job.cancelRequested) return failJob(job, "Cancelled");
+      // One unreadable WAV in a folder should not stop the rest
+      if (path == job.source) return failJob(job, error);
+      LOG_WARN("Job %d: %s", job.id, error.c_str());
+      return true;
+    }
+    job.filesDone++;
+    return true;
+  }
+
+  if (depth >= FILE_JOB_MAX_DEPTH) {
+    entry.close();
+    return failJob(job, "Directory tree too deep: " + path);
+  }
+
+  File child = entry.openNextFile();
+  while (child) {
+    String childPath = joinPath(path, child.name());
+    child.close();
+    if (!peaksTree(job, childPath, buffer, depth + 1, build)) {
+      entry.close();
+      return false;
+    }
+    child = entry.openNextFile();
+  }
+  entry.close();
+  return true;
+}
+
+static bool runJob(FileJob& job) {
+  if (!SD.exists(job.source)) return failJob(job, "Source not found");
+
+  if (job.type == JOB_MOVE) {
+    int lastSlash = job.destination.lastIndexOf('/');
+    if (lastSlash > 0) {
+      createDirectoryPath(job.destination.substring(0, lastSlash));
+    }
+    // A single file's size is known up front; a directory is left to a rescan
+    uint64_t size = 0;
+    File entry = SD.open(job.source, FILE_READ);
+    if (entry) {
+      if (!entry.isDirectory()) size = entry.size();
+      entry.close();
+    }
+    // A FAT rename moves between directories without touching data
+    if (SD.rename(job.source, job.destination)) {
+      noteSDCardMove(job.source, job.destination, size);
+      job.filesDone = 1;
+      return true;
+    }
+    LOG_INFO("Job %d: rename failed, falling back to copy + delete", job.id);
+  }
+
+  if (job.type == JOB_PEAKS) {
+    if (!peaksTree(job, job.source, nullptr, 0, false)) return false;
+    uint8_t* buffer = (uint8_t*)malloc(FILE_JOB_COPY_BUFFER);
+    if (!buffer) return failJob(job, "Out of memory");
+    bool ok = peaksTree(job, job.source, buffer, 0, true);
+    free(buffer);
+    return ok;
+  }
+
+  scanTree(job.source, job.bytesTotal, job.filesTotal, 0);
+
+  if (job.type == JOB_DELETE) {
+    return deleteTree(job, job.source, 0);
+  }
+
+  uint8_t* buffer = (uint8_t*)malloc(FILE_JOB_COPY_BUFFER);
+  if (!buffer) return failJob(job, "Out of memory");
+
+  bool ok;
+  if (job.type == JOB_CHECKSUM) {
+    ok = checksumFile(job, buffer);
+  } else {
+    int lastSlash = job.destination.lastIndexOf('/');
+    if (lastSlash > 0) {
+      createDirectoryPath(job.destination.substring(0, lastSlash));
+    }
+    ok = copyTree(job, job.source, job.destination, buffer, 0);
+    if (ok && job.type == JOB_MOVE) {
+      job.filesDone = 0;
+      ok = deleteTree(job, job.source, 0);
+    }
+  }
+
+  free(buffer);
+  return ok;
+}
+
+static void fileJobTask(void* param) {
+  uint8_t slot;
+
+  while (true) {
+    if (xQueueReceive(jobQueue, &slot, portMAX_DELAY) != pdTRUE) continue;
+
+    FileJob& job = jobs[slot];
+    xSemaphoreTake(jobsMutex, portMAX_DELAY);
+    bool cancelled = job.cancelRequested;
+    job.state = cancelled ? JOB_CANCELLED : JOB_RUNNING;
+    if (cancelled) job.finishedAt = millis();
+    xSemaphoreGive(jobsMutex);
+    if (cancelled) continue;
+
+    LOG_INFO("Job %d started: %s %s", job.id, jobTypeName(job.type), job.source.c_str());
+    uint32_t start = millis();
+    bool ok = runJob(job);
+
+    xSemaphoreTake(jobsMutex, portMAX_DELAY);
+    job.state = ok ? JOB_DONE : (job.cancelRequested ? JOB_CANCELLED : JOB_FAILED);
+    job.finishedAt = millis();
+    xSemaphoreGive(jobsMutex);
+
+    LOG_INFO("Job %d %s in %d ms (%d files, %llu bytes)", job.id, jobStateName(job.state),
+      job.finishedAt - start, job.filesDone, job.bytesDone);
+  }
+}
+
+// ============================================
+// Public API (called from HTTP handlers)
+// ============================================
+
+void initFileJobs() {
+  jobsMutex = xSemaphoreCreateMutex();
+  jobQueue = xQueueCreate(FILE_JOB_SLOTS, sizeof(uint8_t));
+
+  if (!jobsMutex || !jobQueue) {
+    LOG_ERROR("Failed to create file job queue");
+    return;
+  }
+
+  xTaskCreatePinnedToCore(fileJobTask, "file_jobs", FILE_JOB_TASK_STACK, NULL,
+    FILE_JOB_TASK_PRIORITY, NULL, FILE_JOB_TASK_CORE);
+  LOG_INFO("File job engine started (%d slots)", FILE_JOB_SLOTS);
+}
+
+uint32_t submitFileJob(FileJobType type, const String& source, const String& destination) {
+  if (!jobQueue) return 0;
+
+  xSemaphoreTake(jobsMutex, portMAX_DELAY);
+
+  // Prefer an empty slot, otherwise recycle the oldest finished job
+  int slot = -1;
+  for (int i = 0; i < FILE_JOB_SLOTS; i++) {
+    FileJobState state = jobs[i].state;
+    if (state == JOB_EMPTY) {
+      slot = i;
+      break;
+    }
+    if (state != JOB_QUEUED && state != JOB_RUNNING &&
+        (slot < 0 || jobs[i].finishedAt < jobs[slot].finishedAt)) {
+      slot = i;
+    }
+  }
+
+  if (slot < 0) {
+    xSemaphoreGive(jobsMutex);
+    return 0;
+  }
+
+  FileJob& job = jobs[slot];
+  job.id = nextJobId++;
+  job.type = type;
+  job.state = JOB_QUEUED;
+  job.cancelRequested = false;
+  job.source = source;
+  job.destination = destination;
+  job.bytesTotal = 0;
+  job.bytesDone = 0;
+  job.filesTotal = 0;
+  job.filesDone = 0;
+  job.createdAt = millis();
+  job.finishedAt = 0;
+  job.error = "";
+  job.checksum = "";
+  uint32_t id = job.id;
+
+  xSemaphoreGive(jobsMutex);
+
+  uint8_t slotIndex = slot;
+  xQueueSend(jobQueue, &slotIndex, 0);
+  return id;
+}
+
+bool cancelFileJob(uint32_t id) {
+  if (!jobsMutex) return false;
+
+  bool found = false;
+  xSemaphoreTake(jobsMutex, portMAX_DELAY);
+  for (int i = 0; i < FILE_JOB_SLOTS; i++) {
+    if (jobs[i].state != JOB_EMPTY && jobs[i].id == id) {
+      if (jobs[i].state == JOB_QUEUED || jobs[i].state == JOB_RUNNING) {
+        jobs[i].cancelRequested = true;
+      }
+      found = true;
+      break;
+    }
+  }
+  xSemaphoreGive(jobsMutex);
+  return found;
+}
+
+static void describeJob(const FileJob& job, JsonObject out) {
+  out["id"] = job.id;
+  out["type"] = jobTypeName(job.type);
+  out["state"] = jobStateName(job.state);
+  out["source"] = job.source;
+  if (job.destination.length() > 0) {
+    out["destination"] = job.destination;
+  }
+  out["files_done"] = job.filesDone;
+  out["files_total"] = job.filesTotal;
+  out["bytes_done"] = job.bytesDone;
+  out["bytes_total"] = job.bytesTotal;
+  out["progress"] = job.bytesTotal > 0 ? (int)(job.bytesDone * 100 / job.bytesTotal) :
+    (job.filesTotal > 0 ? (int)(job.filesDone * 100 / job.filesTotal) : (job.state == JOB_DONE ? 100 : 0));
+  out["elapsed_ms"] = (job.finishedAt ? job.finishedAt : millis()) - job.createdAt;
+  if (job.error.length() > 0) {
+    out["error"] = job.error;
+  }
+  if (job.checksum.length() > 0) {
+    out["sha256"] = job.checksum;
+  }
+}
+
+bool getFileJobStatus(uint32_t id, JsonObject out) {
+  if (!jobsMutex) return false;
+
+  bool found = false;
+  xSemaphoreTake(jobsMutex, portMAX_DELAY);
+  for (int i = 0; i < FILE_JOB_SLOTS; i++) {
+    if (jobs[i].state != JOB_EMPTY && jobs[i].id == id) {
+      describeJob(jobs[i], out);
+      found = true;
+      break;
+    }
+  }
+  xSemaphoreGive(jobsMutex);
+  return found;
+}
+
+void listFileJobs(JsonArray out) {
+  if (!jobsMutex) return;
+
+  xSemaphoreTake(jobsMutex, portMAX_DELAY);
+  for (int i = 0; i < FILE_JOB_SLOTS; i++) {
+    if (jobs[i].state != JOB_EMPTY) {
+      describeJob(jobs[i], out.add<JsonObject>());
+    }
+  }
+  xSemaphoreGive(jobsMutex);
+}
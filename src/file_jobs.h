@@ -0,0 +1,41 @@
+#ifndef FILE_JOBS_H
+#define FILE_JOBS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Long-running SD operations run on a background task so HTTP handlers can
+// return immediately with a job ID. The job table is fixed-size; finished
+// jobs are recycled oldest-first.
+#define FILE_JOB_SLOTS 8
+#define FILE_JOB_COPY_BUFFER 16384
+#define FILE_JOB_MAX_DEPTH 8
+
+enum FileJobType {
+  JOB_DELETE,
+  JOB_COPY,
+  JOB_MOVE,
+  JOB_CHECKSUM,
+  JOB_PEAKS
+};
+
+enum FileJobState {
+  JOB_EMPTY,
+  JOB_QUEUED,
+  JOB_RUNNING,
+  JOB_DONE,
+  JOB_FAILED,
+  JOB_CANCELLED
+};
+
+void initFileJobs();
+bool parseFileJobType(const String& name, FileJobType& type);
+
+// Returns the new job ID, or 0 if every slot holds an unfinished job
+uint32_t submitFileJob(FileJobType type, const String& source, const String& destination);
+bool cancelFileJob(uint32_t id);
+
+bool getFileJobStatus(uint32_t id, JsonObject out);
+void listFileJobs(JsonArray out);
+
+#endif
@@ -0,0 +1,410 @@
+#include "file_manifest.h"
+#include "config.h"
+#include <SD.h>
+#include <mbedtls/sha256.h>
+
+#define MANIFEST_TASK_STACK 6144
+#define MANIFEST_TASK_PRIORITY 1
+#define MANIFEST_TASK_CORE 0
+#define MANIFEST_PENDING_ROOTS 4
+#define MANIFEST_EARLY_FORGETS 8
+#define HASH_CACHE_MAGIC 0x31485348  // "HSH1"
+
+struct HashEntry {
+  uint64_t pathHash;   // 0 = empty slot
+  uint32_t size;
+  uint32_t mtime;
+  uint8_t digest[32];
+};
+
+struct HashCacheHeader {
+  uint32_t magic;
+  uint32_t count;
+};
+
+static HashEntry entries[MANIFEST_HASH_SLOTS];
+static SemaphoreHandle_t cacheMutex = nullptr;
+static TaskHandle_t hashTask = nullptr;
+static String pendingRoots[MANIFEST_PENDING_ROOTS];
+static size_t nextEvict = 0;
+static bool dirty = false;
+
+// Boot-time writes (SD clock tuning, KV compaction) happen before the cache
+// is loaded; they are remembered here and dropped from it once it is
+static uint64_t earlyForgets[MANIFEST_EARLY_FORGETS];
+static size_t earlyForgetCount = 0;
+static bool earlyForgetAll = false;
+
+static uint32_t cacheHits = 0;
+static uint32_t cacheMisses = 0;
+static uint32_t inlineHashes = 0;
+static uint32_t backgroundHashes = 0;
+static uint64_t bytesHashed = 0;
+
+static uint64_t hashPath(const String& path) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < path.length(); i++) {
+    hash ^= (uint8_t)path[i];
+    hash *= 1099511628211ull;
+  }
+  return hash ? hash : 1;
+}
+
+static String joinPath(const String& dir, const char* name) {
+  return dir.endsWith("/") ? dir + name : dir + "/" + name;
+}
+
+static void toHex(const uint8_t* digest, char* hex) {
+  for (int i = 0; i < 32; i++) {
+    sprintf(hex + i * 2, "%02x", digest[i]);
+  }
+}
+
+// ============================================
+// Hash Cache
+// ============================================
+
+static bool lookupHash(uint64_t pathHash, uint32_t size, uint32_t mtime, uint8_t* digest) {
+  bool found = false;
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  for (size_t i = 0; i < MANIFEST_HASH_SLOTS; i++) {
+    const HashEntry& entry = entries[i];
+    if (entry.pathHash == pathHash) {
+      found = entry.size == size && entry.mtime == mtime;
+      if (found) memcpy(digest, entry.digest, 32);
+      break;
+    }
+  }
+  if (found) cacheHits++;
+  else cacheMisses++;
+  xSemaphoreGive(cacheMutex);
+  return found;
+}
+
+static void storeHash(uint64_t pathHash, uint32_t size, uint32_t mtime, const uint8_t* digest) {
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  HashEntry* slot = nullptr;
+  HashEntry* empty = nullptr;
+  for (size_t i = 0; i < MANIFEST_HASH_SLOTS; i++) {
+    if (entries[i].pathHash == pathHash) {
+      slot = &entries[i];
+      break;
+    }
+    if (!empty && entries[i].pathHash == 0) empty = &entries[i];
+  }
+  if (!slot) slot = empty;
+  if (!slot) {
+    slot = &entries[nextEvict];
+    nextEvict = (nextEvict + 1) % MANIFEST_HASH_SLOTS;
+  }
+
+  slot->pathHash = pathHash;
+  slot->size = size;
+  slot->mtime = mtime;
+  memcpy(slot->digest, digest, 32);
+  dirty = true;
+  xSemaphoreGive(cacheMutex);
+}
+
+// Caller holds cacheMutex (or runs before it exists)
+static void dropHash(uint64_t pathHash) {
+  for (size_t i = 0; i < MANIFEST_HASH_SLOTS; i++) {
+    if (entries[i].pathHash == pathHash) {
+      entries[i].pathHash = 0;
+      dirty = true;
+      break;
+    }
+  }
+}
+
+void forgetFileHash(const String& path) {
+  uint64_t pathHash = hashPath(path);
+  if (!cacheMutex) {
+    for (size_t i = 0; i < earlyForgetCount; i++) {
+      if (earlyForgets[i] == pathHash) return;
+    }
+    if (earlyForgetCount < MANIFEST_EARLY_FORGETS) earlyForgets[earlyForgetCount++] = pathHash;
+    else earlyForgetAll = true;
+    return;
+  }
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  dropHash(pathHash);
+  xSemaphoreGive(cacheMutex);
+}
+
+void forgetAllFileHashes() {
+  if (!cacheMutex) {
+    earlyForgetAll = true;
+    return;
+  }
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  memset(entries, 0, sizeof(entries));
+  dirty = true;
+  xSemaphoreGive(cacheMutex);
+}
+
+static void loadHashCache() {
+  File file = SD.open(PATH_HASH_CACHE, FILE_READ);
+  if (!file) return;
+
+  HashCacheHeader header;
+  bool ok = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+            header.magic == HASH_CACHE_MAGIC && header.count <= MANIFEST_HASH_SLOTS &&
+            file.size() == sizeof(header) + header.count * sizeof(HashEntry) &&
+            file.read((uint8_t*)entries, header.count * sizeof(HashEntry)) == header.count * sizeof(HashEntry);
+  file.close();
+
+  if (!ok) {
+    // A save cut short by a reset; start over rather than trust it
+    memset(entries, 0, sizeof(entries));
+    LOG_WARN("Hash cache: %s is corrupt, discarding", PATH_HASH_CACHE);
+    return;
+  }
+  nextEvict = header.count % MANIFEST_HASH_SLOTS;
+  LOG_INFO("Hash cache: %d digests loaded", header.count);
+}
+
+static void saveHashCache() {
+  static HashEntry snapshot[MANIFEST_HASH_SLOTS];
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  uint32_t count = 0;
+  for (size_t i = 0; i < MANIFEST_HASH_SLOTS; i++) {
+    if (entries[i].pathHash) snapshot[count++] = entries[i];
+  }
+  dirty = false;
+  xSemaphoreGive(cacheMutex);
+
+  File file = SD.open(PATH_HASH_CACHE, FILE_WRITE);
+  if (!file) return;
+  HashCacheHeader header = { HASH_CACHE_MAGIC, count };
+  file.write((uint8_t*)&header, sizeof(header));
+  file.write((uint8_t*)snapshot, count * sizeof(HashEntry));
+  file.close();
+}
+
+// ============================================
+// Hashing
+// ============================================
+
+// mbedtls routes SHA-256 through the ESP32 hardware accelerator
+static bool hashOpenFile(File& file, uint8_t* buffer, uint8_t* digest) {
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts(&ctx, 0);
+
+  size_t total = 0;
+  size_t n;
+  while ((n = file.read(buffer, MANIFEST_HASH_BUFFER)) > 0) {
+    mbedtls_sha256_update(&ctx, buffer, n);
+    total += n;
+  }
+  mbedtls_sha256_finish(&ctx, digest);
+  mbedtls_sha256_free(&ctx);
+
+  bytesHashed += total;
+  return total == file.size();
+}
+
+static void hashTree(File& dir, const String& dirPath, int depth, uint8_t* buffer) {
+  File child = dir.openNextFile();
+  while (child) {
+    String path = joinPath(dirPath, child.name());
+    if (child.isDirectory()) {
+      if (depth < MANIFEST_MAX_DEPTH) hashTree(child, path, depth + 1, buffer);
+    } else {
+      uint64_t pathHash = hashPath(path);
+      uint32_t size = child.size();
+      uint32_t mtime = child.getLastWrite();
+      uint8_t digest[32];
+      if (!lookupHash(pathHash, size, mtime, digest) && hashOpenFile(child, buffer, digest)) {
+        storeHash(pathHash, size, mtime, digest);
+        backgroundHashes++;
+      }
+    }
+    child.close();
+    child = dir.openNextFile();
+  }
+}
+
+static void manifestTask(void* param) {
+  while (true) {
+    bool woken = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MANIFEST_SAVE_DELAY_MS)) > 0;
+
+    String root;
+    xSemaphoreTake(cacheMutex, portMAX_DELAY);
+    for (size_t i = 0; i < MANIFEST_PENDING_ROOTS && root.length() == 0; i++) {
+      if (pendingRoots[i].length() > 0) {
+        root = pendingRoots[i];
+        pendingRoots[i] = "";
+      }
+    }
+    bool save = dirty && !woken && root.length() == 0;
+    xSemaphoreGive(cacheMutex);
+
+    if (root.length() > 0) {
+      uint8_t* buffer = (uint8_t*)malloc(MANIFEST_HASH_BUFFER);
+      File dir = SD.open(root);
+      if (buffer && dir && dir.isDirectory()) {
+        uint32_t start = millis();
+        hashTree(dir, root, 0, buffer);
+        LOG_INFO("Manifest: hashed %s in %d ms", root.c_str(), millis() - start);
+      } else if (buffer && dir) {
+        uint8_t digest[32];
+        if (hashOpenFile(dir, buffer, digest)) {
+          storeHash(hashPath(root), dir.size(), dir.getLastWrite(), digest);
+          backgroundHashes++;
+        }
+      }
+      dir.close();
+      free(buffer);
+      // More roots may be queued
+      xTaskNotifyGive(hashTask);
+    } else if (save) {
+      // Saved once things go quiet, not after every file
+      saveHashCache();
+    }
+  }
+}
+
+static void queueBackgroundHashing(const String& root) {
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  bool queued = false;
+  for (size_t i = 0; i < MANIFEST_PENDING_ROOTS && !queued; i++) {
+    queued = pendingRoots[i] == root;
+  }
+  for (size_t i = 0; i < MANIFEST_PENDING_ROOTS && !queued; i++) {
+    if (pendingRoots[i].length() == 0) {
+      pendingRoots[i] = root;
+      queued = true;
+    }
+  }
+  xSemaphoreGive(cacheMutex);
+
+  // A full queue is fine: the client polls and asks again
+  if (queued) xTaskNotifyGive(hashTask);
+}
+
+// ============================================
+// Manifest
+// ============================================
+
+struct ManifestWalk {
+  JsonArray files;
+  uint32_t offset;
+  uint32_t index;
+  uint32_t pending;
+  uint32_t deadline;
+  bool more;
+  uint8_t* buffer;
+};
+
+static void addManifestEntry(ManifestWalk& walk, const String& path, File& file) {
+  JsonObject entry = walk.files.add<JsonObject>();
+  uint32_t size = file.size();
+  uint32_t mtime = file.getLastWrite();
+  entry["path"] = path;
+  entry["size"] = size;
+  entry["mtime"] = mtime;
+
+  uint64_t pathHash = hashPath(path);
+  uint8_t digest[32];
+  bool known = lookupHash(pathHash, size, mtime, digest);
+
+  if (!known && walk.buffer && size <= MANIFEST_INLINE_MAX_BYTES &&
+      (int32_t)(walk.deadline - millis()) > 0 && hashOpenFile(file, walk.buffer, digest)) {
+    storeHash(pathHash, size, mtime, digest);
+    inlineHashes++;
+    known = true;
+  }
+
+  if (known) {
+    char hex[65];
+    toHex(digest, hex);
+    entry["sha256"] = hex;
+  } else {
+    entry["sha256"] = nullptr;
+    walk.pending++;
+  }
+}
+
+static void walkManifest(File& dir, const String& dirPath, int depth, ManifestWalk& walk) {
+  File child = dir.openNextFile();
+  while (child && !walk.more) {
+    String path = joinPath(dirPath, child.name());
+    if (child.isDirectory()) {
+      if (depth < MANIFEST_MAX_DEPTH) walkManifest(child, path, depth + 1, walk);
+    } else if (walk.index++ >= walk.offset) {
+      if (walk.files.size() < MANIFEST_PAGE_SIZE) addManifestEntry(walk, path, child);
+      else walk.more = true;
+    }
+    child.close();
+    child = dir.openNextFile();
+  }
+}
+
+bool buildFileManifest(const String& root, uint32_t offset, JsonObject out) {
+  File dir = SD.open(root);
+  if (!dir) return false;
+
+  ManifestWalk walk;
+  walk.files = out["files"].to<JsonArray>();
+  walk.offset = offset;
+  walk.index = 0;
+  walk.pending = 0;
+  walk.deadline = millis() + MANIFEST_INLINE_BUDGET_MS;
+  walk.more = false;
+  walk.buffer = (uint8_t*)malloc(MANIFEST_HASH_BUFFER);
+
+  if (dir.isDirectory()) {
+    walkManifest(dir, root, 0, walk);
+  } else if (offset == 0) {
+    // A single file is a one-entry manifest
+    addManifestEntry(walk, root, dir);
+  }
+  dir.close();
+  free(walk.buffer);
+
+  out["path"] = root;
+  out["count"] = walk.files.size();
+  out["pending"] = walk.pending;
+  if (walk.more) {
+    out["next_offset"] = offset + walk.files.size();
+  }
+
+  if (walk.pending > 0) {
+    queueBackgroundHashing(root);
+  }
+  return true;
+}
+
+void initFileManifest() {
+  loadHashCache();
+  if (earlyForgetAll) {
+    memset(entries, 0, sizeof(entries));
+    dirty = true;
+  }
+  for (size_t i = 0; i < earlyForgetCount; i++) dropHash(earlyForgets[i]);
+  cacheMutex = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(manifestTask, "manifest", MANIFEST_TASK_STACK, NULL,
+                          MANIFEST_TASK_PRIORITY, &hashTask, MANIFEST_TASK_CORE);
+}
+
+void getFileManifestStats(JsonObject out) {
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  uint32_t used = 0;
+  for (size_t i = 0; i < MANIFEST_HASH_SLOTS; i++) {
+    if (entries[i].pathHash) used++;
+  }
+  xSemaphoreGive(cacheMutex);
+
+  out["cached"] = used;
+  out["slots"] = MANIFEST_HASH_SLOTS;
+  out["hits"] = cacheHits;
+  out["misses"] = cacheMisses;
+  out["inline_hashes"] = inlineHashes;
+  out["background_hashes"] = backgroundHashes;
+  out["bytes_hashed"] = bytesHashed;
+}
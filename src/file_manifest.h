@@ -0,0 +1,41 @@
+#ifndef FILE_MANIFEST_H
+#define FILE_MANIFEST_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Path/size/mtime/SHA-256 listing of a tree, for delta sync from a host
+// (tools/sync.py).
+//
+// Digests come from mbedtls, which on the ESP32 runs SHA-256 on the hardware
+// accelerator, and are kept in a fixed table keyed by a 64-bit path hash
+// together with the size and mtime they were computed for. The table is
+// saved to PATH_HASH_CACHE, so repeated manifests cost a directory walk.
+// The clock is not set on this device, so mtimes rarely change; writers
+// report to storage (adjustSDCardUsage() and friends), which forwards each
+// write here as forgetFileHash()/forgetAllFileHashes().
+//
+// A manifest hashes small uncached files inline until its time budget runs
+// out; the rest are handed to a background task and reported with a null
+// sha256 and a non-zero "pending" count until they are done.
+#define MANIFEST_HASH_SLOTS 256
+#define MANIFEST_PAGE_SIZE 128
+#define MANIFEST_MAX_DEPTH 8
+#define MANIFEST_INLINE_BUDGET_MS 40
+#define MANIFEST_INLINE_MAX_BYTES 16384
+#define MANIFEST_HASH_BUFFER 4096
+#define MANIFEST_SAVE_DELAY_MS 5000
+
+void initFileManifest();
+
+// Fills out with up to MANIFEST_PAGE_SIZE files starting at offset; false
+// if root does not exist
+bool buildFileManifest(const String& root, uint32_t offset, JsonObject out);
+
+void forgetFileHash(const String& path);
+// For directory-level changes (tree moves, deletes, archive extraction)
+void forgetAllFileHashes();
+
+void getFileManifestStats(JsonObject out);
+
+#endif
@@ -0,0 +1,177 @@
+#include "flash_bundle.h"
+#include "config.h"
+#include "mime_types.h"
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+
+struct __attribute__((packed)) BundleHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t stringsOffset;
+  uint32_t dataOffset;
+  uint32_t totalSize;
+  uint32_t tableCrc;     // CRC32 of everything between the header and dataOffset
+  uint32_t buildTime;
+  uint32_t reserved;
+};
+
+struct __attribute__((packed)) BundleEntry {
+  uint32_t hash;
+  uint32_t pathOffset;
+  uint16_t pathLength;
+  uint16_t flags;
+  uint32_t dataOffset;
+  uint32_t size;
+  uint32_t rawSize;
+};
+
+static const uint8_t* bundleBase = nullptr;
+static const BundleHeader* header = nullptr;
+static const BundleEntry* entries = nullptr;
+static const char* strings = nullptr;
+static esp_partition_mmap_handle_t mapHandle;
+static const esp_partition_t* partition = nullptr;
+static uint32_t hitCount = 0;
+static uint64_t bytesServed = 0;
+
+static uint32_t hashPath(const char* path) {
+  uint32_t hash = 2166136261u;
+  while (*path) {
+    hash ^= (uint8_t)*path++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static const BundleEntry* findEntry(const String& path) {
+  uint32_t hash = hashPath(path.c_str());
+
+  // Lower bound on the hash, then walk the (rare) collisions
+  size_t lo = 0, hi = header->count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (entries[mid].hash < hash) lo = mid + 1;
+    else hi = mid;
+  }
+  for (size_t i = lo; i < header->count && entries[i].hash == hash; i++) {
+    const BundleEntry& entry = entries[i];
+    if (entry.pathLength == path.length() &&
+        memcmp(strings + entry.pathOffset, path.c_str(), entry.pathLength) == 0) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+static bool validateBundle(const BundleHeader& h, size_t partitionSize) {
+  if (h.magic != BUNDLE_MAGIC) {
+    LOG_INFO("Flash bundle: partition is empty");
+    return false;
+  }
+  if (h.version != BUNDLE_VERSION) {
+    LOG_WARN("Flash bundle: unsupported version %d", h.version);
+    return false;
+  }
+  if (h.totalSize > partitionSize || h.dataOffset > h.totalSize ||
+      h.stringsOffset > h.dataOffset ||
+      sizeof(BundleHeader) + (size_t)h.count * sizeof(BundleEntry) > h.stringsOffset) {
+    LOG_WARN("Flash bundle: corrupt header");
+    return false;
+  }
+  return true;
+}
+
+bool initFlashBundle() {
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+    (esp_partition_subtype_t)BUNDLE_PARTITION_SUBTYPE, BUNDLE_PARTITION_LABEL);
+  if (!partition) {
+    LOG_INFO("Flash bundle: no '%s' partition", BUNDLE_PARTITION_LABEL);
+    return false;
+  }
+
+  BundleHeader h;
+  if (esp_partition_read(partition, 0, &h, sizeof(h)) != ESP_OK ||
+      !validateBundle(h, partition->size)) {
+    return false;
+  }
+
+  const void* mapped = nullptr;
+  if (esp_partition_mmap(partition, 0, h.totalSize, ESP_PARTITION_MMAP_DATA,
+                         &mapped, &mapHandle) != ESP_OK) {
+    LOG_ERROR("Flash bundle: mmap of %d bytes failed", h.totalSize);
+    return false;
+  }
+
+  const uint8_t* base = (const uint8_t*)mapped;
+  uint32_t crc = esp_rom_crc32_le(0, base + sizeof(BundleHeader), h.dataOffset - sizeof(BundleHeader));
+  if (crc != h.tableCrc) {
+    LOG_WARN("Flash bundle: table CRC mismatch");
+    esp_partition_munmap(mapHandle);
+    return false;
+  }
+
+  bundleBase = base;
+  header = (const BundleHeader*)base;
+  entries = (const BundleEntry*)(base + sizeof(BundleHeader));
+  strings = (const char*)(base + h.stringsOffset);
+
+  LOG_INFO("Flash bundle: %d files, %d KB mapped", h.count, h.totalSize / 1024);
+  return true;
+}
+
+bool isFlashBundleMounted() {
+  return bundleBase != nullptr;
+}
+
+bool serveFromBundle(AsyncWebServerRequest *request, const String& path) {
+  if (!bundleBase) return false;
+
+  const BundleEntry* entry = findEntry(path);
+  if (!entry) return false;
+
+  bool gzip = entry->flags & BUNDLE_FLAG_GZIP;
+  if (gzip && !(request->hasHeader("Accept-Encoding") &&
+                request->getHeader("Accept-Encoding")->value().indexOf("gzip") >= 0)) {
+    return false;
+  }
+
+  // Progmem response copies from the mapped pointer straight into the TCP
+  // buffer; no heap copy of the file is ever made
+  AsyncWebServerResponse *response = request->beginResponse_P(200, getMimeType(path.c_str()),
+    bundleBase + entry->dataOffset, entry->size);
+  if (gzip) {
+    response->addHeader("Content-Encoding", "gzip");
+  }
+  request->send(response);
+
+  hitCount++;
+  bytesServed += entry->size;
+  return true;
+}
+
+void getFlashBundleInfo(JsonObject out, bool listEntries) {
+  out["mounted"] = bundleBase != nullptr;
+  if (partition) {
+    out["partition_size"] = partition->size;
+    out["partition_offset"] = partition->address;
+  }
+  if (!bundleBase) return;
+
+  out["files"] = header->count;
+  out["size"] = header->totalSize;
+  out["build_time"] = header->buildTime;
+  out["hits"] = hitCount;
+  out["bytes_served"] = bytesServed;
+
+  if (!listEntries) return;
+  JsonArray list = out["entries"].to<JsonArray>();
+  for (size_t i = 0; i < header->count; i++) {
+    const BundleEntry& entry = entries[i];
+    JsonObject item = list.add<JsonObject>();
+    item["path"] = String(strings + entry.pathOffset, entry.pathLength);
+    item["size"] = entry.size;
+    item["raw_size"] = entry.rawSize;
+    item["gzip"] = (entry.flags & BUNDLE_FLAG_GZIP) != 0;
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef FLASH_BUNDLE_H
+#define FLASH_BUNDLE_H
+
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+
+// Read-only bundle of the stock web apps, built from sd_card/ by
+// tools/build_bundle.py and flashed into the "bundle" data partition.
+// The partition is memory-mapped at boot and files are sent straight from
+// mapped flash, so the UI works without an SD card. A path present on the
+// card is served from the card instead, so edited apps are never shadowed.
+//
+// Layout (little endian):
+//   header   32 bytes  magic "BNDL", version, entry count, offsets, CRC
+//   entries  24 bytes each, sorted by FNV-1a hash of the path
+//   strings  paths, not NUL-terminated
+//   blobs    file data, 4-byte aligned, gzip-compressed when flagged
+#define BUNDLE_PARTITION_LABEL "bundle"
+#define BUNDLE_PARTITION_SUBTYPE 0x40
+#define BUNDLE_MAGIC 0x4C444E42
+#define BUNDLE_VERSION 1
+#define BUNDLE_FLAG_GZIP 0x0001
+
+bool initFlashBundle();
+bool isFlashBundleMounted();
+
+// Sends path from the bundle; returns false if it is not bundled (or only
+// bundled gzipped and the client does not accept gzip)
+bool serveFromBundle(AsyncWebServerRequest *request, const String& path);
+
+void getFlashBundleInfo(JsonObject out, bool listEntries);
+
+#endif
@@ -1,12 +1,38 @@
 #include "hardware.h"
+#include "config.h"
+#include "power_manager.h"
+#include "storage.h"
+#include "waveform_peaks.h"
+#include "sensors.h"
+#include "audio_resampler.h"
+#include "recording_durability.h"
 #include <M5Unified.h>
 #include <SD.h>
 
 // Microphone configuration (PDM)
 #define MIC_DATA_PIN 39
 #define MIC_CLK_PIN 38
-#define MIC_SAMPLE_RATE 16000
-#define MIC_BUFFER_SIZE 512
+#define MIC_DEFAULT_RATE 16000
+#define MIC_DEFAULT_BITS 16
+#define MIC_DEFAULT_LATENCY_MS 32
+
+// The SPM1423 needs at least a 1 MHz PDM clock (64x oversampling), so
+// rates below MIC_MIN_SOURCE_RATE are captured at twice the rate and
+// decimated by the resampler
+#define MIC_MIN_SOURCE_RATE 16000
+#define MIC_MAX_SOURCE_RATE 48000
+#define MIC_MIN_LATENCY_MS 8
+#define MIC_MAX_LATENCY_MS 128
+
+// One read (a chunk) covers the latency target and the DMA ring holds two
+// chunks, in descriptors of at most MIC_DMA_MAX_LEN frames
+#define MIC_CHUNK_MIN 128
+#define MIC_CHUNK_MAX 2048
+#define MIC_DMA_MAX_LEN 1023
+#define MIC_DMA_MIN_COUNT 4
+
+// Input samples converted per step while recording
+#define CAPTURE_BLOCK 128
 
 // Hardware pins
 #define LED_PIN 35
@@ -16,16 +42,97 @@
 #define SDCARD_SCK 42
 #define SDCARD_CS 40
 
+// Capture format; the PDM hardware runs at sourceRate and the resampler
+// converts to sampleRate when they differ
+struct MicFormat {
+  uint32_t sampleRate;
+  uint32_t sourceRate;
+  uint8_t bits;
+  uint16_t latencyMs;
+};
+
+static const MicFormat defaultMicFormat = {MIC_DEFAULT_RATE, MIC_DEFAULT_RATE, MIC_DEFAULT_BITS, MIC_DEFAULT_LATENCY_MS};
+static const uint32_t micRates[] = {8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000};
+
+// Everything below is owned by the hardware service task once it runs;
+// setupMicrophone() is the only other writer and finishes before it starts
+
 // Microphone state
 static bool micInitialized = false;
-static int16_t micBuffer[MIC_BUFFER_SIZE]; // Changed to int16_t for M5Unified
-static volatile int currentAudioLevel = 0;
+static MicFormat micFormat = defaultMicFormat;
+static int16_t* micBuffer = nullptr;
+static size_t micChunk = 0;        // samples per read at sourceRate
+static size_t dmaCount = 0;
+static size_t dmaLen = 0;
+static Resampler resampler;
+static bool resampling = false;
 
 // Recording state
 static bool recording = false;
 static File recordingFile;
 static uint32_t recordingStartTime = 0;
 static uint32_t recordingDataSize = 0;
+static String recordingPath;
+static PeakWriter recordingPeaks;
+
+// Conversion buffers for one CAPTURE_BLOCK, allocated while recording
+static int32_t* captureSamples = nullptr;
+static int16_t* captureWords = nullptr;
+static uint8_t* captureBytes = nullptr;
+
+// Commands for the service task, in the order they were posted
+enum HardwareCommandType : uint8_t {
+  HW_START_RECORDING,
+  HW_STOP_RECORDING,
+  HW_SET_FORMAT,
+  HW_LED,
+  HW_GPIO_MODE,
+  HW_GPIO_WRITE,
+  HW_SAMPLE_LEVEL
+};
+
+struct HardwareCommand {
+  HardwareCommandType type;
+  bool persist;               // HW_SET_FORMAT: also save to PATH_MIC_FORMAT
+  uint8_t value;              // GPIO level or pinMode() mode
+  int pin;
+  MicFormat format;
+  char filename[HW_PATH_MAX];
+};
+
+// What the other tasks may see, published by the service task under a
+// sequence counter that is odd while a copy is being written
+struct HardwareSnapshot {
+  bool micInitialized;
+  bool recording;
+  bool resampling;
+  MicFormat format;
+  uint16_t chunk;
+  uint16_t dmaCount;
+  uint16_t dmaLen;
+  uint16_t up;
+  uint16_t down;
+  uint16_t taps;
+  uint32_t recordingStartMs;
+  uint32_t recordingBytes;
+  uint32_t commands;
+  char recordingPath[HW_PATH_MAX];
+  char error[HW_ERROR_MAX];
+};
+
+static QueueHandle_t commandQueue = NULL;
+static HardwareSnapshot snapshot;
+static uint32_t snapshotSeq = 0;
+static uint32_t commandsRun = 0;
+static uint32_t droppedCommands = 0;
+static char lastError[HW_ERROR_MAX] = "";
+
+// Single words written with __atomic builtins from any task
+static int audioLevel = 0;
+static uint32_t ledColor = 0;          // 0xRRGGBB, newest request
+static bool ledPending = false;        // an HW_LED command is queued
+static uint32_t levelRequestMs = 0;
+static bool levelWake = false;         // the service knows the level is wanted
 
 // WAV file header structure
 struct WAVHeader {
@@ -36,172 +143,772 @@ struct WAVHeader {
   uint32_t fmtSize = 16;
   uint16_t audioFormat = 1; // PCM
   uint16_t numChannels = 1; // Mono
-  uint32_t sampleRate = MIC_SAMPLE_RATE;
+  uint32_t sampleRate;
   uint32_t byteRate;
   uint16_t blockAlign;
-  uint16_t bitsPerSample = 16;
+  uint16_t bitsPerSample;
   char data[4] = {'d', 'a', 't', 'a'};
   uint32_t dataSize;
 };
 
-void setupMicrophone() {
-  Serial.println("ℹ️  INFO: Initializing SPM1423 PDM microphone...");
-  
-  // Configure M5Unified microphone
+static_assert(sizeof(WAVHeader) == WAV_HEADER_BYTES, "recovery patches the canonical header");
+
+static uint32_t chunkMs() {
+  return micChunk * 1000 / micFormat.sourceRate;
+}
+
+static bool isMicRate(uint32_t rate) {
+  for (uint32_t supported : micRates) {
+    if (supported == rate) return true;
+  }
+  return false;
+}
+
+// Fields missing from args keep their value in format. A new sample_rate
+// without a source_rate picks the lowest rate the microphone can run at.
+static int parseMicFormat(JsonVariantConst args, MicFormat& format, String& error) {
+  if (!args["sample_rate"].isNull()) {
+    format.sampleRate = args["sample_rate"].as<uint32_t>();
+    if (!isMicRate(format.sampleRate)) {
+      error = "Unsupported sample_rate";
+      return 400;
+    }
+    format.sourceRate = format.sampleRate < MIC_MIN_SOURCE_RATE ? format.sampleRate * 2 : format.sampleRate;
+  }
+  if (!args["source_rate"].isNull()) {
+    format.sourceRate = args["source_rate"].as<uint32_t>();
+    if (!isMicRate(format.sourceRate) || format.sourceRate < MIC_MIN_SOURCE_RATE ||
+        format.sourceRate > MIC_MAX_SOURCE_RATE) {
+      error = "source_rate must be a supported rate from " + String(MIC_MIN_SOURCE_RATE) +
+              " to " + String(MIC_MAX_SOURCE_RATE) + " Hz";
+      return 400;
+    }
+  }
+  if (!args["bits"].isNull()) {
+    uint32_t bits = args["bits"].as<uint32_t>();
+    if (bits != 8 && bits != 16 && bits != 24) {
+      error = "bits must be 8, 16 or 24";
+      return 400;
+    }
+    format.bits = bits;
+  }
+  if (!args["latency_ms"].isNull()) {
+    uint32_t latencyMs = args["latency_ms"].as<uint32_t>();
+    if (latencyMs < MIC_MIN_LATENCY_MS || latencyMs > MIC_MAX_LATENCY_MS) {
+      error = "latency_ms must be " + String(MIC_MIN_LATENCY_MS) + ".." + String(MIC_MAX_LATENCY_MS);
+      return 400;
+    }
+    format.latencyMs = latencyMs;
+  }
+  if (format.sourceRate != format.sampleRate && getResamplerBytes(format.sourceRate, format.sampleRate) == 0) {
+    error = "Cannot resample " + String(format.sourceRate) + " Hz to " + String(format.sampleRate) + " Hz";
+    return 400;
+  }
+  return 200;
+}
+
+static bool loadMicFormat(MicFormat& format) {
+  File file = SD.open(PATH_MIC_FORMAT, FILE_READ);
+  if (!file) return false;
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, file);
+  file.close();
+  if (error) {
+    LOG_ERROR("Mic: invalid %s: %s", PATH_MIC_FORMAT, error.c_str());
+    return false;
+  }
+  String message;
+  return parseMicFormat(doc.as<JsonVariantConst>(), format, message) == 200;
+}
+
+static bool saveMicFormat(const MicFormat& format) {
+  JsonDocument doc;
+  doc["sample_rate"] = format.sampleRate;
+  doc["source_rate"] = format.sourceRate;
+  doc["bits"] = format.bits;
+  doc["latency_ms"] = format.latencyMs;
+  File file = SD.open(PATH_MIC_FORMAT, FILE_WRITE);
+  if (!file) return false;
+  size_t written = serializeJson(doc, file);
+  file.close();
+  adjustSDCardUsage(PATH_MIC_FORMAT, 0);
+  return written > 0;
+}
+
+// Sizes the read chunk and the DMA ring from the latency target, then
+// restarts the PDM driver at the source rate
+static bool applyMicFormat(const MicFormat& format, String& error) {
+  size_t chunk = constrain((size_t)format.sourceRate * format.latencyMs / 1000,
+                           (size_t)MIC_CHUNK_MIN, (size_t)MIC_CHUNK_MAX);
+  size_t ring = chunk * 2;
+  size_t count = max((size_t)MIC_DMA_MIN_COUNT, (ring + MIC_DMA_MAX_LEN - 1) / MIC_DMA_MAX_LEN);
+  size_t len = (ring + count - 1) / count;
+
+  int16_t* buffer = (int16_t*)realloc(micBuffer, chunk * sizeof(int16_t));
+  if (!buffer) {
+    error = "Out of memory";
+    return false;
+  }
+  micBuffer = buffer;
+
+  Resampler next = {};
+  bool nextResampling = format.sourceRate != format.sampleRate;
+  if (nextResampling && !beginResampler(next, format.sourceRate, format.sampleRate)) {
+    error = "Out of memory";
+    return false;
+  }
+  if (resampling) endResampler(resampler);
+  resampler = next;
+  resampling = nextResampling;
+
+  if (M5.Mic.isEnabled()) M5.Mic.end();
   auto cfg = M5.Mic.config();
-  cfg.sample_rate = MIC_SAMPLE_RATE;
+  cfg.sample_rate = format.sourceRate;
   cfg.stereo = false;  // Mono
-  cfg.dma_buf_count = 8;
-  cfg.dma_buf_len = 128;
+  cfg.dma_buf_count = count;
+  cfg.dma_buf_len = len;
   cfg.task_priority = 2;
   cfg.task_pinned_core = APP_CPU_NUM;
-  
   M5.Mic.config(cfg);
+
+  micFormat = format;
+  micChunk = chunk;
+  dmaCount = count;
+  dmaLen = len;
+  micInitialized = M5.Mic.begin();
+  if (!micInitialized) {
+    error = "Microphone failed to start";
+    return false;
+  }
+
+  LOG_INFO("Mic: %u Hz %u-bit (source %u Hz), %u-sample reads, DMA %u x %u",
+           format.sampleRate, format.bits, format.sourceRate, chunk, count, len);
+  return true;
+}
+
+// ============================================
+// Snapshot
+// ============================================
+
+static void setHardwareError(const String& error) {
+  strlcpy(lastError, error.c_str(), sizeof(lastError));
+}
+
+// Only the service task (or setup before it starts) publishes
+static void publishSnapshot() {
+  uint32_t seq = snapshotSeq + 1;
+  __atomic_store_n(&snapshotSeq, seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  snapshot.micInitialized = micInitialized;
+  snapshot.recording = recording;
+  snapshot.resampling = resampling;
+  snapshot.format = micFormat;
+  snapshot.chunk = micChunk;
+  snapshot.dmaCount = dmaCount;
+  snapshot.dmaLen = dmaLen;
+  snapshot.up = resampling ? resampler.up : 1;
+  snapshot.down = resampling ? resampler.down : 1;
+  snapshot.taps = resampling ? resampler.taps : 0;
+  snapshot.recordingStartMs = recordingStartTime;
+  snapshot.recordingBytes = recordingDataSize;
+  snapshot.commands = commandsRun;
+  strlcpy(snapshot.recordingPath, recording ? recordingPath.c_str() : "", sizeof(snapshot.recordingPath));
+  strlcpy(snapshot.error, lastError, sizeof(snapshot.error));
+
+  __atomic_store_n(&snapshotSeq, seq + 1, __ATOMIC_RELEASE);
+}
+
+static void readSnapshot(HardwareSnapshot& out) {
+  for (;;) {
+    uint32_t seq = __atomic_load_n(&snapshotSeq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      // Mid-publish; the service task may be preempted by this caller
+      vTaskDelay(1);
+      continue;
+    }
+    memcpy(&out, &snapshot, sizeof(out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&snapshotSeq, __ATOMIC_RELAXED) == seq) return;
+  }
+}
+
+// ============================================
+// Microphone
+// ============================================
+
+void setupMicrophone() {
+  Serial.println("ℹ️  INFO: Initializing SPM1423 PDM microphone...");
   
-  if (M5.Mic.begin()) {
-    micInitialized = true;
+  MicFormat format = defaultMicFormat;
+  bool saved = loadMicFormat(format);
+  
+  String error;
+  bool ok = applyMicFormat(format, error);
+  if (!ok && saved) {
+    LOG_WARN("Mic: saved format failed (%s), using defaults", error.c_str());
+    ok = applyMicFormat(defaultMicFormat, error);
+  }
+  
+  if (ok) {
     Serial.println("ℹ️  INFO: SPM1423 microphone initialized successfully!");
   } else {
-    Serial.println("❌ ERROR: Failed to initialize microphone");
+    Serial.printf("❌ ERROR: Failed to initialize microphone: %s\n", error.c_str());
     micInitialized = false;
+    setHardwareError(error);
   }
+  publishSnapshot();
 }
 
-int readMicrophoneLevel() {
-  if (!micInitialized) {
-    return 0;
+// Calculate RMS (Root Mean Square) of micBuffer and update the 0-100 level
+static int updateAudioLevel() {
+  int64_t sum = 0;
+  for (size_t i = 0; i < micChunk; i++) {
+    int32_t sample = micBuffer[i];
+    sum += (int64_t)sample * sample;
   }
+  
+  int64_t mean = sum / micChunk;
+  int rms = (int)sqrt(mean);
+  
+  // Normalize to 0-100 range
+  // int16_t range is -32768 to 32767, adjust scaling
+  __atomic_store_n(&audioLevel, min(100, max(0, (rms * 100) / 10000)), __ATOMIC_RELAXED);
+  return rms;
+}
 
-  // Read samples using M5Unified - directly into int16_t buffer
-  if (M5.Mic.isEnabled()) {
-    bool success = M5.Mic.record(micBuffer, MIC_BUFFER_SIZE);
-    
-    if (success) {
-      // Calculate RMS (Root Mean Square) for audio level
-      int64_t sum = 0;
-      for (size_t i = 0; i < MIC_BUFFER_SIZE; i++) {
-        int32_t sample = micBuffer[i];
-        sum += (int64_t)sample * sample;
-      }
-      
-      int64_t mean = sum / MIC_BUFFER_SIZE;
-      int rms = (int)sqrt(mean);
-      
-      // Normalize to 0-100 range
-      // int16_t range is -32768 to 32767, adjust scaling
-      currentAudioLevel = min(100, max(0, (rms * 100) / 10000));
-      
-      // Log every 10th reading for debugging
-      static int readCount = 0;
-      if (++readCount % 10 == 0) {
-        Serial.printf("🎤 MIC: RMS=%d, Level=%d\n", rms, currentAudioLevel);
-      }
-    }
+// Level only; while recording serviceRecording() keeps the level current
+static void sampleLevel() {
+  if (micInitialized && M5.Mic.isEnabled() && M5.Mic.record(micBuffer, micChunk)) {
+    updateAudioLevel();
   }
-  
-  return currentAudioLevel;
 }
 
-bool isMicrophoneInitialized() {
-  return micInitialized;
+// ============================================
+// Recording and format changes (service task)
+// ============================================
+
+static void fillWavHeader(WAVHeader& header, uint32_t dataSize) {
+  header.sampleRate = micFormat.sampleRate;
+  header.bitsPerSample = micFormat.bits;
+  header.fileSize = dataSize + sizeof(WAVHeader) - 8;
+  header.byteRate = header.sampleRate * header.numChannels * (header.bitsPerSample / 8);
+  header.blockAlign = header.numChannels * (header.bitsPerSample / 8);
+  header.dataSize = dataSize;
 }
 
-bool startRecording(const char* filename) {
+static void freeCaptureBuffers() {
+  free(captureSamples);
+  free(captureWords);
+  free(captureBytes);
+  captureSamples = nullptr;
+  captureWords = nullptr;
+  captureBytes = nullptr;
+}
+
+// Only needed when the samples are resampled or repacked
+static bool allocCaptureBuffers() {
+  if (!resampling && micFormat.bits == 16) return true;
+  size_t samples = resampling ? getResamplerMaxOutput(resampler, CAPTURE_BLOCK) : CAPTURE_BLOCK;
+  captureSamples = (int32_t*)malloc(samples * sizeof(int32_t));
+  captureWords = (int16_t*)malloc(samples * sizeof(int16_t));
+  captureBytes = (uint8_t*)malloc(samples * 3);
+  if (captureSamples && captureWords && captureBytes) return true;
+  freeCaptureBuffers();
+  return false;
+}
+
+static void beginRecording(const char* filename) {
   if (!micInitialized) {
-    Serial.println("❌ ERROR: Microphone not initialized");
-    return false;
+    setHardwareError("Microphone not initialized");
+    return;
   }
   
   if (recording) {
     Serial.println("⚠️  WARN: Already recording");
-    return false;
+    return;
+  }
+  
+  if (!allocCaptureBuffers()) {
+    LOG_ERROR("Recording: out of memory for capture buffers");
+    setHardwareError("Out of memory");
+    return;
   }
   
   // Create recordings directory if it doesn't exist
-  if (!SD.exists("/recordings")) {
-    SD.mkdir("/recordings");
+  if (!SD.exists(RECORDINGS_DIR)) {
+    SD.mkdir(RECORDINGS_DIR);
   }
   
-  String fullPath = String("/recordings/") + filename;
+  String fullPath = String(RECORDINGS_DIR "/") + filename;
   recordingFile = SD.open(fullPath.c_str(), FILE_WRITE);
   
   if (!recordingFile) {
     Serial.printf("❌ ERROR: Failed to create recording file: %s\n", fullPath.c_str());
-    return false;
+    setHardwareError("Cannot create " + fullPath);
+    freeCaptureBuffers();
+    return;
   }
   
   // Write placeholder WAV header (we'll update it when done)
   WAVHeader header;
+  fillWavHeader(header, 0);
   header.fileSize = 0;
-  header.byteRate = header.sampleRate * header.numChannels * (header.bitsPerSample / 8);
-  header.blockAlign = header.numChannels * (header.bitsPerSample / 8);
-  header.dataSize = 0;
   
   recordingFile.write((uint8_t*)&header, sizeof(WAVHeader));
+  recordingPath = fullPath;
+  adjustSDCardUsage(recordingPath, sizeof(WAVHeader));
+  
+  beginRecordingCommits(recordingFile, fullPath);
+  
+  // The recording still works without a peak file; /_api/mic/peaks backfills it
+  beginPeakWriter(recordingPeaks, fullPath, micFormat.sampleRate);
+  if (resampling) resetResampler(resampler);
   
   recording = true;
   recordingStartTime = millis();
   recordingDataSize = 0;
-  
+  lastError[0] = '\0';
+
   Serial.printf("🎙️  Recording started: %s\n", fullPath.c_str());
-  return true;
 }
 
-void stopRecording() {
+static void endRecording() {
   if (!recording) {
     return;
   }
   
   recording = false;
-  
+
   // Update WAV header with actual sizes
   WAVHeader header;
-  header.fileSize = recordingDataSize + sizeof(WAVHeader) - 8;
-  header.byteRate = header.sampleRate * header.numChannels * (header.bitsPerSample / 8);
-  header.blockAlign = header.numChannels * (header.bitsPerSample / 8);
-  header.dataSize = recordingDataSize;
+  fillWavHeader(header, recordingDataSize);
   
   recordingFile.seek(0);
   recordingFile.write((uint8_t*)&header, sizeof(WAVHeader));
   recordingFile.close();
+  endRecordingCommits(recordingPath);
+  adjustSDCardUsage(recordingPath, 0);
+  finishPeakWriter(recordingPeaks);
+  freeCaptureBuffers();
   
   uint32_t duration = (millis() - recordingStartTime) / 1000;
   Serial.printf("🎙️  Recording stopped. Duration: %d seconds, Size: %d bytes\n", duration, recordingDataSize);
 }
 
-bool isRecording() {
-  return recording;
+// Packs 24-bit-scale samples into the WAV sample format in captureBytes
+// and keeps an int16 copy for the peak writer
+static size_t packSamples(const int32_t* samples, size_t count) {
+  uint8_t* out = captureBytes;
+  for (size_t i = 0; i < count; i++) {
+    int32_t sample = samples[i];
+    int32_t word = constrain((sample + 128) >> 8, -32768, 32767);
+    captureWords[i] = word;
+    switch (micFormat.bits) {
+      case 8:
+        // 8-bit WAV is unsigned
+        *out++ = constrain(((sample + 32768) >> 16) + 128, 0, 255);
+        break;
+      case 24:
+        *out++ = sample;
+        *out++ = sample >> 8;
+        *out++ = sample >> 16;
+        break;
+      default:
+        *out++ = word;
+        *out++ = word >> 8;
+        break;
+    }
+  }
+  return out - captureBytes;
 }
 
-int getRecordingDuration() {
-  if (!recording) {
-    return 0;
+static size_t writeCaptureBlock(const int16_t* in, size_t count) {
+  size_t produced;
+  if (resampling) {
+    produced = runResampler(resampler, in, count, captureSamples);
+  } else {
+    for (size_t i = 0; i < count; i++) captureSamples[i] = (int32_t)in[i] * 256;
+    produced = count;
   }
-  return (millis() - recordingStartTime) / 1000;
+  if (produced == 0) return 0;
+
+  size_t bytes = packSamples(captureSamples, produced);
+  size_t written = recordingFile.write(captureBytes, bytes);
+  addPeakSamples(recordingPeaks, captureWords, produced);
+  return written;
 }
 
-void processRecording() {
+static void serviceRecording() {
   if (!recording || !micInitialized) {
     return;
   }
   
   // Read audio data using M5Unified - directly writes to int16_t buffer
-  bool success = M5.Mic.record(micBuffer, MIC_BUFFER_SIZE);
+  bool success = M5.Mic.record(micBuffer, micChunk);
   
   if (success) {
-    // Data is already in 16-bit format, write directly to file
-    size_t bytesToWrite = MIC_BUFFER_SIZE * sizeof(int16_t);
-    size_t written = recordingFile.write((uint8_t*)micBuffer, bytesToWrite);
+    size_t written = 0;
+    uint32_t writeStart = micros();
+    if (!resampling && micFormat.bits == 16) {
+      // Already the file format, write directly
+      written = recordingFile.write((uint8_t*)micBuffer, micChunk * sizeof(int16_t));
+      addPeakSamples(recordingPeaks, micBuffer, written / sizeof(int16_t));
+    } else {
+      for (size_t i = 0; i < micChunk; i += CAPTURE_BLOCK) {
+        written += writeCaptureBlock(micBuffer + i, min((size_t)CAPTURE_BLOCK, micChunk - i));
+      }
+    }
     recordingDataSize += written;
-    
+    adjustSDCardUsage(recordingPath, written);
+    noteRecordingWrite(recordingFile, recordingDataSize, written, micros() - writeStart);
+    updateAudioLevel();
+
     // Auto-stop if file gets too large (100MB limit)
     if (recordingDataSize > 100 * 1024 * 1024) {
       Serial.println("⚠️  WARN: Recording stopped - file size limit reached");
-      stopRecording();
+      endRecording();
     }
   }
 }
 
+static void changeMicFormat(const MicFormat& format, bool persist) {
+  if (recording) {
+    setHardwareError("Format not applied: recording in progress");
+    return;
+  }
+
+  String error;
+  bool unchanged = format.sampleRate == micFormat.sampleRate && format.sourceRate == micFormat.sourceRate &&
+                   format.bits == micFormat.bits && format.latencyMs == micFormat.latencyMs;
+  MicFormat previous = micFormat;
+  if (!unchanged && !applyMicFormat(format, error)) {
+    LOG_ERROR("Mic: format not applied: %s", error.c_str());
+    setHardwareError(error);
+    String ignored;
+    applyMicFormat(previous, ignored);
+    return;
+  }
+  if (persist && !saveMicFormat(format)) {
+    setHardwareError("Cannot write " + String(PATH_MIC_FORMAT));
+    return;
+  }
+  lastError[0] = '\0';
+  if (persist) LOG_INFO("Mic format saved");
+}
+
+// ============================================
+// Service task
+// ============================================
+
+static void runCommand(const HardwareCommand& command) {
+  switch (command.type) {
+    case HW_START_RECORDING:
+      beginRecording(command.filename);
+      break;
+    case HW_STOP_RECORDING:
+      endRecording();
+      break;
+    case HW_SET_FORMAT:
+      changeMicFormat(command.format, command.persist);
+      break;
+    case HW_LED: {
+      // Clear first so a colour set from here on queues another write
+      __atomic_store_n(&ledPending, false, __ATOMIC_SEQ_CST);
+      uint32_t color = __atomic_load_n(&ledColor, __ATOMIC_SEQ_CST);
+      rgbLedWrite(LED_PIN, color >> 16, (color >> 8) & 0xff, color & 0xff);
+      break;
+    }
+    case HW_GPIO_MODE:
+      pinMode(command.pin, command.value);
+      break;
+    case HW_GPIO_WRITE:
+      digitalWrite(command.pin, command.value ? HIGH : LOW);
+      break;
+    case HW_SAMPLE_LEVEL:
+      // Only wakes the task; levelWanted() does the rest
+      break;
+  }
+  commandsRun++;
+}
+
+// True while a level query came in the last HW_LEVEL_HOLD_MS. levelWake is
+// cleared before the final check, so a query racing with the hold running
+// out either lands in time for that check or posts a fresh wake-up.
+static bool levelWanted() {
+  if (millis() - __atomic_load_n(&levelRequestMs, __ATOMIC_SEQ_CST) < HW_LEVEL_HOLD_MS) return true;
+  if (!__atomic_load_n(&levelWake, __ATOMIC_SEQ_CST)) return false;
+  __atomic_store_n(&levelWake, false, __ATOMIC_SEQ_CST);
+  return millis() - __atomic_load_n(&levelRequestMs, __ATOMIC_SEQ_CST) < HW_LEVEL_HOLD_MS;
+}
+
+static void hardwareTask(void* param) {
+  uint32_t nextSampleMs = millis();
+
+  for (;;) {
+    TickType_t wait = portMAX_DELAY;
+    if (micInitialized && (recording || levelWanted())) {
+      int32_t remaining = (int32_t)(nextSampleMs - millis());
+      wait = remaining > 0 ? pdMS_TO_TICKS(remaining) : 0;
+    }
+
+    HardwareCommand command;
+    if (xQueueReceive(commandQueue, &command, wait) == pdTRUE) {
+      do {
+        runCommand(command);
+      } while (xQueueReceive(commandQueue, &command, 0) == pdTRUE);
+    }
+
+    if (micInitialized && (recording || levelWanted()) && (int32_t)(millis() - nextSampleMs) >= 0) {
+      if (recording) {
+        serviceRecording();
+      } else {
+        sampleLevel();
+      }
+      // Twice per chunk while recording, once per chunk for the level. Keep
+      // the cadence, but do not try to catch up after a stall or idle time.
+      uint32_t periodMs = max((uint32_t)1, recording ? chunkMs() / 2 : chunkMs());
+      nextSampleMs += periodMs;
+      if ((int32_t)(millis() - nextSampleMs) >= 0) nextSampleMs = millis() + periodMs;
+    }
+
+    publishSnapshot();
+  }
+}
+
+// Before the task starts (setup) commands run on the caller
+static bool postCommand(const HardwareCommand& command) {
+  if (!commandQueue) {
+    runCommand(command);
+    publishSnapshot();
+    return true;
+  }
+  if (xQueueSend(commandQueue, &command, 0) != pdTRUE) {
+    __atomic_add_fetch(&droppedCommands, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  return true;
+}
+
+void startHardwareService() {
+  commandQueue = xQueueCreate(HW_QUEUE_DEPTH, sizeof(HardwareCommand));
+  if (!commandQueue) {
+    LOG_ERROR("Failed to create hardware command queue");
+    return;
+  }
+
+  xTaskCreatePinnedToCore(hardwareTask, "hardware", HW_SERVICE_STACK, NULL,
+    HW_SERVICE_PRIORITY, NULL, HW_SERVICE_CORE);
+  LOG_INFO("Hardware service started (%d commands)", HW_QUEUE_DEPTH);
+}
+
+// ============================================
+// Public API (any task)
+// ============================================
+
+int readMicrophoneLevel() {
+  int level = pollMicrophoneLevel();
+
+  // Log every 10th reading for debugging
+  static int readCount = 0;
+  if (++readCount % 10 == 0) {
+    Serial.printf("🎤 MIC: Level=%d\n", level);
+  }
+  return level;
+}
+
+int pollMicrophoneLevel() {
+  __atomic_store_n(&levelRequestMs, millis(), __ATOMIC_SEQ_CST);
+  if (!__atomic_exchange_n(&levelWake, true, __ATOMIC_SEQ_CST)) {
+    HardwareCommand command = {};
+    command.type = HW_SAMPLE_LEVEL;
+    if (!postCommand(command)) __atomic_store_n(&levelWake, false, __ATOMIC_SEQ_CST);
+  }
+  return __atomic_load_n(&audioLevel, __ATOMIC_RELAXED);
+}
+
+bool isMicrophoneInitialized() {
+  HardwareSnapshot state;
+  readSnapshot(state);
+  return state.micInitialized;
+}
+
+bool startRecording(const char* filename) {
+  HardwareSnapshot state;
+  readSnapshot(state);
+  if (!state.micInitialized) {
+    Serial.println("❌ ERROR: Microphone not initialized");
+    return false;
+  }
+
+  if (state.recording) {
+    Serial.println("⚠️  WARN: Already recording");
+    return false;
+  }
+
+  HardwareCommand command = {};
+  command.type = HW_START_RECORDING;
+  if (strlen(RECORDINGS_DIR "/") + strlen(filename) >= sizeof(command.filename)) {
+    LOG_ERROR("Recording: file name too long");
+    return false;
+  }
+  strlcpy(command.filename, filename, sizeof(command.filename));
+
+  notePowerActivity();
+  return postCommand(command);
+}
+
+void stopRecording() {
+  HardwareCommand command = {};
+  command.type = HW_STOP_RECORDING;
+  if (!postCommand(command)) {
+    LOG_WARN("Recording: hardware queue full, stop not queued");
+  }
+}
+
+bool waitForRecordingStop(uint32_t timeoutMs) {
+  uint32_t start = millis();
+  while (isRecording()) {
+    if (millis() - start >= timeoutMs) return false;
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+  return true;
+}
+
+bool isRecording() {
+  HardwareSnapshot state;
+  readSnapshot(state);
+  return state.recording;
+}
+
+String getRecordingPath() {
+  HardwareSnapshot state;
+  readSnapshot(state);
+  return String(state.recordingPath);
+}
+
+int getRecordingDuration() {
+  HardwareSnapshot state;
+  readSnapshot(state);
+  if (!state.recording) {
+    return 0;
+  }
+  return (millis() - state.recordingStartMs) / 1000;
+}
+
+void getHardwareStatus(JsonObject out) {
+  HardwareSnapshot state;
+  readSnapshot(state);
+  out["recording"] = state.recording;
+  if (state.recording) {
+    out["duration"] = (millis() - state.recordingStartMs) / 1000;
+    out["path"] = state.recordingPath;
+    out["bytes"] = state.recordingBytes;
+  }
+  if (state.error[0]) {
+    out["error"] = state.error;
+  }
+  out["commands"] = state.commands;
+  out["dropped"] = __atomic_load_n(&droppedCommands, __ATOMIC_RELAXED);
+}
+
+// ============================================
+// Capture format
+// ============================================
+
+int setMicFormat(JsonVariantConst args, bool persist, String& error) {
+  HardwareSnapshot state;
+  readSnapshot(state);
+  if (state.recording) {
+    error = "Recording in progress";
+    return 409;
+  }
+
+  HardwareCommand command = {};
+  command.type = HW_SET_FORMAT;
+  command.persist = persist;
+  command.format = state.format;
+  int code = parseMicFormat(args, command.format, error);
+  if (code != 200) return code;
+
+  if (!postCommand(command)) {
+    error = "Hardware queue full";
+    return 503;
+  }
+  return 202;
+}
+
+void getMicFormat(JsonObject out) {
+  HardwareSnapshot state;
+  readSnapshot(state);
+  out["sample_rate"] = state.format.sampleRate;
+  out["source_rate"] = state.format.sourceRate;
+  out["bits"] = state.format.bits;
+  out["latency_ms"] = state.format.latencyMs;
+  out["chunk_samples"] = state.chunk;
+  out["chunk_ms"] = state.chunk * 1000 / state.format.sourceRate;
+  JsonObject dma = out["dma"].to<JsonObject>();
+  dma["count"] = state.dmaCount;
+  dma["len"] = state.dmaLen;
+  out["resampling"] = state.resampling;
+  if (state.resampling) {
+    JsonObject filter = out["resampler"].to<JsonObject>();
+    filter["up"] = state.up;
+    filter["down"] = state.down;
+    filter["taps"] = state.taps;
+    filter["bytes"] = getResamplerBytes(state.format.sourceRate, state.format.sampleRate);
+  }
+  JsonArray rates = out["supported_rates"].to<JsonArray>();
+  for (uint32_t rate : micRates) rates.add(rate);
+  JsonArray bits = out["supported_bits"].to<JsonArray>();
+  bits.add(8);
+  bits.add(16);
+  bits.add(24);
+}
+
+// Resamples one second of a 1 kHz tone at the current rates, on the caller
+// with its own filter
+void benchmarkMicResampler(JsonObject out) {
+  HardwareSnapshot state;
+  readSnapshot(state);
+  const uint32_t sourceRate = state.format.sourceRate;
+  out["source_rate"] = sourceRate;
+  out["sample_rate"] = state.format.sampleRate;
+  Resampler bench;
+  if (!state.resampling || !beginResampler(bench, sourceRate, state.format.sampleRate)) {
+    out["resampling"] = false;
+    return;
+  }
+  
+  int16_t in[CAPTURE_BLOCK];
+  int32_t* samples = (int32_t*)malloc(getResamplerMaxOutput(bench, CAPTURE_BLOCK) * sizeof(int32_t));
+  if (!samples) {
+    endResampler(bench);
+    out["error"] = "Out of memory";
+    return;
+  }
+  
+  uint32_t produced = 0;
+  uint32_t elapsedUs = 0;
+  for (uint32_t n = 0; n < sourceRate; n += CAPTURE_BLOCK) {
+    for (int i = 0; i < CAPTURE_BLOCK; i++) {
+      in[i] = 16000 * sinf(2 * PI * 1000 * (n + i) / sourceRate);
+    }
+    uint32_t start = micros();
+    produced += runResampler(bench, in, CAPTURE_BLOCK, samples);
+    elapsedUs += micros() - start;
+  }
+  free(samples);
+  endResampler(bench);
+  
+  out["resampling"] = true;
+  out["input_samples"] = (sourceRate + CAPTURE_BLOCK - 1) / CAPTURE_BLOCK * CAPTURE_BLOCK;
+  out["output_samples"] = produced;
+  out["elapsed_us"] = elapsedUs;
+  out["ns_per_input"] = (float)elapsedUs * 1000 / sourceRate;
+  out["cpu_percent"] = elapsedUs / 10000.0f;
+}
+
 void setupButton() {
   pinMode(BUTTON_PIN, INPUT_PULLUP);
   Serial.println("ℹ️  INFO: Button initialized on GPIO 41");
@@ -211,48 +918,83 @@ bool readButton() {
   return digitalRead(BUTTON_PIN) == LOW; // Active LOW
 }
 
+int getButtonPin() {
+  return BUTTON_PIN;
+}
+
 void setupLED() {
   pinMode(LED_PIN, OUTPUT);
   Serial.println("ℹ️  INFO: RGB LED initialized on GPIO 35");
 }
 
+// Keeps only the newest colour; at most one write is queued at a time
 void setLED(int r, int g, int b) {
-  rgbLedWrite(LED_PIN, r, g, b);
+  uint32_t color = (uint32_t)constrain(r, 0, 255) << 16 | (uint32_t)constrain(g, 0, 255) << 8 |
+                   (uint32_t)constrain(b, 0, 255);
+  __atomic_store_n(&ledColor, color, __ATOMIC_SEQ_CST);
+  if (__atomic_exchange_n(&ledPending, true, __ATOMIC_SEQ_CST)) return;
+
+  HardwareCommand command = {};
+  command.type = HW_LED;
+  if (!postCommand(command)) __atomic_store_n(&ledPending, false, __ATOMIC_SEQ_CST);
 }
 
 bool isReservedPin(int pin) {
-  return (pin == LED_PIN || pin == MIC_DATA_PIN || pin == MIC_CLK_PIN || 
-          pin == BUTTON_PIN || pin == SDCARD_MISO || pin == SDCARD_MOSI || 
-          pin == SDCARD_SCK || pin == SDCARD_CS);
+  return (pin == LED_PIN || pin == MIC_DATA_PIN || pin == MIC_CLK_PIN ||
+          pin == BUTTON_PIN || pin == SDCARD_MISO || pin == SDCARD_MOSI ||
+          pin == SDCARD_SCK || pin == SDCARD_CS || isSensorBusPin(pin));
 }
 
-bool setGPIOMode(int pin, const String& mode) {
-  if (isReservedPin(pin)) {
-    return false;
+static const int userPins[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 15, 16, 18, 21, 43, 44, 45, 46, 47, 48};
+
+bool isUserPin(int pin) {
+  for (int userPin : userPins) {
+    if (userPin == pin) return true;
   }
+  return false;
+}
 
+static bool parseGPIOMode(const String& mode, uint8_t& value) {
   if (mode == "INPUT") {
-    pinMode(pin, INPUT);
+    value = INPUT;
   } else if (mode == "INPUT_PULLUP") {
-    pinMode(pin, INPUT_PULLUP);
+    value = INPUT_PULLUP;
   } else if (mode == "INPUT_PULLDOWN") {
-    pinMode(pin, INPUT_PULLDOWN);
+    value = INPUT_PULLDOWN;
   } else if (mode == "OUTPUT") {
-    pinMode(pin, OUTPUT);
+    value = OUTPUT;
   } else {
     return false;
   }
-
   return true;
 }
 
+bool isValidGPIOMode(const String& mode) {
+  uint8_t value;
+  return parseGPIOMode(mode, value);
+}
+
+bool setGPIOMode(int pin, const String& mode) {
+  HardwareCommand command = {};
+  if (isReservedPin(pin) || !parseGPIOMode(mode, command.value)) {
+    return false;
+  }
+
+  command.type = HW_GPIO_MODE;
+  command.pin = pin;
+  return postCommand(command);
+}
+
 bool writeGPIO(int pin, int value) {
   if (isReservedPin(pin)) {
     return false;
   }
 
-  digitalWrite(pin, value ? HIGH : LOW);
-  return true;
+  HardwareCommand command = {};
+  command.type = HW_GPIO_WRITE;
+  command.pin = pin;
+  command.value = value ? HIGH : LOW;
+  return postCommand(command);
 }
 
 int readGPIO(int pin) {
@@ -262,4 +1004,3 @@ int readGPIO(int pin) {
 int readAnalogGPIO(int pin) {
   return analogRead(pin);
 }
-
@@ -2,33 +2,73 @@
 #define HARDWARE_H
 
 #include <Arduino.h>
+#include <ArduinoJson.h>
+
+// The microphone, the recording file, the LED and GPIO outputs belong to one
+// hardware service task. Everything else talks to it through a command
+// queue: the calls below that change hardware only validate their
+// arguments and enqueue, so HTTP handlers, rules and LED effects never wait
+// on the mic or the SD card. The task publishes its state as a snapshot
+// under a sequence counter, and the query calls copy the latest consistent
+// snapshot without taking a lock.
+//
+// LED colours are coalesced: the newest colour is kept in one word and at
+// most one LED command is queued, so a fast effect cannot fill the queue.
+// The audio level is measured while a recording runs, and for
+// HW_LEVEL_HOLD_MS after the last level query otherwise.
+//
+// GPIO reads are single register reads (or the ADC driver's own locked
+// path) and are not queued, so a read right after a queued write can still
+// see the old level until the service task has run.
+#define HW_SERVICE_STACK 6144
+#define HW_SERVICE_PRIORITY 3
+#define HW_SERVICE_CORE APP_CPU_NUM
+#define HW_QUEUE_DEPTH 16
+#define HW_LEVEL_HOLD_MS 2000
+#define HW_PATH_MAX 96
+#define HW_ERROR_MAX 64
 
 // Hardware initialization
 void setupMicrophone();
 void setupButton();
 void setupLED();
+void startHardwareService();
 
 // Hardware reading
 int readMicrophoneLevel();
+int pollMicrophoneLevel(); // quiet variant for background polling
 bool readButton();
+int getButtonPin();
 bool isMicrophoneInitialized();
 
-// Audio recording
+// Audio recording. start and stop are queued; start returns false when the
+// mic is down, a recording is running or the queue is full. Failures while
+// starting show up as "error" in getHardwareStatus().
 bool startRecording(const char* filename);
 void stopRecording();
+bool waitForRecordingStop(uint32_t timeoutMs);
 bool isRecording();
+String getRecordingPath(); // empty when not recording
 int getRecordingDuration(); // in seconds
-void processRecording(); // Call this in loop() to write audio data
+void getHardwareStatus(JsonObject out);
+
+// Capture format: sample_rate, bits (8/16/24), latency_ms and optionally
+// source_rate, the PDM rate to resample from. Returns an HTTP status, 202
+// once queued; persist also saves it to PATH_MIC_FORMAT for the next boot.
+int setMicFormat(JsonVariantConst args, bool persist, String& error);
+void getMicFormat(JsonObject out);
+void benchmarkMicResampler(JsonObject out);
 
 // Hardware control
 void setLED(int r, int g, int b);
 
 // GPIO control
+bool isValidGPIOMode(const String& mode);
 bool setGPIOMode(int pin, const String& mode);
 bool writeGPIO(int pin, int value);
 int readGPIO(int pin);
 int readAnalogGPIO(int pin);
 bool isReservedPin(int pin);
+bool isUserPin(int pin); // broken out on the headers and free for apps
 
 #endif
-
@@ -0,0 +1,505 @@
+#include "kv_store.h"
+#include "config.h"
+#include "storage.h"
+#include <SD.h>
+#include <esp_rom_crc.h>
+
+#define KV_INDEX_SIZE 256  // power of two, at least twice KV_MAX_KEYS
+#define KV_MAGIC 0x564B
+#define KV_OP_PUT 0x01
+#define KV_OP_DELETE 0x02
+#define KV_FLAG_MORE 0x80  // another record of the same batch follows
+#define KV_TMP_PATH PATH_KV_LOG ".tmp"
+
+struct __attribute__((packed)) KvRecordHeader {
+  uint16_t magic;
+  uint8_t flags;
+  uint8_t keyLength;
+  uint16_t valueLength;
+  uint16_t reserved;
+  uint32_t crc;  // over the header (crc = 0), key and value
+};
+
+struct KvEntry {
+  String key;  // empty when the entry is free
+  uint32_t hash;
+  uint32_t valueOffset;
+  uint16_t valueLength;
+};
+
+static KvEntry entries[KV_MAX_KEYS];
+static int16_t kvIndex[KV_INDEX_SIZE];
+static size_t keyCount = 0;
+
+static File logFile;
+static uint32_t logEnd = 0;
+static uint32_t logSize = 0;  // file length, including any torn tail past logEnd
+static uint32_t liveBytes = 0;
+static uint32_t compactions = 0;
+static bool needsCompaction = false;
+static bool kvReady = false;
+static SemaphoreHandle_t kvMutex = NULL;
+
+// ============================================
+// In-RAM hash index
+// ============================================
+
+static uint32_t hashKey(const char* key) {
+  uint32_t hash = 2166136261u;
+  while (*key) {
+    hash ^= (uint8_t)*key++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static uint32_t recordSize(size_t keyLength, size_t valueLength) {
+  return sizeof(KvRecordHeader) + keyLength + valueLength;
+}
+
+static int findSlot(const String& key, uint32_t hash) {
+  for (uint32_t i = 0; i < KV_INDEX_SIZE; i++) {
+    uint32_t slot = (hash + i) & (KV_INDEX_SIZE - 1);
+    int16_t entry = kvIndex[slot];
+    if (entry < 0) return -1;
+    if (entries[entry].hash == hash && entries[entry].key == key) return slot;
+  }
+  return -1;
+}
+
+static void insertIndex(int16_t entry) {
+  uint32_t slot = entries[entry].hash & (KV_INDEX_SIZE - 1);
+  while (kvIndex[slot] >= 0) {
+    slot = (slot + 1) & (KV_INDEX_SIZE - 1);
+  }
+  kvIndex[slot] = entry;
+}
+
+// Backward-shift deletion keeps probe chains intact without tombstones
+static void removeIndex(uint32_t slot) {
+  uint32_t hole = slot;
+  uint32_t next = slot;
+  while (true) {
+    next = (next + 1) & (KV_INDEX_SIZE - 1);
+    int16_t entry = kvIndex[next];
+    if (entry < 0) break;
+    uint32_t home = entries[entry].hash & (KV_INDEX_SIZE - 1);
+    if (((next - home) & (KV_INDEX_SIZE - 1)) >= ((next - hole) & (KV_INDEX_SIZE - 1))) {
+      kvIndex[hole] = entry;
+      hole = next;
+    }
+  }
+  kvIndex[hole] = -1;
+}
+
+static void applyPut(const String& key, uint32_t valueOffset, uint16_t valueLength) {
+  uint32_t hash = hashKey(key.c_str());
+  int slot = findSlot(key, hash);
+
+  if (slot >= 0) {
+    KvEntry& entry = entries[kvIndex[slot]];
+    liveBytes -= recordSize(entry.key.length(), entry.valueLength);
+    entry.valueOffset = valueOffset;
+    entry.valueLength = valueLength;
+  } else {
+    int16_t free = -1;
+    for (int16_t i = 0; i < KV_MAX_KEYS; i++) {
+      if (entries[i].key.length() == 0) {
+        free = i;
+        break;
+      }
+    }
+    if (free < 0) {
+      LOG_WARN("KV store full, dropping key: %s", key.c_str());
+      return;
+    }
+    entries[free].key = key;
+    entries[free].hash = hash;
+    entries[free].valueOffset = valueOffset;
+    entries[free].valueLength = valueLength;
+    insertIndex(free);
+    keyCount++;
+  }
+  liveBytes += recordSize(key.length(), valueLength);
+}
+
+static void applyDelete(const String& key) {
+  int slot = findSlot(key, hashKey(key.c_str()));
+  if (slot < 0) return;
+
+  KvEntry& entry = entries[kvIndex[slot]];
+  liveBytes -= recordSize(entry.key.length(), entry.valueLength);
+  entry.key = "";
+  removeIndex(slot);
+  keyCount--;
+}
+
+// ============================================
+// Log records
+// ============================================
+
+static bool writeRecord(File& file, uint32_t offset, uint8_t flags, const String& key, const String& value) {
+  KvRecordHeader header = {KV_MAGIC, flags, (uint8_t)key.length(), (uint16_t)value.length(), 0, 0};
+  uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&header, sizeof(header));
+  crc = esp_rom_crc32_le(crc, (const uint8_t*)key.c_str(), key.length());
+  crc = esp_rom_crc32_le(crc, (const uint8_t*)value.c_str(), value.length());
+  header.crc = crc;
+
+  return file.seek(offset) &&
+         file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+         file.write((const uint8_t*)key.c_str(), key.length()) == key.length() &&
+         file.write((const uint8_t*)value.c_str(), value.length()) == value.length();
+}
+
+static bool readValue(const KvEntry& entry, String& value) {
+  char* buffer = (char*)malloc(entry.valueLength + 1);
+  if (!buffer) return false;
+
+  bool ok = logFile.seek(entry.valueOffset) &&
+            logFile.read((uint8_t*)buffer, entry.valueLength) == entry.valueLength;
+  buffer[entry.valueLength] = '\0';
+  if (ok) value = buffer;
+  free(buffer);
+  return ok;
+}
+
+// Replays committed records into the index. Stops at the first torn or
+// corrupt record; a batch whose final record is missing is discarded whole.
+static void replayLog() {
+  struct Pending {
+    uint8_t op;
+    String key;
+    uint32_t valueOffset;
+    uint16_t valueLength;
+  };
+  static Pending pending[KV_MAX_BATCH];
+  size_t pendingCount = 0;
+
+  uint32_t size = logFile.size();
+  uint32_t offset = 0;
+  uint32_t committed = 0;
+  char key[KV_MAX_KEY + 1];
+  uint8_t buffer[128];
+
+  while (offset + sizeof(KvRecordHeader) <= size) {
+    KvRecordHeader header;
+    if (!logFile.seek(offset) || logFile.read((uint8_t*)&header, sizeof(header)) != sizeof(header)) break;
+
+    uint8_t op = header.flags & ~KV_FLAG_MORE;
+    if (header.magic != KV_MAGIC || (op != KV_OP_PUT && op != KV_OP_DELETE) ||
+        header.keyLength == 0 || header.keyLength > KV_MAX_KEY || header.valueLength > KV_MAX_VALUE ||
+        offset + recordSize(header.keyLength, header.valueLength) > size) {
+      break;
+    }
+
+    uint32_t storedCrc = header.crc;
+    header.crc = 0;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&header, sizeof(header));
+    if (logFile.read((uint8_t*)key, header.keyLength) != header.keyLength) break;
+    key[header.keyLength] = '\0';
+    crc = esp_rom_crc32_le(crc, (const uint8_t*)key, header.keyLength);
+
+    uint16_t remaining = header.valueLength;
+    while (remaining > 0) {
+      size_t n = min((size_t)remaining, sizeof(buffer));
+      if (logFile.read(buffer, n) != n) break;
+      crc = esp_rom_crc32_le(crc, buffer, n);
+      remaining -= n;
+    }
+    if (remaining > 0 || crc != storedCrc || pendingCount == KV_MAX_BATCH) break;
+
+    Pending& record = pending[pendingCount++];
+    record.op = op;
+    record.key = key;
+    record.valueOffset = offset + sizeof(KvRecordHeader) + header.keyLength;
+    record.valueLength = header.valueLength;
+    offset += recordSize(header.keyLength, header.valueLength);
+
+    if (!(header.flags & KV_FLAG_MORE)) {
+      for (size_t i = 0; i < pendingCount; i++) {
+        if (pending[i].op == KV_OP_PUT) applyPut(pending[i].key, pending[i].valueOffset, pending[i].valueLength);
+        else applyDelete(pending[i].key);
+      }
+      pendingCount = 0;
+      committed = offset;
+    }
+  }
+
+  logEnd = committed;
+  logSize = size;
+  if (logEnd < size) {
+    LOG_WARN("KV log: discarding %d bytes after offset %d", size - logEnd, logEnd);
+    needsCompaction = true;
+  }
+}
+
+// Rewrites live records into a fresh log. The old log is only removed once
+// the new one is complete, so a crash leaves one intact copy.
+static bool compactLog() {
+  static uint32_t newOffsets[KV_MAX_KEYS];
+  uint32_t startMs = millis();
+
+  File tmp = SD.open(KV_TMP_PATH, FILE_WRITE);
+  if (!tmp) {
+    LOG_ERROR("KV compaction: cannot create %s", KV_TMP_PATH);
+    return false;
+  }
+
+  uint32_t offset = 0;
+  for (size_t i = 0; i < KV_MAX_KEYS; i++) {
+    if (entries[i].key.length() == 0) continue;
+
+    String value;
+    if (!readValue(entries[i], value) || !writeRecord(tmp, offset, KV_OP_PUT, entries[i].key, value)) {
+      LOG_ERROR("KV compaction failed at key: %s", entries[i].key.c_str());
+      tmp.close();
+      SD.remove(KV_TMP_PATH);
+      return false;
+    }
+    newOffsets[i] = offset + sizeof(KvRecordHeader) + entries[i].key.length();
+    offset += recordSize(entries[i].key.length(), value.length());
+  }
+  tmp.flush();
+  tmp.close();
+
+  uint32_t oldSize = logFile.size();
+  logFile.close();
+  SD.remove(PATH_KV_LOG);
+  if (!SD.rename(KV_TMP_PATH, PATH_KV_LOG)) {
+    LOG_ERROR("KV compaction: rename failed");
+  }
+  adjustSDCardUsage(PATH_KV_LOG, (int64_t)offset - oldSize);
+  logSize = offset;
+
+  logFile = SD.open(PATH_KV_LOG, "r+");
+  if (!logFile) {
+    LOG_ERROR("KV compaction: cannot reopen log");
+    kvReady = false;
+    return false;
+  }
+
+  for (size_t i = 0; i < KV_MAX_KEYS; i++) {
+    if (entries[i].key.length() > 0) entries[i].valueOffset = newOffsets[i];
+  }
+  LOG_INFO("KV compaction: %d -> %d bytes in %d ms", logEnd, offset, millis() - startMs);
+  logEnd = offset;
+  liveBytes = offset;
+  needsCompaction = false;
+  compactions++;
+  return true;
+}
+
+// ============================================
+// Public API
+// ============================================
+
+bool initKvStore() {
+  if (!kvMutex) kvMutex = xSemaphoreCreateMutex();
+  if (!kvMutex) {
+    LOG_ERROR("Failed to create KV store mutex");
+    return false;
+  }
+
+  memset(kvIndex, 0xFF, sizeof(kvIndex));
+  keyCount = 0;
+  liveBytes = 0;
+
+  if (!SD.exists(DIR_OS)) SD.mkdir(DIR_OS);
+
+  // A leftover temp file is either a finished compaction whose rename was
+  // interrupted, or a partial one next to an intact log
+  if (SD.exists(KV_TMP_PATH)) {
+    if (SD.exists(PATH_KV_LOG)) SD.remove(KV_TMP_PATH);
+    else SD.rename(KV_TMP_PATH, PATH_KV_LOG);
+  }
+
+  if (!SD.exists(PATH_KV_LOG)) {
+    File created = SD.open(PATH_KV_LOG, FILE_WRITE);
+    if (!created) {
+      LOG_ERROR("Failed to create KV log: %s", PATH_KV_LOG);
+      return false;
+    }
+    created.close();
+  }
+
+  logFile = SD.open(PATH_KV_LOG, "r+");
+  if (!logFile) {
+    LOG_ERROR("Failed to open KV log: %s", PATH_KV_LOG);
+    return false;
+  }
+
+  replayLog();
+  kvReady = true;
+  LOG_INFO("KV store ready: %d keys, %d/%d live bytes", keyCount, liveBytes, logEnd);
+  return true;
+}
+
+void serviceKvStore() {
+  if (!kvReady) return;
+
+  uint32_t dead = logEnd - liveBytes;
+  if (!needsCompaction && (dead < KV_COMPACT_MIN_BYTES || dead < liveBytes)) return;
+
+  xSemaphoreTake(kvMutex, portMAX_DELAY);
+  compactLog();
+  xSemaphoreGive(kvMutex);
+}
+
+bool isValidKvKey(const String& key) {
+  if (key.length() == 0 || key.length() > KV_MAX_KEY) return false;
+  for (size_t i = 0; i < key.length(); i++) {
+    if (!isprint(key[i])) return false;
+  }
+  return true;
+}
+
+bool getKvValue(const String& key, String& value) {
+  if (!kvReady) return false;
+
+  xSemaphoreTake(kvMutex, portMAX_DELAY);
+  int slot = findSlot(key, hashKey(key.c_str()));
+  bool found = slot >= 0 && readValue(entries[kvIndex[slot]], value);
+  xSemaphoreGive(kvMutex);
+  return found;
+}
+
+bool getKvValue(const String& key, JsonVariant out) {
+  String value;
+  if (!getKvValue(key, value)) return false;
+
+  // Values are stored as JSON text; parse them so the caller's document
+  // encodes correctly as JSON and as MessagePack alike
+  JsonDocument parsed;
+  if (deserializeJson(parsed, value)) {
+    out.set(value);
+  } else {
+    out.set(parsed.as<JsonVariantConst>());
+  }
+  return true;
+}
+
+bool putKvValue(const String& key, const String& value, String& error) {
+  KvOp op = {key, value, false};
+  return applyKvBatch(&op, 1, error);
+}
+
+bool deleteKvValue(const String& key, String& error) {
+  if (!kvReady) {
+    error = "Store unavailable";
+    return false;
+  }
+
+  xSemaphoreTake(kvMutex, portMAX_DELAY);
+  bool exists = findSlot(key, hashKey(key.c_str())) >= 0;
+  xSemaphoreGive(kvMutex);
+
+  if (!exists) {
+    error = "Key not found";
+    return false;
+  }
+  KvOp op = {key, String(), true};
+  return applyKvBatch(&op, 1, error);
+}
+
+// Replays the batch against the key count: a key set twice is new once,
+// and a remove frees its slot for the puts that follow it
+static bool batchFits(const KvOp* ops, size_t count) {
+  size_t keys = keyCount;
+  for (size_t i = 0; i < count; i++) {
+    int earlier = -1;
+    for (size_t j = 0; j < i; j++) {
+      if (ops[j].key == ops[i].key) earlier = j;
+    }
+    bool exists = earlier >= 0 ? !ops[earlier].remove : findSlot(ops[i].key, hashKey(ops[i].key.c_str())) >= 0;
+
+    if (ops[i].remove && exists) keys--;
+    if (!ops[i].remove && !exists && ++keys > KV_MAX_KEYS) return false;
+  }
+  return true;
+}
+
+bool applyKvBatch(const KvOp* ops, size_t count, String& error) {
+  if (!kvReady) {
+    error = "Store unavailable";
+    return false;
+  }
+  if (count == 0 || count > KV_MAX_BATCH) {
+    error = "Batch must hold 1-" + String(KV_MAX_BATCH) + " operations";
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (!isValidKvKey(ops[i].key)) {
+      error = "Invalid key";
+      return false;
+    }
+    if (!ops[i].remove && ops[i].value.length() > KV_MAX_VALUE) {
+      error = "Value too large";
+      return false;
+    }
+  }
+
+  xSemaphoreTake(kvMutex, portMAX_DELAY);
+
+  if (!batchFits(ops, count)) {
+    xSemaphoreGive(kvMutex);
+    error = "Store full";
+    return false;
+  }
+
+  // All records reach the card before any becomes visible
+  static uint32_t valueOffsets[KV_MAX_BATCH];
+  uint32_t offset = logEnd;
+  bool ok = true;
+  for (size_t i = 0; i < count && ok; i++) {
+    uint8_t flags = (ops[i].remove ? KV_OP_DELETE : KV_OP_PUT) | (i + 1 < count ? KV_FLAG_MORE : 0);
+    const String& value = ops[i].remove ? String() : ops[i].value;
+    ok = writeRecord(logFile, offset, flags, ops[i].key, value);
+    valueOffsets[i] = offset + sizeof(KvRecordHeader) + ops[i].key.length();
+    offset += recordSize(ops[i].key.length(), value.length());
+  }
+  logFile.flush();
+
+  if (!ok) {
+    // Anything past logEnd is ignored on replay; compaction tidies it up
+    needsCompaction = true;
+    adjustSDCardUsage(PATH_KV_LOG, 0);
+    xSemaphoreGive(kvMutex);
+    LOG_ERROR("KV log write failed");
+    error = "Write failed";
+    return false;
+  }
+
+  logEnd = offset;
+  adjustSDCardUsage(PATH_KV_LOG, logEnd > logSize ? logEnd - logSize : 0);
+  if (logEnd > logSize) logSize = logEnd;
+  for (size_t i = 0; i < count; i++) {
+    if (ops[i].remove) applyDelete(ops[i].key);
+    else applyPut(ops[i].key, valueOffsets[i], ops[i].value.length());
+  }
+
+  xSemaphoreGive(kvMutex);
+  return true;
+}
+
+void listKvKeys(const String& prefix, JsonArray out) {
+  if (!kvReady) return;
+
+  xSemaphoreTake(kvMutex, portMAX_DELAY);
+  for (size_t i = 0; i < KV_MAX_KEYS; i++) {
+    if (entries[i].key.length() > 0 && entries[i].key.startsWith(prefix)) {
+      out.add(entries[i].key);
+    }
+  }
+  xSemaphoreGive(kvMutex);
+}
+
+void getKvStats(JsonObject out) {
+  out["ready"] = kvReady;
+  out["keys"] = keyCount;
+  out["max_keys"] = KV_MAX_KEYS;
+  out["max_value"] = KV_MAX_VALUE;
+  out["log_bytes"] = logEnd;
+  out["live_bytes"] = liveBytes;
+  out["compactions"] = compactions;
+}
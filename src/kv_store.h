@@ -0,0 +1,43 @@
+#ifndef KV_STORE_H
+#define KV_STORE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Small persistent key-value store for apps and system settings.
+//
+// Every put/delete appends one CRC-checked record to PATH_KV_LOG and flushes
+// it, so a write costs a single small append regardless of store size. Keys
+// live in an in-RAM hash index pointing at their latest value in the log;
+// values are read back from SD on demand. serviceKvStore() rewrites the log
+// once dead records outweigh live ones.
+#define KV_MAX_KEYS 128
+#define KV_MAX_KEY 64
+#define KV_MAX_VALUE 2048
+#define KV_MAX_BATCH 32
+#define KV_COMPACT_MIN_BYTES 16384
+
+struct KvOp {
+  String key;
+  String value;
+  bool remove;
+};
+
+bool initKvStore();
+void serviceKvStore();
+
+bool isValidKvKey(const String& key);
+
+bool getKvValue(const String& key, String& value);
+// Same, decoded into out; a value that is not valid JSON comes back as a string
+bool getKvValue(const String& key, JsonVariant out);
+bool putKvValue(const String& key, const String& value, String& error);
+bool deleteKvValue(const String& key, String& error);
+
+// Applies all operations or none of them, also across a power loss
+bool applyKvBatch(const KvOp* ops, size_t count, String& error);
+
+void listKvKeys(const String& prefix, JsonArray out);
+void getKvStats(JsonObject out);
+
+#endif
@@ -0,0 +1,353 @@
+#include "led_effects.h"
+#include "config.h"
+#include "hardware.h"
+#include "scheduler.h"
+#include <esp_timer.h>
+
+enum LedEffectType {
+  EFFECT_NONE,
+  EFFECT_SOLID,
+  EFFECT_KEYFRAMES,
+  EFFECT_BLINK,
+  EFFECT_BREATHE,
+  EFFECT_AUDIO
+};
+
+static const char* effectNames[] = { "none", "solid", "keyframes", "blink", "breathe", "audio" };
+
+struct LedColor {
+  uint8_t r, g, b;
+};
+
+struct LedKeyframe {
+  LedColor color;
+  bool fade;
+  uint32_t ms;
+};
+
+struct LedPattern {
+  LedEffectType type;
+  LedColor color;
+  LedColor altColor;      // blink off colour, audio peak colour
+  uint32_t onMs;
+  uint32_t offMs;
+  uint32_t periodMs;
+  float minLevel;         // breathe and audio floor, 0..1
+  float gain;
+  uint8_t brightness;
+  uint32_t durationMs;    // 0 runs until replaced
+  int32_t loops;          // keyframe cycles; 0 repeats forever
+  uint32_t cycleMs;
+  uint8_t keyframeCount;
+  LedKeyframe keyframes[LED_MAX_KEYFRAMES];
+};
+
+static LedPattern active;
+static SemaphoreHandle_t effectMutex = nullptr;
+static esp_timer_handle_t frameTimer = nullptr;
+static volatile bool playing = false;
+static int64_t startUs = 0;
+static int64_t nextFrameUs = 0;
+static LedColor shown = {0, 0, 0};
+static bool shownValid = false;
+static float audioLevel = 0;
+static volatile int micLevel = 0;
+static int micTask = -1;
+
+static uint32_t frames = 0;
+static uint32_t writes = 0;
+static uint32_t lateFrames = 0;
+static uint32_t maxJitterUs = 0;
+
+// ============================================
+// Rendering
+// ============================================
+
+static LedColor mix(LedColor from, LedColor to, float t) {
+  return {
+    (uint8_t)(from.r + (to.r - from.r) * t),
+    (uint8_t)(from.g + (to.g - from.g) * t),
+    (uint8_t)(from.b + (to.b - from.b) * t)
+  };
+}
+
+static LedColor scale(LedColor color, float level) {
+  return { (uint8_t)(color.r * level), (uint8_t)(color.g * level), (uint8_t)(color.b * level) };
+}
+
+static LedColor renderKeyframes(uint32_t elapsedMs, bool& finished) {
+  uint32_t cycle = elapsedMs / active.cycleMs;
+  if (active.loops > 0 && cycle >= (uint32_t)active.loops) {
+    finished = true;
+    return active.keyframes[active.keyframeCount - 1].color;
+  }
+
+  uint32_t t = elapsedMs % active.cycleMs;
+  for (uint8_t i = 0; i < active.keyframeCount; i++) {
+    const LedKeyframe& frame = active.keyframes[i];
+    if (t < frame.ms) {
+      if (!frame.fade) return frame.color;
+      const LedKeyframe& prev = active.keyframes[i == 0 ? active.keyframeCount - 1 : i - 1];
+      return mix(prev.color, frame.color, (float)t / frame.ms);
+    }
+    t -= frame.ms;
+  }
+  return active.keyframes[active.keyframeCount - 1].color;
+}
+
+static LedColor renderFrame(uint32_t elapsedMs, bool& finished) {
+  switch (active.type) {
+    case EFFECT_KEYFRAMES:
+      return renderKeyframes(elapsedMs, finished);
+
+    case EFFECT_BLINK:
+      return elapsedMs % (active.onMs + active.offMs) < active.onMs ? active.color : active.altColor;
+
+    case EFFECT_BREATHE: {
+      float phase = (float)(elapsedMs % active.periodMs) / active.periodMs;
+      float swell = (1.0f - cosf(phase * 2 * PI)) / 2;
+      return scale(active.color, active.minLevel + (1.0f - active.minLevel) * swell);
+    }
+
+    case EFFECT_AUDIO: {
+      // Instant attack, exponential release
+      float level = min(1.0f, micLevel * active.gain / 100.0f);
+      audioLevel = max(level, audioLevel * LED_AUDIO_DECAY);
+      return scale(mix(active.color, active.altColor, audioLevel),
+                   active.minLevel + (1.0f - active.minLevel) * audioLevel);
+    }
+
+    default:
+      finished = true;
+      return active.color;
+  }
+}
+
+static void onFrame(void* arg) {
+  if (xSemaphoreTake(effectMutex, 0) != pdTRUE) return;
+  if (!playing) {
+    xSemaphoreGive(effectMutex);
+    return;
+  }
+
+  int64_t now = esp_timer_get_time();
+  uint32_t jitter = now > nextFrameUs ? (uint32_t)(now - nextFrameUs) : 0;
+  if (jitter > maxJitterUs) maxJitterUs = jitter;
+  if (jitter > LED_FRAME_MS * 1000 / 2) lateFrames++;
+  nextFrameUs += LED_FRAME_MS * 1000;
+  if (nextFrameUs < now) nextFrameUs = now + LED_FRAME_MS * 1000;
+  frames++;
+
+  uint32_t elapsedMs = (now - startUs) / 1000;
+  bool finished = active.durationMs > 0 && elapsedMs >= active.durationMs;
+  LedColor color = scale(renderFrame(elapsedMs, finished), active.brightness / 255.0f);
+
+  if (!shownValid || color.r != shown.r || color.g != shown.g || color.b != shown.b) {
+    setLED(color.r, color.g, color.b);
+    shown = color;
+    shownValid = true;
+    writes++;
+  }
+
+  if (finished) {
+    playing = false;
+    esp_timer_stop(frameTimer);
+    setSchedulerTaskPeriod(micTask, 0);
+  }
+  xSemaphoreGive(effectMutex);
+}
+
+static void pollMicForLed() {
+  micLevel = pollMicrophoneLevel();
+}
+
+// ============================================
+// Patterns
+// ============================================
+
+// "#rrggbb", [r, g, b] or {"r":, "g":, "b":}
+static bool parseColor(JsonVariantConst value, LedColor& color) {
+  if (value.is<const char*>()) {
+    const char* text = value.as<const char*>();
+    if (*text == '#') text++;
+    if (strlen(text) != 6) return false;
+    char* end;
+    uint32_t rgb = strtoul(text, &end, 16);
+    if (*end) return false;
+    color = { (uint8_t)(rgb >> 16), (uint8_t)(rgb >> 8), (uint8_t)rgb };
+    return true;
+  }
+  if (value.is<JsonArrayConst>() && value.size() == 3) {
+    color = { (uint8_t)constrain(value[0].as<int>(), 0, 255),
+              (uint8_t)constrain(value[1].as<int>(), 0, 255),
+              (uint8_t)constrain(value[2].as<int>(), 0, 255) };
+    return true;
+  }
+  if (value.is<JsonObjectConst>()) {
+    color = { (uint8_t)constrain(value["r"] | 0, 0, 255),
+              (uint8_t)constrain(value["g"] | 0, 0, 255),
+              (uint8_t)constrain(value["b"] | 0, 0, 255) };
+    return true;
+  }
+  return false;
+}
+
+static bool parseEffectType(const String& name, LedEffectType& type) {
+  for (int i = 0; i <= EFFECT_AUDIO; i++) {
+    if (name == effectNames[i]) {
+      type = (LedEffectType)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool parsePattern(JsonVariantConst json, LedPattern& pattern, String& error) {
+  pattern = LedPattern();
+  if (!parseEffectType(json["effect"] | "", pattern.type)) {
+    error = "effect must be none, solid, keyframes, blink, breathe or audio";
+    return false;
+  }
+  if (pattern.type == EFFECT_NONE) return true;
+
+  pattern.brightness = constrain(json["brightness"] | 255, 0, 255);
+  pattern.durationMs = json["duration_ms"] | 0;
+  pattern.minLevel = constrain(json["min"] | 0.05f, 0.0f, 1.0f);
+  pattern.gain = json["gain"] | 1.0f;
+  pattern.color = {255, 255, 255};
+  if (!json["color"].isNull() && !parseColor(json["color"], pattern.color)) {
+    error = "Invalid color";
+    return false;
+  }
+
+  switch (pattern.type) {
+    case EFFECT_KEYFRAMES: {
+      JsonArrayConst keyframes = json["keyframes"];
+      if (keyframes.size() == 0 || keyframes.size() > LED_MAX_KEYFRAMES) {
+        error = "keyframes must have 1.." + String(LED_MAX_KEYFRAMES) + " entries";
+        return false;
+      }
+      for (JsonVariantConst item : keyframes) {
+        LedKeyframe& frame = pattern.keyframes[pattern.keyframeCount++];
+        if (!parseColor(item["color"], frame.color)) {
+          error = "Invalid color in keyframe " + String(pattern.keyframeCount - 1);
+          return false;
+        }
+        frame.ms = max(LED_FRAME_MS, (int)(item["ms"] | 500));
+        frame.fade = item["fade"] | false;
+        pattern.cycleMs += frame.ms;
+      }
+      JsonVariantConst loop = json["loop"];
+      pattern.loops = loop.is<bool>() ? (loop.as<bool>() ? 0 : 1) : max(0, loop | 0);
+      break;
+    }
+
+    case EFFECT_BLINK:
+      pattern.onMs = max(LED_FRAME_MS, (int)(json["on_ms"] | 500));
+      pattern.offMs = max(LED_FRAME_MS, (int)(json["off_ms"] | 500));
+      if (!json["off_color"].isNull() && !parseColor(json["off_color"], pattern.altColor)) {
+        error = "Invalid off_color";
+        return false;
+      }
+      break;
+
+    case EFFECT_BREATHE:
+      pattern.periodMs = max(4 * LED_FRAME_MS, (int)(json["period_ms"] | 3000));
+      break;
+
+    case EFFECT_AUDIO:
+      pattern.altColor = {255, 0, 0};
+      if (!json["peak_color"].isNull() && !parseColor(json["peak_color"], pattern.altColor)) {
+        error = "Invalid peak_color";
+        return false;
+      }
+      if (pattern.gain <= 0) {
+        error = "gain must be positive";
+        return false;
+      }
+      break;
+
+    default:
+      break;
+  }
+  return true;
+}
+
+// ============================================
+// Public API
+// ============================================
+
+void initLedEffects() {
+  effectMutex = xSemaphoreCreateMutex();
+
+  esp_timer_create_args_t args = {};
+  args.callback = onFrame;
+  args.name = "led_frame";
+  esp_timer_create(&args, &frameTimer);
+
+  micTask = addSchedulerTask("led_mic", pollMicForLed, 0, SCHEDULER_PRIORITY_LOW);
+}
+
+bool playLedEffect(JsonVariantConst json, String& error) {
+  LedPattern* pattern = new (std::nothrow) LedPattern();
+  if (!pattern) {
+    error = "Out of memory";
+    return false;
+  }
+  if (!parsePattern(json, *pattern, error)) {
+    delete pattern;
+    return false;
+  }
+
+  xSemaphoreTake(effectMutex, portMAX_DELAY);
+  esp_timer_stop(frameTimer);
+  active = *pattern;
+  playing = active.type != EFFECT_NONE;
+  startUs = esp_timer_get_time();
+  nextFrameUs = startUs;
+  shownValid = false;
+  audioLevel = 0;
+  frames = writes = lateFrames = maxJitterUs = 0;
+  if (playing) {
+    esp_timer_start_periodic(frameTimer, LED_FRAME_MS * 1000);
+  }
+  xSemaphoreGive(effectMutex);
+
+  setSchedulerTaskPeriod(micTask, active.type == EFFECT_AUDIO ? LED_MIC_INTERVAL_MS : 0);
+  delete pattern;
+
+  // The timer's first tick is one frame away; show frame 0 now
+  if (playing) onFrame(nullptr);
+
+  LOG_INFO("LED effect: %s", effectNames[active.type]);
+  return true;
+}
+
+void stopLedEffect() {
+  if (!playing) return;
+
+  xSemaphoreTake(effectMutex, portMAX_DELAY);
+  playing = false;
+  esp_timer_stop(frameTimer);
+  xSemaphoreGive(effectMutex);
+  setSchedulerTaskPeriod(micTask, 0);
+}
+
+void getLedEffectStatus(JsonObject out) {
+  xSemaphoreTake(effectMutex, portMAX_DELAY);
+  out["effect"] = effectNames[active.type];
+  out["playing"] = (bool)playing;
+  if (active.type != EFFECT_NONE) {
+    out["elapsed_ms"] = (uint32_t)((esp_timer_get_time() - startUs) / 1000);
+  }
+  JsonArray color = out["color"].to<JsonArray>();
+  color.add(shown.r);
+  color.add(shown.g);
+  color.add(shown.b);
+  out["frame_ms"] = LED_FRAME_MS;
+  out["frames"] = frames;
+  out["writes"] = writes;
+  out["late_frames"] = lateFrames;
+  out["max_jitter_us"] = maxJitterUs;
+  xSemaphoreGive(effectMutex);
+}
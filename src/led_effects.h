@@ -0,0 +1,35 @@
+#ifndef LED_EFFECTS_H
+#define LED_EFFECTS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// On-device LED effects, so a fade or blink costs one request instead of a
+// stream of /_api/led/set calls.
+//
+//   solid      one colour
+//   keyframes  a list of {color, ms, fade}; each step fades from the previous
+//              step's colour (or jumps to its own) over ms, then loops
+//   blink      color for on_ms, off_color for off_ms
+//   breathe    cosine swell of color between min and full over period_ms
+//   audio      color towards peak_color with the microphone level
+//
+// Frames are rendered by an esp_timer every LED_FRAME_MS from the time since
+// the effect started, so timing does not drift with callback latency. The
+// LED is only written (one RMT transfer) when the rendered colour changes.
+// Any direct colour write (/_api/led/set, rules) stops the effect.
+#define LED_FRAME_MS 20
+#define LED_MAX_KEYFRAMES 32
+#define LED_MIC_INTERVAL_MS 40
+#define LED_AUDIO_DECAY 0.85f
+
+void initLedEffects();
+
+// Parses and starts an effect; "none" stops playback. Returns false with
+// error set if the pattern is invalid.
+bool playLedEffect(JsonVariantConst pattern, String& error);
+void stopLedEffect();
+
+void getLedEffectStatus(JsonObject out);
+
+#endif
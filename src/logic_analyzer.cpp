@@ -0,0 +1,675 @@
+#include "logic_analyzer.h"
+#include "config.h"
+#include "hardware.h"
+#include "storage.h"
+#include "power_manager.h"
+#include "api_router.h"
+#include <SD.h>
+#include <esp_cpu.h>
+#include <esp_rom_crc.h>
+#include <driver/dedic_gpio.h>
+#include <hal/dedic_gpio_cpu_ll.h>
+#include <soc/gpio_periph.h>
+#include <soc/io_mux_reg.h>
+
+enum LogicState {
+  LOGIC_IDLE,
+  LOGIC_ARMED,
+  LOGIC_CAPTURING,
+  LOGIC_SAVING,
+  LOGIC_DONE,
+  LOGIC_TIMEOUT,
+  LOGIC_CANCELLED,
+  LOGIC_FAILED
+};
+
+static const char* stateNames[] = {
+  "idle", "armed", "capturing", "saving", "done", "timeout", "cancelled", "failed"
+};
+
+enum TriggerCondition { TRIG_NONE = -1, TRIG_HIGH, TRIG_LOW, TRIG_RISING, TRIG_FALLING, TRIG_CHANGE };
+static const char* conditionNames[] = { "high", "low", "rising", "falling", "change" };
+
+struct LogicCapture {
+  int pins[LOGIC_MAX_CHANNELS];
+  int8_t conditions[LOGIC_MAX_CHANNELS];
+  uint8_t channels;
+  uint32_t cpuHz;
+  uint32_t periodCycles;
+  uint32_t samples;
+  uint32_t preTrigger;
+  uint32_t timeoutMs;
+  bool vcd;
+  String path;
+  // The trigger as masks over a sample byte; every condition must hold
+  uint8_t levelMask;
+  uint8_t levelValue;
+  uint8_t riseMask;
+  uint8_t fallMask;
+  uint8_t changeMask;
+};
+
+static LogicCapture capture;
+static volatile LogicState state = LOGIC_IDLE;
+static volatile bool cancelRequested = false;
+static uint8_t* ring = nullptr;
+static uint32_t ringStart = 0;
+static uint32_t lateSamples = 0;
+static bool interruptsMasked = false;
+static uint32_t startedMs = 0;
+static uint32_t triggeredMs = 0;
+static uint32_t finishedMs = 0;
+static size_t fileBytes = 0;
+static String lastError;
+
+// ============================================
+// Sampling
+// ============================================
+
+static inline uint8_t IRAM_ATTR readSample(uint32_t inMask, uint32_t shift) {
+  return (dedic_gpio_cpu_ll_read_in() & inMask) >> shift;
+}
+
+// Samples into the ring until the trigger matches with preTrigger samples
+// held before it. Returns the ring index of the trigger sample, -1 when
+// cancelled or -2 on timeout; next is left at the trigger sample's tick.
+static int32_t IRAM_ATTR waitForTrigger(uint32_t inMask, uint32_t shift, uint32_t& next) {
+  const uint32_t size = capture.samples;
+  const uint32_t period = capture.periodCycles;
+  const uint32_t pre = capture.preTrigger;
+  const uint8_t levelMask = capture.levelMask, levelValue = capture.levelValue;
+  const uint8_t riseMask = capture.riseMask, fallMask = capture.fallMask;
+  const uint8_t changeMask = capture.changeMask;
+  const uint32_t sliceCycles = (uint64_t)capture.cpuHz * LOGIC_ARM_SLICE_MS / 1000 + pre * period;
+  const uint32_t deadline = millis() + capture.timeoutMs;
+  uint32_t index = 0;
+
+  while (true) {
+    uint32_t held = 0;
+    next = esp_cpu_get_cycle_count();
+    uint32_t sliceEnd = next + sliceCycles;
+    uint8_t prev = readSample(inMask, shift);
+
+    while ((int32_t)(next - sliceEnd) < 0) {
+      while ((int32_t)(esp_cpu_get_cycle_count() - next) < 0) {}
+      uint8_t sample = readSample(inMask, shift);
+      ring[index] = sample;
+
+      if (held < pre) {
+        held++;
+      } else {
+        uint8_t changed = sample ^ prev;
+        if ((sample & levelMask) == levelValue &&
+            (changed & sample & riseMask) == riseMask &&
+            (changed & prev & fallMask) == fallMask &&
+            (changed & changeMask) == changeMask) {
+          return index;
+        }
+      }
+
+      prev = sample;
+      if (++index == size) index = 0;
+      next += period;
+    }
+
+    if (cancelRequested) return -1;
+    if ((int32_t)(millis() - deadline) >= 0) return -2;
+    // Lets the idle task feed the watchdog; the pre-trigger count restarts
+    vTaskDelay(1);
+  }
+}
+
+// Takes count samples after the one at index, continuing its schedule
+static void IRAM_ATTR captureRemainder(uint32_t index, uint32_t count, uint32_t next,
+                                       uint32_t inMask, uint32_t shift) {
+  const uint32_t size = capture.samples;
+  const uint32_t period = capture.periodCycles;
+  uint32_t late = 0;
+
+  while (count--) {
+    next += period;
+    int32_t lag;
+    while ((lag = (int32_t)(esp_cpu_get_cycle_count() - next)) < 0) {}
+    if (++index == size) index = 0;
+    ring[index] = readSample(inMask, shift);
+    if (lag >= (int32_t)period) late++;
+  }
+  lateSamples = late;
+}
+
+static inline uint8_t sampleAt(uint32_t i) {
+  uint32_t index = ringStart + i;
+  if (index >= capture.samples) index -= capture.samples;
+  return ring[index];
+}
+
+// ============================================
+// Export
+// ============================================
+
+// Buffers small writes into sector-sized ones
+struct FileSink {
+  File file;
+  uint8_t buffer[512];
+  size_t used;
+  size_t total;
+  bool ok;
+};
+
+static void sinkFlush(FileSink& sink) {
+  if (sink.used == 0) return;
+  if (sink.file.write(sink.buffer, sink.used) != sink.used) sink.ok = false;
+  sink.total += sink.used;
+  sink.used = 0;
+}
+
+static void sinkWrite(FileSink& sink, const void* data, size_t len) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  while (len > 0) {
+    size_t n = min(len, sizeof(sink.buffer) - sink.used);
+    memcpy(sink.buffer + sink.used, bytes, n);
+    sink.used += n;
+    bytes += n;
+    len -= n;
+    if (sink.used == sizeof(sink.buffer)) sinkFlush(sink);
+  }
+}
+
+static void sinkPrintf(FileSink& sink, const char* fmt, ...) {
+  char line[128];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  if (len > 0) sinkWrite(sink, line, min((size_t)len, sizeof(line) - 1));
+}
+
+static uint64_t sampleTimeNs(uint32_t i) {
+  return (uint64_t)i * capture.periodCycles * 1000000000ULL / capture.cpuHz;
+}
+
+static void writeVCD(FileSink& sink) {
+  sinkPrintf(sink, "$version ESP2GO logic capture $end\n");
+  sinkPrintf(sink, "$comment trigger at sample %u, %u Hz $end\n",
+             capture.preTrigger, capture.cpuHz / capture.periodCycles);
+  sinkPrintf(sink, "$timescale 1 ns $end\n$scope module logic $end\n");
+  for (int ch = 0; ch < capture.channels; ch++) {
+    sinkPrintf(sink, "$var wire 1 %c GPIO%d $end\n", '!' + ch, capture.pins[ch]);
+  }
+  sinkPrintf(sink, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+
+  uint8_t prev = sampleAt(0);
+  for (int ch = 0; ch < capture.channels; ch++) {
+    sinkPrintf(sink, "%d%c\n", (prev >> ch) & 1, '!' + ch);
+  }
+  sinkPrintf(sink, "$end\n");
+
+  // Value changes only, so idle lines cost nothing
+  for (uint32_t i = 1; i < capture.samples; i++) {
+    uint8_t sample = sampleAt(i);
+    uint8_t changed = sample ^ prev;
+    if (changed == 0) continue;
+    sinkPrintf(sink, "#%llu\n", sampleTimeNs(i));
+    for (int ch = 0; ch < capture.channels; ch++) {
+      if (changed & (1 << ch)) sinkPrintf(sink, "%d%c\n", (sample >> ch) & 1, '!' + ch);
+    }
+    prev = sample;
+  }
+  sinkPrintf(sink, "#%llu\n", sampleTimeNs(capture.samples));
+}
+
+static void put16(uint8_t* p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t* p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+struct ZipEntry {
+  const char* name;
+  uint32_t crc;
+  uint32_t size;
+  uint32_t offset;
+};
+
+// Local file header and central directory record of a stored (method 0)
+// entry dated 1980-01-01
+static void writeZipHeader(FileSink& sink, const ZipEntry& entry, bool central) {
+  uint8_t header[46] = {0};
+  uint16_t nameLen = strlen(entry.name);
+  uint8_t* p = header;
+  if (central) {
+    put32(p, 0x02014b50); p += 4;
+    put16(p, 20); p += 2;
+  } else {
+    put32(p, 0x04034b50); p += 4;
+  }
+  put16(p, 10); p += 2;      // version needed
+  p += 2 + 2 + 2;            // flags, method, time
+  put16(p, 0x21); p += 2;    // date
+  put32(p, entry.crc); p += 4;
+  put32(p, entry.size); p += 4;
+  put32(p, entry.size); p += 4;
+  put16(p, nameLen); p += 2;
+  p += 2;                    // extra length
+  if (central) {
+    p += 2 + 2 + 2 + 4;      // comment, disk, internal and external attributes
+    put32(p, entry.offset); p += 4;
+  }
+  sinkWrite(sink, header, p - header);
+  sinkWrite(sink, entry.name, nameLen);
+}
+
+// sigrok session: "version", "metadata" and the raw samples in "logic-1-1",
+// one byte per sample with probe n in bit n-1
+static void writeSigrok(FileSink& sink) {
+  uint32_t rate = capture.cpuHz / capture.periodCycles;
+  char rateText[24];
+  if (rate % 1000000 == 0) {
+    snprintf(rateText, sizeof(rateText), "%u MHz", rate / 1000000);
+  } else if (rate % 1000 == 0) {
+    snprintf(rateText, sizeof(rateText), "%u kHz", rate / 1000);
+  } else {
+    snprintf(rateText, sizeof(rateText), "%u Hz", rate);
+  }
+
+  String metadata = "[global]\nsigrok version=0.5.2\n\n[device 1]\ncapturefile=logic-1\n";
+  metadata += "total probes=" + String(capture.channels) + "\n";
+  metadata += "samplerate=" + String(rateText) + "\n";
+  metadata += "total analog=0\n";
+  for (int ch = 0; ch < capture.channels; ch++) {
+    metadata += "probe" + String(ch + 1) + "=GPIO" + String(capture.pins[ch]) + "\n";
+  }
+  metadata += "unitsize=1\n";
+
+  uint32_t tail = capture.samples - ringStart;
+  uint32_t crc = esp_rom_crc32_le(0, ring + ringStart, tail);
+  crc = esp_rom_crc32_le(crc, ring, ringStart);
+
+  ZipEntry entries[] = {
+    { "version", esp_rom_crc32_le(0, (const uint8_t*)"2", 1), 1, 0 },
+    { "metadata", esp_rom_crc32_le(0, (const uint8_t*)metadata.c_str(), metadata.length()),
+      metadata.length(), 0 },
+    { "logic-1-1", crc, capture.samples, 0 }
+  };
+
+  entries[0].offset = sink.total + sink.used;
+  writeZipHeader(sink, entries[0], false);
+  sinkWrite(sink, "2", 1);
+
+  entries[1].offset = sink.total + sink.used;
+  writeZipHeader(sink, entries[1], false);
+  sinkWrite(sink, metadata.c_str(), metadata.length());
+
+  entries[2].offset = sink.total + sink.used;
+  writeZipHeader(sink, entries[2], false);
+  sinkWrite(sink, ring + ringStart, tail);
+  sinkWrite(sink, ring, ringStart);
+
+  uint32_t directoryStart = sink.total + sink.used;
+  for (const ZipEntry& entry : entries) writeZipHeader(sink, entry, true);
+  uint32_t directorySize = sink.total + sink.used - directoryStart;
+
+  uint8_t end[22] = {0};
+  put32(end, 0x06054b50);
+  put16(end + 8, 3);
+  put16(end + 10, 3);
+  put32(end + 12, directorySize);
+  put32(end + 16, directoryStart);
+  sinkWrite(sink, end, sizeof(end));
+}
+
+static bool saveCapture() {
+  if (!SD.exists(LOGIC_CAPTURE_DIR)) SD.mkdir(LOGIC_CAPTURE_DIR);
+
+  int64_t oldSize = 0;
+  if (SD.exists(capture.path)) {
+    File old = SD.open(capture.path, FILE_READ);
+    if (old) {
+      oldSize = old.size();
+      old.close();
+    }
+  }
+
+  FileSink* sink = new (std::nothrow) FileSink();
+  if (!sink) {
+    lastError = "Out of memory";
+    return false;
+  }
+  sink->file = SD.open(capture.path, FILE_WRITE);
+  sink->ok = (bool)sink->file;
+  if (sink->ok) {
+    if (capture.vcd) writeVCD(*sink);
+    else writeSigrok(*sink);
+    sinkFlush(*sink);
+    sink->file.close();
+  }
+
+  bool ok = sink->ok;
+  fileBytes = sink->total;
+  delete sink;
+
+  adjustSDCardUsage(capture.path, (int64_t)fileBytes - oldSize);
+
+  if (!ok) lastError = "Failed to write " + capture.path;
+  return ok;
+}
+
+// ============================================
+// Capture Task
+// ============================================
+
+static void finishCapture(LogicState result) {
+  free(ring);
+  ring = nullptr;
+  finishedMs = millis();
+  state = result;
+}
+
+static void captureTask(void* param) {
+  // A bundle belongs to the core that created it, which this task is pinned to
+  dedic_gpio_bundle_config_t config = {};
+  config.gpio_array = capture.pins;
+  config.array_size = capture.channels;
+  config.flags.in_en = 1;
+
+  dedic_gpio_bundle_handle_t bundle = nullptr;
+  if (dedic_gpio_new_bundle(&config, &bundle) != ESP_OK) {
+    lastError = "No free dedicated GPIO channels";
+    LOG_ERROR("Logic capture: %s", lastError.c_str());
+    finishCapture(LOGIC_FAILED);
+    vTaskDelete(NULL);
+    return;
+  }
+
+  // Pins driven by OUTPUT mode have their input buffer off; enabling it
+  // leaves the output alone so a pin can be captured while driven
+  for (int ch = 0; ch < capture.channels; ch++) {
+    PIN_INPUT_ENABLE(GPIO_PIN_MUX_REG[capture.pins[ch]]);
+  }
+
+  uint32_t inMask = 0, shift = 0;
+  dedic_gpio_get_in_mask(bundle, &inMask);
+  dedic_gpio_get_in_offset(bundle, &shift);
+
+  uint32_t next = 0;
+  int32_t triggerIndex = waitForTrigger(inMask, shift, next);
+
+  if (triggerIndex >= 0) {
+    state = LOGIC_CAPTURING;
+    triggeredMs = millis();
+    uint32_t remaining = capture.samples - capture.preTrigger - 1;
+    uint64_t remainingUs = (uint64_t)remaining * capture.periodCycles / (capture.cpuHz / 1000000);
+    interruptsMasked = remainingUs <= LOGIC_MASKED_MAX_US;
+
+    if (interruptsMasked) portDISABLE_INTERRUPTS();
+    captureRemainder(triggerIndex, remaining, next, inMask, shift);
+    if (interruptsMasked) portENABLE_INTERRUPTS();
+
+    ringStart = (triggerIndex + capture.samples - capture.preTrigger) % capture.samples;
+  }
+
+  dedic_gpio_del_bundle(bundle);
+
+  if (triggerIndex == -1) {
+    LOG_INFO("Logic capture cancelled");
+    finishCapture(LOGIC_CANCELLED);
+  } else if (triggerIndex == -2) {
+    LOG_INFO("Logic capture: no trigger within %u ms", capture.timeoutMs);
+    finishCapture(LOGIC_TIMEOUT);
+  } else {
+    // Writing the file has no timing constraints
+    vTaskPrioritySet(NULL, 1);
+    state = LOGIC_SAVING;
+    bool ok = saveCapture();
+    LOG_INFO("Logic capture: %u samples on %d pins, %u late, %s %s",
+             capture.samples, capture.channels, lateSamples,
+             ok ? "saved to" : "failed to save", capture.path.c_str());
+    finishCapture(ok ? LOGIC_DONE : LOGIC_FAILED);
+  }
+  vTaskDelete(NULL);
+}
+
+// ============================================
+// Public API
+// ============================================
+
+static int parseCondition(const String& name) {
+  for (int i = 0; i < 5; i++) {
+    if (name.equalsIgnoreCase(conditionNames[i])) return i;
+  }
+  return TRIG_NONE;
+}
+
+// pins is a JSON array or a comma-separated list; returns 0 or an HTTP status
+static int parsePins(JsonVariantConst value, String& error) {
+  String list;
+  if (value.is<JsonArrayConst>()) {
+    for (JsonVariantConst pin : value.as<JsonArrayConst>()) {
+      list += pin.as<String>() + ",";
+    }
+  } else {
+    list = value.as<String>() + ",";
+  }
+
+  capture.channels = 0;
+  int start = 0;
+  for (int comma = list.indexOf(','); comma >= 0; comma = list.indexOf(',', start)) {
+    String item = list.substring(start, comma);
+    start = comma + 1;
+    item.trim();
+    if (item.length() == 0) continue;
+
+    int pin = item.toInt();
+    if (capture.channels == LOGIC_MAX_CHANNELS) {
+      error = "At most " + String(LOGIC_MAX_CHANNELS) + " pins";
+      return 400;
+    }
+    if (isReservedPin(pin) || !isUserPin(pin)) {
+      error = "Pin " + String(pin) + " is reserved for system use";
+      return 403;
+    }
+    for (int ch = 0; ch < capture.channels; ch++) {
+      if (capture.pins[ch] == pin) {
+        error = "Pin " + String(pin) + " listed twice";
+        return 400;
+      }
+    }
+    capture.conditions[capture.channels] = TRIG_NONE;
+    capture.pins[capture.channels++] = pin;
+  }
+  if (capture.channels == 0) {
+    error = "Missing pins";
+    return 400;
+  }
+  return 0;
+}
+
+// trigger is {"<pin>": "<condition>"} or "pin:condition,..."
+static bool parseTrigger(JsonVariantConst value, String& error) {
+  capture.levelMask = capture.levelValue = 0;
+  capture.riseMask = capture.fallMask = capture.changeMask = 0;
+  if (value.isNull()) return true;
+
+  JsonDocument parsed;
+  JsonObjectConst conditions;
+  if (value.is<JsonObjectConst>()) {
+    conditions = value.as<JsonObjectConst>();
+  } else {
+    String list = value.as<String>() + ",";
+    int start = 0;
+    for (int comma = list.indexOf(','); comma >= 0; comma = list.indexOf(',', start)) {
+      String item = list.substring(start, comma);
+      start = comma + 1;
+      int colon = item.indexOf(':');
+      if (colon > 0) parsed[item.substring(0, colon)] = item.substring(colon + 1);
+    }
+    conditions = parsed.as<JsonObjectConst>();
+  }
+
+  for (JsonPairConst kv : conditions) {
+    int pin = String(kv.key().c_str()).toInt();
+    int ch = 0;
+    while (ch < capture.channels && capture.pins[ch] != pin) ch++;
+    if (ch == capture.channels) {
+      error = "Trigger pin " + String(pin) + " is not captured";
+      return false;
+    }
+    int condition = parseCondition(kv.value().as<String>());
+    uint8_t bit = 1 << ch;
+    switch (condition) {
+      case TRIG_HIGH:    capture.levelMask |= bit; capture.levelValue |= bit; break;
+      case TRIG_LOW:     capture.levelMask |= bit; break;
+      case TRIG_RISING:  capture.riseMask |= bit; break;
+      case TRIG_FALLING: capture.fallMask |= bit; break;
+      case TRIG_CHANGE:  capture.changeMask |= bit; break;
+      default:
+        error = "Invalid trigger condition for pin " + String(pin);
+        return false;
+    }
+    capture.conditions[ch] = condition;
+  }
+  return true;
+}
+
+static String captureName(JsonVariantConst value) {
+  String name;
+  String requested = value.as<String>();
+  for (size_t i = 0; i < requested.length() && name.length() < 32; i++) {
+    char c = requested[i];
+    if (isalnum((unsigned char)c) || c == '_' || c == '-') name += c;
+  }
+  if (name.length() == 0) name = "capture_" + String(millis() / 1000);
+  return name;
+}
+
+int startLogicCapture(JsonVariantConst args, String& error) {
+  if (isLogicCaptureActive()) {
+    error = "A capture is already running";
+    return 409;
+  }
+  if (!isSDCardMounted()) {
+    error = "SD card not mounted";
+    return 503;
+  }
+
+  int code = parsePins(args["pins"], error);
+  if (code != 0) return code;
+  if (!parseTrigger(args["trigger"], error)) return 400;
+
+  int rate = apiArgInt(args["rate_hz"], LOGIC_DEFAULT_RATE_HZ);
+  int samples = apiArgInt(args["samples"], LOGIC_DEFAULT_SAMPLES);
+  int preTrigger = apiArgInt(args["pre_trigger"], 0);
+  int timeoutMs = apiArgInt(args["timeout_ms"], LOGIC_DEFAULT_TIMEOUT_MS);
+  String format = args["format"].isNull() ? String("vcd") : args["format"].as<String>();
+
+  // Sample timing follows the clock, so take it to full speed first
+  notePowerActivity();
+  uint32_t cpuHz = getCpuFrequencyMhz() * 1000000;
+  int maxRate = cpuHz / LOGIC_MIN_PERIOD_CYCLES;
+
+  if (rate < LOGIC_MIN_RATE_HZ || rate > maxRate) {
+    error = "rate_hz must be " + String(LOGIC_MIN_RATE_HZ) + ".." + String(maxRate);
+    return 400;
+  }
+  if (samples < LOGIC_MIN_SAMPLES || samples > LOGIC_MAX_SAMPLES) {
+    error = "samples must be " + String(LOGIC_MIN_SAMPLES) + ".." + String(LOGIC_MAX_SAMPLES);
+    return 400;
+  }
+  if ((uint64_t)samples * 1000 / rate > LOGIC_MAX_CAPTURE_MS) {
+    error = "Capture longer than " + String(LOGIC_MAX_CAPTURE_MS) + " ms; lower samples or raise rate_hz";
+    return 400;
+  }
+  if (preTrigger < 0 || preTrigger >= samples) {
+    error = "pre_trigger must be below samples";
+    return 400;
+  }
+  if (timeoutMs < 0 || timeoutMs > LOGIC_MAX_TIMEOUT_MS) {
+    error = "timeout_ms must be 0.." + String(LOGIC_MAX_TIMEOUT_MS);
+    return 400;
+  }
+  if (format != "vcd" && format != "sr") {
+    error = "format must be vcd or sr";
+    return 400;
+  }
+  if (ESP.getMaxAllocHeap() < (uint32_t)samples + LOGIC_HEAP_RESERVE) {
+    error = "Not enough memory for " + String(samples) + " samples";
+    return 503;
+  }
+
+  ring = (uint8_t*)malloc(samples);
+  if (!ring) {
+    error = "Out of memory";
+    return 503;
+  }
+
+  capture.cpuHz = cpuHz;
+  capture.periodCycles = (cpuHz + rate / 2) / rate;
+  capture.samples = samples;
+  capture.preTrigger = preTrigger;
+  capture.timeoutMs = timeoutMs;
+  capture.vcd = format == "vcd";
+  capture.path = String(LOGIC_CAPTURE_DIR) + "/" + captureName(args["file"]) + "." + format;
+
+  cancelRequested = false;
+  lateSamples = 0;
+  interruptsMasked = false;
+  fileBytes = 0;
+  lastError = "";
+  startedMs = millis();
+  triggeredMs = finishedMs = 0;
+  state = LOGIC_ARMED;
+
+  if (xTaskCreatePinnedToCore(captureTask, "logic", LOGIC_TASK_STACK, NULL,
+                              LOGIC_TASK_PRIORITY, NULL, LOGIC_TASK_CORE) != pdPASS) {
+    free(ring);
+    ring = nullptr;
+    state = LOGIC_IDLE;
+    error = "Failed to start capture task";
+    return 503;
+  }
+
+  LOG_INFO("Logic capture armed: %d pins, %u Hz, %u samples, %d pre-trigger",
+           capture.channels, cpuHz / capture.periodCycles, samples, preTrigger);
+  return 202;
+}
+
+// Takes effect at the next slice boundary while armed; a triggered capture
+// is short enough to finish
+bool cancelLogicCapture() {
+  if (state != LOGIC_ARMED) return false;
+  cancelRequested = true;
+  return true;
+}
+
+bool isLogicCaptureActive() {
+  return state == LOGIC_ARMED || state == LOGIC_CAPTURING || state == LOGIC_SAVING;
+}
+
+void getLogicCaptureStatus(JsonObject out) {
+  LogicState current = state;
+  out["state"] = stateNames[current];
+  if (current == LOGIC_IDLE) return;
+
+  JsonArray pins = out["pins"].to<JsonArray>();
+  JsonObject trigger = out["trigger"].to<JsonObject>();
+  for (int ch = 0; ch < capture.channels; ch++) {
+    pins.add(capture.pins[ch]);
+    if (capture.conditions[ch] != TRIG_NONE) {
+      trigger[String(capture.pins[ch])] = conditionNames[capture.conditions[ch]];
+    }
+  }
+  out["rate_hz"] = capture.cpuHz / capture.periodCycles;
+  out["samples"] = capture.samples;
+  out["pre_trigger"] = capture.preTrigger;
+  out["format"] = capture.vcd ? "vcd" : "sr";
+  out["file"] = capture.path;
+
+  if (current == LOGIC_ARMED) {
+    out["armed_ms"] = millis() - startedMs;
+    return;
+  }
+  if (triggeredMs) out["trigger_delay_ms"] = triggeredMs - startedMs;
+  if (current == LOGIC_DONE || current == LOGIC_FAILED) {
+    out["late_samples"] = lateSamples;
+    out["interrupts_masked"] = interruptsMasked;
+  }
+  if (current == LOGIC_DONE) out["bytes"] = fileBytes;
+  if (current == LOGIC_FAILED) out["error"] = lastError;
+}
@@ -0,0 +1,52 @@
+#ifndef LOGIC_ANALYZER_H
+#define LOGIC_ANALYZER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Logic-analyzer capture of up to LOGIC_MAX_CHANNELS user GPIOs.
+//
+// The pins are bound to a dedicated-GPIO bundle, whose state the CPU reads
+// in one instruction, and sampled by a loop paced on the cycle counter in a
+// task pinned to LOGIC_TASK_CORE. Each sample is one byte (bit n = nth pin)
+// in a ring buffer allocated for the capture. The ring runs until the
+// trigger matches with pre_trigger samples already held, then fills the
+// remainder. While armed the task sleeps for a tick every
+// LOGIC_ARM_SLICE_MS plus the pre-trigger span so the idle task and the
+// watchdog keep running; the pre-trigger count restarts after each sleep,
+// so the samples before the trigger are always contiguous.
+//
+// After the trigger, interrupts are masked if the rest of the capture takes
+// at most LOGIC_MASKED_MAX_US; longer captures run with interrupts enabled
+// and samples taken more than a period late are counted in late_samples.
+// The result is written to LOGIC_CAPTURE_DIR as VCD or as a sigrok session
+// (.sr: an uncompressed zip of metadata and raw logic-1-1), then freed.
+#define LOGIC_MAX_CHANNELS 8
+#define LOGIC_MIN_SAMPLES 64
+#define LOGIC_MAX_SAMPLES 65536
+#define LOGIC_DEFAULT_SAMPLES 16384
+#define LOGIC_DEFAULT_RATE_HZ 1000000
+#define LOGIC_MIN_RATE_HZ 1000
+#define LOGIC_MIN_PERIOD_CYCLES 20
+#define LOGIC_MAX_CAPTURE_MS 2000
+#define LOGIC_MAX_TIMEOUT_MS 60000
+#define LOGIC_DEFAULT_TIMEOUT_MS 10000
+#define LOGIC_ARM_SLICE_MS 200
+#define LOGIC_MASKED_MAX_US 20000
+#define LOGIC_HEAP_RESERVE (32 * 1024)
+#define LOGIC_TASK_STACK 4096
+#define LOGIC_TASK_PRIORITY 5
+#define LOGIC_TASK_CORE 0
+#define LOGIC_CAPTURE_DIR "/captures"
+
+// Validates the request and starts the capture task. On failure returns an
+// HTTP status and sets error: 400 bad arguments, 403 reserved pin, 409 a
+// capture is already running, 503 SD missing or not enough memory.
+int startLogicCapture(JsonVariantConst args, String& error);
+
+bool cancelLogicCapture();
+bool isLogicCaptureActive();
+
+void getLogicCaptureStatus(JsonObject out);
+
+#endif
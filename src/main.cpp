@@ -3,10 +3,22 @@
 #include <esp_system.h>
 #include "config.h"
 #include "storage.h"
+#include "sd_bench.h"
 #include "hardware.h"
 #include "wifi_manager.h"
 #include "api_server.h"
 #include "ota.h"
+#include "file_jobs.h"
+#include "kv_store.h"
+#include "rules_engine.h"
+#include "asset_cache.h"
+#include "flash_bundle.h"
+#include "file_manifest.h"
+#include "scheduler.h"
+#include "power_manager.h"
+#include "led_effects.h"
+#include "sensors.h"
+#include "recording_durability.h"
 
 void printSystemInfo() {
   Serial.println("\n==================================================");
@@ -35,6 +47,23 @@ void printSystemInfo() {
   LOG_INFO("Free Sketch Space: %d bytes", ESP.getFreeSketchSpace());
 }
 
+void monitorWiFi() {
+  if (WiFi.getMode() == WIFI_STA && WiFi.status() != WL_CONNECTED) {
+    LOG_WARN("WiFi disconnected, attempting reconnect...");
+    WiFi.reconnect();
+  }
+}
+
+void monitorHeap() {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  
+  if (freeHeap < 10000) {
+    LOG_ERROR("Low memory warning! Free heap: %d bytes", freeHeap);
+  }
+}
+
+// Unit tests bring their own setup() and loop()
+#ifndef PIO_UNIT_TESTING
 void setup() {
   auto cfg = M5.config();
   M5.begin(cfg);
@@ -44,55 +73,39 @@ void setup() {
   
   printSystemInfo();
   
+  initScheduler();
   setupSDCard();
+  initSDBench();
+  initFlashBundle();
+  initKvStore();
+  initAssetCache();
+  initFileManifest();
+  initFileJobs();
+  initRecordingDurability();
   setupMicrophone();
+  startHardwareService();
+  initLedEffects();
+  initSensors();
+  initRulesEngine();
   initWiFiConfig();
   setupWiFi();
+  initPowerManager();
   setupWebServer();
   initOTA();
   
+  addSchedulerTask("kv_store", serviceKvStore, 1000, SCHEDULER_PRIORITY_LOW);
+  addSchedulerTask("wifi_monitor", monitorWiFi, 30000, SCHEDULER_PRIORITY_NORMAL);
+  addSchedulerTask("heap_monitor", monitorHeap, 90000, SCHEDULER_PRIORITY_LOW);
+  
   Serial.println("==================================================");
   LOG_INFO("System Ready!");
   LOG_INFO("Free Heap After Init: %d bytes", ESP.getFreeHeap());
   Serial.println("==================================================\n");
 }
 
-void monitorWiFi() {
-  static unsigned long lastCheck = 0;
-  unsigned long now = millis();
-  
-  if (now - lastCheck > 30000) {
-    lastCheck = now;
-    if (WiFi.getMode() == WIFI_STA && WiFi.status() != WL_CONNECTED) {
-      LOG_WARN("WiFi disconnected, attempting reconnect...");
-      WiFi.reconnect();
-    }
-  }
-}
-
-void monitorHeap() {
-  static unsigned long lastHeapCheck = 0;
-  unsigned long now = millis();
-  
-  if (now - lastHeapCheck > 90000) {
-    lastHeapCheck = now;
-    uint32_t freeHeap = ESP.getFreeHeap();
-    
-    if (freeHeap < 10000) {
-      LOG_ERROR("Low memory warning! Free heap: %d bytes", freeHeap);
-    }
-  }
-}
-
+// OTA registers its own event-driven task (see scheduler.h); recording runs
+// on the hardware service task
 void loop() {
-  handleOTA();
-  
-  if (!isOTAPending()) {
-    processRecording();
-    monitorWiFi();
-    monitorHeap();
-  }
-  
-  delay(100);
-  yield();
+  runScheduler();
 }
+#endif
@@ -0,0 +1,130 @@
+#ifndef MIME_TYPES_H
+#define MIME_TYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Extension -> Content-Type table for the static file handler.
+// The hash seed is searched at compile time so every extension lands in its
+// own slot: a lookup is one hash of the extension plus one string compare.
+
+struct MimeEntry {
+  const char* ext;
+  const char* type;
+};
+
+constexpr MimeEntry MIME_ENTRIES[] = {
+  {"html", "text/html"},
+  {"htm", "text/html"},
+  {"css", "text/css"},
+  {"js", "application/javascript"},
+  {"json", "application/json"},
+  {"png", "image/png"},
+  {"jpg", "image/jpeg"},
+  {"jpeg", "image/jpeg"},
+  {"gif", "image/gif"},
+  {"svg", "image/svg+xml"},
+  {"ico", "image/x-icon"},
+  {"txt", "text/plain"},
+  {"pdf", "application/pdf"},
+  {"xml", "text/xml"},
+  {"zip", "application/zip"},
+  {"mp3", "audio/mpeg"},
+  {"mp4", "video/mp4"},
+  {"woff", "font/woff"},
+  {"woff2", "font/woff2"},
+  {"ttf", "font/ttf"},
+  {"wav", "audio/wav"},
+  {"yaml", "text/yaml"},
+  {"csv", "text/csv"},
+};
+
+#define MIME_DEFAULT_TYPE "application/octet-stream"
+#define MIME_TABLE_SIZE 64  // power of two
+#define MIME_SLOT_EMPTY 0xFF
+#define MIME_MAX_EXT_LEN 8
+
+constexpr size_t MIME_ENTRY_COUNT = sizeof(MIME_ENTRIES) / sizeof(MIME_ENTRIES[0]);
+static_assert(MIME_ENTRY_COUNT < MIME_SLOT_EMPTY, "MIME table index must fit in uint8_t");
+
+constexpr char mimeLower(char c) {
+  return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+// FNV-1a over the lowercased extension, mixed with a seed
+constexpr uint32_t mimeHash(const char* ext, size_t len, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (uint8_t)mimeLower(ext[i]);
+    h *= 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+constexpr size_t mimeStrLen(const char* s) {
+  size_t n = 0;
+  while (s[n]) n++;
+  return n;
+}
+
+constexpr bool mimeSeedIsPerfect(uint32_t seed) {
+  bool used[MIME_TABLE_SIZE] = {};
+  for (size_t i = 0; i < MIME_ENTRY_COUNT; i++) {
+    size_t slot = mimeHash(MIME_ENTRIES[i].ext, mimeStrLen(MIME_ENTRIES[i].ext), seed) & (MIME_TABLE_SIZE - 1);
+    if (used[slot]) return false;
+    used[slot] = true;
+  }
+  return true;
+}
+
+constexpr uint32_t findMimeSeed() {
+  for (uint32_t seed = 1; seed < 100000; seed++) {
+    if (mimeSeedIsPerfect(seed)) return seed;
+  }
+  return 0;
+}
+
+constexpr uint32_t MIME_SEED = findMimeSeed();
+static_assert(MIME_SEED != 0, "No perfect hash seed for MIME table - increase MIME_TABLE_SIZE");
+
+struct MimeTable {
+  uint8_t slots[MIME_TABLE_SIZE];
+};
+
+constexpr MimeTable buildMimeTable() {
+  MimeTable table = {};
+  for (size_t i = 0; i < MIME_TABLE_SIZE; i++) {
+    table.slots[i] = MIME_SLOT_EMPTY;
+  }
+  for (size_t i = 0; i < MIME_ENTRY_COUNT; i++) {
+    size_t slot = mimeHash(MIME_ENTRIES[i].ext, mimeStrLen(MIME_ENTRIES[i].ext), MIME_SEED) & (MIME_TABLE_SIZE - 1);
+    table.slots[slot] = (uint8_t)i;
+  }
+  return table;
+}
+
+constexpr MimeTable MIME_TABLE = buildMimeTable();
+
+// Content type for a path, based on the extension of its last segment
+inline const char* getMimeType(const char* path) {
+  const char* ext = nullptr;
+  for (const char* p = path; *p; p++) {
+    if (*p == '.') ext = p + 1;
+    else if (*p == '/') ext = nullptr;
+  }
+  if (!ext) return MIME_DEFAULT_TYPE;
+
+  size_t len = mimeStrLen(ext);
+  if (len == 0 || len > MIME_MAX_EXT_LEN) return MIME_DEFAULT_TYPE;
+
+  uint8_t index = MIME_TABLE.slots[mimeHash(ext, len, MIME_SEED) & (MIME_TABLE_SIZE - 1)];
+  if (index == MIME_SLOT_EMPTY) return MIME_DEFAULT_TYPE;
+
+  const char* candidate = MIME_ENTRIES[index].ext;
+  for (size_t i = 0; i <= len; i++) {
+    if (mimeLower(ext[i]) != candidate[i]) return MIME_DEFAULT_TYPE;
+  }
+  return MIME_ENTRIES[index].type;
+}
+
+#endif
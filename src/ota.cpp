@@ -1,14 +1,19 @@
 #include "ota.h"
 #include "config.h"
 #include "hardware.h"
+#include "scheduler.h"
 #include <Update.h>
 #include <SD.h>
 #include <WiFi.h>
 
 static bool otaPending = false;
 static String otaFirmwarePath = "";
+static int otaTask = -1;
 
 void initOTA() {
+  // Runs only when an update is scheduled, ahead of everything else
+  otaTask = addSchedulerTask("ota", handleOTA, 0, SCHEDULER_PRIORITY_HIGH);
+  
   #ifdef OTA_PASSWORD
   LOG_INFO("🔄 OTA Updates: ENABLED (password protected)");
   #else
@@ -20,6 +25,7 @@ void scheduleOTAUpdate(const String& firmwarePath) {
   otaFirmwarePath = firmwarePath;
   otaPending = true;
   LOG_INFO("OTA update scheduled: %s", firmwarePath.c_str());
+  signalSchedulerTask(otaTask);
 }
 
 bool isOTAPending() {
@@ -38,6 +44,9 @@ void handleOTA() {
   LOG_INFO("Free heap before cleanup: %d bytes", ESP.getFreeHeap());
   
   stopRecording();
+  if (!waitForRecordingStop(2000)) {
+    LOG_WARN("Recording did not stop before the update");
+  }
   WiFi.disconnect(false);
   delay(500);
   
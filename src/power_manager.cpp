@@ -0,0 +1,205 @@
+#include "power_manager.h"
+#include "config.h"
+#include "hardware.h"
+#include "ota.h"
+#include "logic_analyzer.h"
+#include "request_governor.h"
+#include "scheduler.h"
+#include <WiFi.h>
+#include <esp_timer.h>
+
+static const char* const levelNames[POWER_LEVEL_COUNT] = { "performance", "balanced", "idle" };
+static const uint32_t levelMhz[POWER_LEVEL_COUNT] = {
+  POWER_MHZ_PERFORMANCE, POWER_MHZ_BALANCED, POWER_MHZ_IDLE
+};
+
+static SemaphoreHandle_t powerMutex = nullptr;
+static volatile PowerLevel currentLevel = POWER_PERFORMANCE;
+static int pinnedLevel = -1;          // -1 = automatic
+static volatile uint32_t lastActivityMs = 0;
+static volatile uint32_t activityCount = 0;
+static uint32_t lastTickActivity = 0;
+static float requestRate = 0;         // smoothed activity per second
+
+static uint32_t levelSinceMs = 0;
+static uint64_t levelTimeMs[POWER_LEVEL_COUNT];
+static uint32_t transitions = 0;
+static uint32_t rampUps = 0;
+static uint64_t rampUpTotalUs = 0;
+static uint32_t rampUpMaxUs = 0;
+
+// Modem sleep is only allowed in pure station mode
+static void applyWiFiSleep(PowerLevel level) {
+  if (WiFi.getMode() != WIFI_STA) return;
+  WiFi.setSleep(level == POWER_IDLE ? WIFI_PS_MIN_MODEM : WIFI_PS_NONE);
+}
+
+// Caller holds powerMutex
+static void applyLevel(PowerLevel level) {
+  if (level == currentLevel) return;
+
+  uint32_t now = millis();
+  levelTimeMs[currentLevel] += now - levelSinceMs;
+  levelSinceMs = now;
+
+  setCpuFrequencyMhz(levelMhz[level]);
+  applyWiFiSleep(level);
+  currentLevel = level;
+  transitions++;
+}
+
+static bool isBusy() {
+  return isRecording() || isOTAPending() || isLogicCaptureActive() || getActiveRequestCount() > 0 ||
+         requestRate >= POWER_BUSY_RATE;
+}
+
+static void powerTick() {
+  uint32_t count = activityCount;
+  float perSecond = (count - lastTickActivity) * 1000.0f / POWER_TICK_MS;
+  lastTickActivity = count;
+  requestRate = requestRate * 0.5f + perSecond * 0.5f;
+
+  xSemaphoreTake(powerMutex, portMAX_DELAY);
+  if (pinnedLevel >= 0) {
+    applyLevel((PowerLevel)pinnedLevel);
+  } else {
+    uint32_t quietMs = millis() - lastActivityMs;
+    PowerLevel target = POWER_IDLE;
+    if (isBusy() || quietMs < POWER_BALANCED_AFTER_MS) target = POWER_PERFORMANCE;
+    else if (quietMs < POWER_IDLE_AFTER_MS) target = POWER_BALANCED;
+
+    // Step down one level per tick so short lulls don't reach idle
+    if (target > currentLevel) target = (PowerLevel)(currentLevel + 1);
+    applyLevel(target);
+  }
+  xSemaphoreGive(powerMutex);
+}
+
+void initPowerManager() {
+  powerMutex = xSemaphoreCreateMutex();
+  lastActivityMs = millis();
+  levelSinceMs = millis();
+  currentLevel = POWER_PERFORMANCE;
+  setCpuFrequencyMhz(POWER_MHZ_PERFORMANCE);
+  applyWiFiSleep(POWER_PERFORMANCE);
+
+  addSchedulerTask("power", powerTick, POWER_TICK_MS, SCHEDULER_PRIORITY_LOW);
+  LOG_INFO("Power manager: %d/%d/%d MHz, idle after %d s",
+           POWER_MHZ_PERFORMANCE, POWER_MHZ_BALANCED, POWER_MHZ_IDLE, POWER_IDLE_AFTER_MS / 1000);
+}
+
+void notePowerActivity() {
+  lastActivityMs = millis();
+  activityCount++;
+
+  if (!powerMutex || currentLevel == POWER_PERFORMANCE || pinnedLevel >= 0) return;
+
+  int64_t start = esp_timer_get_time();
+  xSemaphoreTake(powerMutex, portMAX_DELAY);
+  bool switched = currentLevel != POWER_PERFORMANCE && pinnedLevel < 0;
+  if (switched) applyLevel(POWER_PERFORMANCE);
+  xSemaphoreGive(powerMutex);
+
+  if (switched) {
+    uint32_t elapsedUs = (uint32_t)(esp_timer_get_time() - start);
+    rampUps++;
+    rampUpTotalUs += elapsedUs;
+    if (elapsedUs > rampUpMaxUs) rampUpMaxUs = elapsedUs;
+  }
+}
+
+bool setPowerMode(const String& mode) {
+  int level = -2;
+  if (mode == "auto") level = -1;
+  for (int i = 0; i < POWER_LEVEL_COUNT; i++) {
+    if (mode == levelNames[i]) level = i;
+  }
+  if (level == -2) return false;
+
+  xSemaphoreTake(powerMutex, portMAX_DELAY);
+  pinnedLevel = level;
+  applyLevel(level >= 0 ? (PowerLevel)level : POWER_PERFORMANCE);
+  xSemaphoreGive(powerMutex);
+
+  LOG_INFO("Power mode: %s", mode.c_str());
+  return true;
+}
+
+void getPowerStats(JsonObject out) {
+  xSemaphoreTake(powerMutex, portMAX_DELAY);
+  uint32_t now = millis();
+  out["level"] = levelNames[currentLevel];
+  out["mode"] = pinnedLevel >= 0 ? levelNames[pinnedLevel] : "auto";
+  out["cpu_mhz"] = getCpuFrequencyMhz();
+  out["modem_sleep"] = currentLevel == POWER_IDLE && WiFi.getMode() == WIFI_STA;
+  out["request_rate"] = requestRate;
+  out["quiet_ms"] = now - lastActivityMs;
+  out["transitions"] = transitions;
+
+  JsonObject time = out["time_ms"].to<JsonObject>();
+  for (int i = 0; i < POWER_LEVEL_COUNT; i++) {
+    uint64_t ms = levelTimeMs[i];
+    if (i == currentLevel) ms += now - levelSinceMs;
+    time[levelNames[i]] = ms;
+  }
+  xSemaphoreGive(powerMutex);
+
+  JsonObject ramp = out["ramp_up"].to<JsonObject>();
+  ramp["count"] = rampUps;
+  ramp["avg_us"] = rampUps ? (uint32_t)(rampUpTotalUs / rampUps) : 0;
+  ramp["max_us"] = rampUpMaxUs;
+}
+
+// ============================================
+// Benchmark
+// ============================================
+
+// Hashes a RAM buffer; stands in for handler work such as JSON encoding
+static uint32_t runWorkload(const uint8_t* buffer, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (int round = 0; round < 16; round++) {
+    for (size_t i = 0; i < size; i++) {
+      hash ^= buffer[i];
+      hash *= 16777619u;
+    }
+  }
+  return hash;
+}
+
+void runPowerBenchmark(uint32_t iterations, JsonObject out) {
+  static uint8_t buffer[4096];
+  for (size_t i = 0; i < sizeof(buffer); i++) buffer[i] = i * 31;
+
+  out["iterations"] = iterations;
+  volatile uint32_t sink = 0;
+
+  xSemaphoreTake(powerMutex, portMAX_DELAY);
+  PowerLevel restore = currentLevel;
+
+  JsonObject workload = out["workload_us"].to<JsonObject>();
+  for (int level = 0; level < POWER_LEVEL_COUNT; level++) {
+    applyLevel((PowerLevel)level);
+    int64_t start = esp_timer_get_time();
+    sink = sink + runWorkload(buffer, sizeof(buffer));
+    workload[levelNames[level]] = (uint32_t)(esp_timer_get_time() - start);
+  }
+
+  // The same switch notePowerActivity() makes when a request arrives at idle
+  uint64_t totalUs = 0;
+  uint32_t maxUs = 0;
+  for (uint32_t n = 0; n < iterations; n++) {
+    applyLevel(POWER_IDLE);
+    int64_t start = esp_timer_get_time();
+    applyLevel(POWER_PERFORMANCE);
+    uint32_t elapsedUs = (uint32_t)(esp_timer_get_time() - start);
+    totalUs += elapsedUs;
+    if (elapsedUs > maxUs) maxUs = elapsedUs;
+  }
+
+  applyLevel(restore);
+  xSemaphoreGive(powerMutex);
+
+  JsonObject ramp = out["ramp_up"].to<JsonObject>();
+  ramp["avg_us"] = (uint32_t)(totalUs / iterations);
+  ramp["max_us"] = maxUs;
+}
@@ -0,0 +1,48 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Load-adaptive CPU clock and WiFi power save.
+//
+//   performance  240 MHz, modem sleep off
+//   balanced     160 MHz, modem sleep off
+//   idle          80 MHz, modem sleep (DTIM) when in station mode
+//
+// Any admitted HTTP request or recording start jumps straight to performance from
+// the calling task. A once-a-second scheduler task steps back down after
+// POWER_BALANCED_AFTER_MS / POWER_IDLE_AFTER_MS without activity, and holds
+// performance while requests are in flight, a recording or logic capture
+// runs or the request rate stays above POWER_BUSY_RATE. APB stays at 80 MHz at every level, so
+// SPI, I2S and UART clocks are unaffected by the switches.
+#define POWER_MHZ_PERFORMANCE 240
+#define POWER_MHZ_BALANCED 160
+#define POWER_MHZ_IDLE 80
+#define POWER_TICK_MS 1000
+#define POWER_BALANCED_AFTER_MS 2000
+#define POWER_IDLE_AFTER_MS 15000
+#define POWER_BUSY_RATE 2.0f
+#define POWER_BENCH_MAX 20
+
+enum PowerLevel {
+  POWER_PERFORMANCE = 0,
+  POWER_BALANCED = 1,
+  POWER_IDLE = 2,
+  POWER_LEVEL_COUNT
+};
+
+void initPowerManager();
+
+// Cheap when already at full speed; safe from any task
+void notePowerActivity();
+
+// "auto" lets the governor decide; a level name pins that level
+bool setPowerMode(const String& mode);
+
+void getPowerStats(JsonObject out);
+
+// Times ramp-ups from idle and a fixed workload at each level
+void runPowerBenchmark(uint32_t iterations, JsonObject out);
+
+#endif
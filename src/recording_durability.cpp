@@ -0,0 +1,487 @@
+#include "recording_durability.h"
+#include "config.h"
+#include "hardware.h"
+#include "storage.h"
+#include <SD.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+
+#define JOURNAL_MAGIC "WJN1"
+
+enum DurabilityPolicy {
+  DURABILITY_NONE,
+  DURABILITY_PERIODIC,
+  DURABILITY_JOURNAL
+};
+
+static const char* policyNames[] = { "none", "periodic", "journal" };
+
+struct DurabilityConfig {
+  DurabilityPolicy policy;
+  uint32_t commitMs;
+  uint32_t commitBytes;
+};
+
+struct JournalRecord {
+  uint32_t dataSize;
+  uint32_t crc;  // over dataSize
+};
+
+// Write and commit time of the current (or last) recording
+struct CommitStats {
+  uint32_t bytes;
+  uint32_t committedBytes;
+  uint32_t commits;
+  uint32_t failures;
+  uint64_t writeUs;
+  uint64_t commitUs;
+  uint32_t maxCommitUs;
+};
+
+static DurabilityConfig config = {
+  DURABILITY_PERIODIC, DURABILITY_DEFAULT_COMMIT_MS, DURABILITY_DEFAULT_COMMIT_BYTES
+};
+
+static DurabilityPolicy activePolicy = DURABILITY_NONE;
+static File journal;
+static String journalPath;
+static uint32_t lastCommitMs = 0;
+static uint32_t uncommitted = 0;
+static CommitStats stats;
+static bool haveStats = false;
+static JsonDocument recovery;
+
+static void putLE32(uint8_t* out, uint32_t value) {
+  out[0] = value;
+  out[1] = value >> 8;
+  out[2] = value >> 16;
+  out[3] = value >> 24;
+}
+
+static uint32_t getLE32(const uint8_t* in) {
+  return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static uint32_t journalCrc(uint32_t dataSize) {
+  return esp_rom_crc32_le(0, (const uint8_t*)&dataSize, sizeof(dataSize));
+}
+
+// ============================================
+// Commit
+// ============================================
+
+// RIFF and data chunk sizes of the canonical 44-byte header
+static bool patchWavSizes(File& wav, uint32_t dataSize) {
+  uint8_t riffSize[4], dataBytes[4];
+  putLE32(riffSize, dataSize + WAV_HEADER_BYTES - 8);
+  putLE32(dataBytes, dataSize);
+
+  size_t end = wav.position();
+  bool ok = wav.seek(4) && wav.write(riffSize, 4) == 4 &&
+            wav.seek(40) && wav.write(dataBytes, 4) == 4;
+  wav.seek(end);
+  return ok;
+}
+
+static bool commit(DurabilityPolicy policy, File& wav, File& jnl, uint32_t dataSize) {
+  if (policy == DURABILITY_PERIODIC) {
+    // One sync writes the patched header, the data and the directory entry
+    bool ok = patchWavSizes(wav, dataSize);
+    wav.flush();
+    return ok;
+  }
+  if (policy == DURABILITY_JOURNAL) {
+    // The data must be on the card before the record that vouches for it
+    wav.flush();
+    JournalRecord record = { dataSize, journalCrc(dataSize) };
+    bool ok = jnl.write((const uint8_t*)&record, sizeof(record)) == sizeof(record);
+    jnl.flush();
+    return ok;
+  }
+  return true;
+}
+
+static void removeFile(const String& path) {
+  File file = SD.open(path, FILE_READ);
+  if (!file) return;
+  size_t size = file.size();
+  file.close();
+  if (SD.remove(path)) adjustSDCardUsage(path, -(int64_t)size);
+}
+
+void beginRecordingCommits(File& wav, const String& path) {
+  activePolicy = config.policy;
+  stats = CommitStats();
+  haveStats = true;
+  uncommitted = 0;
+  lastCommitMs = millis();
+  if (activePolicy == DURABILITY_NONE) return;
+
+  // Header and directory entry go to the card before any audio
+  wav.flush();
+
+  if (activePolicy == DURABILITY_JOURNAL) {
+    journalPath = path + JOURNAL_SUFFIX;
+    journal = SD.open(journalPath, FILE_WRITE);
+    if (!journal || journal.write((const uint8_t*)JOURNAL_MAGIC, 4) != 4) {
+      LOG_WARN("Recording: cannot create %s, using periodic commits", journalPath.c_str());
+      journal.close();
+      activePolicy = DURABILITY_PERIODIC;
+      return;
+    }
+    journal.flush();
+    adjustSDCardUsage(journalPath, 4);
+  }
+}
+
+void noteRecordingWrite(File& wav, uint32_t dataSize, uint32_t written, uint32_t writeUs) {
+  stats.bytes += written;
+  stats.writeUs += writeUs;
+  uncommitted += written;
+  if (activePolicy == DURABILITY_NONE) return;
+  if (uncommitted < config.commitBytes && millis() - lastCommitMs < config.commitMs) return;
+
+  int64_t start = esp_timer_get_time();
+  if (commit(activePolicy, wav, journal, dataSize)) {
+    stats.committedBytes = dataSize;
+  } else {
+    stats.failures++;
+  }
+  if (activePolicy == DURABILITY_JOURNAL) adjustSDCardUsage(journalPath, sizeof(JournalRecord));
+  uint32_t us = esp_timer_get_time() - start;
+
+  stats.commits++;
+  stats.commitUs += us;
+  if (us > stats.maxCommitUs) stats.maxCommitUs = us;
+  uncommitted = 0;
+  lastCommitMs = millis();
+}
+
+// The final header is written; the journal has nothing left to vouch for
+void endRecordingCommits(const String& path) {
+  stats.committedBytes = stats.bytes;
+  if (activePolicy == DURABILITY_JOURNAL) {
+    journal.close();
+    removeFile(journalPath);
+  }
+}
+
+// ============================================
+// Recovery
+// ============================================
+
+// Last intact record; a torn append at the end is skipped
+static bool readJournal(const String& path, uint32_t& dataSize) {
+  File file = SD.open(path, FILE_READ);
+  if (!file) return false;
+
+  bool found = false;
+  char magic[4];
+  if (file.read((uint8_t*)magic, 4) == 4 && memcmp(magic, JOURNAL_MAGIC, 4) == 0) {
+    size_t count = (file.size() - 4) / sizeof(JournalRecord);
+    while (count-- > 0 && !found) {
+      JournalRecord record;
+      file.seek(4 + count * sizeof(JournalRecord));
+      if (file.read((uint8_t*)&record, sizeof(record)) == sizeof(record) &&
+          record.crc == journalCrc(record.dataSize)) {
+        dataSize = record.dataSize;
+        found = true;
+      }
+    }
+  }
+  file.close();
+  return found;
+}
+
+enum RepairResult {
+  REPAIR_CLEAN,
+  REPAIR_FIXED,
+  REPAIR_SKIPPED
+};
+
+// Only the canonical header this firmware writes is touched. A header that
+// was never finished (data size 0), claims more than the file holds or has
+// a journal next to it is set to the committed length: the journal's last
+// record when there is one, else everything the card kept, in whole samples.
+static RepairResult repairWav(const String& path, uint32_t& dataSize) {
+  uint32_t journalSize = 0;
+  bool haveJournal = readJournal(path + JOURNAL_SUFFIX, journalSize);
+
+  File wav = SD.open(path, "r+");
+  if (!wav) return REPAIR_SKIPPED;
+
+  uint8_t header[WAV_HEADER_BYTES];
+  size_t size = wav.size();
+  if (size < WAV_HEADER_BYTES || wav.read(header, WAV_HEADER_BYTES) != WAV_HEADER_BYTES ||
+      memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVEfmt ", 8) != 0 ||
+      getLE32(header + 16) != 16 || memcmp(header + 36, "data", 4) != 0) {
+    wav.close();
+    return REPAIR_SKIPPED;
+  }
+
+  uint32_t available = size - WAV_HEADER_BYTES;
+  uint32_t claimed = getLE32(header + 40);
+  if (!haveJournal && claimed != 0 && claimed <= available) {
+    wav.close();
+    return REPAIR_CLEAN;
+  }
+
+  uint16_t blockAlign = header[32] | (header[33] << 8);
+  dataSize = haveJournal && journalSize < available ? journalSize : available;
+  if (blockAlign > 1) dataSize -= dataSize % blockAlign;
+  if (claimed == dataSize && getLE32(header + 4) == dataSize + WAV_HEADER_BYTES - 8) {
+    wav.close();
+    return REPAIR_CLEAN;
+  }
+
+  bool ok = patchWavSizes(wav, dataSize);
+  wav.close();
+  if (!ok) return REPAIR_SKIPPED;
+  adjustSDCardUsage(path, 0);
+  return REPAIR_FIXED;
+}
+
+// One at a time, rescanning after each, so entries are never removed from
+// a directory that is being walked
+static uint32_t removeJournals() {
+  uint32_t removed = 0;
+  while (true) {
+    File dir = SD.open(RECORDINGS_DIR);
+    if (!dir) return removed;
+
+    String found;
+    File entry = dir.openNextFile();
+    while (entry && found.isEmpty()) {
+      String name = entry.name();
+      if (!entry.isDirectory() && name.endsWith(JOURNAL_SUFFIX)) {
+        found = String(RECORDINGS_DIR) + "/" + name;
+      }
+      entry.close();
+      if (found.isEmpty()) entry = dir.openNextFile();
+    }
+    dir.close();
+
+    if (found.isEmpty()) return removed;
+    removeFile(found);
+    if (SD.exists(found)) {
+      LOG_ERROR("Recovery: cannot remove %s", found.c_str());
+      return removed;
+    }
+    removed++;
+  }
+}
+
+void recoverRecordings() {
+  uint32_t startMs = millis();
+  uint32_t checked = 0, repaired = 0, skipped = 0;
+  recovery.clear();
+  JsonObject out = recovery.to<JsonObject>();
+  JsonArray files = out["repaired_files"].to<JsonArray>();
+
+  File dir = SD.open(RECORDINGS_DIR);
+  if (dir && dir.isDirectory()) {
+    File entry = dir.openNextFile();
+    while (entry) {
+      String name = entry.name();
+      bool isWav = !entry.isDirectory() && name.endsWith(".wav");
+      entry.close();
+
+      if (isWav) {
+        String path = String(RECORDINGS_DIR) + "/" + name;
+        uint32_t dataSize = 0;
+        checked++;
+        switch (repairWav(path, dataSize)) {
+          case REPAIR_FIXED: {
+            repaired++;
+            JsonObject item = files.add<JsonObject>();
+            item["path"] = path;
+            item["data_bytes"] = dataSize;
+            LOG_WARN("Recovery: repaired %s (%u data bytes)", path.c_str(), dataSize);
+            break;
+          }
+          case REPAIR_SKIPPED:
+            skipped++;
+            break;
+          default:
+            break;
+        }
+      }
+      entry = dir.openNextFile();
+    }
+  }
+  dir.close();
+
+  out["checked"] = checked;
+  out["repaired"] = repaired;
+  out["skipped"] = skipped;
+  out["journals_removed"] = removeJournals();
+  out["duration_ms"] = millis() - startMs;
+  LOG_INFO("Recovery: %u recordings checked, %u repaired in %u ms",
+           checked, repaired, millis() - startMs);
+}
+
+// ============================================
+// Configuration
+// ============================================
+
+static int parseDurability(JsonVariantConst json, DurabilityConfig& next, String& error) {
+  if (!json["policy"].isNull()) {
+    String name = json["policy"] | "";
+    int index = -1;
+    for (int i = 0; i <= DURABILITY_JOURNAL; i++) {
+      if (name == policyNames[i]) index = i;
+    }
+    if (index < 0) {
+      error = "policy must be none, periodic or journal";
+      return 400;
+    }
+    next.policy = (DurabilityPolicy)index;
+  }
+  if (!json["commit_ms"].isNull()) {
+    next.commitMs = json["commit_ms"].as<uint32_t>();
+    if (next.commitMs < DURABILITY_MIN_COMMIT_MS) {
+      error = "commit_ms must be at least " + String(DURABILITY_MIN_COMMIT_MS);
+      return 400;
+    }
+  }
+  if (!json["commit_bytes"].isNull()) {
+    next.commitBytes = json["commit_bytes"].as<uint32_t>();
+    if (next.commitBytes < DURABILITY_MIN_COMMIT_BYTES) {
+      error = "commit_bytes must be at least " + String(DURABILITY_MIN_COMMIT_BYTES);
+      return 400;
+    }
+  }
+  return 200;
+}
+
+static bool saveDurability() {
+  JsonDocument doc;
+  doc["policy"] = policyNames[config.policy];
+  doc["commit_ms"] = config.commitMs;
+  doc["commit_bytes"] = config.commitBytes;
+  File file = SD.open(PATH_RECORDING_DURABILITY, FILE_WRITE);
+  if (!file) return false;
+  size_t written = serializeJson(doc, file);
+  file.close();
+  adjustSDCardUsage(PATH_RECORDING_DURABILITY, 0);
+  return written > 0;
+}
+
+void initRecordingDurability() {
+  File file = SD.open(PATH_RECORDING_DURABILITY, FILE_READ);
+  if (file) {
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, file);
+    file.close();
+
+    DurabilityConfig next = config;
+    String message;
+    if (error) {
+      LOG_ERROR("Recording: invalid %s: %s", PATH_RECORDING_DURABILITY, error.c_str());
+    } else if (parseDurability(doc.as<JsonVariantConst>(), next, message) != 200) {
+      LOG_ERROR("Recording: %s in %s", message.c_str(), PATH_RECORDING_DURABILITY);
+    } else {
+      config = next;
+    }
+  }
+
+  recoverRecordings();
+}
+
+int setRecordingDurability(JsonVariantConst args, String& error) {
+  if (isRecording()) {
+    error = "Recording in progress";
+    return 409;
+  }
+
+  DurabilityConfig next = config;
+  int code = parseDurability(args, next, error);
+  if (code != 200) return code;
+
+  config = next;
+  if (!saveDurability()) {
+    error = "Cannot write " + String(PATH_RECORDING_DURABILITY);
+    return 500;
+  }
+  LOG_INFO("Recording durability: %s", policyNames[config.policy]);
+  return 200;
+}
+
+void getRecordingDurability(JsonObject out) {
+  out["policy"] = policyNames[config.policy];
+  out["commit_ms"] = config.commitMs;
+  out["commit_bytes"] = config.commitBytes;
+
+  if (haveStats) {
+    JsonObject recording = out["recording"].to<JsonObject>();
+    uint64_t busyUs = stats.writeUs + stats.commitUs;
+    recording["active"] = isRecording();
+    recording["policy"] = policyNames[activePolicy];
+    recording["bytes"] = stats.bytes;
+    recording["committed_bytes"] = stats.committedBytes;
+    recording["commits"] = stats.commits;
+    recording["failures"] = stats.failures;
+    recording["write_us"] = stats.writeUs;
+    recording["commit_us"] = stats.commitUs;
+    recording["max_commit_us"] = stats.maxCommitUs;
+    recording["write_mbps"] = busyUs ? (float)stats.bytes / busyUs : 0;
+    recording["commit_percent"] = busyUs ? stats.commitUs * 100.0f / busyUs : 0;
+  }
+
+  out["recovery"] = recovery;
+}
+
+// ============================================
+// Benchmark
+// ============================================
+
+void benchRecordingDurability(const char* path, uint8_t* buffer, JsonArray out) {
+  String benchJournal = String(path) + JOURNAL_SUFFIX;
+  memset(buffer, 0, DURABILITY_BENCH_CHUNK);
+
+  for (int i = DURABILITY_NONE; i <= DURABILITY_JOURNAL; i++) {
+    DurabilityPolicy policy = (DurabilityPolicy)i;
+    JsonObject item = out.add<JsonObject>();
+    item["policy"] = policyNames[policy];
+
+    int64_t start = esp_timer_get_time();
+    File wav = SD.open(path, FILE_WRITE);
+    File jnl;
+    if (policy == DURABILITY_JOURNAL) {
+      jnl = SD.open(benchJournal, FILE_WRITE);
+      if (jnl) jnl.write((const uint8_t*)JOURNAL_MAGIC, 4);
+    }
+    bool ok = wav && (policy != DURABILITY_JOURNAL || jnl) &&
+              wav.write(buffer, WAV_HEADER_BYTES) == WAV_HEADER_BYTES;
+
+    uint32_t commits = 0, maxCommitUs = 0, pending = 0;
+    for (uint32_t written = 0; ok && written < DURABILITY_BENCH_BYTES; written += DURABILITY_BENCH_CHUNK) {
+      ok = wav.write(buffer, DURABILITY_BENCH_CHUNK) == DURABILITY_BENCH_CHUNK;
+      pending += DURABILITY_BENCH_CHUNK;
+      if (ok && policy != DURABILITY_NONE && pending >= DURABILITY_BENCH_COMMIT_BYTES) {
+        int64_t commitStart = esp_timer_get_time();
+        ok = commit(policy, wav, jnl, written + DURABILITY_BENCH_CHUNK);
+        uint32_t us = esp_timer_get_time() - commitStart;
+        if (us > maxCommitUs) maxCommitUs = us;
+        commits++;
+        pending = 0;
+      }
+    }
+
+    // Finish like stopRecording()
+    if (ok) ok = patchWavSizes(wav, DURABILITY_BENCH_BYTES);
+    wav.close();
+    jnl.close();
+    int64_t elapsed = esp_timer_get_time() - start;
+    SD.remove(path);
+    if (policy == DURABILITY_JOURNAL) SD.remove(benchJournal);
+
+    if (!ok) {
+      item["error"] = "I/O failed";
+      continue;
+    }
+    item["write_mbps"] = elapsed > 0 ? (float)DURABILITY_BENCH_BYTES / elapsed : 0;
+    item["commits"] = commits;
+    item["max_commit_us"] = maxCommitUs;
+  }
+}
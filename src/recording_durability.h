@@ -0,0 +1,59 @@
+#ifndef RECORDING_DURABILITY_H
+#define RECORDING_DURABILITY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+
+// How much of a recording survives a reset or power loss.
+//
+// none:     data reaches the card when the File buffer fills and the header
+//           sizes are only written by stopRecording(). FAT records the file
+//           length on sync, so after a reset little or nothing is left.
+// periodic: group commit. Once commit_ms have passed or commit_bytes have
+//           been written since the last commit, the WAV header sizes are
+//           patched in place and the file is synced, so a reset loses at
+//           most one commit interval.
+// journal:  like periodic, but the committed length is appended to a
+//           CRC-checked "<file>.wav.jnl" sidecar instead of rewriting the
+//           header sector; the header is fixed up on stop or at recovery.
+//
+// recoverRecordings() runs at boot before the microphone starts. It repairs
+// every WAV in RECORDINGS_DIR whose header sizes do not match the data on
+// the card (using the journal's last intact record where there is one) and
+// removes leftover journals. A clean stop leaves no journal behind.
+//
+// The same commit step is timed by the SD benchmark for each policy, and
+// the running recording keeps write and commit times, so the cost of a
+// policy can be read both ways.
+#define RECORDINGS_DIR "/recordings"
+#define JOURNAL_SUFFIX ".jnl"
+#define WAV_HEADER_BYTES 44
+#define DURABILITY_DEFAULT_COMMIT_MS 1000
+#define DURABILITY_DEFAULT_COMMIT_BYTES (64 * 1024)
+#define DURABILITY_MIN_COMMIT_MS 100
+#define DURABILITY_MIN_COMMIT_BYTES 4096
+#define DURABILITY_BENCH_BYTES (256 * 1024)
+#define DURABILITY_BENCH_CHUNK 1024
+#define DURABILITY_BENCH_COMMIT_BYTES (16 * 1024)
+
+// Loads PATH_RECORDING_DURABILITY and runs the recovery pass
+void initRecordingDurability();
+
+// Returns an HTTP status; applies from the next recording
+int setRecordingDurability(JsonVariantConst args, String& error);
+void getRecordingDurability(JsonObject out);
+
+// Recording hooks. begin follows the placeholder header, note follows every
+// write with the total data bytes so far, end follows the final header.
+void beginRecordingCommits(File& wav, const String& path);
+void noteRecordingWrite(File& wav, uint32_t dataSize, uint32_t written, uint32_t writeUs);
+void endRecordingCommits(const String& path);
+
+void recoverRecordings();
+
+// Writes DURABILITY_BENCH_BYTES to path under each policy; buffer must hold
+// DURABILITY_BENCH_CHUNK bytes
+void benchRecordingDurability(const char* path, uint8_t* buffer, JsonArray out);
+
+#endif
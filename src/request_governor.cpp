@@ -0,0 +1,281 @@
+#include "request_governor.h"
+#include "config.h"
+#include "power_manager.h"
+
+enum TrackState : uint8_t {
+  TRACK_FREE,
+  TRACK_ADMITTED,
+  TRACK_REJECTED
+};
+
+struct TrackedRequest {
+  AsyncWebServerRequest *request;
+  TrackState state;
+  bool large;
+  bool closed;          // disconnect seen; the request object is going away
+  std::function<void()> cleanup;
+};
+
+struct ClientBucket {
+  uint32_t ip;
+  float tokens;
+  uint32_t lastRefill;
+  uint32_t lastSeen;
+  uint32_t requests;
+  uint32_t rejected;
+};
+
+static TrackedRequest tracked[GOV_TRACK_SLOTS];
+// Requests refused while every slot was taken, so their later callbacks
+// are not answered a second time; the oldest is overwritten when full
+static AsyncWebServerRequest* untracked[GOV_UNTRACKED_SLOTS];
+static size_t nextUntracked = 0;
+static ClientBucket clients[GOV_MAX_CLIENTS];
+
+static uint32_t activeRequests = 0;
+static uint32_t activeLarge = 0;
+static uint32_t peakRequests = 0;
+static uint32_t admittedCount = 0;
+static uint32_t rejectedRate = 0;
+static uint32_t rejectedBusy = 0;
+static uint32_t rejectedLarge = 0;
+static uint32_t rejectedMemory = 0;
+static uint32_t rejectedUntracked = 0;
+static uint32_t lowestFreeHeap = UINT32_MAX;
+static uint32_t lowestLargestBlock = UINT32_MAX;
+
+static TrackedRequest* findTracked(AsyncWebServerRequest *request) {
+  for (size_t i = 0; i < GOV_TRACK_SLOTS; i++) {
+    if (tracked[i].state != TRACK_FREE && !tracked[i].closed && tracked[i].request == request) {
+      return &tracked[i];
+    }
+  }
+  return nullptr;
+}
+
+// The owner's cleanup always runs before the slot can be reused, so state a
+// handler keeps per request (extract or PUT ownership) is never stranded
+static void releaseSlot(TrackedRequest& slot) {
+  std::function<void()> cleanup = slot.cleanup;
+  slot.cleanup = nullptr;
+  if (cleanup) cleanup();
+
+  if (slot.state == TRACK_ADMITTED) {
+    activeRequests--;
+    if (slot.large) activeLarge--;
+  }
+  slot.state = TRACK_FREE;
+  slot.request = nullptr;
+  slot.closed = false;
+}
+
+// A slot is only reused once its request has disconnected; a long transfer
+// keeps its slot however long it runs
+static TrackedRequest* allocateSlot() {
+  for (size_t i = 0; i < GOV_TRACK_SLOTS; i++) {
+    if (tracked[i].state != TRACK_FREE && tracked[i].closed) {
+      releaseSlot(tracked[i]);
+    }
+  }
+  for (size_t i = 0; i < GOV_TRACK_SLOTS; i++) {
+    if (tracked[i].state == TRACK_FREE) return &tracked[i];
+  }
+  return nullptr;
+}
+
+static ClientBucket& findClient(uint32_t ip) {
+  size_t oldest = 0;
+  for (size_t i = 0; i < GOV_MAX_CLIENTS; i++) {
+    if (clients[i].ip == ip && clients[i].lastSeen != 0) return clients[i];
+    if (clients[i].lastSeen < clients[oldest].lastSeen) oldest = i;
+  }
+
+  ClientBucket& bucket = clients[oldest];
+  bucket.ip = ip;
+  bucket.tokens = GOV_RATE_BURST;
+  bucket.lastRefill = millis();
+  bucket.requests = 0;
+  bucket.rejected = 0;
+  return bucket;
+}
+
+static bool takeToken(ClientBucket& bucket) {
+  uint32_t now = millis();
+  bucket.tokens += (now - bucket.lastRefill) * (GOV_RATE_PER_SEC / 1000.0f);
+  if (bucket.tokens > GOV_RATE_BURST) bucket.tokens = GOV_RATE_BURST;
+  bucket.lastRefill = now;
+  bucket.lastSeen = now | 1;
+
+  if (bucket.tokens < 1.0f) return false;
+  bucket.tokens -= 1.0f;
+  return true;
+}
+
+static void sendRefusal(AsyncWebServerRequest *request, int code, const char* reason) {
+  AsyncWebServerResponse *response = request->beginResponse(code, "application/json",
+    String("{\"error\":\"") + reason + "\",\"retry_after\":" + GOV_RETRY_AFTER_SEC + "}");
+  response->addHeader("Retry-After", String(GOV_RETRY_AFTER_SEC));
+  request->send(response);
+}
+
+static bool refuse(TrackedRequest *slot, AsyncWebServerRequest *request, int code, const char* reason) {
+  if (slot->state == TRACK_ADMITTED) {
+    activeRequests--;
+    if (slot->large) activeLarge--;
+  }
+  slot->state = TRACK_REJECTED;
+  slot->large = false;
+  LOG_WARN("Governor: %d %s for %s", code, reason, request->url().c_str());
+  sendRefusal(request, code, reason);
+  return false;
+}
+
+bool admitRequest(AsyncWebServerRequest *request, bool large) {
+  TrackedRequest *slot = findTracked(request);
+
+  if (slot) {
+    if (slot->state == TRACK_REJECTED) return false;
+    if (!large || slot->large) {
+      notePowerActivity();
+      return true;
+    }
+
+    // Upgrade an admitted request into the large-transfer pool
+    if (activeLarge >= GOV_MAX_LARGE_TRANSFERS) {
+      rejectedLarge++;
+      return refuse(slot, request, 503, "Too many transfers in progress");
+    }
+    slot->large = true;
+    activeLarge++;
+    notePowerActivity();
+    return true;
+  }
+
+  for (size_t i = 0; i < GOV_UNTRACKED_SLOTS; i++) {
+    if (untracked[i] == request) return false;
+  }
+
+  slot = allocateSlot();
+  if (!slot) {
+    // Closing the connection here would free the request under the caller,
+    // so it is answered like any other refusal
+    rejectedUntracked++;
+    untracked[nextUntracked] = request;
+    nextUntracked = (nextUntracked + 1) % GOV_UNTRACKED_SLOTS;
+    request->onDisconnect([request]() {
+      for (size_t i = 0; i < GOV_UNTRACKED_SLOTS; i++) {
+        if (untracked[i] == request) untracked[i] = nullptr;
+      }
+    });
+    LOG_WARN("Governor: 503 no tracking slot for %s", request->url().c_str());
+    sendRefusal(request, 503, "Server busy");
+    return false;
+  }
+
+  slot->request = request;
+  slot->state = TRACK_ADMITTED;
+  slot->large = false;
+  slot->closed = false;
+  slot->cleanup = nullptr;
+  activeRequests++;
+
+  request->onDisconnect([request]() {
+    TrackedRequest *closed = findTracked(request);
+    if (!closed) return;
+    // Marked first so nothing the cleanup calls can find the dying request
+    closed->closed = true;
+    releaseSlot(*closed);
+  });
+
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t largestBlock = ESP.getMaxAllocHeap();
+  if (freeHeap < lowestFreeHeap) lowestFreeHeap = freeHeap;
+  if (largestBlock < lowestLargestBlock) lowestLargestBlock = largestBlock;
+
+  if (freeHeap < GOV_MIN_FREE_HEAP || largestBlock < GOV_MIN_LARGEST_BLOCK) {
+    rejectedMemory++;
+    return refuse(slot, request, 503, "Low memory");
+  }
+
+  ClientBucket& bucket = findClient((uint32_t)request->client()->remoteIP());
+  bucket.requests++;
+  if (!takeToken(bucket)) {
+    bucket.rejected++;
+    rejectedRate++;
+    return refuse(slot, request, 429, "Rate limit exceeded");
+  }
+
+  if (activeRequests > GOV_MAX_REQUESTS) {
+    rejectedBusy++;
+    return refuse(slot, request, 503, "Server busy");
+  }
+
+  if (large) {
+    if (activeLarge >= GOV_MAX_LARGE_TRANSFERS) {
+      rejectedLarge++;
+      return refuse(slot, request, 503, "Too many transfers in progress");
+    }
+    slot->large = true;
+    activeLarge++;
+  }
+
+  // Only admitted work counts as activity, so a refused or rate-limited
+  // client cannot hold the CPU at full speed
+  notePowerActivity();
+  admittedCount++;
+  if (activeRequests > peakRequests) peakRequests = activeRequests;
+  return true;
+}
+
+void onRequestClosed(AsyncWebServerRequest *request, std::function<void()> cleanup) {
+  TrackedRequest *slot = findTracked(request);
+  if (slot) {
+    slot->cleanup = cleanup;
+  } else {
+    request->onDisconnect(cleanup);
+  }
+}
+
+uint32_t getActiveRequestCount() {
+  return activeRequests;
+}
+
+void getGovernorStats(JsonObject out) {
+  out["active"] = activeRequests;
+  out["active_large"] = activeLarge;
+  out["peak_active"] = peakRequests;
+  out["max_active"] = GOV_MAX_REQUESTS;
+  out["max_large"] = GOV_MAX_LARGE_TRANSFERS;
+  out["admitted"] = admittedCount;
+
+  JsonObject rejected = out["rejected"].to<JsonObject>();
+  rejected["rate"] = rejectedRate;
+  rejected["busy"] = rejectedBusy;
+  rejected["large"] = rejectedLarge;
+  rejected["memory"] = rejectedMemory;
+  rejected["untracked"] = rejectedUntracked;
+
+  JsonObject heap = out["heap"].to<JsonObject>();
+  heap["free"] = ESP.getFreeHeap();
+  heap["largest_block"] = ESP.getMaxAllocHeap();
+  heap["lowest_free"] = lowestFreeHeap == UINT32_MAX ? ESP.getFreeHeap() : lowestFreeHeap;
+  heap["lowest_largest_block"] = lowestLargestBlock == UINT32_MAX ? ESP.getMaxAllocHeap() : lowestLargestBlock;
+  heap["min_free_watermark"] = GOV_MIN_FREE_HEAP;
+  heap["min_block_watermark"] = GOV_MIN_LARGEST_BLOCK;
+
+  JsonObject rate = out["rate_limit"].to<JsonObject>();
+  rate["per_sec"] = GOV_RATE_PER_SEC;
+  rate["burst"] = GOV_RATE_BURST;
+
+  uint32_t now = millis();
+  JsonArray list = out["clients"].to<JsonArray>();
+  for (size_t i = 0; i < GOV_MAX_CLIENTS; i++) {
+    if (clients[i].lastSeen == 0) continue;
+    JsonObject client = list.add<JsonObject>();
+    client["ip"] = IPAddress(clients[i].ip).toString();
+    client["requests"] = clients[i].requests;
+    client["rejected"] = clients[i].rejected;
+    client["tokens"] = (int)clients[i].tokens;
+    client["idle_ms"] = now - clients[i].lastSeen;
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef REQUEST_GOVERNOR_H
+#define REQUEST_GOVERNOR_H
+
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+#include <functional>
+
+// Admission control in front of every HTTP handler. Without PSRAM a handful
+// of parallel transfers can exhaust the heap, so requests are refused up
+// front instead of failing an allocation halfway through:
+//   - 503 + Retry-After when free heap or the largest block is below its
+//     watermark, or when too many requests/large transfers are in flight
+//   - 429 + Retry-After when a client IP exceeds its token bucket
+// All of this runs on the async_tcp task, so no locking is needed.
+#define GOV_MAX_REQUESTS 12
+#define GOV_MAX_LARGE_TRANSFERS 3
+#define GOV_TRACK_SLOTS 24
+#define GOV_UNTRACKED_SLOTS 8
+#define GOV_MAX_CLIENTS 16
+#define GOV_RATE_PER_SEC 20
+#define GOV_RATE_BURST 40
+#define GOV_MIN_FREE_HEAP 24576
+#define GOV_MIN_LARGEST_BLOCK 8192
+#define GOV_LARGE_FILE_BYTES 32768
+#define GOV_RETRY_AFTER_SEC 2
+
+// Call at the top of each handler callback (request, upload and body).
+// A request is judged once: later calls return the same verdict, and a
+// refused request has already been answered. Passing large = true moves an
+// admitted request into the large-transfer pool, which has its own cap.
+bool admitRequest(AsyncWebServerRequest *request, bool large = false);
+
+// The governor owns the request's onDisconnect hook; handlers that need
+// cleanup on disconnect register it here instead
+void onRequestClosed(AsyncWebServerRequest *request, std::function<void()> cleanup);
+
+uint32_t getActiveRequestCount();
+void getGovernorStats(JsonObject out);
+
+#endif
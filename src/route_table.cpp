@@ -0,0 +1,40 @@
+#include "route_table.h"
+#include <string.h>
+
+uint32_t hashRoutePath(const char* path) {
+  uint32_t h = 2166136261u;
+  while (*path) {
+    h ^= (uint8_t)*path++;
+    h *= 16777619u;
+  }
+  return h ^ (h >> 16);
+}
+
+void buildRouteTable(RouteTable& table, size_t count) {
+  memset(table.slots, ROUTE_TABLE_EMPTY, sizeof(table.slots));
+  table.count = count;
+  table.distinct = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0 && strcmp(table.paths[i - 1], table.paths[i]) == 0) continue;
+
+    uint32_t slot = hashRoutePath(table.paths[i]) & (ROUTE_TABLE_SLOTS - 1);
+    while (table.slots[slot] != ROUTE_TABLE_EMPTY) {
+      slot = (slot + 1) & (ROUTE_TABLE_SLOTS - 1);
+    }
+    table.slots[slot] = (uint8_t)i;
+    table.distinct++;
+  }
+}
+
+int findRoutePath(const RouteTable& table, const char* path) {
+  uint32_t slot = hashRoutePath(path) & (ROUTE_TABLE_SLOTS - 1);
+  while (table.slots[slot] != ROUTE_TABLE_EMPTY) {
+    int first = table.slots[slot];
+    if (strcmp(table.paths[first], path) == 0) {
+      return first;
+    }
+    slot = (slot + 1) & (ROUTE_TABLE_SLOTS - 1);
+  }
+  return -1;
+}
@@ -0,0 +1,38 @@
+#ifndef ROUTE_TABLE_H
+#define ROUTE_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Hash index over a sorted list of request paths, the lookup behind the
+// /_api/* router.
+//
+// Paths are FNV-1a hashed into an open-addressed table of uint8_t entry
+// numbers, linear probing, at most half full. Only the first entry of each
+// run of equal paths is indexed; the caller walks the rest of the run to
+// match on method. Builds without Arduino and runs on the host.
+#define ROUTE_TABLE_SLOTS 256  // power of two
+#define ROUTE_TABLE_MAX 128    // entries; at most half the slots
+#define ROUTE_TABLE_EMPTY 0xFF
+
+static_assert((ROUTE_TABLE_SLOTS & (ROUTE_TABLE_SLOTS - 1)) == 0, "slot count must be a power of two");
+static_assert(ROUTE_TABLE_MAX * 2 <= ROUTE_TABLE_SLOTS, "route table must stay at most half full");
+static_assert(ROUTE_TABLE_MAX <= ROUTE_TABLE_EMPTY, "entry numbers must fit in uint8_t");
+
+struct RouteTable {
+  const char* paths[ROUTE_TABLE_MAX];  // sorted, so equal paths are adjacent
+  uint8_t slots[ROUTE_TABLE_SLOTS];
+  size_t count;
+  size_t distinct;
+};
+
+uint32_t hashRoutePath(const char* path);
+
+// Indexes table.paths[0..count), which the caller fills in strcmp order;
+// the strings must outlive the table
+void buildRouteTable(RouteTable& table, size_t count);
+
+// Entry number of the first occurrence of path, or -1
+int findRoutePath(const RouteTable& table, const char* path);
+
+#endif
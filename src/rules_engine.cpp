@@ -0,0 +1,621 @@
+#include "rules_engine.h"
+#include "config.h"
+#include "hardware.h"
+#include "led_effects.h"
+#include <SD.h>
+#include <esp_timer.h>
+
+#define RULES_TASK_STACK 4096
+#define RULES_TASK_PRIORITY 4
+#define RULES_TASK_CORE APP_CPU_NUM
+#define RULES_MIC_INTERVAL_MS 50
+#define RULES_DEBOUNCE_MS 30
+#define RULES_MIN_INTERVAL_MS 10
+
+enum RuleTrigger : uint8_t {
+  TRIGGER_BUTTON,
+  TRIGGER_GPIO,
+  TRIGGER_MIC,
+  TRIGGER_TIMER
+};
+
+enum RuleEdge : uint8_t {
+  EDGE_RISING,   // button press, GPIO low->high, mic level rises above threshold
+  EDGE_FALLING,  // button release, GPIO high->low, mic level drops below threshold
+  EDGE_CHANGE
+};
+
+enum RuleConditionType : uint8_t {
+  CONDITION_BUTTON,
+  CONDITION_GPIO,
+  CONDITION_MIC_ABOVE,
+  CONDITION_MIC_BELOW,
+  CONDITION_RECORDING
+};
+
+enum RuleActionType : uint8_t {
+  ACTION_LED,
+  ACTION_GPIO,
+  ACTION_GPIO_TOGGLE,
+  ACTION_RECORD_START,
+  ACTION_RECORD_STOP,
+  ACTION_LOG
+};
+
+struct RuleCondition {
+  uint8_t type;
+  int8_t pin;
+  int16_t value;
+};
+
+struct RuleAction {
+  uint8_t type;
+  int8_t pin;
+  uint8_t r, g, b;    // LED colour; r doubles as the GPIO level
+  uint16_t text;      // offset into the text pool, 0xFFFF if unused
+};
+
+struct Rule {
+  char name[RULE_MAX_NAME + 1];
+  bool enabled;
+  uint8_t trigger;
+  uint8_t edge;
+  int8_t pin;
+  uint8_t inputMode;  // GPIO trigger: INPUT, INPUT_PULLUP or INPUT_PULLDOWN
+  int16_t threshold;
+  uint32_t interval;
+  uint32_t cooldown;
+  uint8_t conditionCount;
+  uint8_t actionCount;
+  RuleCondition conditions[RULE_MAX_CONDITIONS];
+  RuleAction actions[RULE_MAX_ACTIONS];
+
+  // Runtime state
+  bool lastState;
+  uint8_t toggleState;  // one bit per action
+  uint32_t nextDue;
+  uint32_t lastFired;
+  uint32_t fires;
+  uint32_t lastReactionUs;
+  uint32_t maxReactionUs;
+};
+
+static Rule rules[RULES_MAX];
+static size_t ruleCount = 0;
+static char textPool[RULES_TEXT_POOL];
+
+// Compiled off to the side, then swapped in under the mutex
+static Rule stagedRules[RULES_MAX];
+static char stagedPool[RULES_TEXT_POOL];
+
+static int8_t interruptPins[RULES_MAX];
+static size_t interruptPinCount = 0;
+static uint64_t claimedPins = 0;  // inputs and outputs of enabled rules, by GPIO number
+static bool usesMic = false;
+static int micLevel = 0;
+static uint32_t evaluations = 0;
+
+static SemaphoreHandle_t rulesMutex = NULL;
+static TaskHandle_t rulesTaskHandle = NULL;
+static volatile uint32_t pendingEdgeUs = 0;
+
+static const char* triggerName(uint8_t trigger) {
+  switch (trigger) {
+    case TRIGGER_BUTTON: return "button";
+    case TRIGGER_GPIO: return "gpio";
+    case TRIGGER_MIC: return "mic";
+    case TRIGGER_TIMER: return "timer";
+  }
+  return "unknown";
+}
+
+// ============================================
+// Compilation (JSON -> rule table)
+// ============================================
+
+static bool parseEdge(const String& name, uint8_t& edge) {
+  if (name == "rising" || name == "press") edge = EDGE_RISING;
+  else if (name == "falling" || name == "release") edge = EDGE_FALLING;
+  else if (name == "change") edge = EDGE_CHANGE;
+  else return false;
+  return true;
+}
+
+static bool isUsablePin(int pin) {
+  return pin >= 0 && pin < 49 && !isReservedPin(pin);
+}
+
+static uint16_t addText(const char* text, size_t& poolUsed, String& error) {
+  size_t length = strlen(text) + 1;
+  if (poolUsed + length > RULES_TEXT_POOL) {
+    error = "Text pool full";
+    return 0xFFFF;
+  }
+  memcpy(stagedPool + poolUsed, text, length);
+  uint16_t offset = poolUsed;
+  poolUsed += length;
+  return offset;
+}
+
+static bool compileTrigger(JsonVariantConst json, Rule& rule, String& error) {
+  String type = json["type"] | "";
+
+  if (type == "button") {
+    rule.trigger = TRIGGER_BUTTON;
+    if (!parseEdge(json["edge"] | "press", rule.edge)) {
+      error = "Unknown button edge";
+      return false;
+    }
+  } else if (type == "gpio") {
+    rule.trigger = TRIGGER_GPIO;
+    rule.pin = json["pin"] | -1;
+    if (!isUsablePin(rule.pin)) {
+      error = "Invalid trigger pin";
+      return false;
+    }
+    if (!parseEdge(json["edge"] | "rising", rule.edge)) {
+      error = "Unknown GPIO edge";
+      return false;
+    }
+    String mode = json["mode"] | "INPUT";
+    if (mode == "INPUT") rule.inputMode = INPUT;
+    else if (mode == "INPUT_PULLUP") rule.inputMode = INPUT_PULLUP;
+    else if (mode == "INPUT_PULLDOWN") rule.inputMode = INPUT_PULLDOWN;
+    else {
+      error = "Unknown input mode";
+      return false;
+    }
+  } else if (type == "mic") {
+    rule.trigger = TRIGGER_MIC;
+    if (json["above"].is<int>()) {
+      rule.edge = EDGE_RISING;
+      rule.threshold = json["above"];
+    } else if (json["below"].is<int>()) {
+      rule.edge = EDGE_FALLING;
+      rule.threshold = json["below"];
+    } else {
+      error = "Mic trigger needs 'above' or 'below'";
+      return false;
+    }
+  } else if (type == "timer") {
+    rule.trigger = TRIGGER_TIMER;
+    rule.interval = json["interval"] | 0;
+    if (rule.interval < RULES_MIN_INTERVAL_MS) {
+      error = "Timer interval must be at least " + String(RULES_MIN_INTERVAL_MS) + " ms";
+      return false;
+    }
+  } else {
+    error = "Unknown trigger type";
+    return false;
+  }
+  return true;
+}
+
+static bool compileCondition(JsonVariantConst json, RuleCondition& condition, String& error) {
+  String type = json["type"] | "";
+  condition.pin = -1;
+
+  if (type == "button") {
+    condition.type = CONDITION_BUTTON;
+    condition.value = json["pressed"].isNull() || json["pressed"].as<bool>() ? 1 : 0;
+  } else if (type == "gpio") {
+    condition.type = CONDITION_GPIO;
+    condition.pin = json["pin"] | -1;
+    condition.value = json["equals"] | 1;
+    if (condition.pin < 0 || condition.pin >= 49) {
+      error = "Invalid condition pin";
+      return false;
+    }
+  } else if (type == "mic" && json["above"].is<int>()) {
+    condition.type = CONDITION_MIC_ABOVE;
+    condition.value = json["above"];
+  } else if (type == "mic" && json["below"].is<int>()) {
+    condition.type = CONDITION_MIC_BELOW;
+    condition.value = json["below"];
+  } else if (type == "recording") {
+    condition.type = CONDITION_RECORDING;
+    condition.value = json["equals"].isNull() || json["equals"].as<bool>() ? 1 : 0;
+  } else {
+    error = "Unknown condition";
+    return false;
+  }
+  return true;
+}
+
+static bool compileAction(JsonVariantConst json, RuleAction& action, size_t& poolUsed, String& error) {
+  String type = json["type"] | "";
+  action.pin = -1;
+  action.r = action.g = action.b = 0;
+  action.text = 0xFFFF;
+
+  if (type == "led") {
+    action.type = ACTION_LED;
+    action.r = json["r"] | 0;
+    action.g = json["g"] | 0;
+    action.b = json["b"] | 0;
+  } else if (type == "gpio") {
+    action.pin = json["pin"] | -1;
+    if (!isUsablePin(action.pin)) {
+      error = "Invalid action pin";
+      return false;
+    }
+    if (json["value"] == "toggle") {
+      action.type = ACTION_GPIO_TOGGLE;
+    } else {
+      action.type = ACTION_GPIO;
+      action.r = json["value"].as<bool>() ? 1 : 0;
+    }
+  } else if (type == "record_start") {
+    action.type = ACTION_RECORD_START;
+    if (json["file"].is<const char*>()) {
+      String file = json["file"].as<String>();
+      if (file.indexOf('/') >= 0 || file.indexOf("..") >= 0) {
+        error = "Recording file must be a plain name";
+        return false;
+      }
+      action.text = addText(file.c_str(), poolUsed, error);
+    }
+  } else if (type == "record_stop") {
+    action.type = ACTION_RECORD_STOP;
+  } else if (type == "log") {
+    action.type = ACTION_LOG;
+    action.text = addText(json["message"] | "", poolUsed, error);
+  } else {
+    error = "Unknown action";
+    return false;
+  }
+  return error.length() == 0;
+}
+
+static bool compileRule(JsonVariantConst json, Rule& rule, size_t& poolUsed, String& error) {
+  memset(&rule, 0, sizeof(rule));
+  rule.pin = -1;
+
+  strlcpy(rule.name, json["name"] | "rule", sizeof(rule.name));
+  rule.enabled = json["enabled"] | true;
+
+  if (!compileTrigger(json["trigger"], rule, error)) return false;
+  rule.cooldown = json["cooldown"] | (rule.trigger == TRIGGER_BUTTON ? RULES_DEBOUNCE_MS : 0);
+
+  JsonArrayConst conditions = json["conditions"];
+  if (conditions.size() > RULE_MAX_CONDITIONS) {
+    error = "Too many conditions (max " + String(RULE_MAX_CONDITIONS) + ")";
+    return false;
+  }
+  for (JsonVariantConst condition : conditions) {
+    if (!compileCondition(condition, rule.conditions[rule.conditionCount++], error)) return false;
+  }
+
+  JsonArrayConst actions = json["actions"];
+  if (actions.size() == 0 || actions.size() > RULE_MAX_ACTIONS) {
+    error = "Rules need 1-" + String(RULE_MAX_ACTIONS) + " actions";
+    return false;
+  }
+  for (JsonVariantConst action : actions) {
+    if (!compileAction(action, rule.actions[rule.actionCount++], poolUsed, error)) return false;
+  }
+  return true;
+}
+
+// ============================================
+// Evaluation (rules task)
+// ============================================
+
+static void IRAM_ATTR onInputEdge() {
+  if (pendingEdgeUs == 0) {
+    pendingEdgeUs = (uint32_t)esp_timer_get_time() | 1;
+  }
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(rulesTaskHandle, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+static bool readTriggerState(const Rule& rule) {
+  switch (rule.trigger) {
+    case TRIGGER_BUTTON: return readButton();
+    case TRIGGER_GPIO: return digitalRead(rule.pin) == HIGH;
+    case TRIGGER_MIC: return rule.edge == EDGE_RISING ? micLevel > rule.threshold : micLevel < rule.threshold;
+  }
+  return false;
+}
+
+static bool conditionsMet(const Rule& rule, bool button) {
+  for (uint8_t i = 0; i < rule.conditionCount; i++) {
+    const RuleCondition& condition = rule.conditions[i];
+    bool met = false;
+    switch (condition.type) {
+      case CONDITION_BUTTON: met = button == (condition.value != 0); break;
+      case CONDITION_GPIO: met = digitalRead(condition.pin) == condition.value; break;
+      case CONDITION_MIC_ABOVE: met = micLevel > condition.value; break;
+      case CONDITION_MIC_BELOW: met = micLevel < condition.value; break;
+      case CONDITION_RECORDING: met = isRecording() == (condition.value != 0); break;
+    }
+    if (!met) return false;
+  }
+  return true;
+}
+
+static void runActions(Rule& rule) {
+  for (uint8_t i = 0; i < rule.actionCount; i++) {
+    const RuleAction& action = rule.actions[i];
+    switch (action.type) {
+      case ACTION_LED:
+        stopLedEffect();
+        setLED(action.r, action.g, action.b);
+        break;
+      case ACTION_GPIO:
+        writeGPIO(action.pin, action.r);
+        break;
+      case ACTION_GPIO_TOGGLE:
+        rule.toggleState ^= (1 << i);
+        writeGPIO(action.pin, (rule.toggleState >> i) & 1);
+        break;
+      case ACTION_RECORD_START:
+        if (!isRecording()) {
+          String file = action.text != 0xFFFF ? String(textPool + action.text)
+                                              : String(rule.name) + "_" + String(millis()) + ".wav";
+          startRecording(file.c_str());
+        }
+        break;
+      case ACTION_RECORD_STOP:
+        stopRecording();
+        break;
+      case ACTION_LOG:
+        LOG_INFO("Rule %s: %s", rule.name, textPool + action.text);
+        break;
+    }
+  }
+}
+
+static void evaluateRules(uint32_t startUs) {
+  uint32_t now = millis();
+  bool button = readButton();
+  evaluations++;
+
+  for (size_t i = 0; i < ruleCount; i++) {
+    Rule& rule = rules[i];
+    bool fire = false;
+
+    if (rule.trigger == TRIGGER_TIMER) {
+      if ((int32_t)(now - rule.nextDue) >= 0) {
+        fire = true;
+        rule.nextDue = now + rule.interval;
+      }
+    } else {
+      bool state = rule.trigger == TRIGGER_BUTTON ? button : readTriggerState(rule);
+      if (state != rule.lastState) {
+        rule.lastState = state;
+        if (rule.trigger == TRIGGER_MIC) {
+          // Mic triggers fire when the level crosses into the configured band
+          fire = state;
+        } else {
+          fire = rule.edge == EDGE_CHANGE || state == (rule.edge == EDGE_RISING);
+        }
+      }
+    }
+
+    if (!fire || !rule.enabled) continue;
+    if (rule.cooldown && rule.fires > 0 && now - rule.lastFired < rule.cooldown) continue;
+    if (!conditionsMet(rule, button)) continue;
+
+    runActions(rule);
+
+    uint32_t reactionUs = (uint32_t)esp_timer_get_time() - startUs;
+    rule.fires++;
+    rule.lastFired = now;
+    rule.lastReactionUs = reactionUs;
+    if (reactionUs > rule.maxReactionUs) rule.maxReactionUs = reactionUs;
+  }
+}
+
+// Time until the next timer rule or mic poll is due; portMAX_DELAY when
+// only a pin interrupt or a reload can make a rule fire. Caller holds
+// rulesMutex.
+static TickType_t nextWakeTicks(uint32_t lastMicPoll) {
+  uint32_t now = millis();
+  int32_t waitMs = -1;
+  if (usesMic) {
+    waitMs = max((int32_t)0, (int32_t)(lastMicPoll + RULES_MIC_INTERVAL_MS - now));
+  }
+  for (size_t i = 0; i < ruleCount; i++) {
+    if (rules[i].trigger != TRIGGER_TIMER || !rules[i].enabled) continue;
+    int32_t remaining = max((int32_t)0, (int32_t)(rules[i].nextDue - now));
+    if (waitMs < 0 || remaining < waitMs) waitMs = remaining;
+  }
+  return waitMs < 0 ? portMAX_DELAY : pdMS_TO_TICKS(waitMs);
+}
+
+static void rulesTask(void *param) {
+  uint32_t lastMicPoll = 0;
+  TickType_t wait = portMAX_DELAY;
+
+  for (;;) {
+    // Woken early by pin interrupts and reloads; the timeout drives timers and mic polling
+    ulTaskNotifyTake(pdTRUE, wait);
+
+    uint32_t startUs = pendingEdgeUs;
+    pendingEdgeUs = 0;
+    if (startUs == 0) startUs = (uint32_t)esp_timer_get_time();
+
+    xSemaphoreTake(rulesMutex, portMAX_DELAY);
+    if (usesMic && millis() - lastMicPoll >= RULES_MIC_INTERVAL_MS) {
+      micLevel = pollMicrophoneLevel();
+      lastMicPoll = millis();
+    }
+    if (ruleCount > 0) {
+      evaluateRules(startUs);
+    }
+    wait = nextWakeTicks(lastMicPoll);
+    xSemaphoreGive(rulesMutex);
+  }
+}
+
+// ============================================
+// Activation
+// ============================================
+
+static void addInterruptPin(int pin) {
+  for (size_t i = 0; i < interruptPinCount; i++) {
+    if (interruptPins[i] == pin) return;
+  }
+  attachInterrupt(digitalPinToInterrupt(pin), onInputEdge, CHANGE);
+  interruptPins[interruptPinCount++] = pin;
+  claimedPins |= 1ULL << pin;
+}
+
+// Caller holds rulesMutex
+static void activateStagedRules(size_t count) {
+  for (size_t i = 0; i < interruptPinCount; i++) {
+    detachInterrupt(digitalPinToInterrupt(interruptPins[i]));
+  }
+  interruptPinCount = 0;
+  claimedPins = 0;
+
+  memcpy(rules, stagedRules, sizeof(Rule) * count);
+  memcpy(textPool, stagedPool, sizeof(textPool));
+  ruleCount = count;
+  usesMic = false;
+
+  uint32_t now = millis();
+  for (size_t i = 0; i < ruleCount; i++) {
+    Rule& rule = rules[i];
+    // A disabled rule claims no pins and does not keep the mic sampled
+    if (!rule.enabled) continue;
+
+    if (rule.trigger == TRIGGER_BUTTON) {
+      pinMode(getButtonPin(), INPUT_PULLUP);
+      addInterruptPin(getButtonPin());
+    } else if (rule.trigger == TRIGGER_GPIO) {
+      pinMode(rule.pin, rule.inputMode);
+      addInterruptPin(rule.pin);
+    } else if (rule.trigger == TRIGGER_MIC) {
+      usesMic = true;
+    }
+
+    for (uint8_t c = 0; c < rule.conditionCount; c++) {
+      uint8_t type = rule.conditions[c].type;
+      if (type == CONDITION_MIC_ABOVE || type == CONDITION_MIC_BELOW) usesMic = true;
+    }
+    for (uint8_t a = 0; a < rule.actionCount; a++) {
+      if (rule.actions[a].type == ACTION_GPIO || rule.actions[a].type == ACTION_GPIO_TOGGLE) {
+        setGPIOMode(rule.actions[a].pin, "OUTPUT");
+        claimedPins |= 1ULL << rule.actions[a].pin;
+      }
+    }
+
+    // Start from the current input level so loading never fires an edge
+    rule.lastState = rule.trigger != TRIGGER_TIMER && readTriggerState(rule);
+    rule.nextDue = now + rule.interval;
+  }
+}
+
+bool loadRules(JsonVariantConst doc, JsonArray errors) {
+  if (!rulesMutex) {
+    errors.add("Rules engine not running");
+    return false;
+  }
+
+  JsonArrayConst list = doc["rules"];
+  if (list.size() > RULES_MAX) {
+    errors.add("Too many rules (max " + String(RULES_MAX) + ")");
+    return false;
+  }
+
+  size_t count = 0;
+  size_t poolUsed = 0;
+  bool ok = true;
+  for (JsonVariantConst json : list) {
+    String error;
+    if (!compileRule(json, stagedRules[count], poolUsed, error)) {
+      errors.add("rule " + String(count) + ": " + error);
+      ok = false;
+    }
+    count++;
+  }
+  if (!ok) return false;
+
+  xSemaphoreTake(rulesMutex, portMAX_DELAY);
+  activateStagedRules(count);
+  xSemaphoreGive(rulesMutex);
+
+  // The task may be blocked without a timeout; let it pick up the new timers
+  if (rulesTaskHandle) xTaskNotifyGive(rulesTaskHandle);
+
+  LOG_INFO("Rules loaded: %d active (%d bytes of text)", count, poolUsed);
+  return true;
+}
+
+bool reloadRulesFromFile(JsonArray errors) {
+  File file = SD.open(PATH_RULES, FILE_READ);
+  if (!file) {
+    errors.add("Cannot open " PATH_RULES);
+    return false;
+  }
+
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, file);
+  file.close();
+
+  if (error) {
+    errors.add(String("Invalid JSON: ") + error.c_str());
+    return false;
+  }
+  return loadRules(doc, errors);
+}
+
+void initRulesEngine() {
+  rulesMutex = xSemaphoreCreateMutex();
+  if (!rulesMutex) {
+    LOG_ERROR("Failed to create rules mutex");
+    return;
+  }
+
+  xTaskCreatePinnedToCore(rulesTask, "rules", RULES_TASK_STACK, NULL,
+    RULES_TASK_PRIORITY, &rulesTaskHandle, RULES_TASK_CORE);
+
+  if (!SD.exists(PATH_RULES)) {
+    LOG_INFO("No rules file (%s), rules engine idle", PATH_RULES);
+    return;
+  }
+
+  JsonDocument result;
+  JsonArray errors = result.to<JsonArray>();
+  if (!reloadRulesFromFile(errors)) {
+    for (JsonVariant error : errors) {
+      LOG_ERROR("Rules: %s", error.as<const char*>());
+    }
+  }
+}
+
+void getRulesStatus(JsonObject out) {
+  out["source"] = PATH_RULES;
+  out["running"] = rulesTaskHandle != NULL;
+  if (!rulesMutex) return;
+
+  xSemaphoreTake(rulesMutex, portMAX_DELAY);
+  out["evaluations"] = evaluations;
+  out["mic_level"] = usesMic ? micLevel : -1;
+  JsonArray pins = out["pins"].to<JsonArray>();
+  for (int pin = 0; pin < 64; pin++) {
+    if (claimedPins & (1ULL << pin)) pins.add(pin);
+  }
+
+  uint32_t now = millis();
+  JsonArray list = out["rules"].to<JsonArray>();
+  for (size_t i = 0; i < ruleCount; i++) {
+    const Rule& rule = rules[i];
+    JsonObject entry = list.add<JsonObject>();
+    entry["name"] = rule.name;
+    entry["enabled"] = rule.enabled;
+    entry["trigger"] = triggerName(rule.trigger);
+    entry["conditions"] = rule.conditionCount;
+    entry["actions"] = rule.actionCount;
+    entry["fires"] = rule.fires;
+    if (rule.fires > 0) {
+      entry["last_fired_ms_ago"] = now - rule.lastFired;
+      entry["last_reaction_us"] = rule.lastReactionUs;
+      entry["max_reaction_us"] = rule.maxReactionUs;
+    }
+  }
+  xSemaphoreGive(rulesMutex);
+}
@@ -0,0 +1,26 @@
+#ifndef RULES_ENGINE_H
+#define RULES_ENGINE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// On-device automation: "when <trigger> and <conditions> do <actions>".
+//
+// Rules are read from PATH_RULES (JSON) and compiled into a fixed table of
+// plain structs evaluated by a dedicated task. Button and GPIO edges wake
+// the task from their pin interrupt, so reactions do not wait for a poll.
+#define RULES_MAX 32
+#define RULE_MAX_CONDITIONS 4
+#define RULE_MAX_ACTIONS 4
+#define RULE_MAX_NAME 24
+#define RULES_TEXT_POOL 1024
+
+void initRulesEngine();
+
+// Compiles a rules document and, if it has no errors, makes it active
+bool loadRules(JsonVariantConst doc, JsonArray errors);
+bool reloadRulesFromFile(JsonArray errors);
+
+void getRulesStatus(JsonObject out);
+
+#endif
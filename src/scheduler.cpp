@@ -0,0 +1,207 @@
+#include "scheduler.h"
+#include "config.h"
+#include <esp_timer.h>
+
+struct SchedulerTask {
+  const char* name;
+  SchedulerTaskFn fn;
+  SchedulerPriority priority;
+  uint32_t periodMs;
+  uint32_t deadlineMs;
+  uint32_t releaseMs;      // when the current (or next) job became ready
+  bool signalled;
+
+  uint32_t runs;
+  uint32_t overruns;       // finished after release + deadline
+  uint32_t skipped;        // periodic releases dropped because the task fell behind
+  uint64_t totalUs;
+  uint32_t maxUs;
+  uint32_t maxLatencyMs;   // release to start
+};
+
+static SchedulerTask tasks[SCHEDULER_MAX_TASKS];
+static int taskCount = 0;
+static TaskHandle_t loopTaskHandle = nullptr;
+static portMUX_TYPE taskLock = portMUX_INITIALIZER_UNLOCKED;
+
+static int64_t startedUs = 0;
+static uint64_t busyUs = 0;
+static uint32_t wakeups = 0;
+
+static const char* priorityName(SchedulerPriority priority) {
+  switch (priority) {
+    case SCHEDULER_PRIORITY_HIGH: return "high";
+    case SCHEDULER_PRIORITY_NORMAL: return "normal";
+    default: return "low";
+  }
+}
+
+// Signed difference keeps comparisons correct across the millis() wrap
+static inline int32_t msUntil(uint32_t when, uint32_t now) {
+  return (int32_t)(when - now);
+}
+
+static uint32_t effectiveDeadline(const SchedulerTask& task) {
+  if (task.deadlineMs) return task.deadlineMs;
+  return task.periodMs ? task.periodMs : SCHEDULER_EVENT_DEADLINE_MS;
+}
+
+static bool isReady(const SchedulerTask& task, uint32_t now) {
+  return task.signalled || (task.periodMs && msUntil(task.releaseMs, now) <= 0);
+}
+
+void initScheduler() {
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  startedUs = esp_timer_get_time();
+  LOG_INFO("Scheduler ready (%d task slots)", SCHEDULER_MAX_TASKS);
+}
+
+int addSchedulerTask(const char* name, SchedulerTaskFn fn, uint32_t periodMs,
+                     SchedulerPriority priority, uint32_t deadlineMs) {
+  if (taskCount >= SCHEDULER_MAX_TASKS) {
+    LOG_ERROR("Scheduler: no slot for task '%s'", name);
+    return -1;
+  }
+
+  SchedulerTask& task = tasks[taskCount];
+  memset(&task, 0, sizeof(task));
+  task.name = name;
+  task.fn = fn;
+  task.priority = priority;
+  task.periodMs = periodMs;
+  task.deadlineMs = deadlineMs;
+  task.releaseMs = millis() + periodMs;
+  return taskCount++;
+}
+
+void setSchedulerTaskPeriod(int id, uint32_t periodMs) {
+  if (id < 0 || id >= taskCount) return;
+
+  portENTER_CRITICAL(&taskLock);
+  if (tasks[id].periodMs != periodMs) {
+    tasks[id].periodMs = periodMs;
+    tasks[id].releaseMs = millis() + periodMs;
+  }
+  portEXIT_CRITICAL(&taskLock);
+
+  if (loopTaskHandle) xTaskNotifyGive(loopTaskHandle);
+}
+
+void signalSchedulerTask(int id) {
+  if (id < 0 || id >= taskCount) return;
+
+  portENTER_CRITICAL(&taskLock);
+  if (!tasks[id].signalled) {
+    tasks[id].signalled = true;
+    tasks[id].releaseMs = millis();
+  }
+  portEXIT_CRITICAL(&taskLock);
+
+  if (loopTaskHandle) xTaskNotifyGive(loopTaskHandle);
+}
+
+// ============================================
+// Dispatch
+// ============================================
+
+// Highest priority first, then earliest absolute deadline
+static int pickReadyTask(uint32_t now) {
+  int best = -1;
+  uint32_t bestDeadline = 0;
+
+  for (int i = 0; i < taskCount; i++) {
+    const SchedulerTask& task = tasks[i];
+    if (!isReady(task, now)) continue;
+
+    uint32_t deadline = task.releaseMs + effectiveDeadline(task);
+    if (best < 0 || task.priority < tasks[best].priority ||
+        (task.priority == tasks[best].priority && msUntil(deadline, bestDeadline) < 0)) {
+      best = i;
+      bestDeadline = deadline;
+    }
+  }
+  return best;
+}
+
+static void runTask(SchedulerTask& task, uint32_t now) {
+  portENTER_CRITICAL(&taskLock);
+  uint32_t releaseMs = task.releaseMs;
+  task.signalled = false;
+  if (task.periodMs) {
+    task.releaseMs += task.periodMs;
+    // Fell more than a period behind: drop the missed releases and re-phase
+    if (msUntil(task.releaseMs, now) <= 0) {
+      task.skipped += (now - task.releaseMs) / task.periodMs + 1;
+      task.releaseMs = now + task.periodMs;
+    }
+  }
+  portEXIT_CRITICAL(&taskLock);
+
+  uint32_t latencyMs = now - releaseMs;
+  if (latencyMs > task.maxLatencyMs) task.maxLatencyMs = latencyMs;
+
+  int64_t start = esp_timer_get_time();
+  task.fn();
+  uint32_t elapsedUs = (uint32_t)(esp_timer_get_time() - start);
+
+  task.runs++;
+  task.totalUs += elapsedUs;
+  busyUs += elapsedUs;
+  if (elapsedUs > task.maxUs) task.maxUs = elapsedUs;
+
+  if (msUntil(releaseMs + effectiveDeadline(task), millis()) < 0) {
+    task.overruns++;
+  }
+}
+
+void runScheduler() {
+  for (;;) {
+    uint32_t now = millis();
+    int next = pickReadyTask(now);
+    if (next < 0) break;
+    runTask(tasks[next], now);
+  }
+
+  // Sleep until the earliest periodic release; signals cut the wait short
+  uint32_t now = millis();
+  int32_t sleepMs = SCHEDULER_MAX_IDLE_MS;
+  for (int i = 0; i < taskCount; i++) {
+    if (tasks[i].periodMs) {
+      sleepMs = min(sleepMs, max((int32_t)0, msUntil(tasks[i].releaseMs, now)));
+    }
+  }
+
+  if (sleepMs > 0) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleepMs));
+    wakeups++;
+  }
+}
+
+void getSchedulerStats(JsonObject out) {
+  uint64_t elapsedUs = esp_timer_get_time() - startedUs;
+  out["tasks"] = taskCount;
+  out["wakeups"] = wakeups;
+  out["busy_ms"] = busyUs / 1000;
+  out["load_percent"] = elapsedUs ? (float)(busyUs * 100.0 / elapsedUs) : 0.0f;
+
+  uint32_t now = millis();
+  JsonArray list = out["task_list"].to<JsonArray>();
+  for (int i = 0; i < taskCount; i++) {
+    const SchedulerTask& task = tasks[i];
+    JsonObject item = list.add<JsonObject>();
+    item["name"] = task.name;
+    item["priority"] = priorityName(task.priority);
+    item["period_ms"] = task.periodMs;
+    item["deadline_ms"] = effectiveDeadline(task);
+    item["runs"] = task.runs;
+    item["avg_us"] = task.runs ? (uint32_t)(task.totalUs / task.runs) : 0;
+    item["max_us"] = task.maxUs;
+    item["total_ms"] = task.totalUs / 1000;
+    item["max_latency_ms"] = task.maxLatencyMs;
+    item["overruns"] = task.overruns;
+    item["skipped"] = task.skipped;
+    if (task.periodMs) {
+      item["next_in_ms"] = max((int32_t)0, msUntil(task.releaseMs, now));
+    }
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Cooperative deadline scheduler for the Arduino loop task.
+//
+// Work that used to be polled every 100 ms from loop() registers here as a
+// task. A task is released either periodically (periodMs > 0) or when some
+// other task signals it; ready tasks run highest priority first, earliest
+// deadline first within a priority. Between releases the loop task blocks on
+// its notification value, so it sleeps until the next deadline and a signal
+// from a web handler wakes it immediately.
+#define SCHEDULER_MAX_TASKS 12
+#define SCHEDULER_MAX_IDLE_MS 1000
+#define SCHEDULER_EVENT_DEADLINE_MS 100
+
+enum SchedulerPriority {
+  SCHEDULER_PRIORITY_HIGH = 0,
+  SCHEDULER_PRIORITY_NORMAL = 1,
+  SCHEDULER_PRIORITY_LOW = 2
+};
+
+typedef void (*SchedulerTaskFn)();
+
+void initScheduler();
+
+// Returns a task id, or -1 when the table is full. deadlineMs is measured
+// from each release; 0 means one period (or SCHEDULER_EVENT_DEADLINE_MS for
+// signal-only tasks). A run that finishes past its deadline is an overrun.
+int addSchedulerTask(const char* name, SchedulerTaskFn fn, uint32_t periodMs,
+                     SchedulerPriority priority, uint32_t deadlineMs = 0);
+
+// Safe to call from any task; ids < 0 are ignored
+void setSchedulerTaskPeriod(int id, uint32_t periodMs);
+void signalSchedulerTask(int id);
+
+// Runs every ready task, then blocks until the next release or signal
+void runScheduler();
+
+void getSchedulerStats(JsonObject out);
+
+#endif
@@ -0,0 +1,362 @@
+#include "sd_bench.h"
+#include "config.h"
+#include "storage.h"
+#include "scheduler.h"
+#include "recording_durability.h"
+#include <SD.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+// Integer dividers of the 80 MHz APB clock, slowest first
+static const uint32_t tuneClocks[] = {
+  4000000, 8000000, 10000000, 16000000, 20000000, 26666667, 40000000
+};
+static const size_t benchBlocks[] = { 512, 4096, SD_BENCH_MAX_BLOCK };
+
+static SemaphoreHandle_t benchMutex = nullptr;
+static JsonDocument lastBench;
+static volatile bool benchRunning = false;
+static int restartTask = -1;
+
+// ============================================
+// Verified I/O
+// ============================================
+
+// Every 32-bit word depends on its file offset and the run's seed, so a
+// dropped, repeated or bit-flipped block never verifies
+static inline uint32_t patternWord(uint32_t offset, uint32_t seed) {
+  uint32_t x = (offset >> 2) * 2654435761u ^ seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+static void fillPattern(uint8_t* buffer, size_t len, uint32_t offset, uint32_t seed) {
+  uint32_t* words = (uint32_t*)buffer;
+  for (size_t i = 0; i < len / 4; i++) {
+    words[i] = patternWord(offset + i * 4, seed);
+  }
+}
+
+static uint32_t countMismatches(const uint8_t* buffer, size_t len, uint32_t offset, uint32_t seed) {
+  const uint32_t* words = (const uint32_t*)buffer;
+  uint32_t bad = 0;
+  for (size_t i = 0; i < len / 4; i++) {
+    if (words[i] != patternWord(offset + i * 4, seed)) bad++;
+  }
+  return bad;
+}
+
+// Bytes per microsecond is MB/s
+static float toMBps(size_t bytes, int64_t us) {
+  return us > 0 ? (float)bytes / us : 0;
+}
+
+// Only the SD calls are timed; pattern generation and checks are not
+static bool writePattern(size_t block, size_t bytes, uint32_t seed, uint8_t* buffer, float& mbps) {
+  File file = SD.open(PATH_SD_BENCH, FILE_WRITE);
+  if (!file) return false;
+
+  int64_t busy = 0;
+  for (size_t offset = 0; offset < bytes; offset += block) {
+    fillPattern(buffer, block, offset, seed);
+    int64_t start = esp_timer_get_time();
+    size_t written = file.write(buffer, block);
+    busy += esp_timer_get_time() - start;
+    if (written != block) {
+      file.close();
+      return false;
+    }
+  }
+
+  int64_t start = esp_timer_get_time();
+  file.close();
+  busy += esp_timer_get_time() - start;
+
+  mbps = toMBps(bytes, busy);
+  return true;
+}
+
+static bool readPattern(size_t block, size_t bytes, uint32_t seed, uint8_t* buffer,
+                        float& mbps, uint32_t& errors) {
+  File file = SD.open(PATH_SD_BENCH, FILE_READ);
+  if (!file) return false;
+
+  int64_t busy = 0;
+  for (size_t offset = 0; offset < bytes; offset += block) {
+    int64_t start = esp_timer_get_time();
+    size_t got = file.read(buffer, block);
+    busy += esp_timer_get_time() - start;
+    if (got != block) {
+      file.close();
+      return false;
+    }
+    errors += countMismatches(buffer, block, offset, seed);
+  }
+  file.close();
+
+  mbps = toMBps(bytes, busy);
+  return true;
+}
+
+// Random 4 KB reads (verified) and in-place writes over the pattern file
+static bool randomTest(uint32_t seed, uint8_t* buffer, JsonObject out, uint32_t& errors) {
+  const uint32_t blocks = SD_BENCH_FILE_BYTES / SD_BENCH_RANDOM_BLOCK;
+
+  File file = SD.open(PATH_SD_BENCH, FILE_READ);
+  if (!file) return false;
+  int64_t busy = 0;
+  for (int n = 0; n < SD_BENCH_RANDOM_OPS; n++) {
+    uint32_t offset = random(blocks) * SD_BENCH_RANDOM_BLOCK;
+    int64_t start = esp_timer_get_time();
+    bool ok = file.seek(offset) && file.read(buffer, SD_BENCH_RANDOM_BLOCK) == SD_BENCH_RANDOM_BLOCK;
+    busy += esp_timer_get_time() - start;
+    if (!ok) {
+      file.close();
+      return false;
+    }
+    errors += countMismatches(buffer, SD_BENCH_RANDOM_BLOCK, offset, seed);
+  }
+  file.close();
+  out["read_iops"] = busy > 0 ? (uint32_t)(SD_BENCH_RANDOM_OPS * 1000000LL / busy) : 0;
+
+  file = SD.open(PATH_SD_BENCH, "r+");
+  if (!file) return false;
+  busy = 0;
+  for (int n = 0; n < SD_BENCH_RANDOM_OPS; n++) {
+    uint32_t offset = random(blocks) * SD_BENCH_RANDOM_BLOCK;
+    fillPattern(buffer, SD_BENCH_RANDOM_BLOCK, offset, seed);
+    int64_t start = esp_timer_get_time();
+    bool ok = file.seek(offset) && file.write(buffer, SD_BENCH_RANDOM_BLOCK) == SD_BENCH_RANDOM_BLOCK;
+    file.flush();
+    busy += esp_timer_get_time() - start;
+    if (!ok) {
+      file.close();
+      return false;
+    }
+  }
+  file.close();
+  out["write_iops"] = busy > 0 ? (uint32_t)(SD_BENCH_RANDOM_OPS * 1000000LL / busy) : 0;
+  out["block"] = SD_BENCH_RANDOM_BLOCK;
+  out["ops"] = SD_BENCH_RANDOM_OPS;
+  return true;
+}
+
+// ============================================
+// Benchmark
+// ============================================
+
+static void runBenchmark(JsonObject out) {
+  uint32_t startMs = millis();
+  out["spi_hz"] = getSDCardClock();
+  out["file_bytes"] = SD_BENCH_FILE_BYTES;
+
+  uint8_t* buffer = (uint8_t*)malloc(SD_BENCH_MAX_BLOCK);
+  if (!buffer) {
+    out["error"] = "Out of memory";
+    return;
+  }
+
+  uint32_t seed = esp_random();
+  uint32_t errors = 0;
+  bool ok = true;
+
+  JsonArray sequential = out["sequential"].to<JsonArray>();
+  for (size_t block : benchBlocks) {
+    float writeMBps = 0, readMBps = 0;
+    uint32_t blockErrors = 0;
+    ok = writePattern(block, SD_BENCH_FILE_BYTES, seed, buffer, writeMBps) &&
+         readPattern(block, SD_BENCH_FILE_BYTES, seed, buffer, readMBps, blockErrors);
+    if (!ok) {
+      out["error"] = "I/O failed with " + String(block) + " byte blocks";
+      break;
+    }
+
+    JsonObject item = sequential.add<JsonObject>();
+    item["block"] = block;
+    item["write_mbps"] = writeMBps;
+    item["read_mbps"] = readMBps;
+    item["errors"] = blockErrors;
+    errors += blockErrors;
+  }
+
+  if (ok && !randomTest(seed, buffer, out["random"].to<JsonObject>(), errors)) {
+    out["error"] = "Random I/O failed";
+    ok = false;
+  }
+
+  if (ok) {
+    benchRecordingDurability(PATH_SD_BENCH, buffer, out["recording"].to<JsonArray>());
+  }
+
+  SD.remove(PATH_SD_BENCH);
+  free(buffer);
+
+  out["errors"] = errors;
+  out["verified"] = ok && errors == 0;
+  out["duration_ms"] = millis() - startMs;
+  out["uptime_s"] = millis() / 1000;
+
+  LOG_INFO("SD bench at %d kHz: %s, %d mismatched words, %d ms",
+           getSDCardClock() / 1000, ok ? "completed" : "failed", errors, millis() - startMs);
+}
+
+static void benchTask(void* param) {
+  JsonDocument result;
+  runBenchmark(result.to<JsonObject>());
+
+  xSemaphoreTake(benchMutex, portMAX_DELAY);
+  lastBench = result;
+  xSemaphoreGive(benchMutex);
+
+  benchRunning = false;
+  vTaskDelete(NULL);
+}
+
+bool startSDBench() {
+  if (benchRunning || !isSDCardMounted()) return false;
+
+  benchRunning = true;
+  if (xTaskCreatePinnedToCore(benchTask, "sd_bench", SD_BENCH_TASK_STACK, NULL, 1, NULL, 0) != pdPASS) {
+    benchRunning = false;
+    return false;
+  }
+  return true;
+}
+
+// ============================================
+// Clock Tuning
+// ============================================
+
+static bool loadTuneFile(JsonDocument& doc) {
+  File file = SD.open(PATH_SD_TUNE, FILE_READ);
+  if (!file) return false;
+  bool ok = !deserializeJson(doc, file);
+  file.close();
+  return ok;
+}
+
+static bool saveTuneFile(const JsonDocument& doc) {
+  File file = SD.open(PATH_SD_TUNE, FILE_WRITE);
+  if (!file) return false;
+  serializeJson(doc, file);
+  file.close();
+  adjustSDCardUsage(PATH_SD_TUNE, 0);
+  return true;
+}
+
+// The reference file is written at the safe clock. At each faster clock it
+// must first read back clean SD_TUNE_ROUNDS times before anything is written;
+// SPI data blocks carry a CRC, so a bad write is rejected by the card rather
+// than landing on it.
+static uint32_t runClockSweep(JsonArray results) {
+  uint8_t* buffer = (uint8_t*)malloc(SD_BENCH_MAX_BLOCK);
+  if (!buffer) return SDCARD_DEFAULT_HZ;
+
+  uint32_t seed = esp_random();
+  float mbps = 0;
+  if (!writePattern(SD_BENCH_MAX_BLOCK, SD_TUNE_FILE_BYTES, seed, buffer, mbps)) {
+    free(buffer);
+    return SDCARD_DEFAULT_HZ;
+  }
+
+  uint32_t best = SDCARD_DEFAULT_HZ;
+  for (uint32_t hz : tuneClocks) {
+    uint32_t errors = 0;
+    float readMBps = 0, writeMBps = 0;
+    bool ok = mountSDCard(hz);
+
+    for (int round = 0; ok && round < SD_TUNE_ROUNDS; round++) {
+      ok = readPattern(SD_BENCH_MAX_BLOCK, SD_TUNE_FILE_BYTES, seed, buffer, readMBps, errors) &&
+           errors == 0;
+    }
+    if (ok) {
+      seed = esp_random();
+      ok = writePattern(SD_BENCH_MAX_BLOCK, SD_TUNE_FILE_BYTES, seed, buffer, writeMBps) &&
+           readPattern(SD_BENCH_MAX_BLOCK, SD_TUNE_FILE_BYTES, seed, buffer, readMBps, errors) &&
+           errors == 0;
+    }
+
+    JsonObject item = results.add<JsonObject>();
+    item["hz"] = hz;
+    item["ok"] = ok;
+    item["errors"] = errors;
+    if (ok) {
+      item["write_mbps"] = writeMBps;
+      item["read_mbps"] = readMBps;
+    }
+    LOG_INFO("SD tune: %d kHz %s (read %.2f MB/s, write %.2f MB/s, %d errors)",
+             hz / 1000, ok ? "stable" : "FAILED", readMBps, writeMBps, errors);
+
+    // Faster clocks only get worse once one fails
+    if (!ok) break;
+    best = hz;
+  }
+  free(buffer);
+
+  if (!mountSDCard(best)) {
+    best = SDCARD_DEFAULT_HZ;
+    mountSDCard(best);
+  }
+  SD.remove(PATH_SD_BENCH);
+  return best;
+}
+
+uint32_t prepareSDClock() {
+  JsonDocument doc;
+  if (!loadTuneFile(doc)) return SDCARD_DEFAULT_HZ;
+
+  if (doc["tune_pending"] | false) {
+    // Cleared first so a crash mid-sweep cannot turn into a boot loop
+    doc["tune_pending"] = false;
+    saveTuneFile(doc);
+
+    LOG_INFO("SD: tuning SPI clock...");
+    uint32_t hz = runClockSweep(doc["results"].to<JsonArray>());
+    doc["spi_hz"] = hz;
+    saveTuneFile(doc);
+    return hz;
+  }
+
+  uint32_t hz = doc["spi_hz"] | SDCARD_DEFAULT_HZ;
+  return constrain(hz, (uint32_t)400000, tuneClocks[sizeof(tuneClocks) / sizeof(tuneClocks[0]) - 1]);
+}
+
+static void restartForTune() {
+  LOG_INFO("Restarting to tune the SD clock");
+  ESP.restart();
+}
+
+bool scheduleSDClockTune() {
+  JsonDocument doc;
+  loadTuneFile(doc);
+  doc["tune_pending"] = true;
+  if (!saveTuneFile(doc)) return false;
+
+  // Leaves time for the HTTP reply to go out
+  setSchedulerTaskPeriod(restartTask, SD_TUNE_RESTART_DELAY_MS);
+  return true;
+}
+
+void initSDBench() {
+  benchMutex = xSemaphoreCreateMutex();
+  restartTask = addSchedulerTask("sd_retune", restartForTune, 0, SCHEDULER_PRIORITY_LOW);
+}
+
+void getSDBenchStatus(JsonObject out) {
+  out["spi_hz"] = getSDCardClock();
+  out["default_hz"] = SDCARD_DEFAULT_HZ;
+  out["running"] = (bool)benchRunning;
+
+  JsonDocument tune;
+  if (loadTuneFile(tune)) {
+    out["tune"] = tune;
+  }
+
+  xSemaphoreTake(benchMutex, portMAX_DELAY);
+  if (!lastBench.isNull()) {
+    out["last"] = lastBench;
+  }
+  xSemaphoreGive(benchMutex);
+}
@@ -0,0 +1,45 @@
+#ifndef SD_BENCH_H
+#define SD_BENCH_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// SD card throughput measurement and SPI clock tuning.
+//
+// The benchmark runs on a background task at the current clock: sequential
+// write/read of SD_BENCH_FILE_BYTES at each block size, then random 4 KB
+// reads and writes. Every byte written is a pattern derived from its offset
+// and a per-run seed, and every read is checked against it, so marginal
+// wiring shows up as errors rather than as a fast but corrupt result.
+// Finally a recording is written under each durability policy
+// (recording_durability.h) to show what its commits cost.
+//
+// Changing the clock means remounting, which is only safe before anything
+// else has a file open. Tuning is therefore requested over the API, flagged
+// in PATH_SD_TUNE and carried out by setupSDCard() on the next boot: each
+// clock in ascending order must pass SD_TUNE_ROUNDS verified rounds, and the
+// fastest one that does is stored for later mounts.
+#define SD_BENCH_FILE_BYTES (256 * 1024)
+#define SD_BENCH_MAX_BLOCK 16384
+#define SD_BENCH_RANDOM_BLOCK 4096
+#define SD_BENCH_RANDOM_OPS 64
+#define SD_BENCH_TASK_STACK 6144
+#define SD_TUNE_FILE_BYTES (64 * 1024)
+#define SD_TUNE_ROUNDS 2
+#define SD_TUNE_RESTART_DELAY_MS 1000
+
+void initSDBench();
+
+// Called by setupSDCard() with the card mounted at SDCARD_DEFAULT_HZ. Runs
+// a pending tune, then returns the clock to mount at.
+uint32_t prepareSDClock();
+
+// False if a benchmark is already running
+bool startSDBench();
+
+// Flags a tune for the next boot and restarts shortly after
+bool scheduleSDClockTune();
+
+void getSDBenchStatus(JsonObject out);
+
+#endif
@@ -0,0 +1,234 @@
+#include "sensor_drivers.h"
+#include <string.h>
+
+uint8_t sensirionCrc8(const uint8_t* data, size_t len) {
+  uint8_t crc = 0xFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static bool writeCommand(const SensorBus& bus, uint8_t address, const uint8_t* command, size_t len) {
+  return bus.write(bus.context, address, command, len);
+}
+
+static bool readBytes(const SensorBus& bus, uint8_t address, uint8_t* in, size_t len) {
+  return bus.transfer(bus.context, address, nullptr, 0, in, len);
+}
+
+static bool readRegisters(const SensorBus& bus, uint8_t address, uint8_t reg, uint8_t* in, size_t len) {
+  return bus.transfer(bus.context, address, &reg, 1, in, len);
+}
+
+static bool writeRegister(const SensorBus& bus, uint8_t address, uint8_t reg, uint8_t value) {
+  uint8_t data[2] = { reg, value };
+  return bus.write(bus.context, address, data, 2);
+}
+
+// Two big-endian words, each followed by its CRC
+static bool readSensirionWords(const SensorBus& bus, uint8_t address, uint16_t& first, uint16_t& second) {
+  uint8_t in[6];
+  if (!readBytes(bus, address, in, 6)) return false;
+  if (sensirionCrc8(in, 2) != in[2] || sensirionCrc8(in + 3, 2) != in[5]) return false;
+  first = (in[0] << 8) | in[1];
+  second = (in[3] << 8) | in[4];
+  return true;
+}
+
+// ============================================
+// SHT3x (ENV III): temperature, humidity
+// ============================================
+
+static bool sht3xBegin(const SensorBus& bus, uint8_t address, uint8_t* state) {
+  static const uint8_t reset[] = { 0x30, 0xA2 };
+  static const uint8_t status[] = { 0xF3, 0x2D };
+  if (!writeCommand(bus, address, reset, 2)) return false;
+  bus.delayMs(bus.context, 2);
+  if (!writeCommand(bus, address, status, 2)) return false;
+
+  uint8_t in[3];
+  return readBytes(bus, address, in, 3) && sensirionCrc8(in, 2) == in[2];
+}
+
+static bool sht3xRead(const SensorBus& bus, uint8_t address, uint8_t* state, float* values) {
+  // Single shot, high repeatability, no clock stretching: at most 15.5 ms
+  static const uint8_t measure[] = { 0x24, 0x00 };
+  if (!writeCommand(bus, address, measure, 2)) return false;
+  bus.delayMs(bus.context, 16);
+
+  uint16_t rawT, rawRH;
+  if (!readSensirionWords(bus, address, rawT, rawRH)) return false;
+  values[0] = -45.0f + 175.0f * rawT / 65535.0f;
+  values[1] = 100.0f * rawRH / 65535.0f;
+  return true;
+}
+
+// ============================================
+// SHT4x (ENV IV): temperature, humidity
+// ============================================
+
+static bool sht4xBegin(const SensorBus& bus, uint8_t address, uint8_t* state) {
+  static const uint8_t reset[] = { 0x94 };
+  static const uint8_t serial[] = { 0x89 };
+  if (!writeCommand(bus, address, reset, 1)) return false;
+  bus.delayMs(bus.context, 2);
+  if (!writeCommand(bus, address, serial, 1)) return false;
+  bus.delayMs(bus.context, 2);
+
+  uint16_t high, low;
+  return readSensirionWords(bus, address, high, low);
+}
+
+static bool sht4xRead(const SensorBus& bus, uint8_t address, uint8_t* state, float* values) {
+  // High precision: at most 8.3 ms
+  static const uint8_t measure[] = { 0xFD };
+  if (!writeCommand(bus, address, measure, 1)) return false;
+  bus.delayMs(bus.context, 10);
+
+  uint16_t rawT, rawRH;
+  if (!readSensirionWords(bus, address, rawT, rawRH)) return false;
+  float humidity = -6.0f + 125.0f * rawRH / 65535.0f;
+  values[0] = -45.0f + 175.0f * rawT / 65535.0f;
+  values[1] = humidity < 0 ? 0 : humidity > 100 ? 100 : humidity;
+  return true;
+}
+
+// ============================================
+// BMP280 (ENV IV, BPS): temperature, pressure
+// ============================================
+
+#define BMP280_REG_CALIBRATION 0x88
+#define BMP280_REG_CHIP_ID 0xD0
+#define BMP280_REG_CTRL_MEAS 0xF4
+#define BMP280_REG_CONFIG 0xF5
+#define BMP280_REG_DATA 0xF7
+
+struct Bmp280Calibration {
+  uint16_t t1;
+  int16_t t2, t3;
+  uint16_t p1;
+  int16_t p2, p3, p4, p5, p6, p7, p8, p9;
+};
+
+static_assert(sizeof(Bmp280Calibration) <= SENSOR_STATE_BYTES, "BMP280 state too large");
+
+static bool bmp280Begin(const SensorBus& bus, uint8_t address, uint8_t* state) {
+  uint8_t id;
+  // BME280 (0x60) has the same temperature and pressure block
+  if (!readRegisters(bus, address, BMP280_REG_CHIP_ID, &id, 1) || (id != 0x58 && id != 0x60)) {
+    return false;
+  }
+
+  uint8_t raw[24];
+  if (!readRegisters(bus, address, BMP280_REG_CALIBRATION, raw, sizeof(raw))) return false;
+  uint16_t words[12];
+  for (int i = 0; i < 12; i++) words[i] = raw[i * 2] | (raw[i * 2 + 1] << 8);
+
+  Bmp280Calibration cal;
+  cal.t1 = words[0];
+  cal.t2 = (int16_t)words[1];
+  cal.t3 = (int16_t)words[2];
+  cal.p1 = words[3];
+  cal.p2 = (int16_t)words[4];
+  cal.p3 = (int16_t)words[5];
+  cal.p4 = (int16_t)words[6];
+  cal.p5 = (int16_t)words[7];
+  cal.p6 = (int16_t)words[8];
+  cal.p7 = (int16_t)words[9];
+  cal.p8 = (int16_t)words[10];
+  cal.p9 = (int16_t)words[11];
+  if (cal.p1 == 0) return false;
+  memcpy(state, &cal, sizeof(cal));
+
+  // Normal mode, temperature x2, pressure x16, IIR filter 4, 125 ms standby
+  return writeRegister(bus, address, BMP280_REG_CONFIG, 0x48) &&
+         writeRegister(bus, address, BMP280_REG_CTRL_MEAS, 0x57);
+}
+
+// Integer compensation from the BMP280 datasheet, section 8.2
+static bool bmp280Read(const SensorBus& bus, uint8_t address, uint8_t* state, float* values) {
+  Bmp280Calibration cal;
+  memcpy(&cal, state, sizeof(cal));
+
+  uint8_t in[6];
+  if (!readRegisters(bus, address, BMP280_REG_DATA, in, 6)) return false;
+  int32_t adcP = ((int32_t)in[0] << 12) | (in[1] << 4) | (in[2] >> 4);
+  int32_t adcT = ((int32_t)in[3] << 12) | (in[4] << 4) | (in[5] >> 4);
+  // Reset value until the first conversion completes
+  if (adcT == 0x80000 || adcP == 0x80000) return false;
+
+  int32_t var1 = ((((adcT >> 3) - ((int32_t)cal.t1 << 1))) * cal.t2) >> 11;
+  int32_t var2 = (((((adcT >> 4) - (int32_t)cal.t1) * ((adcT >> 4) - (int32_t)cal.t1)) >> 12) * cal.t3) >> 14;
+  int32_t tFine = var1 + var2;
+  values[0] = ((tFine * 5 + 128) >> 8) / 100.0f;
+
+  int64_t p1 = (int64_t)tFine - 128000;
+  int64_t p2 = p1 * p1 * cal.p6;
+  p2 += (p1 * cal.p5) << 17;
+  p2 += (int64_t)cal.p4 << 35;
+  p1 = ((p1 * p1 * cal.p3) >> 8) + ((p1 * cal.p2) << 12);
+  p1 = ((((int64_t)1 << 47) + p1) * cal.p1) >> 33;
+  if (p1 == 0) return false;
+
+  int64_t p = 1048576 - adcP;
+  p = (((p << 31) - p2) * 3125) / p1;
+  p1 = ((int64_t)cal.p9 * (p >> 13) * (p >> 13)) >> 25;
+  p2 = ((int64_t)cal.p8 * p) >> 19;
+  p = ((p + p1 + p2) >> 8) + ((int64_t)cal.p7 << 4);
+  values[1] = p / 256.0f / 100.0f;  // Q24.8 Pa to hPa
+  return true;
+}
+
+// ============================================
+// BH1750 (DLight): illuminance
+// ============================================
+
+static bool bh1750Begin(const SensorBus& bus, uint8_t address, uint8_t* state) {
+  static const uint8_t powerOn[] = { 0x01 };
+  static const uint8_t continuousHigh[] = { 0x10 };
+  return writeCommand(bus, address, powerOn, 1) &&
+         writeCommand(bus, address, continuousHigh, 1);
+}
+
+static bool bh1750Read(const SensorBus& bus, uint8_t address, uint8_t* state, float* values) {
+  uint8_t in[2];
+  if (!readBytes(bus, address, in, 2)) return false;
+  values[0] = ((in[0] << 8) | in[1]) / 1.2f;
+  return true;
+}
+
+// ============================================
+// Registry
+// ============================================
+
+// Autodetect probes in this order; SHT3x and SHT4x share 0x44 and are told
+// apart by their identity commands
+static const SensorDriver drivers[] = {
+  { "sht3x", { 0x44, 0x45 }, 2, { "temperature", "humidity" }, { "C", "%" }, 100,
+    sht3xBegin, sht3xRead },
+  { "sht4x", { 0x44, 0x45 }, 2, { "temperature", "humidity" }, { "C", "%" }, 100,
+    sht4xBegin, sht4xRead },
+  { "bmp280", { 0x76, 0x77 }, 2, { "temperature", "pressure" }, { "C", "hPa" }, 125,
+    bmp280Begin, bmp280Read },
+  { "bh1750", { 0x23, 0x5C }, 1, { "illuminance" }, { "lx" }, 180,
+    bh1750Begin, bh1750Read },
+};
+
+size_t getSensorDriverCount() {
+  return sizeof(drivers) / sizeof(drivers[0]);
+}
+
+const SensorDriver* getSensorDriver(size_t index) {
+  return index < getSensorDriverCount() ? &drivers[index] : nullptr;
+}
+
+const SensorDriver* findSensorDriver(const char* name) {
+  for (const SensorDriver& driver : drivers) {
+    if (strcmp(driver.name, name) == 0) return &driver;
+  }
+  return nullptr;
+}
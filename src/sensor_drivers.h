@@ -0,0 +1,43 @@
+#ifndef SENSOR_DRIVERS_H
+#define SENSOR_DRIVERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// I2C sensor drivers for Grove/M5 units. They talk to the device only
+// through SensorBus and keep their calibration in a caller-owned state
+// block, so they build without Arduino and run on the host against a
+// simulated bus.
+#define SENSOR_MAX_VALUES 4
+#define SENSOR_STATE_BYTES 32
+
+// Transactions on one I2C bus. write with len 0 is an address probe.
+// transfer writes out (if any) and reads in after a repeated start.
+struct SensorBus {
+  bool (*write)(void* context, uint8_t address, const uint8_t* data, size_t len);
+  bool (*transfer)(void* context, uint8_t address, const uint8_t* out, size_t outLen,
+                   uint8_t* in, size_t inLen);
+  void (*delayMs)(void* context, uint32_t ms);
+  void* context;
+};
+
+struct SensorDriver {
+  const char* name;
+  uint8_t addresses[2];               // tried in order by autodetect
+  uint8_t valueCount;
+  const char* valueNames[SENSOR_MAX_VALUES];
+  const char* units[SENSOR_MAX_VALUES];
+  uint32_t minIntervalMs;
+  // Checks the device's identity and configures it
+  bool (*begin)(const SensorBus& bus, uint8_t address, uint8_t* state);
+  bool (*read)(const SensorBus& bus, uint8_t address, uint8_t* state, float* values);
+};
+
+size_t getSensorDriverCount();
+const SensorDriver* getSensorDriver(size_t index);
+const SensorDriver* findSensorDriver(const char* name);
+
+// Sensirion CRC-8 (polynomial 0x31, init 0xFF)
+uint8_t sensirionCrc8(const uint8_t* data, size_t len);
+
+#endif
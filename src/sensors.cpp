@@ -0,0 +1,385 @@
+#include "sensors.h"
+#include "sensor_drivers.h"
+#include "config.h"
+#include <Wire.h>
+#include <SD.h>
+#include <esp_timer.h>
+
+struct SensorSlot {
+  const SensorDriver* driver;
+  char name[SENSOR_NAME_MAX];
+  uint8_t address;
+  uint32_t intervalMs;
+  uint32_t nextMs;
+  uint8_t state[SENSOR_STATE_BYTES];
+  bool ready;
+  // Cache, guarded by sensorMutex
+  bool valid;
+  float values[SENSOR_MAX_VALUES];
+  uint32_t updatedMs;
+  uint32_t reads;
+  uint32_t errors;
+  uint32_t failedInRow;
+  uint32_t readUs;
+  float* history;           // SENSOR_HISTORY rows of valueCount
+  uint32_t* historyMs;
+  uint16_t historyHead;
+  uint16_t historyCount;
+};
+
+static SensorSlot slots[SENSORS_MAX];
+static size_t slotCount = 0;
+static SemaphoreHandle_t sensorMutex = nullptr;
+static TaskHandle_t sensorTaskHandle = nullptr;
+static volatile bool reloadRequested = true;
+static bool busActive = false;
+static int busSda = SENSOR_BUS_SDA;
+static int busScl = SENSOR_BUS_SCL;
+static uint32_t busHz = SENSOR_BUS_HZ;
+static const char* configSource = "none";
+
+// ============================================
+// Bus
+// ============================================
+
+static bool wireWrite(void* context, uint8_t address, const uint8_t* data, size_t len) {
+  Wire.beginTransmission(address);
+  if (len > 0) Wire.write(data, len);
+  return Wire.endTransmission() == 0;
+}
+
+static bool wireTransfer(void* context, uint8_t address, const uint8_t* out, size_t outLen,
+                         uint8_t* in, size_t inLen) {
+  if (outLen > 0) {
+    Wire.beginTransmission(address);
+    Wire.write(out, outLen);
+    if (Wire.endTransmission(false) != 0) return false;
+  }
+  if (Wire.requestFrom((uint16_t)address, inLen) != inLen) return false;
+  for (size_t i = 0; i < inLen; i++) {
+    in[i] = Wire.read();
+  }
+  return true;
+}
+
+static void wireDelay(void* context, uint32_t ms) {
+  vTaskDelay(pdMS_TO_TICKS(ms) + 1);
+}
+
+static const SensorBus wireBus = { wireWrite, wireTransfer, wireDelay, nullptr };
+
+// ============================================
+// Configuration
+// ============================================
+
+static void clearSlots() {
+  for (size_t i = 0; i < slotCount; i++) {
+    free(slots[i].history);
+    free(slots[i].historyMs);
+  }
+  memset(slots, 0, sizeof(slots));
+  slotCount = 0;
+}
+
+static bool addressTaken(uint8_t address) {
+  for (size_t i = 0; i < slotCount; i++) {
+    if (slots[i].address == address) return true;
+  }
+  return false;
+}
+
+static SensorSlot* addSlot(const SensorDriver* driver, uint8_t address, const char* name,
+                           uint32_t intervalMs) {
+  if (slotCount >= SENSORS_MAX) {
+    LOG_WARN("Sensors: table full, ignoring %s at 0x%02x", driver->name, address);
+    return nullptr;
+  }
+
+  SensorSlot& slot = slots[slotCount];
+  slot.history = (float*)calloc(SENSOR_HISTORY * driver->valueCount, sizeof(float));
+  slot.historyMs = (uint32_t*)calloc(SENSOR_HISTORY, sizeof(uint32_t));
+  if (!slot.history || !slot.historyMs) {
+    free(slot.history);
+    free(slot.historyMs);
+    memset(&slot, 0, sizeof(slot));
+    LOG_ERROR("Sensors: out of memory for %s history", name);
+    return nullptr;
+  }
+
+  slot.driver = driver;
+  slot.address = address;
+  strlcpy(slot.name, name, sizeof(slot.name));
+  slot.intervalMs = max(intervalMs, driver->minIntervalMs);
+  slotCount++;
+  return &slot;
+}
+
+// Names default to the driver's, with the address appended on a clash
+static String uniqueName(const char* requested, const SensorDriver* driver, uint8_t address) {
+  String name = requested && *requested ? requested : driver->name;
+  for (size_t i = 0; i < slotCount; i++) {
+    if (name == slots[i].name) {
+      name += "_" + String(address, HEX);
+      break;
+    }
+  }
+  return name;
+}
+
+static void autodetect() {
+  for (size_t d = 0; d < getSensorDriverCount(); d++) {
+    const SensorDriver* driver = getSensorDriver(d);
+    for (uint8_t address : driver->addresses) {
+      if (address == 0 || addressTaken(address)) continue;
+      if (!wireBus.write(nullptr, address, nullptr, 0)) continue;
+
+      uint8_t state[SENSOR_STATE_BYTES] = {0};
+      if (!driver->begin(wireBus, address, state)) continue;
+
+      SensorSlot* slot = addSlot(driver, address, uniqueName(nullptr, driver, address).c_str(),
+                                 SENSOR_DEFAULT_INTERVAL_MS);
+      if (slot) {
+        memcpy(slot->state, state, sizeof(state));
+        slot->ready = true;
+        LOG_INFO("Sensors: found %s at 0x%02x", driver->name, address);
+      }
+    }
+  }
+}
+
+static void loadConfiguredSensors(JsonArrayConst list) {
+  for (JsonVariantConst item : list) {
+    const char* driverName = item["driver"] | "";
+    const SensorDriver* driver = findSensorDriver(driverName);
+    if (!driver) {
+      LOG_WARN("Sensors: unknown driver '%s'", driverName);
+      continue;
+    }
+
+    // Address as a number or a "0x44" string; defaults to the driver's first
+    uint8_t address = driver->addresses[0];
+    if (item["address"].is<const char*>()) {
+      address = strtol(item["address"].as<const char*>(), nullptr, 0);
+    } else if (!item["address"].isNull()) {
+      address = item["address"].as<int>();
+    }
+
+    uint32_t interval = item["interval_ms"] | SENSOR_DEFAULT_INTERVAL_MS;
+    String name = uniqueName(item["name"] | "", driver, address);
+    addSlot(driver, address, name.c_str(), interval);
+  }
+}
+
+// Runs on the sensor task with sensorMutex held
+static void reloadConfiguration() {
+  clearSlots();
+  if (busActive) {
+    Wire.end();
+    busActive = false;
+  }
+
+  JsonDocument doc;
+  bool haveFile = false;
+  File file = SD.open(PATH_SENSORS, FILE_READ);
+  if (file) {
+    DeserializationError error = deserializeJson(doc, file);
+    file.close();
+    if (error) {
+      LOG_ERROR("Sensors: invalid %s: %s", PATH_SENSORS, error.c_str());
+    } else {
+      haveFile = true;
+    }
+  }
+
+  busSda = doc["sda"] | SENSOR_BUS_SDA;
+  busScl = doc["scl"] | SENSOR_BUS_SCL;
+  busHz = doc["frequency"] | SENSOR_BUS_HZ;
+  if (!Wire.begin(busSda, busScl, busHz)) {
+    LOG_ERROR("Sensors: cannot start I2C on SDA %d / SCL %d", busSda, busScl);
+    configSource = "none";
+    return;
+  }
+  busActive = true;
+
+  if (haveFile && doc["sensors"].is<JsonArrayConst>()) {
+    configSource = "file";
+    loadConfiguredSensors(doc["sensors"].as<JsonArrayConst>());
+  } else {
+    configSource = "autodetect";
+    autodetect();
+  }
+
+  if (slotCount == 0) {
+    // Hand the pins back to GPIO use
+    Wire.end();
+    busActive = false;
+    LOG_INFO("Sensors: none %s", haveFile ? "configured" : "detected");
+    return;
+  }
+
+  uint32_t now = millis();
+  for (size_t i = 0; i < slotCount; i++) {
+    slots[i].nextMs = now;
+  }
+  LOG_INFO("Sensors: polling %d sensors on SDA %d / SCL %d", slotCount, busSda, busScl);
+}
+
+// ============================================
+// Polling
+// ============================================
+
+static void pollSensor(SensorSlot& slot) {
+  // Bus transactions happen outside the mutex; only the results are shared
+  int64_t start = esp_timer_get_time();
+  float values[SENSOR_MAX_VALUES];
+  bool ready = slot.ready;
+  if (!ready) {
+    ready = slot.driver->begin(wireBus, slot.address, slot.state);
+  }
+  bool ok = ready && slot.driver->read(wireBus, slot.address, slot.state, values);
+  uint32_t elapsedUs = (uint32_t)(esp_timer_get_time() - start);
+
+  xSemaphoreTake(sensorMutex, portMAX_DELAY);
+  slot.ready = ready;
+  slot.reads++;
+  slot.readUs = elapsedUs;
+  if (ok) {
+    uint8_t count = slot.driver->valueCount;
+    memcpy(slot.values, values, count * sizeof(float));
+    slot.valid = true;
+    slot.updatedMs = millis();
+    slot.failedInRow = 0;
+
+    memcpy(slot.history + slot.historyHead * count, values, count * sizeof(float));
+    slot.historyMs[slot.historyHead] = slot.updatedMs;
+    slot.historyHead = (slot.historyHead + 1) % SENSOR_HISTORY;
+    if (slot.historyCount < SENSOR_HISTORY) slot.historyCount++;
+  } else {
+    slot.errors++;
+    if (++slot.failedInRow >= SENSOR_REINIT_AFTER) {
+      slot.ready = false;
+    }
+    if (slot.failedInRow == SENSOR_REINIT_AFTER) {
+      LOG_WARN("Sensors: %s at 0x%02x not responding", slot.name, slot.address);
+    }
+  }
+  xSemaphoreGive(sensorMutex);
+}
+
+static void sensorTask(void* param) {
+  for (;;) {
+    if (reloadRequested) {
+      reloadRequested = false;
+      xSemaphoreTake(sensorMutex, portMAX_DELAY);
+      reloadConfiguration();
+      xSemaphoreGive(sensorMutex);
+    }
+
+    uint32_t waitMs = SENSOR_IDLE_MS;
+    for (size_t i = 0; i < slotCount; i++) {
+      SensorSlot& slot = slots[i];
+      uint32_t now = millis();
+      if ((int32_t)(now - slot.nextMs) >= 0) {
+        pollSensor(slot);
+        // Keep the cadence, but do not try to catch up after a stall
+        slot.nextMs += slot.intervalMs;
+        if ((int32_t)(millis() - slot.nextMs) >= 0) slot.nextMs = millis() + slot.intervalMs;
+      }
+      int32_t remaining = (int32_t)(slot.nextMs - millis());
+      waitMs = min(waitMs, (uint32_t)max(remaining, (int32_t)0));
+    }
+
+    // Woken early by reloadSensors()
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+  }
+}
+
+// ============================================
+// Public API
+// ============================================
+
+void initSensors() {
+  sensorMutex = xSemaphoreCreateMutex();
+  if (!sensorMutex) {
+    LOG_ERROR("Failed to create sensor mutex");
+    return;
+  }
+
+  xTaskCreatePinnedToCore(sensorTask, "sensors", SENSOR_TASK_STACK, NULL,
+    SENSOR_TASK_PRIORITY, &sensorTaskHandle, SENSOR_TASK_CORE);
+}
+
+void reloadSensors() {
+  reloadRequested = true;
+  if (sensorTaskHandle) xTaskNotifyGive(sensorTaskHandle);
+}
+
+bool isSensorBusPin(int pin) {
+  return busActive && (pin == busSda || pin == busScl);
+}
+
+static float rounded(float value) {
+  return roundf(value * 100) / 100;
+}
+
+void getSensorReadings(JsonObject out, const char* name, bool history) {
+  if (!sensorMutex) return;
+
+  xSemaphoreTake(sensorMutex, portMAX_DELAY);
+  uint32_t now = millis();
+
+  JsonObject bus = out["bus"].to<JsonObject>();
+  bus["active"] = busActive;
+  bus["sda"] = busSda;
+  bus["scl"] = busScl;
+  bus["frequency"] = busHz;
+  out["source"] = configSource;
+
+  JsonArray list = out["sensors"].to<JsonArray>();
+  for (size_t i = 0; i < slotCount; i++) {
+    const SensorSlot& slot = slots[i];
+    if (name && *name && strcmp(name, slot.name) != 0) continue;
+
+    JsonObject entry = list.add<JsonObject>();
+    entry["name"] = slot.name;
+    entry["driver"] = slot.driver->name;
+    entry["address"] = slot.address;
+    entry["interval_ms"] = slot.intervalMs;
+    entry["ok"] = slot.valid && slot.failedInRow == 0;
+    entry["reads"] = slot.reads;
+    entry["errors"] = slot.errors;
+    entry["read_us"] = slot.readUs;
+
+    uint8_t count = slot.driver->valueCount;
+    JsonObject units = entry["units"].to<JsonObject>();
+    for (uint8_t v = 0; v < count; v++) {
+      units[slot.driver->valueNames[v]] = slot.driver->units[v];
+    }
+    if (!slot.valid) continue;
+
+    entry["age_ms"] = now - slot.updatedMs;
+    JsonObject values = entry["values"].to<JsonObject>();
+    for (uint8_t v = 0; v < count; v++) {
+      values[slot.driver->valueNames[v]] = rounded(slot.values[v]);
+    }
+
+    if (!history) continue;
+
+    // Oldest first; ages are relative to this response
+    JsonObject samples = entry["history"].to<JsonObject>();
+    JsonArray ages = samples["age_ms"].to<JsonArray>();
+    JsonArray series[SENSOR_MAX_VALUES];
+    for (uint8_t v = 0; v < count; v++) {
+      series[v] = samples[slot.driver->valueNames[v]].to<JsonArray>();
+    }
+    uint16_t first = (slot.historyHead + SENSOR_HISTORY - slot.historyCount) % SENSOR_HISTORY;
+    for (uint16_t n = 0; n < slot.historyCount; n++) {
+      uint16_t row = (first + n) % SENSOR_HISTORY;
+      ages.add(now - slot.historyMs[row]);
+      for (uint8_t v = 0; v < count; v++) {
+        series[v].add(rounded(slot.history[row * count + v]));
+      }
+    }
+  }
+  xSemaphoreGive(sensorMutex);
+}
@@ -0,0 +1,42 @@
+#ifndef SENSORS_H
+#define SENSORS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Background I2C sensor service for the Grove port.
+//
+// Sensors are listed in PATH_SENSORS; without that file the bus is probed
+// once for every known driver (sensor_drivers.h) and whatever answers is
+// polled. A dedicated task reads each sensor at its own interval and stores
+// the latest values plus SENSOR_HISTORY samples in RAM, so /_api/sensors
+// only copies from the cache and never waits on the bus. A sensor that
+// fails SENSOR_REINIT_AFTER reads in a row is re-initialized on its next
+// turn, so a unit that is unplugged and plugged back in recovers.
+//
+// The bus pins count as reserved while the bus is in use; when nothing is
+// configured or detected the bus is released again.
+#define SENSORS_MAX 8
+#define SENSOR_HISTORY 60
+#define SENSOR_NAME_MAX 16
+#define SENSOR_DEFAULT_INTERVAL_MS 2000
+#define SENSOR_REINIT_AFTER 3
+#define SENSOR_BUS_SDA 2
+#define SENSOR_BUS_SCL 1
+#define SENSOR_BUS_HZ 100000
+#define SENSOR_TASK_STACK 4096
+#define SENSOR_TASK_PRIORITY 2
+#define SENSOR_TASK_CORE APP_CPU_NUM
+#define SENSOR_IDLE_MS 60000
+
+void initSensors();
+
+// Re-reads PATH_SENSORS (or re-probes) on the sensor task
+void reloadSensors();
+
+bool isSensorBusPin(int pin);
+
+// name filters to one sensor; history adds the buffered samples
+void getSensorReadings(JsonObject out, const char* name, bool history);
+
+#endif
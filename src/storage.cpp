@@ -1,4 +1,8 @@
 #include "storage.h"
+#include "config.h"
+#include "sd_bench.h"
+#include "file_manifest.h"
+#include "asset_cache.h"
 #include <SPI.h>
 
 #define SDCARD_MISO 14
@@ -6,11 +10,40 @@
 #define SDCARD_SCK 42
 #define SDCARD_CS 40
 
+#define STORAGE_SCAN_TASK_STACK 6144
+#define STORAGE_SCAN_TASK_PRIORITY 1
+#define STORAGE_SCAN_TASK_CORE 0
+
+struct DirUsage {
+  char name[STORAGE_USAGE_NAME_LEN];   // top-level directory, "" for files in /
+  uint64_t bytes;
+  uint32_t files;
+};
+
+static portMUX_TYPE usageLock = portMUX_INITIALIZER_UNLOCKED;
+static DirUsage dirUsage[STORAGE_USAGE_MAX_DIRS];
+static int dirUsageCount = 0;
+static uint64_t cardTotal = 0;
+static uint64_t cardUsed = 0;
+static volatile bool usageReady = false;
+static volatile bool scanning = false;
+static int64_t scanDelta = 0;          // deltas reported since the scan read usedBytes()
+static uint32_t scanCount = 0;
+static uint32_t lastScanAt = 0;
+static uint32_t lastScanDuration = 0;
+static int64_t lastDrift = 0;
+static uint32_t adjustments = 0;
+static TaskHandle_t scanTask = nullptr;
+static uint32_t sdClockHz = 0;
+
+static void startUsageScanner();
+
 void setupSDCard() {
   Serial.println("ℹ️  INFO: Initializing SD card...");
   SPI.begin(SDCARD_SCK, SDCARD_MISO, SDCARD_MOSI, SDCARD_CS);
   
-  if (!SD.begin(SDCARD_CS)) {
+  // Always mount at the safe clock first; the tuned clock lives on the card
+  if (!mountSDCard(SDCARD_DEFAULT_HZ)) {
     Serial.println("❌ ERROR: SD Card Mount Failed!");
     return;
   }
@@ -27,7 +60,19 @@ void setupSDCard() {
     cardType == CARD_SDHC ? "SDHC" : "Unknown");
   
   Serial.printf("ℹ️  INFO: SD Card Size: %llu MB\n", SD.cardSize() / (1024 * 1024));
-  Serial.printf("ℹ️  INFO: Used Space: %llu MB\n", SD.usedBytes() / (1024 * 1024));
+  
+  uint32_t tunedHz = prepareSDClock();
+  if (tunedHz != sdClockHz) {
+    // A card that no longer mounts or reads at its tuned clock drops back
+    if (!mountSDCard(tunedHz) || !SD.exists(PATH_SD_TUNE)) {
+      LOG_WARN("SD: tuned clock %d kHz failed, using %d kHz", tunedHz / 1000, SDCARD_DEFAULT_HZ / 1000);
+      mountSDCard(SDCARD_DEFAULT_HZ);
+    }
+  }
+  LOG_INFO("SD: SPI clock %d kHz", sdClockHz / 1000);
+  
+  // Used space is measured in the background; see startUsageScanner()
+  startUsageScanner();
 }
 
 void listDir(File dir, String path, JsonArray& files, int depth = 0, int& count = *(new int(0))) {
@@ -57,6 +102,20 @@ void listDir(File dir, String path, JsonArray& files, int depth = 0, int& count
   }
 }
 
+bool mountSDCard(uint32_t hz) {
+  SD.end();
+  if (!SD.begin(SDCARD_CS, SPI, hz)) {
+    sdClockHz = 0;
+    return false;
+  }
+  sdClockHz = hz;
+  return true;
+}
+
+uint32_t getSDCardClock() {
+  return sdClockHz;
+}
+
 bool isSDCardMounted() {
   return SD.cardType() != CARD_NONE;
 }
@@ -66,6 +125,234 @@ uint64_t getSDCardSize() {
 }
 
 uint64_t getSDCardUsed() {
-  return SD.usedBytes();
+  return cardUsed;
 }
 
+// Helper to create directory path recursively
+void createDirectoryPath(const String& path) {
+  if (path.length() == 0 || path == "/") return;
+  if (SD.exists(path)) return;
+  
+  int lastSlash = path.lastIndexOf('/');
+  if (lastSlash > 0) {
+    String parentPath = path.substring(0, lastSlash);
+    createDirectoryPath(parentPath);
+  }
+  
+  SD.mkdir(path);
+  LOG_INFO("Created directory: %s", path.c_str());
+}
+
+// ============================================
+// Space Accounting
+// ============================================
+
+// "/apps/x/y.html" -> "apps"; files directly in / map to ""
+static void topLevelName(const char* path, char* out) {
+  while (*path == '/') path++;
+  const char* slash = strchr(path, '/');
+  size_t len = slash ? (size_t)(slash - path) : 0;
+  if (len >= STORAGE_USAGE_NAME_LEN) len = STORAGE_USAGE_NAME_LEN - 1;
+  memcpy(out, path, len);
+  out[len] = '\0';
+}
+
+static DirUsage* findDirUsage(DirUsage* table, int& count, const char* name, bool create) {
+  for (int i = 0; i < count; i++) {
+    if (strcmp(table[i].name, name) == 0) return &table[i];
+  }
+  if (!create || count >= STORAGE_USAGE_MAX_DIRS) return nullptr;
+
+  DirUsage* entry = &table[count++];
+  strlcpy(entry->name, name, STORAGE_USAGE_NAME_LEN);
+  entry->bytes = 0;
+  entry->files = 0;
+  return entry;
+}
+
+static uint64_t addClamped(uint64_t value, int64_t delta) {
+  if (delta < 0 && (uint64_t)(-delta) > value) return 0;
+  return value + delta;
+}
+
+// Caller holds usageLock
+static void applyDelta(const char* name, int64_t delta) {
+  cardUsed = addClamped(cardUsed, delta);
+  if (scanning) scanDelta += delta;
+  DirUsage* dir = findDirUsage(dirUsage, dirUsageCount, name, delta > 0);
+  if (dir) dir->bytes = addClamped(dir->bytes, delta);
+  adjustments++;
+}
+
+void adjustSDCardUsage(const String& path, int64_t delta) {
+  forgetFileHash(path);
+  invalidateAssetCache(path);
+  if (delta == 0) return;
+
+  char name[STORAGE_USAGE_NAME_LEN];
+  topLevelName(path.c_str(), name);
+
+  portENTER_CRITICAL(&usageLock);
+  applyDelta(name, delta);
+  portEXIT_CRITICAL(&usageLock);
+}
+
+void noteSDCardMove(const String& source, const String& destination, uint64_t size) {
+  invalidateAssetCache(source);
+  invalidateAssetCache(destination);
+  if (size > 0) {
+    forgetFileHash(source);
+    forgetFileHash(destination);
+  } else {
+    // Digests are keyed by path hash, so a tree cannot be dropped by prefix
+    forgetAllFileHashes();
+  }
+
+  char from[STORAGE_USAGE_NAME_LEN];
+  char to[STORAGE_USAGE_NAME_LEN];
+  topLevelName(source.c_str(), from);
+  topLevelName(destination.c_str(), to);
+  if (strcmp(from, to) == 0) return;
+
+  if (size == 0) {
+    requestSDCardRescan();
+    return;
+  }
+
+  // Same bytes on the card, only their directory changes
+  portENTER_CRITICAL(&usageLock);
+  applyDelta(from, -(int64_t)size);
+  applyDelta(to, (int64_t)size);
+  portEXIT_CRITICAL(&usageLock);
+}
+
+void requestSDCardRescan() {
+  if (scanTask) xTaskNotifyGive(scanTask);
+}
+
+void noteSDCardTreeChange(const String& path) {
+  invalidateAssetCache(path);
+  forgetAllFileHashes();
+  requestSDCardRescan();
+}
+
+bool isSDCardUsageReady() {
+  return usageReady;
+}
+
+static void scanTree(File& dir, int depth, uint64_t& bytes, uint32_t& files, uint32_t& visited) {
+  File child = dir.openNextFile();
+  while (child) {
+    if (child.isDirectory()) {
+      if (depth < STORAGE_SCAN_MAX_DEPTH) scanTree(child, depth + 1, bytes, files, visited);
+    } else {
+      bytes += child.size();
+      files++;
+    }
+    child.close();
+
+    // Let HTTP handlers and the recorder get at the card between entries
+    if (++visited % 32 == 0) vTaskDelay(1);
+    child = dir.openNextFile();
+  }
+}
+
+static void measureUsage() {
+  uint32_t start = millis();
+  portENTER_CRITICAL(&usageLock);
+  scanning = true;
+  scanDelta = 0;
+  portEXIT_CRITICAL(&usageLock);
+
+  uint64_t total = SD.totalBytes();
+  uint64_t used = SD.usedBytes();
+
+  DirUsage table[STORAGE_USAGE_MAX_DIRS];
+  int count = 0;
+  uint32_t visited = 0;
+
+  File root = SD.open("/");
+  if (root) {
+    File child = root.openNextFile();
+    while (child) {
+      const char* name = child.isDirectory() ? child.name() : "";
+      DirUsage* entry = findDirUsage(table, count, name, true);
+      if (entry) {
+        if (child.isDirectory()) {
+          scanTree(child, 1, entry->bytes, entry->files, visited);
+        } else {
+          entry->bytes += child.size();
+          entry->files++;
+        }
+      }
+      child.close();
+      child = root.openNextFile();
+    }
+    root.close();
+  }
+
+  // usedBytes() was read before the walk, so deltas reported since then
+  // are added back on top of it
+  portENTER_CRITICAL(&usageLock);
+  used = addClamped(used, scanDelta);
+  lastDrift = usageReady ? (int64_t)cardUsed - (int64_t)used : 0;
+  cardTotal = total;
+  cardUsed = used;
+  memcpy(dirUsage, table, sizeof(DirUsage) * count);
+  dirUsageCount = count;
+  scanning = false;
+  portEXIT_CRITICAL(&usageLock);
+
+  usageReady = true;
+  scanCount++;
+  lastScanAt = millis();
+  lastScanDuration = lastScanAt - start;
+
+  LOG_INFO("SD usage: %llu of %llu MB used, %d entries scanned in %d ms (drift %lld bytes)",
+           used / (1024 * 1024), total / (1024 * 1024), visited, lastScanDuration, lastDrift);
+}
+
+static void usageScanTask(void* param) {
+  while (true) {
+    if (isSDCardMounted()) measureUsage();
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(STORAGE_RECONCILE_MS));
+  }
+}
+
+static void startUsageScanner() {
+  if (scanTask) return;
+  xTaskCreatePinnedToCore(usageScanTask, "sd_usage", STORAGE_SCAN_TASK_STACK, NULL,
+                          STORAGE_SCAN_TASK_PRIORITY, &scanTask, STORAGE_SCAN_TASK_CORE);
+}
+
+void getSDCardUsage(JsonObject out) {
+  DirUsage table[STORAGE_USAGE_MAX_DIRS];
+
+  portENTER_CRITICAL(&usageLock);
+  uint64_t total = cardTotal;
+  uint64_t used = cardUsed;
+  int count = dirUsageCount;
+  memcpy(table, dirUsage, sizeof(DirUsage) * count);
+  portEXIT_CRITICAL(&usageLock);
+
+  out["ready"] = (bool)usageReady;
+  out["total"] = total;
+  out["used"] = used;
+  out["free"] = total > used ? total - used : 0;
+  out["scanning"] = (bool)scanning;
+  out["scans"] = scanCount;
+  if (scanCount > 0) {
+    out["last_scan_age_s"] = (millis() - lastScanAt) / 1000;
+    out["last_scan_ms"] = lastScanDuration;
+    out["drift_bytes"] = lastDrift;
+  }
+  out["adjustments"] = adjustments;
+
+  JsonArray dirs = out["dirs"].to<JsonArray>();
+  for (int i = 0; i < count; i++) {
+    JsonObject dir = dirs.add<JsonObject>();
+    dir["path"] = String("/") + table[i].name;
+    dir["bytes"] = table[i].bytes;
+    dir["files"] = table[i].files;
+  }
+}
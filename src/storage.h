@@ -5,14 +5,47 @@
 #include <SD.h>
 #include <ArduinoJson.h>
 
+// Space accounting. FatFs answers usedBytes()/totalBytes() by walking the
+// FAT, which takes seconds on a large card, so a background task measures
+// usage once after mount and then every STORAGE_RECONCILE_MS. In between,
+// writers report byte deltas and the cached figures stay current without
+// touching the card. Per-directory totals are kept for each top-level
+// directory (files in / count under "/").
+#define STORAGE_RECONCILE_MS (10 * 60 * 1000)
+#define STORAGE_USAGE_MAX_DIRS 16
+#define STORAGE_USAGE_NAME_LEN 24
+#define STORAGE_SCAN_MAX_DEPTH 12
+
+// SD.begin()'s default; every card is mounted here first
+#define SDCARD_DEFAULT_HZ 4000000
+
 // SD Card initialization
 void setupSDCard();
+// Remounts at the given SPI clock; only safe while no files are open
+bool mountSDCard(uint32_t hz);
+uint32_t getSDCardClock();
 
 // SD Card operations
 void listDir(File dir, String path, JsonArray& files, int depth, int& count);
 bool isSDCardMounted();
 uint64_t getSDCardSize();
 uint64_t getSDCardUsed();
+bool isSDCardUsageReady();
+
+// Called by anything that writes, grows or shrinks a file (delta 0 for a
+// rewrite of unknown or unchanged size); safe from any task. This is also
+// the one place that drops the file's cached digest (file_manifest.h) and
+// RAM copy (asset_cache.h), so writers report nowhere else.
+void adjustSDCardUsage(const String& path, int64_t delta);
+// Renames only matter to usage when they cross top-level directories. Pass
+// size 0 for directories; their usage is then re-measured in the background.
+void noteSDCardMove(const String& source, const String& destination, uint64_t size);
+// For changes to a whole tree (archive extraction): invalidates everything
+// below path and re-measures usage
+void noteSDCardTreeChange(const String& path);
+void requestSDCardRescan();
+void getSDCardUsage(JsonObject out);
+void createDirectoryPath(const String& path);
 
 #endif
 
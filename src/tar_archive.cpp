@@ -0,0 +1,513 @@
+#include "tar_archive.h"
+#include "config.h"
+#include "storage.h"
+
+#define TAR_NAME_LEN 100
+#define TAR_PREFIX_LEN 155
+#define TAR_TRAILER_SIZE (2 * TAR_BLOCK_SIZE)
+
+// ustar header field offsets
+#define TAR_OFF_NAME 0
+#define TAR_OFF_MODE 100
+#define TAR_OFF_UID 108
+#define TAR_OFF_GID 116
+#define TAR_OFF_SIZE 124
+#define TAR_OFF_MTIME 136
+#define TAR_OFF_CHKSUM 148
+#define TAR_OFF_TYPE 156
+#define TAR_OFF_MAGIC 257
+#define TAR_OFF_VERSION 263
+#define TAR_OFF_UNAME 265
+#define TAR_OFF_GNAME 297
+#define TAR_OFF_PREFIX 345
+
+static void writeOctal(uint8_t* field, size_t width, uint32_t value) {
+  // width - 1 digits followed by NUL
+  field[width - 1] = '\0';
+  for (int i = width - 2; i >= 0; i--) {
+    field[i] = '0' + (value & 7);
+    value >>= 3;
+  }
+}
+
+static uint32_t readOctal(const uint8_t* field, size_t width) {
+  uint32_t value = 0;
+  size_t i = 0;
+  while (i < width && field[i] == ' ') i++;
+  for (; i < width && field[i] >= '0' && field[i] <= '7'; i++) {
+    value = (value << 3) | (field[i] - '0');
+  }
+  return value;
+}
+
+static uint32_t headerChecksum(const uint8_t* block) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+    bool inChecksum = i >= TAR_OFF_CHKSUM && i < TAR_OFF_CHKSUM + 8;
+    sum += inChecksum ? ' ' : block[i];
+  }
+  return sum;
+}
+
+bool buildTarHeader(uint8_t* block, const String& name, uint32_t size, uint32_t mtime, bool isDir) {
+  memset(block, 0, TAR_BLOCK_SIZE);
+
+  size_t len = name.length();
+  if (len == 0 || len > TAR_MAX_PATH) {
+    return false;
+  }
+
+  if (len <= TAR_NAME_LEN) {
+    memcpy(block + TAR_OFF_NAME, name.c_str(), len);
+  } else {
+    // Split at the first '/' that leaves a name short enough for the name field
+    int split = -1;
+    for (int i = len - TAR_NAME_LEN - 1; i < (int)len && i <= TAR_PREFIX_LEN; i++) {
+      if (i >= 0 && name[i] == '/') {
+        split = i;
+        break;
+      }
+    }
+    if (split <= 0) {
+      return false;
+    }
+    memcpy(block + TAR_OFF_PREFIX, name.c_str(), split);
+    memcpy(block + TAR_OFF_NAME, name.c_str() + split + 1, len - split - 1);
+  }
+
+  writeOctal(block + TAR_OFF_MODE, 8, isDir ? 0755 : 0644);
+  writeOctal(block + TAR_OFF_UID, 8, 0);
+  writeOctal(block + TAR_OFF_GID, 8, 0);
+  writeOctal(block + TAR_OFF_SIZE, 12, isDir ? 0 : size);
+  writeOctal(block + TAR_OFF_MTIME, 12, mtime);
+  block[TAR_OFF_TYPE] = isDir ? '5' : '0';
+  memcpy(block + TAR_OFF_MAGIC, "ustar", 6);
+  memcpy(block + TAR_OFF_VERSION, "00", 2);
+  memcpy(block + TAR_OFF_UNAME, "esp2go", 6);
+  memcpy(block + TAR_OFF_GNAME, "esp2go", 6);
+
+  writeOctal(block + TAR_OFF_CHKSUM, 7, headerChecksum(block));
+  block[TAR_OFF_CHKSUM + 7] = ' ';
+  return true;
+}
+
+bool parseTarHeader(const uint8_t* block, String& name, uint32_t& size, char& type) {
+  if (readOctal(block + TAR_OFF_CHKSUM, 8) != headerChecksum(block)) {
+    return false;
+  }
+
+  name = "";
+  if (memcmp(block + TAR_OFF_MAGIC, "ustar", 5) == 0 && block[TAR_OFF_PREFIX] != '\0') {
+    name.concat((const char*)block + TAR_OFF_PREFIX, strnlen((const char*)block + TAR_OFF_PREFIX, TAR_PREFIX_LEN));
+    name += "/";
+  }
+  name.concat((const char*)block + TAR_OFF_NAME, strnlen((const char*)block + TAR_OFF_NAME, TAR_NAME_LEN));
+
+  // Base-256 sizes (files >= 8 GB) are not supported
+  if (block[TAR_OFF_SIZE] & 0x80) {
+    return false;
+  }
+  size = readOctal(block + TAR_OFF_SIZE, 12);
+  type = block[TAR_OFF_TYPE] ? block[TAR_OFF_TYPE] : '0';
+  return true;
+}
+
+bool isTarEndBlock(const uint8_t* block) {
+  for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+    if (block[i]) return false;
+  }
+  return true;
+}
+
+static uint32_t tarPadding(uint32_t size) {
+  return (TAR_BLOCK_SIZE - (size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE;
+}
+
+// ============================================
+// Archive writer
+// ============================================
+
+bool beginTarWriter(TarWriter& writer, const String& path) {
+  writer.rootPath = path;
+  while (writer.rootPath.length() > 1 && writer.rootPath.endsWith("/")) {
+    writer.rootPath.remove(writer.rootPath.length() - 1);
+  }
+  writer.archiveBase = writer.rootPath.substring(writer.rootPath.lastIndexOf('/') + 1);
+  writer.depth = 0;
+  writer.fileRemaining = 0;
+  writer.padRemaining = 0;
+  writer.headerPos = TAR_BLOCK_SIZE;
+  writer.trailerRemaining = TAR_TRAILER_SIZE;
+  writer.entries = 0;
+  writer.failed = false;
+  writer.error = "";
+
+  File root = SD.open(writer.rootPath, FILE_READ);
+  if (!root) {
+    return false;
+  }
+
+  if (root.isDirectory()) {
+    writer.dirs[0] = root;
+    writer.dirNames[0] = writer.archiveBase;
+    writer.depth = 1;
+    if (writer.archiveBase.length() > 0) {
+      if (!buildTarHeader(writer.header, writer.archiveBase + "/", 0, root.getLastWrite(), true)) {
+        root.close();
+        writer.depth = 0;
+        writer.error = "Name too long for tar: " + writer.archiveBase;
+        return false;
+      }
+      writer.headerPos = 0;
+      writer.entries++;
+    }
+  } else {
+    if (!buildTarHeader(writer.header, writer.archiveBase, root.size(), root.getLastWrite(), false)) {
+      root.close();
+      writer.error = "Name too long for tar: " + writer.archiveBase;
+      return false;
+    }
+    writer.headerPos = 0;
+    writer.file = root;
+    writer.fileRemaining = root.size();
+    writer.padRemaining = tarPadding(root.size());
+    writer.entries++;
+  }
+  return true;
+}
+
+static void failTarWriter(TarWriter& writer, const String& error) {
+  LOG_ERROR("tar: %s", error.c_str());
+  if (writer.file) {
+    writer.file.close();
+  }
+  while (writer.depth > 0) {
+    writer.dirs[--writer.depth].close();
+  }
+  writer.failed = true;
+  writer.error = error;
+}
+
+static void advanceTarWriter(TarWriter& writer) {
+  File& dir = writer.dirs[writer.depth - 1];
+  File entry = dir.openNextFile();
+  if (!entry) {
+    dir.close();
+    writer.depth--;
+    return;
+  }
+
+  const String& parent = writer.dirNames[writer.depth - 1];
+  String member = parent.length() > 0 ? parent + "/" + entry.name() : String(entry.name());
+
+  if (entry.isDirectory()) {
+    if (writer.depth >= TAR_MAX_DEPTH) {
+      entry.close();
+      failTarWriter(writer, "Nested deeper than " + String(TAR_MAX_DEPTH) + " levels: " + member);
+      return;
+    }
+    if (!buildTarHeader(writer.header, member + "/", 0, entry.getLastWrite(), true)) {
+      entry.close();
+      failTarWriter(writer, "Name too long for tar: " + member);
+      return;
+    }
+    writer.dirs[writer.depth] = entry;
+    writer.dirNames[writer.depth] = member;
+    writer.depth++;
+  } else {
+    if (!buildTarHeader(writer.header, member, entry.size(), entry.getLastWrite(), false)) {
+      entry.close();
+      failTarWriter(writer, "Name too long for tar: " + member);
+      return;
+    }
+    writer.file = entry;
+    writer.fileRemaining = entry.size();
+    writer.padRemaining = tarPadding(entry.size());
+  }
+
+  writer.headerPos = 0;
+  writer.entries++;
+}
+
+size_t readTarWriter(TarWriter& writer, uint8_t* buffer, size_t maxLen) {
+  size_t out = 0;
+
+  while (out < maxLen && !writer.failed) {
+    if (writer.headerPos < TAR_BLOCK_SIZE) {
+      size_t n = min(TAR_BLOCK_SIZE - writer.headerPos, maxLen - out);
+      memcpy(buffer + out, writer.header + writer.headerPos, n);
+      writer.headerPos += n;
+      out += n;
+    } else if (writer.fileRemaining > 0) {
+      size_t want = min((size_t)writer.fileRemaining, maxLen - out);
+      size_t got = writer.file.read(buffer + out, want);
+      if (got == 0) {
+        failTarWriter(writer, "Read failed with " + String(writer.fileRemaining) + " bytes left: " +
+                      String(writer.file.path()));
+        break;
+      }
+      writer.fileRemaining -= got;
+      out += got;
+    } else if (writer.padRemaining > 0) {
+      size_t n = min((size_t)writer.padRemaining, maxLen - out);
+      memset(buffer + out, 0, n);
+      writer.padRemaining -= n;
+      out += n;
+    } else if (writer.file) {
+      writer.file.close();
+    } else if (writer.depth > 0) {
+      advanceTarWriter(writer);
+    } else if (writer.trailerRemaining > 0) {
+      size_t n = min((size_t)writer.trailerRemaining, maxLen - out);
+      memset(buffer + out, 0, n);
+      writer.trailerRemaining -= n;
+      out += n;
+    } else {
+      break;
+    }
+  }
+
+  return out;
+}
+
+// ============================================
+// Streaming extractor
+// ============================================
+
+void beginTarExtractor(TarExtractor& extractor, const String& destPath) {
+  extractor.destPath = destPath;
+  while (extractor.destPath.length() > 1 && extractor.destPath.endsWith("/")) {
+    extractor.destPath.remove(extractor.destPath.length() - 1);
+  }
+  extractor.headerFill = 0;
+  extractor.longName = "";
+  extractor.paxData = "";
+  extractor.skipNext = false;
+  if (extractor.file) {
+    extractor.file.close();
+  }
+  extractor.dataRemaining = 0;
+  extractor.padRemaining = 0;
+  extractor.entryType = 0;
+  extractor.zeroBlocks = 0;
+  extractor.files = 0;
+  extractor.dirs = 0;
+  extractor.skipped = 0;
+  extractor.bytes = 0;
+  extractor.failed = false;
+  extractor.error = "";
+}
+
+static void failTarExtractor(TarExtractor& extractor, const String& error) {
+  LOG_ERROR("tar: %s", error.c_str());
+  if (extractor.file) {
+    String partial = extractor.file.path();
+    extractor.file.close();
+    SD.remove(partial);
+  }
+  extractor.failed = true;
+  extractor.error = error;
+}
+
+// Maps a member name onto the destination directory; empty if unsafe
+static String resolveTarMember(const TarExtractor& extractor, String name) {
+  while (name.startsWith("./")) name = name.substring(2);
+  while (name.startsWith("/")) name = name.substring(1);
+  while (name.endsWith("/")) name.remove(name.length() - 1);
+
+  if (name.length() == 0 || name.indexOf("..") >= 0) {
+    return String();
+  }
+  return extractor.destPath == "/" ? "/" + name : extractor.destPath + "/" + name;
+}
+
+// Takes the path record of a pax 'x' header ("<len> path=<name>\n") as the
+// next member's name, like a GNU long name. Other keys (mtime, uid, ...)
+// mean nothing on FAT and are ignored.
+static void applyPaxHeader(TarExtractor& extractor) {
+  const String& data = extractor.paxData;
+  bool overflow = data.length() >= TAR_MAX_PAX;
+  bool found = false;
+  unsigned int pos = 0;
+
+  while (pos < data.length()) {
+    int space = data.indexOf(' ', pos);
+    if (space < 0) break;
+    long len = data.substring(pos, space).toInt();
+    if (len <= space - (long)pos || pos + len > data.length()) break;
+
+    String record = data.substring(space + 1, pos + len - 1);
+    if (record.startsWith("path=")) {
+      String path = record.substring(5);
+      if (path.length() > 0 && path.length() <= TAR_MAX_PATH) {
+        extractor.longName = path;
+        found = true;
+      } else {
+        overflow = true;
+      }
+    }
+    pos += len;
+  }
+
+  // A path we cannot read must not fall back to the truncated ustar name
+  if (overflow && !found) {
+    extractor.skipNext = true;
+  }
+  extractor.paxData = "";
+}
+
+static void handleTarHeader(TarExtractor& extractor) {
+  String name;
+  uint32_t size;
+  char type;
+
+  if (!parseTarHeader(extractor.header, name, size, type)) {
+    failTarExtractor(extractor, "Invalid tar header");
+    return;
+  }
+
+  bool nameHeader = type == 'L' || type == 'x';
+  if (!nameHeader && extractor.longName.length() > 0) {
+    name = extractor.longName;
+    extractor.longName = "";
+  }
+
+  extractor.entryType = type;
+  extractor.dataRemaining = size;
+  extractor.padRemaining = tarPadding(size);
+
+  if (type == 'L') {
+    // GNU long name: the data blocks hold the next member's name
+    extractor.longName = "";
+    return;
+  }
+
+  if (type == 'x') {
+    // pax extended header: the data blocks hold records for the next member
+    extractor.paxData = "";
+    if (size == 0) applyPaxHeader(extractor);
+    return;
+  }
+
+  if (extractor.skipNext) {
+    LOG_WARN("tar: Skipping member with unreadable pax path: %s", name.c_str());
+    extractor.skipNext = false;
+    extractor.skipped++;
+    return;
+  }
+
+  if (type != '0' && type != '7' && type != '5') {
+    // Links, devices and global pax headers carry nothing we can store on FAT
+    extractor.skipped++;
+    return;
+  }
+
+  String path = resolveTarMember(extractor, name);
+  if (path.length() == 0) {
+    LOG_WARN("tar: Skipping unsafe member: %s", name.c_str());
+    extractor.skipped++;
+    return;
+  }
+
+  if (type == '5') {
+    createDirectoryPath(path);
+    extractor.dirs++;
+    return;
+  }
+
+  int lastSlash = path.lastIndexOf('/');
+  if (lastSlash > 0) {
+    createDirectoryPath(path.substring(0, lastSlash));
+  }
+  if (SD.exists(path)) {
+    SD.remove(path);
+  }
+
+  extractor.file = SD.open(path, FILE_WRITE);
+  if (!extractor.file) {
+    failTarExtractor(extractor, "Cannot create " + path);
+    return;
+  }
+  extractor.files++;
+
+  if (size == 0) {
+    extractor.file.close();
+  }
+}
+
+bool writeTarExtractor(TarExtractor& extractor, const uint8_t* data, size_t len) {
+  size_t pos = 0;
+
+  while (pos < len && !extractor.failed) {
+    if (extractor.dataRemaining > 0) {
+      size_t n = min((size_t)extractor.dataRemaining, len - pos);
+
+      if (extractor.file) {
+        if (extractor.file.write(data + pos, n) != n) {
+          failTarExtractor(extractor, "Write failed");
+          break;
+        }
+        extractor.bytes += n;
+      } else if (extractor.entryType == 'L') {
+        for (size_t i = 0; i < n && data[pos + i] != '\0'; i++) {
+          if (extractor.longName.length() < TAR_MAX_PATH) {
+            extractor.longName += (char)data[pos + i];
+          }
+        }
+      } else if (extractor.entryType == 'x') {
+        for (size_t i = 0; i < n && extractor.paxData.length() < TAR_MAX_PAX; i++) {
+          extractor.paxData += (char)data[pos + i];
+        }
+      }
+
+      extractor.dataRemaining -= n;
+      pos += n;
+      if (extractor.dataRemaining == 0 && extractor.file) {
+        extractor.file.close();
+      }
+      if (extractor.dataRemaining == 0 && extractor.entryType == 'x') {
+        applyPaxHeader(extractor);
+      }
+      continue;
+    }
+
+    if (extractor.padRemaining > 0) {
+      size_t n = min((size_t)extractor.padRemaining, len - pos);
+      extractor.padRemaining -= n;
+      pos += n;
+      continue;
+    }
+
+    size_t n = min(TAR_BLOCK_SIZE - extractor.headerFill, len - pos);
+    memcpy(extractor.header + extractor.headerFill, data + pos, n);
+    extractor.headerFill += n;
+    pos += n;
+    if (extractor.headerFill < TAR_BLOCK_SIZE) {
+      break;
+    }
+    extractor.headerFill = 0;
+
+    if (isTarEndBlock(extractor.header)) {
+      extractor.zeroBlocks++;
+      continue;
+    }
+    if (extractor.zeroBlocks >= 2) {
+      // Anything after the end-of-archive marker is ignored
+      continue;
+    }
+    extractor.zeroBlocks = 0;
+    handleTarHeader(extractor);
+  }
+
+  return !extractor.failed;
+}
+
+bool finishTarExtractor(TarExtractor& extractor) {
+  if (!extractor.failed && (extractor.dataRemaining > 0 || extractor.headerFill > 0)) {
+    failTarExtractor(extractor, "Truncated archive");
+  }
+  if (extractor.file) {
+    extractor.file.close();
+  }
+  return !extractor.failed;
+}
@@ -0,0 +1,67 @@
+#ifndef TAR_ARCHIVE_H
+#define TAR_ARCHIVE_H
+
+#include <Arduino.h>
+#include <SD.h>
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_MAX_DEPTH 4     // open directory handles while streaming
+#define TAR_MAX_PATH 255    // ustar prefix (155) + '/' + name (100)
+#define TAR_MAX_PAX 1024    // pax extended header bytes kept for parsing
+
+// ustar header helpers (no SD access, usable on host)
+bool buildTarHeader(uint8_t* block, const String& name, uint32_t size, uint32_t mtime, bool isDir);
+bool parseTarHeader(const uint8_t* block, String& name, uint32_t& size, char& type);
+bool isTarEndBlock(const uint8_t* block);
+
+// Streams a directory tree (or single file) as a tar archive.
+// Memory use is one header block plus one File handle per directory level.
+// A member that cannot be archived (too deep, name too long, read error)
+// sets failed and stops the stream; the archive is never silently trimmed.
+struct TarWriter {
+  String rootPath;
+  String archiveBase;     // member name prefix for rootPath
+  File dirs[TAR_MAX_DEPTH];
+  String dirNames[TAR_MAX_DEPTH];
+  int depth;
+  File file;
+  uint32_t fileRemaining;
+  uint32_t padRemaining;
+  uint8_t header[TAR_BLOCK_SIZE];
+  size_t headerPos;
+  uint32_t trailerRemaining;
+  bool started;
+  uint32_t entries;
+  bool failed;
+  String error;
+};
+
+bool beginTarWriter(TarWriter& writer, const String& path);    // false with error empty: not found
+size_t readTarWriter(TarWriter& writer, uint8_t* buffer, size_t maxLen);
+
+// Extracts a tar stream onto SD as chunks arrive.
+struct TarExtractor {
+  String destPath;
+  uint8_t header[TAR_BLOCK_SIZE];
+  size_t headerFill;
+  String longName;        // from a GNU 'L' entry or pax path, applies to the next member
+  String paxData;         // records of a pax 'x' header being read
+  bool skipNext;          // pax path could not be read; drop the next member
+  File file;
+  uint32_t dataRemaining;
+  uint32_t padRemaining;
+  char entryType;
+  uint32_t zeroBlocks;
+  uint32_t files;
+  uint32_t dirs;
+  uint32_t skipped;
+  uint64_t bytes;
+  bool failed;
+  String error;
+};
+
+void beginTarExtractor(TarExtractor& extractor, const String& destPath);
+bool writeTarExtractor(TarExtractor& extractor, const uint8_t* data, size_t len);
+bool finishTarExtractor(TarExtractor& extractor);
+
+#endif
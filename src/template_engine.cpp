@@ -0,0 +1,75 @@
+#include "template_engine.h"
+#include <memory>
+
+#define TEMPLATE_OPEN "{{"
+#define TEMPLATE_CLOSE "}}"
+
+static size_t findPlaceholder(const TemplateState& state, size_t from) {
+  const char* open = strstr(state.tmpl + from, TEMPLATE_OPEN);
+  return open ? (size_t)(open - state.tmpl) : state.length;
+}
+
+void initTemplateState(TemplateState& state, const char* tmpl, TemplateResolver resolver) {
+  state.tmpl = tmpl;
+  state.length = strlen(tmpl);
+  state.pos = 0;
+  state.nextPlaceholder = findPlaceholder(state, 0);
+  state.value = "";
+  state.valuePos = 0;
+  state.resolver = resolver;
+}
+
+size_t renderTemplateChunk(TemplateState& state, uint8_t* buffer, size_t maxLen) {
+  size_t out = 0;
+  
+  while (out < maxLen) {
+    // Drain a resolved value that did not fit in the previous chunk
+    if (state.valuePos < state.value.length()) {
+      size_t n = min(state.value.length() - state.valuePos, maxLen - out);
+      memcpy(buffer + out, state.value.c_str() + state.valuePos, n);
+      state.valuePos += n;
+      out += n;
+      continue;
+    }
+    
+    if (state.pos >= state.length) {
+      break;
+    }
+    
+    if (state.pos == state.nextPlaceholder) {
+      const char* nameStart = state.tmpl + state.pos + strlen(TEMPLATE_OPEN);
+      const char* close = strstr(nameStart, TEMPLATE_CLOSE);
+      
+      if (!close) {
+        // Unterminated placeholder: emit the rest verbatim
+        state.nextPlaceholder = state.length;
+        continue;
+      }
+      
+      String name;
+      name.concat(nameStart, close - nameStart);
+      state.value = state.resolver ? state.resolver(name) : String();
+      state.valuePos = 0;
+      state.pos = (close - state.tmpl) + strlen(TEMPLATE_CLOSE);
+      state.nextPlaceholder = findPlaceholder(state, state.pos);
+      continue;
+    }
+    
+    size_t n = min(state.nextPlaceholder - state.pos, maxLen - out);
+    memcpy(buffer + out, state.tmpl + state.pos, n);
+    state.pos += n;
+    out += n;
+  }
+  
+  return out;
+}
+
+AsyncWebServerResponse* beginTemplateResponse(AsyncWebServerRequest *request, const char* contentType,
+                                              const char* tmpl, TemplateResolver resolver) {
+  std::shared_ptr<TemplateState> state = std::make_shared<TemplateState>();
+  initTemplateState(*state, tmpl, resolver);
+  
+  return request->beginChunkedResponse(contentType, [state](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+    return renderTemplateChunk(*state, buffer, maxLen);
+  });
+}
@@ -0,0 +1,29 @@
+#ifndef TEMPLATE_ENGINE_H
+#define TEMPLATE_ENGINE_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// Minimal streaming template renderer for built-in pages.
+// Templates are NUL-terminated strings kept in flash; "{{name}}" placeholders
+// are resolved one at a time as the chunked response is filled, so the full
+// page never exists in RAM.
+typedef std::function<String(const String& name)> TemplateResolver;
+
+struct TemplateState {
+  const char* tmpl;
+  size_t length;
+  size_t pos;
+  size_t nextPlaceholder;
+  String value;
+  size_t valuePos;
+  TemplateResolver resolver;
+};
+
+void initTemplateState(TemplateState& state, const char* tmpl, TemplateResolver resolver);
+size_t renderTemplateChunk(TemplateState& state, uint8_t* buffer, size_t maxLen);
+
+AsyncWebServerResponse* beginTemplateResponse(AsyncWebServerRequest *request, const char* contentType,
+                                              const char* tmpl, TemplateResolver resolver);
+
+#endif
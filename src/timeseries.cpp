@@ -0,0 +1,398 @@
+#include "timeseries.h"
+#include "config.h"
+#include "storage.h"
+#include <SD.h>
+#include <float.h>
+
+#define TS_READ_BATCH 32
+
+struct TsSeries {
+  String name;
+  uint32_t records;
+  uint32_t indexedBlocks;
+  int64_t lastTs;
+  TsBlockSummary tail;  // partial block after the last indexed one
+  uint32_t lastUsed;
+};
+
+// Open series metadata; evicted LRU and rebuilt from SD on demand
+static TsSeries openSeriesTable[TS_MAX_SERIES];
+static size_t openSeriesCount = 0;
+
+bool isValidSeriesName(const String& name) {
+  if (name.length() == 0 || name.length() > TS_MAX_NAME) return false;
+  for (size_t i = 0; i < name.length(); i++) {
+    char c = name[i];
+    if (!isalnum(c) && c != '_' && c != '-') return false;
+  }
+  return true;
+}
+
+static String dataPath(const String& name) {
+  return String(DIR_TIMESERIES) + "/" + name + ".dat";
+}
+
+static String indexPath(const String& name) {
+  return String(DIR_TIMESERIES) + "/" + name + ".idx";
+}
+
+static void resetSummary(TsBlockSummary& summary) {
+  memset(&summary, 0, sizeof(summary));
+  summary.min = FLT_MAX;
+  summary.max = -FLT_MAX;
+}
+
+static void addToSummary(TsBlockSummary& summary, const TsRecord& record) {
+  if (summary.count == 0) summary.firstTs = record.ts;
+  summary.lastTs = record.ts;
+  if (record.value < summary.min) summary.min = record.value;
+  if (record.value > summary.max) summary.max = record.value;
+  summary.sum += record.value;
+  summary.count++;
+}
+
+static void mergeSummary(TsBlockSummary& dst, const TsBlockSummary& src) {
+  if (src.count == 0) return;
+  if (dst.count == 0) dst.firstTs = src.firstTs;
+  dst.lastTs = src.lastTs;
+  if (src.min < dst.min) dst.min = src.min;
+  if (src.max > dst.max) dst.max = src.max;
+  dst.sum += src.sum;
+  dst.count += src.count;
+}
+
+static bool summarizeRecords(File& dat, uint32_t start, uint32_t count, TsBlockSummary& out) {
+  resetSummary(out);
+  TsRecord buffer[TS_READ_BATCH];
+
+  if (!dat.seek(start * sizeof(TsRecord))) return false;
+  while (count > 0) {
+    uint32_t n = min(count, (uint32_t)TS_READ_BATCH);
+    if (dat.read((uint8_t*)buffer, n * sizeof(TsRecord)) != n * sizeof(TsRecord)) return false;
+    for (uint32_t i = 0; i < n; i++) {
+      addToSummary(out, buffer[i]);
+    }
+    count -= n;
+  }
+  return true;
+}
+
+static bool readSummary(File& idx, uint32_t block, TsBlockSummary& out) {
+  return idx.seek(block * sizeof(TsBlockSummary)) &&
+         idx.read((uint8_t*)&out, sizeof(out)) == sizeof(out);
+}
+
+// Rebuilds in-RAM state from the files. Index entries missing after a power
+// loss are regenerated from the raw records.
+static bool loadSeries(TsSeries& series) {
+  File dat = SD.open(dataPath(series.name), FILE_READ);
+  if (!dat) return false;
+
+  series.records = dat.size() / sizeof(TsRecord);
+  uint32_t fullBlocks = series.records / TS_BLOCK_RECORDS;
+
+  File idx = SD.open(indexPath(series.name), FILE_READ);
+  uint32_t indexed = idx ? idx.size() / sizeof(TsBlockSummary) : 0;
+  if (idx) idx.close();
+  if (indexed > fullBlocks) indexed = fullBlocks;
+
+  if (indexed < fullBlocks) {
+    LOG_WARN("Time series %s: rebuilding %d index blocks", series.name.c_str(), fullBlocks - indexed);
+    if (!SD.exists(indexPath(series.name))) {
+      File created = SD.open(indexPath(series.name), FILE_WRITE);
+      created.close();
+    }
+    File rebuild = SD.open(indexPath(series.name), "r+");
+    if (!rebuild) {
+      dat.close();
+      return false;
+    }
+    uint32_t sizeBefore = rebuild.size();
+    rebuild.seek(indexed * sizeof(TsBlockSummary));
+    for (; indexed < fullBlocks; indexed++) {
+      TsBlockSummary summary;
+      if (!summarizeRecords(dat, indexed * TS_BLOCK_RECORDS, TS_BLOCK_RECORDS, summary)) break;
+      rebuild.write((uint8_t*)&summary, sizeof(summary));
+    }
+    adjustSDCardUsage(indexPath(series.name), (int64_t)rebuild.size() - sizeBefore);
+    rebuild.close();
+  }
+
+  series.indexedBlocks = indexed;
+  uint32_t tailStart = indexed * TS_BLOCK_RECORDS;
+  summarizeRecords(dat, tailStart, series.records - tailStart, series.tail);
+  series.records = tailStart + series.tail.count;
+  dat.close();
+
+  series.lastTs = INT64_MIN;
+  if (series.tail.count > 0) {
+    series.lastTs = series.tail.lastTs;
+  } else if (indexed > 0) {
+    File last = SD.open(indexPath(series.name), FILE_READ);
+    TsBlockSummary summary;
+    if (last && readSummary(last, indexed - 1, summary)) {
+      series.lastTs = summary.lastTs;
+    }
+    last.close();
+  }
+  return true;
+}
+
+static TsSeries* openSeries(const String& name, bool create) {
+  for (size_t i = 0; i < openSeriesCount; i++) {
+    if (openSeriesTable[i].name == name) {
+      openSeriesTable[i].lastUsed = millis();
+      return &openSeriesTable[i];
+    }
+  }
+
+  if (!SD.exists(dataPath(name))) {
+    if (!create) return nullptr;
+    createDirectoryPath(DIR_TIMESERIES);
+    File dat = SD.open(dataPath(name), FILE_WRITE);
+    if (!dat) return nullptr;
+    dat.close();
+    LOG_INFO("Created time series: %s", name.c_str());
+  }
+
+  size_t slot = openSeriesCount;
+  if (openSeriesCount < TS_MAX_SERIES) {
+    openSeriesCount++;
+  } else {
+    slot = 0;
+    for (size_t i = 1; i < TS_MAX_SERIES; i++) {
+      if (openSeriesTable[i].lastUsed < openSeriesTable[slot].lastUsed) slot = i;
+    }
+  }
+
+  TsSeries& series = openSeriesTable[slot];
+  series.name = name;
+  series.lastUsed = millis();
+  if (!loadSeries(series)) {
+    series.name = "";
+    return nullptr;
+  }
+  return &series;
+}
+
+size_t writeTimeSeries(const String& name, const TsRecord* points, size_t count) {
+  TsSeries* series = openSeries(name, true);
+  if (!series) return 0;
+
+  // r+ lets a torn record left by a power loss be overwritten in place
+  File dat = SD.open(dataPath(name), "r+");
+  if (!dat) return 0;
+  uint32_t sizeBefore = dat.size();
+  dat.seek(series->records * sizeof(TsRecord));
+  uint32_t indexedBefore = series->indexedBlocks;
+
+  // Accepted points are written straight from the caller's array, one run
+  // of consecutive points at a time; a dropped point or a full block ends a run
+  size_t runStart = 0;
+  size_t runLength = 0;
+  size_t accepted = 0;
+  bool ok = true;
+
+  auto flush = [&]() {
+    if (runLength == 0) return;
+    size_t bytes = runLength * sizeof(TsRecord);
+    if (dat.write((const uint8_t*)(points + runStart), bytes) != bytes) {
+      LOG_ERROR("Time series %s: write failed", name.c_str());
+      ok = false;
+      return;
+    }
+    series->records += runLength;
+    accepted += runLength;
+    runLength = 0;
+  };
+
+  for (size_t i = 0; i < count && ok; i++) {
+    if (points[i].ts < series->lastTs) {
+      flush();
+      continue;
+    }
+
+    if (runLength++ == 0) runStart = i;
+    series->lastTs = points[i].ts;
+    addToSummary(series->tail, points[i]);
+
+    if (series->tail.count == TS_BLOCK_RECORDS) {
+      // Data must be on the card before its index entry
+      flush();
+      if (!ok) break;
+
+      File idx = SD.open(indexPath(name), series->indexedBlocks == 0 ? FILE_WRITE : "r+");
+      if (idx) {
+        idx.seek(series->indexedBlocks * sizeof(TsBlockSummary));
+        idx.write((uint8_t*)&series->tail, sizeof(TsBlockSummary));
+        idx.close();
+        series->indexedBlocks++;
+        resetSummary(series->tail);
+      } else {
+        LOG_ERROR("Time series %s: cannot write index", name.c_str());
+        ok = false;
+      }
+    }
+  }
+
+  if (ok) flush();
+  adjustSDCardUsage(dataPath(name), (int64_t)dat.size() - sizeBefore);
+  dat.close();
+  if (series->indexedBlocks != indexedBefore) {
+    // Index entries are only ever appended here
+    adjustSDCardUsage(indexPath(name), (int64_t)(series->indexedBlocks - indexedBefore) * sizeof(TsBlockSummary));
+  }
+
+  if (!ok) {
+    // Resync RAM state with whatever reached the card
+    loadSeries(*series);
+  }
+  return accepted;
+}
+
+bool queryTimeSeries(const String& name, int64_t from, int64_t to, int64_t step, JsonObject out, String& error) {
+  TsSeries* series = openSeries(name, false);
+  if (!series) {
+    error = "Series not found";
+    return false;
+  }
+
+  uint32_t startMicros = micros();
+  File dat = SD.open(dataPath(name), FILE_READ);
+  File idx = SD.open(indexPath(name), FILE_READ);
+  if (!dat) {
+    error = "Cannot open series";
+    return false;
+  }
+
+  // Clamp open-ended ranges to the stored data so auto-step stays useful
+  TsRecord first;
+  if (series->records > 0 && dat.read((uint8_t*)&first, sizeof(first)) == sizeof(first)) {
+    if (from < first.ts) from = first.ts;
+    if (to > series->lastTs) to = series->lastTs;
+  }
+  if (to < from) {
+    error = "Invalid range";
+    return false;
+  }
+  if (step <= 0) {
+    step = (to - from) / 100 + 1;
+  }
+  if ((to - from) / step + 1 > TS_MAX_BUCKETS) {
+    error = "Too many buckets, increase step";
+    return false;
+  }
+
+  JsonArray points = out["points"].to<JsonArray>();
+  int64_t currentBucket = -1;
+  TsBlockSummary acc;
+  resetSummary(acc);
+  uint32_t summaryBlocks = 0;
+  uint32_t rawBlocks = 0;
+
+  auto emitBucket = [&]() {
+    if (acc.count == 0) return;
+    JsonArray point = points.add<JsonArray>();
+    point.add(from + currentBucket * step);
+    point.add(acc.min);
+    point.add(acc.max);
+    point.add((float)(acc.sum / acc.count));
+    point.add(acc.count);
+  };
+
+  auto addToBucket = [&](int64_t bucket, const TsBlockSummary& summary) {
+    if (bucket != currentBucket) {
+      emitBucket();
+      currentBucket = bucket;
+      resetSummary(acc);
+    }
+    mergeSummary(acc, summary);
+  };
+
+  // Returns false once the block lies past the end of the range
+  auto processBlock = [&](const TsBlockSummary& summary, uint32_t firstRecord) -> bool {
+    if (summary.count == 0 || summary.lastTs < from) return true;
+    if (summary.firstTs > to) return false;
+
+    int64_t firstBucket = (summary.firstTs - from) / step;
+    int64_t lastBucket = (summary.lastTs - from) / step;
+    if (summary.firstTs >= from && summary.lastTs <= to && firstBucket == lastBucket) {
+      addToBucket(firstBucket, summary);
+      summaryBlocks++;
+      return true;
+    }
+
+    // Block straddles a bucket or range edge: fall back to its raw records
+    rawBlocks++;
+    TsRecord buffer[TS_READ_BATCH];
+    uint32_t remaining = summary.count;
+    dat.seek(firstRecord * sizeof(TsRecord));
+    while (remaining > 0) {
+      uint32_t n = min(remaining, (uint32_t)TS_READ_BATCH);
+      if (dat.read((uint8_t*)buffer, n * sizeof(TsRecord)) != n * sizeof(TsRecord)) break;
+      for (uint32_t i = 0; i < n; i++) {
+        if (buffer[i].ts < from || buffer[i].ts > to) continue;
+        TsBlockSummary single;
+        resetSummary(single);
+        addToSummary(single, buffer[i]);
+        addToBucket((buffer[i].ts - from) / step, single);
+      }
+      remaining -= n;
+    }
+    return true;
+  };
+
+  // Binary search for the first indexed block that reaches 'from'
+  uint32_t lo = 0;
+  uint32_t hi = idx ? series->indexedBlocks : 0;
+  TsBlockSummary summary;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (!readSummary(idx, mid, summary)) break;
+    if (summary.lastTs < from) lo = mid + 1;
+    else hi = mid;
+  }
+
+  bool more = true;
+  if (idx) {
+    idx.seek(lo * sizeof(TsBlockSummary));
+    for (uint32_t block = lo; block < series->indexedBlocks && more; block++) {
+      if (idx.read((uint8_t*)&summary, sizeof(summary)) != sizeof(summary)) break;
+      more = processBlock(summary, block * TS_BLOCK_RECORDS);
+    }
+  }
+  if (more) {
+    processBlock(series->tail, series->indexedBlocks * TS_BLOCK_RECORDS);
+  }
+  emitBucket();
+
+  dat.close();
+  if (idx) idx.close();
+
+  out["series"] = name;
+  out["from"] = from;
+  out["to"] = to;
+  out["step"] = step;
+  out["summary_blocks"] = summaryBlocks;
+  out["raw_blocks"] = rawBlocks;
+  out["elapsed_us"] = micros() - startMicros;
+  return true;
+}
+
+void listTimeSeries(JsonArray out) {
+  File dir = SD.open(DIR_TIMESERIES);
+  if (!dir || !dir.isDirectory()) return;
+
+  File file = dir.openNextFile();
+  while (file) {
+    String name = file.name();
+    if (!file.isDirectory() && name.endsWith(".dat")) {
+      JsonObject entry = out.add<JsonObject>();
+      entry["name"] = name.substring(0, name.length() - 4);
+      entry["records"] = file.size() / sizeof(TsRecord);
+      entry["bytes"] = file.size();
+    }
+    file = dir.openNextFile();
+  }
+  dir.close();
+}
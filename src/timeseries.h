@@ -0,0 +1,44 @@
+#ifndef TIMESERIES_H
+#define TIMESERIES_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Append-only binary time-series store on SD.
+//
+// Each series is two files under DIR_TIMESERIES:
+//   <name>.dat  fixed-width TsRecord entries, timestamps non-decreasing
+//   <name>.idx  one TsBlockSummary per full block of TS_BLOCK_RECORDS
+// Range queries binary-search the index and aggregate whole-block summaries,
+// only reading raw records for blocks that straddle a bucket boundary.
+#define TS_BLOCK_RECORDS 256
+#define TS_MAX_SERIES 8
+#define TS_MAX_NAME 24
+#define TS_MAX_BUCKETS 500
+#define TS_WRITE_BATCH 64
+#define TS_MAX_WRITE_BODY 32768
+
+struct __attribute__((packed)) TsRecord {
+  int64_t ts;       // milliseconds (client-defined epoch)
+  float value;
+};
+
+struct __attribute__((packed)) TsBlockSummary {
+  int64_t firstTs;
+  int64_t lastTs;
+  float min;
+  float max;
+  double sum;
+  uint32_t count;
+  uint32_t reserved;
+};
+
+bool isValidSeriesName(const String& name);
+
+// Appends points in order; returns the number accepted (out-of-order points are dropped)
+size_t writeTimeSeries(const String& name, const TsRecord* points, size_t count);
+
+bool queryTimeSeries(const String& name, int64_t from, int64_t to, int64_t step, JsonObject out, String& error);
+void listTimeSeries(JsonArray out);
+
+#endif
@@ -0,0 +1,368 @@
+#include "waveform_peaks.h"
+#include "config.h"
+#include "storage.h"
+#include <SD.h>
+#include <new>
+
+#define PEAKS_MAGIC "PKS1"
+
+// WAV fields the backfill needs
+struct WavFormat {
+  uint16_t audioFormat;
+  uint16_t channels;
+  uint32_t sampleRate;
+  uint16_t bitsPerSample;
+  uint32_t dataOffset;
+  uint32_t dataSize;
+};
+
+String peakPathFor(const String& wavPath) {
+  return wavPath + PEAKS_SUFFIX;
+}
+
+// Samples covered by one pair at a level
+static uint32_t levelSpan(uint8_t level) {
+  uint32_t span = PEAKS_BASE_SAMPLES;
+  for (uint8_t i = 0; i < level; i++) span *= PEAKS_LEVEL_FACTOR;
+  return span;
+}
+
+// ============================================
+// Page Layout
+// ============================================
+//
+// A level-k page fills on the same sample as level-0 page n = (p+1)*4^k, and
+// pages that fill together are written in ascending level order. Counting
+// the pages each level has written by then gives the index of any full
+// page. Partial pages follow all full pages, one per level in level order.
+
+static uint32_t fullPageCount(const PeakFileHeader& header, uint8_t level) {
+  return (header.samples / levelSpan(level)) / PEAKS_PAGE_PAIRS;
+}
+
+static uint32_t tailPairCount(const PeakFileHeader& header, uint8_t level) {
+  return getPeakPairCount(header, level) - fullPageCount(header, level) * PEAKS_PAGE_PAIRS;
+}
+
+static uint32_t fullPageOffset(uint8_t level, uint32_t page) {
+  uint32_t n = (page + 1) * (levelSpan(level) / PEAKS_BASE_SAMPLES);
+  uint32_t index = 0;
+  uint32_t divisor = 1;
+  for (uint8_t j = 0; j < PEAKS_LEVELS; j++) {
+    index += j <= level ? n / divisor : (n - 1) / divisor;
+    divisor *= PEAKS_LEVEL_FACTOR;
+  }
+  return PEAKS_HEADER_BYTES + (index - 1) * PEAKS_PAGE_BYTES;
+}
+
+static uint32_t tailPageOffset(const PeakFileHeader& header, uint8_t level) {
+  uint32_t offset = PEAKS_HEADER_BYTES;
+  for (uint8_t j = 0; j < PEAKS_LEVELS; j++) {
+    offset += fullPageCount(header, j) * PEAKS_PAGE_BYTES;
+  }
+  for (uint8_t j = 0; j < level; j++) {
+    offset += tailPairCount(header, j) * 2;
+  }
+  return offset;
+}
+
+// ============================================
+// Writer
+// ============================================
+
+static void writeHeader(PeakWriter& writer, bool complete) {
+  PeakFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PEAKS_MAGIC, 4);
+  header.sampleRate = writer.sampleRate;
+  header.samples = writer.samples;
+  header.baseSamples = PEAKS_BASE_SAMPLES;
+  header.levels = PEAKS_LEVELS;
+  header.factor = PEAKS_LEVEL_FACTOR;
+  header.pagePairs = PEAKS_PAGE_PAIRS;
+  header.complete = complete ? 1 : 0;
+  writer.file.write((uint8_t*)&header, sizeof(header));
+}
+
+static void resetPair(PeakWriter& writer, uint8_t level) {
+  writer.low[level] = INT16_MAX;
+  writer.high[level] = INT16_MIN;
+  writer.fill[level] = 0;
+}
+
+static void writePage(PeakWriter& writer, uint8_t level) {
+  size_t bytes = writer.pagePairs[level] * 2;
+  writer.pagePairs[level] = 0;
+  if (writer.failed) return;
+
+  size_t written = writer.file.write((uint8_t*)writer.page[level], bytes);
+  adjustSDCardUsage(writer.path, written);
+  if (written != bytes) {
+    LOG_ERROR("Peaks: Write failed for %s", writer.path.c_str());
+    writer.failed = true;
+  }
+}
+
+// Stores the open pair of a level and folds it into the level above. While
+// finishing, full pages are left for finishPeakWriter() to write in order.
+static void closePair(PeakWriter& writer, uint8_t level, bool finishing) {
+  int16_t low = writer.low[level];
+  int16_t high = writer.high[level];
+  int highByte = (high + 255) >> 8;
+
+  int8_t* pair = &writer.page[level][writer.pagePairs[level] * 2];
+  pair[0] = low >> 8;
+  pair[1] = highByte > 127 ? 127 : highByte;
+  writer.pagePairs[level]++;
+  resetPair(writer, level);
+
+  if (!finishing && writer.pagePairs[level] == PEAKS_PAGE_PAIRS) {
+    writePage(writer, level);
+  }
+
+  if (level + 1 < PEAKS_LEVELS) {
+    uint8_t parent = level + 1;
+    if (low < writer.low[parent]) writer.low[parent] = low;
+    if (high > writer.high[parent]) writer.high[parent] = high;
+    writer.fill[parent]++;
+    if (!finishing && writer.fill[parent] == PEAKS_LEVEL_FACTOR) {
+      closePair(writer, parent, false);
+    }
+  }
+}
+
+bool beginPeakWriter(PeakWriter& writer, const String& wavPath, uint32_t sampleRate) {
+  writer.path = peakPathFor(wavPath);
+  writer.sampleRate = sampleRate;
+  writer.samples = 0;
+  writer.failed = false;
+  writer.active = false;
+  for (uint8_t level = 0; level < PEAKS_LEVELS; level++) {
+    resetPair(writer, level);
+    writer.pagePairs[level] = 0;
+  }
+
+  File existing = SD.open(writer.path);
+  if (existing) {
+    int64_t size = existing.isDirectory() ? 0 : existing.size();
+    existing.close();
+    if (SD.remove(writer.path)) adjustSDCardUsage(writer.path, -size);
+  }
+
+  writer.file = SD.open(writer.path, FILE_WRITE);
+  if (!writer.file) {
+    LOG_WARN("Peaks: Cannot create %s", writer.path.c_str());
+    return false;
+  }
+  writeHeader(writer, false);
+  adjustSDCardUsage(writer.path, PEAKS_HEADER_BYTES);
+  writer.active = true;
+  return true;
+}
+
+void addPeakSamples(PeakWriter& writer, const int16_t* samples, size_t count) {
+  if (!writer.active) return;
+
+  size_t i = 0;
+  while (i < count) {
+    // Fold a run up to the end of the open level-0 pair
+    size_t run = PEAKS_BASE_SAMPLES - writer.fill[0];
+    if (run > count - i) run = count - i;
+
+    int16_t low = writer.low[0];
+    int16_t high = writer.high[0];
+    for (size_t end = i + run; i < end; i++) {
+      if (samples[i] < low) low = samples[i];
+      if (samples[i] > high) high = samples[i];
+    }
+    writer.low[0] = low;
+    writer.high[0] = high;
+    writer.fill[0] += run;
+    writer.samples += run;
+
+    if (writer.fill[0] == PEAKS_BASE_SAMPLES) {
+      closePair(writer, 0, false);
+    }
+  }
+}
+
+bool finishPeakWriter(PeakWriter& writer) {
+  if (!writer.active) return false;
+  writer.active = false;
+
+  for (uint8_t level = 0; level < PEAKS_LEVELS; level++) {
+    if (writer.fill[level] > 0) closePair(writer, level, true);
+    if (writer.pagePairs[level] > 0) writePage(writer, level);
+  }
+
+  if (!writer.failed) {
+    writer.file.seek(0);
+    writeHeader(writer, true);
+  }
+  writer.file.close();
+  adjustSDCardUsage(writer.path, 0);
+
+  if (writer.failed) {
+    File partial = SD.open(writer.path);
+    int64_t size = partial ? partial.size() : 0;
+    partial.close();
+    if (SD.remove(writer.path)) adjustSDCardUsage(writer.path, -size);
+    return false;
+  }
+  return true;
+}
+
+// ============================================
+// Backfill
+// ============================================
+
+static bool readWavFormat(File& wav, WavFormat& format) {
+  uint8_t riff[12];
+  if (wav.read(riff, 12) != 12 || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+    return false;
+  }
+
+  bool haveFormat = false;
+  uint8_t chunk[8];
+  while (wav.read(chunk, 8) == 8) {
+    uint32_t size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | ((uint32_t)chunk[7] << 24);
+    uint32_t start = wav.position();
+
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      uint8_t fmt[16];
+      if (size < 16 || wav.read(fmt, 16) != 16) return false;
+      format.audioFormat = fmt[0] | (fmt[1] << 8);
+      format.channels = fmt[2] | (fmt[3] << 8);
+      format.sampleRate = fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | ((uint32_t)fmt[7] << 24);
+      format.bitsPerSample = fmt[14] | (fmt[15] << 8);
+      haveFormat = true;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      format.dataOffset = start;
+      // A recording cut short by a reset still has the zero placeholder size
+      uint32_t available = wav.size() - start;
+      format.dataSize = size == 0 || size > available ? available : size;
+      return haveFormat;
+    }
+
+    if (!wav.seek(start + size + (size & 1))) return false;
+  }
+  return false;
+}
+
+// Converts little-endian PCM to int16 in place: 24-bit shrinks front to
+// back, unsigned 8-bit widens back to front
+static size_t toInt16Samples(uint8_t* buffer, size_t count, size_t sampleBytes) {
+  if (sampleBytes == 3) {
+    for (size_t i = 0; i < count; i++) {
+      buffer[i * 2] = buffer[i * 3 + 1];
+      buffer[i * 2 + 1] = buffer[i * 3 + 2];
+    }
+  } else if (sampleBytes == 1) {
+    for (size_t i = count; i-- > 0;) {
+      uint8_t sample = buffer[i] - 128;
+      buffer[i * 2] = 0;
+      buffer[i * 2 + 1] = sample;
+    }
+  }
+  return count;
+}
+
+bool buildPeakFile(const String& wavPath, uint8_t* buffer, size_t bufferSize,
+                   volatile bool& cancel, uint64_t& bytesDone, String& error) {
+  File wav = SD.open(wavPath, FILE_READ);
+  if (!wav || wav.isDirectory()) {
+    error = "Cannot open " + wavPath;
+    return false;
+  }
+
+  WavFormat format;
+  if (!readWavFormat(wav, format) || format.audioFormat != 1 || format.channels != 1 ||
+      (format.bitsPerSample != 8 && format.bitsPerSample != 16 && format.bitsPerSample != 24)) {
+    wav.close();
+    error = "Not an 8, 16 or 24-bit mono PCM WAV: " + wavPath;
+    return false;
+  }
+  const size_t sampleBytes = format.bitsPerSample / 8;
+
+  PeakWriter* writer = new (std::nothrow) PeakWriter();
+  if (!writer) {
+    wav.close();
+    error = "Out of memory";
+    return false;
+  }
+  if (!beginPeakWriter(*writer, wavPath, format.sampleRate)) {
+    wav.close();
+    delete writer;
+    error = "Cannot create " + peakPathFor(wavPath);
+    return false;
+  }
+
+  // 8-bit samples widen to int16, so read at most half a buffer of them
+  wav.seek(format.dataOffset);
+  uint32_t remaining = format.dataSize - format.dataSize % sampleBytes;
+  size_t readSize = sampleBytes == 1 ? bufferSize / 2 : bufferSize - bufferSize % sampleBytes;
+  while (remaining > 0 && !cancel) {
+    size_t want = remaining < readSize ? remaining : readSize;
+    size_t n = wav.read(buffer, want);
+    n -= n % sampleBytes;
+    if (n == 0) break;
+    size_t count = toInt16Samples(buffer, n / sampleBytes, sampleBytes);
+    addPeakSamples(*writer, (const int16_t*)buffer, count);
+    remaining -= n;
+    bytesDone += n;
+  }
+  wav.close();
+
+  if (cancel) {
+    // Leave no half-built file behind to be mistaken for a finished one
+    writer->failed = true;
+  }
+  bool ok = finishPeakWriter(*writer);
+  delete writer;
+  if (!ok && !cancel) error = "Write failed: " + peakPathFor(wavPath);
+  return ok;
+}
+
+// ============================================
+// Reader
+// ============================================
+
+bool readPeakHeader(const String& wavPath, PeakFileHeader& header) {
+  File file = SD.open(peakPathFor(wavPath), FILE_READ);
+  if (!file) return false;
+  bool ok = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header);
+  file.close();
+
+  return ok && memcmp(header.magic, PEAKS_MAGIC, 4) == 0 && header.complete &&
+         header.levels == PEAKS_LEVELS && header.baseSamples == PEAKS_BASE_SAMPLES &&
+         header.factor == PEAKS_LEVEL_FACTOR && header.pagePairs == PEAKS_PAGE_PAIRS;
+}
+
+uint32_t getPeakPairCount(const PeakFileHeader& header, uint8_t level) {
+  uint32_t span = levelSpan(level);
+  return (header.samples + span - 1) / span;
+}
+
+size_t readPeakBytes(File& file, const PeakFileHeader& header, uint8_t level,
+                     uint32_t offset, uint8_t* out, size_t maxBytes) {
+  uint32_t total = getPeakPairCount(header, level) * 2;
+  if (level >= PEAKS_LEVELS || offset >= total) return 0;
+
+  uint32_t page = offset / PEAKS_PAGE_BYTES;
+  uint32_t within = offset % PEAKS_PAGE_BYTES;
+  uint32_t fullPages = fullPageCount(header, level);
+  uint32_t position;
+  uint32_t pageBytes;
+  if (page < fullPages) {
+    position = fullPageOffset(level, page);
+    pageBytes = PEAKS_PAGE_BYTES;
+  } else {
+    position = tailPageOffset(header, level);
+    pageBytes = tailPairCount(header, level) * 2;
+  }
+
+  size_t n = pageBytes - within;
+  if (n > maxBytes) n = maxBytes;
+  if (!file.seek(position + within)) return 0;
+  return file.read(out, n);
+}
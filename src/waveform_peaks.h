@@ -0,0 +1,75 @@
+#ifndef WAVEFORM_PEAKS_H
+#define WAVEFORM_PEAKS_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+// Min/max peak files for recordings, so a waveform can be drawn without
+// downloading the WAV. "<file>.wav.pk" holds PEAKS_LEVELS resolutions;
+// level 0 has one min/max pair (int8, the high byte of the sample) per
+// PEAKS_BASE_SAMPLES samples and each level above folds PEAKS_LEVEL_FACTOR
+// pairs of the one below.
+//
+// Every level is accumulated incrementally from the samples as they are
+// captured. A level's pairs are buffered in a PEAKS_PAGE_PAIRS page and
+// appended to the file when the page fills, so a recording of any length
+// costs PEAKS_LEVELS pages of RAM. Page order is fixed by the sample count,
+// which lets a reader find any level's pages without an index. finish
+// writes the partial page of each level in level order, then fills in the
+// header.
+#define PEAKS_SUFFIX ".pk"
+#define PEAKS_LEVELS 5
+#define PEAKS_BASE_SAMPLES 256
+#define PEAKS_LEVEL_FACTOR 4
+#define PEAKS_PAGE_PAIRS 128
+#define PEAKS_PAGE_BYTES (PEAKS_PAGE_PAIRS * 2)
+#define PEAKS_HEADER_BYTES 32
+
+struct PeakFileHeader {
+  char magic[4];          // "PKS1"
+  uint32_t sampleRate;
+  uint32_t samples;       // samples covered; valid once complete is set
+  uint16_t baseSamples;
+  uint8_t levels;
+  uint8_t factor;
+  uint16_t pagePairs;
+  uint8_t complete;
+  uint8_t reserved[13];
+};
+
+struct PeakWriter {
+  File file;
+  String path;
+  uint32_t sampleRate;
+  uint32_t samples;
+  bool active;
+  bool failed;
+  // Open pair per level and how many samples (level 0) or child pairs feed it
+  int16_t low[PEAKS_LEVELS];
+  int16_t high[PEAKS_LEVELS];
+  uint16_t fill[PEAKS_LEVELS];
+  uint16_t pagePairs[PEAKS_LEVELS];
+  int8_t page[PEAKS_LEVELS][PEAKS_PAGE_BYTES];
+};
+
+String peakPathFor(const String& wavPath);
+
+bool beginPeakWriter(PeakWriter& writer, const String& wavPath, uint32_t sampleRate);
+void addPeakSamples(PeakWriter& writer, const int16_t* samples, size_t count);
+bool finishPeakWriter(PeakWriter& writer);
+
+// Generates the peak file for an existing 8, 16 or 24-bit mono PCM WAV. bytesDone
+// advances as the WAV is read; setting cancel stops early.
+bool buildPeakFile(const String& wavPath, uint8_t* buffer, size_t bufferSize,
+                   volatile bool& cancel, uint64_t& bytesDone, String& error);
+
+// Header of a finished peak file; false if missing or incomplete
+bool readPeakHeader(const String& wavPath, PeakFileHeader& header);
+uint32_t getPeakPairCount(const PeakFileHeader& header, uint8_t level);
+
+// Reads up to maxBytes of a level's pair data starting at byte offset
+// (2 bytes per pair); stops at a page boundary
+size_t readPeakBytes(File& file, const PeakFileHeader& header, uint8_t level,
+                     uint32_t offset, uint8_t* out, size_t maxBytes);
+
+#endif
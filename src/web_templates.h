@@ -0,0 +1,154 @@
+#ifndef WEB_TEMPLATES_H
+#define WEB_TEMPLATES_H
+
+#include <Arduino.h>
+
+// Built-in pages rendered by template_engine; see the resolvers in api_server.cpp
+
+// Served at "/" when the SD card has no usable index.html.
+// Placeholders: sd_status, sd_size, sd_used, index_status
+static const char FALLBACK_PAGE_TEMPLATE[] PROGMEM = R"rawliteral(
+<!DOCTYPE html>
+<html>
+<head>
+    <title>ESP2GO Manager - Fallback</title>
+    <meta name="viewport" content="width=device-width, initial-scale=1">
+    <link href="https://cdn.jsdelivr.net/npm/bootstrap@5.3.2/dist/css/bootstrap.min.css" rel="stylesheet">
+</head>
+<body class="bg-light">
+    <div class="container my-4">
+        <div class="card shadow">
+            <div class="card-header bg-primary text-white">
+                <h1 class="h3 mb-0">ESP2GO Manager</h1>
+                <small>Fallback Interface</small>
+            </div>
+            <div class="card-body">
+                <div class="alert alert-warning">
+                    <strong>⚠️ Using Fallback Interface</strong><br>
+                    No custom index.html found on SD card. Upload one to customize!
+                </div>
+                
+                <h5 class="mt-4">📊 System Status</h5>
+                <table class="table table-sm">
+                    <tbody>
+                        <tr>
+                            <td class="fw-bold">SD Card Status:</td>
+                            <td>{{sd_status}}</td>
+                        </tr>
+                        <tr>
+                            <td class="fw-bold">SD Card Size:</td>
+                            <td>{{sd_size}}</td>
+                        </tr>
+                        <tr>
+                            <td class="fw-bold">Used Space:</td>
+                            <td>{{sd_used}}</td>
+                        </tr>
+                        <tr>
+                            <td class="fw-bold">index.html exists:</td>
+                            <td>{{index_status}}</td>
+                        </tr>
+                    </tbody>
+                </table>
+                
+                <h5 class="mt-4">📤 Upload File</h5>
+                <form id="uploadForm" enctype="multipart/form-data" class="mb-3">
+                    <div class="input-group">
+                        <input type="file" class="form-control" id="fileInput" name="file">
+                        <button type="submit" class="btn btn-primary">Upload</button>
+                    </div>
+                </form>
+                
+                <h5 class="mt-4">📁 Files</h5>
+                <div id="fileList" class="list-group"></div>
+            </div>
+        </div>
+    </div>
+    <script>
+        function loadFiles() {
+            fetch('/list')
+                .then(response => response.json())
+                .then(data => {
+                    const fileList = document.getElementById('fileList');
+                    if (data.files.length === 0) {
+                        fileList.innerHTML = '<div class="alert alert-info">No files on SD card</div>';
+                        return;
+                    }
+                    fileList.innerHTML = '';
+                    data.files.forEach(file => {
+                        const div = document.createElement('div');
+                        div.className = 'list-group-item d-flex justify-content-between align-items-center';
+                        
+                        const info = document.createElement('div');
+                        const icon = file.isDir ? '📁' : '📄';
+                        info.innerHTML = '<strong>' + icon + ' ' + escapeHtml(file.name) + '</strong> <small class="text-muted">(' + formatBytes(file.size) + ')</small>';
+                        
+                        const btnGroup = document.createElement('div');
+                        btnGroup.className = 'btn-group btn-group-sm';
+                        
+                        if (!file.isDir) {
+                            const downloadBtn = document.createElement('button');
+                            downloadBtn.className = 'btn btn-outline-primary';
+                            downloadBtn.textContent = 'Download';
+                            downloadBtn.onclick = function() { downloadFile(file.path); };
+                            btnGroup.appendChild(downloadBtn);
+                        }
+                        
+                        const deleteBtn = document.createElement('button');
+                        deleteBtn.className = 'btn btn-outline-danger';
+                        deleteBtn.textContent = 'Delete';
+                        deleteBtn.onclick = function() { deleteFile(file.path); };
+                        btnGroup.appendChild(deleteBtn);
+                        
+                        div.appendChild(info);
+                        div.appendChild(btnGroup);
+                        fileList.appendChild(div);
+                    });
+                });
+        }
+        
+        function formatBytes(bytes) {
+            if (bytes === 0) return '0 Bytes';
+            const k = 1024;
+            const sizes = ['Bytes', 'KB', 'MB', 'GB'];
+            const i = Math.floor(Math.log(bytes) / Math.log(k));
+            return Math.round(bytes / Math.pow(k, i) * 100) / 100 + ' ' + sizes[i];
+        }
+        
+        function escapeHtml(text) {
+            const div = document.createElement('div');
+            div.textContent = text;
+            return div.innerHTML;
+        }
+        
+        function downloadFile(path) {
+            window.location.href = '/download?path=' + encodeURIComponent(path);
+        }
+        
+        function deleteFile(path) {
+            if (confirm('Delete ' + path + '?')) {
+                fetch('/delete?path=' + encodeURIComponent(path), {method: 'DELETE'})
+                    .then(() => loadFiles());
+            }
+        }
+        
+        document.getElementById('uploadForm').onsubmit = function(e) {
+            e.preventDefault();
+            const formData = new FormData();
+            formData.append('file', document.getElementById('fileInput').files[0]);
+            fetch('/upload', {
+                method: 'POST',
+                body: formData
+            }).then(() => {
+                loadFiles();
+                document.getElementById('fileInput').value = '';
+                alert('Upload complete! Refresh the page if you uploaded index.html');
+            });
+        };
+        
+        loadFiles();
+    </script>
+</body>
+</html>
+)rawliteral";
+
+#endif
@@ -0,0 +1,733 @@
+#include "webdav.h"
+#include "config.h"
+#include "mime_types.h"
+#include "storage.h"
+#include "file_jobs.h"
+#include "request_governor.h"
+#include <SD.h>
+#include <esp_system.h>
+#include <memory>
+
+#define DAV_XML_TYPE "application/xml; charset=utf-8"
+#define DAV_ALLOW "OPTIONS, PROPFIND, GET, HEAD, PUT, DELETE, MKCOL, MOVE, LOCK, UNLOCK"
+#define DAV_DATE_LEN 32
+
+enum PropfindState {
+  PROPFIND_SELF,
+  PROPFIND_CHILDREN,
+  PROPFIND_END,
+  PROPFIND_DONE
+};
+
+// One PROPFIND in flight; entry holds the XML not yet handed to the socket
+struct PropfindWriter {
+  File dir;
+  String path;
+  bool isDir;
+  uint64_t size;
+  time_t mtime;
+  bool children;
+  PropfindState state;
+  char entry[DAV_ENTRY_MAX];
+  size_t entryLen;
+  size_t entryPos;
+  uint32_t entries;
+};
+
+// A single streamed PUT at a time, owned by its request
+static AsyncWebServerRequest *putOwner = nullptr;
+static File putFile;
+static String putPath;
+static size_t putBytes = 0;
+static bool putFailed = false;
+
+static uint32_t propfindCount = 0;
+static uint32_t propfindEntries = 0;
+static uint32_t getCount = 0;
+static uint32_t rangeCount = 0;
+static uint32_t putCount = 0;
+static uint64_t putTotalBytes = 0;
+static uint32_t lockCount = 0;
+
+// ============================================
+// Paths and Headers
+// ============================================
+
+static String headerValue(AsyncWebServerRequest *request, const char* name) {
+  const AsyncWebHeader* header = request->getHeader(name);
+  return header ? header->value() : String();
+}
+
+// "/dav/apps/" -> "/apps"; empty for anything outside the card
+static String davPath(const String& url) {
+  if (!url.startsWith(DAV_PREFIX)) return String();
+  String path = url.substring(strlen(DAV_PREFIX));
+  if (path.length() > 0 && path[0] != '/') return String();
+  while (path.length() > 1 && path.endsWith("/")) {
+    path.remove(path.length() - 1);
+  }
+  if (path.length() == 0) path = "/";
+  if (path.indexOf("..") >= 0) return String();
+  return path;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static String percentDecode(const String& text) {
+  String out;
+  out.reserve(text.length());
+  for (size_t i = 0; i < text.length(); i++) {
+    if (text[i] == '%' && i + 2 < text.length() && hexValue(text[i + 1]) >= 0 && hexValue(text[i + 2]) >= 0) {
+      out += (char)(hexValue(text[i + 1]) << 4 | hexValue(text[i + 2]));
+      i += 2;
+    } else {
+      out += text[i];
+    }
+  }
+  return out;
+}
+
+// Destination is an absolute URI ("http://host/dav/x"); clients may also
+// send just the path
+static String destinationPath(AsyncWebServerRequest *request) {
+  String dest = headerValue(request, "Destination");
+  int scheme = dest.indexOf("://");
+  if (scheme >= 0) {
+    int slash = dest.indexOf('/', scheme + 3);
+    dest = slash >= 0 ? dest.substring(slash) : String("/");
+  }
+  return davPath(percentDecode(dest));
+}
+
+static bool parentIsDirectory(const String& path) {
+  int slash = path.lastIndexOf('/');
+  if (slash <= 0) return true;
+  File parent = SD.open(path.substring(0, slash));
+  bool ok = parent && parent.isDirectory();
+  parent.close();
+  return ok;
+}
+
+static bool isProtectedPath(const String& path) {
+  return path == "/" || path == PATH_INDEX;
+}
+
+static void formatHttpDate(time_t t, char* out, size_t cap) {
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  strftime(out, cap, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// ============================================
+// PROPFIND
+// ============================================
+
+static bool appendText(char* out, size_t cap, size_t& len, const char* text) {
+  size_t n = strlen(text);
+  if (len + n >= cap) return false;
+  memcpy(out + len, text, n);
+  len += n;
+  out[len] = '\0';
+  return true;
+}
+
+// Percent-encodes everything but unreserved characters and '/', which
+// also keeps '&' and '<' out of the XML
+static bool appendHref(char* out, size_t cap, size_t& len, const char* path, bool isDir) {
+  static const char hex[] = "0123456789ABCDEF";
+  if (!appendText(out, cap, len, DAV_PREFIX)) return false;
+  for (const char* p = path; *p; p++) {
+    uint8_t c = *p;
+    bool plain = isalnum(c) || c == '/' || c == '-' || c == '.' || c == '_' || c == '~';
+    if (len + 4 >= cap) return false;
+    if (plain) {
+      out[len++] = c;
+    } else {
+      out[len++] = '%';
+      out[len++] = hex[c >> 4];
+      out[len++] = hex[c & 15];
+    }
+  }
+  out[len] = '\0';
+  if (isDir && (len == 0 || out[len - 1] != '/')) {
+    return appendText(out, cap, len, "/");
+  }
+  return true;
+}
+
+// Appends one <D:response>; false if it does not fit the buffer
+static bool appendEntry(char* out, size_t cap, size_t& len, const char* path, bool isDir,
+                        uint64_t size, time_t mtime) {
+  char date[DAV_DATE_LEN];
+  char number[24];
+  formatHttpDate(mtime, date, sizeof(date));
+
+  if (!appendText(out, cap, len, "<D:response><D:href>")) return false;
+  if (!appendHref(out, cap, len, path, isDir)) return false;
+  if (!appendText(out, cap, len, "</D:href><D:propstat><D:prop>")) return false;
+
+  if (isDir) {
+    if (!appendText(out, cap, len, "<D:resourcetype><D:collection/></D:resourcetype>")) return false;
+  } else {
+    snprintf(number, sizeof(number), "%llu", (unsigned long long)size);
+    if (!appendText(out, cap, len, "<D:resourcetype/><D:getcontentlength>") ||
+        !appendText(out, cap, len, number) ||
+        !appendText(out, cap, len, "</D:getcontentlength><D:getcontenttype>") ||
+        !appendText(out, cap, len, getMimeType(path)) ||
+        !appendText(out, cap, len, "</D:getcontenttype>")) {
+      return false;
+    }
+  }
+
+  return appendText(out, cap, len, "<D:getlastmodified>") &&
+         appendText(out, cap, len, date) &&
+         appendText(out, cap, len, "</D:getlastmodified></D:prop>"
+                                   "<D:status>HTTP/1.1 200 OK</D:status></D:propstat></D:response>");
+}
+
+// Refills writer.entry with the next piece of the response; false when done
+static bool nextPropfindChunk(PropfindWriter& writer) {
+  writer.entryLen = 0;
+  writer.entryPos = 0;
+  writer.entry[0] = '\0';
+
+  while (writer.entryLen == 0) {
+    switch (writer.state) {
+      case PROPFIND_SELF:
+        appendText(writer.entry, DAV_ENTRY_MAX, writer.entryLen,
+                   "<?xml version=\"1.0\" encoding=\"utf-8\"?><D:multistatus xmlns:D=\"DAV:\">");
+        {
+          size_t prolog = writer.entryLen;
+          if (!appendEntry(writer.entry, DAV_ENTRY_MAX, writer.entryLen, writer.path.c_str(),
+                           writer.isDir, writer.size, writer.mtime)) {
+            LOG_WARN("WebDAV: Path too long for PROPFIND: %s", writer.path.c_str());
+            writer.entryLen = prolog;
+          }
+        }
+        writer.entries++;
+        writer.state = writer.children ? PROPFIND_CHILDREN : PROPFIND_END;
+        break;
+
+      case PROPFIND_CHILDREN: {
+        File child = writer.dir.openNextFile();
+        if (!child) {
+          writer.dir.close();
+          writer.state = PROPFIND_END;
+          break;
+        }
+        bool isDir = child.isDirectory();
+        if (!appendEntry(writer.entry, DAV_ENTRY_MAX, writer.entryLen, child.path(), isDir,
+                         isDir ? 0 : child.size(), child.getLastWrite())) {
+          LOG_WARN("WebDAV: Skipping entry with long path: %s", child.path());
+          writer.entryLen = 0;
+        } else {
+          writer.entries++;
+        }
+        child.close();
+        break;
+      }
+
+      case PROPFIND_END:
+        appendText(writer.entry, DAV_ENTRY_MAX, writer.entryLen, "</D:multistatus>");
+        writer.state = PROPFIND_DONE;
+        propfindEntries += writer.entries;
+        break;
+
+      case PROPFIND_DONE:
+        return false;
+    }
+  }
+  return true;
+}
+
+static size_t readPropfind(PropfindWriter& writer, uint8_t* buffer, size_t maxLen) {
+  size_t written = 0;
+  while (written < maxLen) {
+    if (writer.entryPos == writer.entryLen && !nextPropfindChunk(writer)) break;
+    size_t n = writer.entryLen - writer.entryPos;
+    if (n > maxLen - written) n = maxLen - written;
+    memcpy(buffer + written, writer.entry + writer.entryPos, n);
+    writer.entryPos += n;
+    written += n;
+  }
+  return written;
+}
+
+static void handlePropfind(AsyncWebServerRequest *request, const String& path) {
+  String depth = headerValue(request, "Depth");
+  if (depth.equalsIgnoreCase("infinity")) {
+    request->send(403, DAV_XML_TYPE,
+      "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+      "<D:error xmlns:D=\"DAV:\"><D:propfind-finite-depth/></D:error>");
+    return;
+  }
+
+  File target = SD.open(path);
+  if (!target) {
+    request->send(404, "text/plain", "Not found");
+    return;
+  }
+
+  std::shared_ptr<PropfindWriter> writer = std::make_shared<PropfindWriter>();
+  writer->path = path;
+  writer->isDir = target.isDirectory();
+  writer->size = writer->isDir ? 0 : target.size();
+  writer->mtime = target.getLastWrite();
+  // A missing Depth header means infinity; answer it like Depth: 1
+  writer->children = writer->isDir && depth != "0";
+  writer->state = PROPFIND_SELF;
+  writer->entryLen = 0;
+  writer->entryPos = 0;
+  writer->entries = 0;
+  if (writer->children) {
+    writer->dir = target;
+  } else {
+    target.close();
+  }
+
+  propfindCount++;
+  AsyncWebServerResponse *response = request->beginChunkedResponse(DAV_XML_TYPE,
+    [writer](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      return readPropfind(*writer, buffer, maxLen);
+    });
+  response->setCode(207);
+  request->send(response);
+}
+
+// ============================================
+// GET / HEAD
+// ============================================
+
+// Single "bytes=a-b", "bytes=a-" or "bytes=-n" range. Returns 1 with the
+// inclusive bounds set, 0 to send the whole file (no or multiple ranges),
+// -1 if the range lies outside the file.
+static int parseRange(const String& header, size_t size, size_t& start, size_t& end) {
+  if (!header.startsWith("bytes=") || header.indexOf(',') >= 0) return 0;
+  String spec = header.substring(6);
+  spec.trim();
+  int dash = spec.indexOf('-');
+  if (dash < 0) return 0;
+
+  String first = spec.substring(0, dash);
+  String last = spec.substring(dash + 1);
+  if (first.length() == 0) {
+    size_t suffix = strtoul(last.c_str(), nullptr, 10);
+    if (suffix == 0 || size == 0) return -1;
+    start = suffix >= size ? 0 : size - suffix;
+    end = size - 1;
+    return 1;
+  }
+
+  start = strtoul(first.c_str(), nullptr, 10);
+  end = last.length() > 0 ? strtoul(last.c_str(), nullptr, 10) : size - 1;
+  if (start >= size || end < start) return -1;
+  if (end >= size) end = size - 1;
+  return 1;
+}
+
+static void handleGet(AsyncWebServerRequest *request, const String& path) {
+  File file = SD.open(path, FILE_READ);
+  if (!file) {
+    request->send(404, "text/plain", "Not found");
+    return;
+  }
+  if (file.isDirectory()) {
+    file.close();
+    AsyncWebServerResponse *response = request->beginResponse(405, "text/plain", "Use PROPFIND to list collections");
+    response->addHeader("Allow", DAV_ALLOW);
+    request->send(response);
+    return;
+  }
+
+  size_t size = file.size();
+  char date[DAV_DATE_LEN];
+  formatHttpDate(file.getLastWrite(), date, sizeof(date));
+  if (!admitRequest(request, size > GOV_LARGE_FILE_BYTES)) {
+    file.close();
+    return;
+  }
+
+  size_t start = 0;
+  size_t end = size > 0 ? size - 1 : 0;
+  int range = parseRange(headerValue(request, "Range"), size, start, end);
+  if (range < 0) {
+    file.close();
+    AsyncWebServerResponse *response = request->beginResponse(416, "text/plain", "Range not satisfiable");
+    response->addHeader("Content-Range", "bytes */" + String(size));
+    request->send(response);
+    return;
+  }
+
+  getCount++;
+  if (range > 0) rangeCount++;
+  const char* contentType = getMimeType(path.c_str());
+
+  if (size == 0) {
+    file.close();
+    request->send(200, contentType, String());
+    return;
+  }
+
+  size_t length = end - start + 1;
+  file.seek(start);
+  std::shared_ptr<File> shared = std::make_shared<File>(file);
+  AsyncWebServerResponse *response = request->beginResponse(contentType, length,
+    [shared, length](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      if (index >= length) {
+        shared->close();
+        return 0;
+      }
+      size_t want = length - index < maxLen ? length - index : maxLen;
+      return shared->read(buffer, want);
+    });
+  response->addHeader("Accept-Ranges", "bytes");
+  response->addHeader("Last-Modified", date);
+  if (range > 0) {
+    response->setCode(206);
+    response->addHeader("Content-Range", "bytes " + String(start) + "-" + String(end) + "/" + String(size));
+  }
+  request->send(response);
+}
+
+// ============================================
+// PUT
+// ============================================
+
+static void abortPut() {
+  putFile.close();
+  String temp = putPath + DAV_PUT_SUFFIX;
+  SD.remove(temp);
+  adjustSDCardUsage(temp, -(int64_t)putBytes);
+  putOwner = nullptr;
+}
+
+static void receivePut(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  if (!admitRequest(request, total > GOV_LARGE_FILE_BYTES)) return;
+
+  if (index == 0 && putOwner == nullptr) {
+    String path = davPath(request->url());
+    if (path.length() == 0 || isProtectedPath(path) || !parentIsDirectory(path)) return;
+
+    File existing = SD.open(path);
+    bool isDir = existing && existing.isDirectory();
+    existing.close();
+    if (isDir) return;
+
+    putFile = SD.open(path + DAV_PUT_SUFFIX, FILE_WRITE);
+    if (!putFile) {
+      LOG_ERROR("WebDAV: Cannot open %s for PUT", path.c_str());
+      return;
+    }
+
+    putOwner = request;
+    putPath = path;
+    putBytes = 0;
+    putFailed = false;
+    onRequestClosed(request, [request]() {
+      if (putOwner == request) {
+        LOG_WARN("WebDAV: Client disconnected mid-PUT: %s", putPath.c_str());
+        abortPut();
+      }
+    });
+    LOG_INFO("WebDAV: PUT %s (%d bytes)", path.c_str(), total);
+  }
+
+  if (putOwner != request || putFailed || len == 0) return;
+
+  size_t written = putFile.write(data, len);
+  putBytes += written;
+  adjustSDCardUsage(putPath + DAV_PUT_SUFFIX, written);
+  if (written != len) {
+    LOG_ERROR("WebDAV: Write failed at %d bytes: %s", putBytes, putPath.c_str());
+    putFailed = true;
+  }
+}
+
+static void finishPut(AsyncWebServerRequest *request, const String& path) {
+  if (putOwner != request) {
+    // Empty bodies never reach receivePut
+    if (request->contentLength() > 0 && putOwner) {
+      AsyncWebServerResponse *response = request->beginResponse(503, "text/plain", "Another upload is in progress");
+      response->addHeader("Retry-After", String(GOV_RETRY_AFTER_SEC));
+      request->send(response);
+      return;
+    }
+    if (isProtectedPath(path)) {
+      request->send(403, "text/plain", "Protected path");
+      return;
+    }
+    if (!parentIsDirectory(path)) {
+      request->send(409, "text/plain", "Parent collection does not exist");
+      return;
+    }
+    File existing = SD.open(path);
+    bool exists = (bool)existing;
+    bool isDir = exists && existing.isDirectory();
+    existing.close();
+    if (isDir) {
+      request->send(405, "text/plain", "Cannot PUT to a collection");
+      return;
+    }
+    if (request->contentLength() > 0) {
+      request->send(500, "text/plain", "Cannot write file");
+      return;
+    }
+    File empty = SD.open(path, FILE_WRITE);
+    bool ok = (bool)empty;
+    empty.close();
+    adjustSDCardUsage(path, 0);
+    request->send(ok ? (exists ? 204 : 201) : 500);
+    return;
+  }
+
+  putFile.close();
+  if (putFailed || putBytes != request->contentLength()) {
+    abortPut();
+    request->send(507, "text/plain", "Write failed");
+    return;
+  }
+
+  String temp = putPath + DAV_PUT_SUFFIX;
+  File existing = SD.open(putPath);
+  bool exists = (bool)existing;
+  int64_t existingSize = exists ? existing.size() : 0;
+  existing.close();
+  if (exists && SD.remove(putPath)) {
+    adjustSDCardUsage(putPath, -existingSize);
+  }
+
+  bool ok = SD.rename(temp, putPath);
+  if (ok) noteSDCardMove(temp, putPath, putBytes);
+  putOwner = nullptr;
+  if (!ok) {
+    LOG_ERROR("WebDAV: Cannot move %s into place", temp.c_str());
+    SD.remove(temp);
+    adjustSDCardUsage(temp, -(int64_t)putBytes);
+    request->send(500, "text/plain", "Rename failed");
+    return;
+  }
+
+  putCount++;
+  putTotalBytes += putBytes;
+  LOG_INFO("WebDAV: Stored %s (%d bytes)", putPath.c_str(), putBytes);
+  request->send(exists ? 204 : 201);
+}
+
+// ============================================
+// MKCOL / DELETE / MOVE
+// ============================================
+
+static void handleMkcol(AsyncWebServerRequest *request, const String& path) {
+  if (request->contentLength() > 0) {
+    request->send(415, "text/plain", "MKCOL body not supported");
+    return;
+  }
+  if (SD.exists(path)) {
+    request->send(405, "text/plain", "Already exists");
+    return;
+  }
+  if (!parentIsDirectory(path)) {
+    request->send(409, "text/plain", "Parent collection does not exist");
+    return;
+  }
+  if (!SD.mkdir(path)) {
+    request->send(500, "text/plain", "Cannot create collection");
+    return;
+  }
+  LOG_INFO("WebDAV: Created %s", path.c_str());
+  request->send(201);
+}
+
+static void handleDelete(AsyncWebServerRequest *request, const String& path) {
+  if (isProtectedPath(path)) {
+    request->send(403, "text/plain", "Protected path");
+    return;
+  }
+
+  File file = SD.open(path);
+  if (!file) {
+    request->send(404, "text/plain", "Not found");
+    return;
+  }
+  bool isDir = file.isDirectory();
+  uint64_t size = isDir ? 0 : file.size();
+  file.close();
+
+  // Same split as /_api/files/delete: trees can take seconds
+  if (isDir) {
+    uint32_t jobId = submitFileJob(JOB_DELETE, path, "");
+    if (jobId == 0) {
+      AsyncWebServerResponse *response = request->beginResponse(503, "text/plain", "Job queue full");
+      response->addHeader("Retry-After", String(GOV_RETRY_AFTER_SEC));
+      request->send(response);
+      return;
+    }
+    LOG_INFO("WebDAV: Queued job %d to delete %s", jobId, path.c_str());
+    request->send(202);
+    return;
+  }
+
+  if (!SD.remove(path)) {
+    request->send(500, "text/plain", "Delete failed");
+    return;
+  }
+  adjustSDCardUsage(path, -(int64_t)size);
+  LOG_INFO("WebDAV: Deleted %s", path.c_str());
+  request->send(204);
+}
+
+static void handleMove(AsyncWebServerRequest *request, const String& source) {
+  String destination = destinationPath(request);
+  if (destination.length() == 0) {
+    request->send(400, "text/plain", "Bad Destination");
+    return;
+  }
+  if (isProtectedPath(source) || isProtectedPath(destination) || destination == source ||
+      destination.startsWith(source + "/")) {
+    request->send(403, "text/plain", "Cannot move there");
+    return;
+  }
+
+  File entry = SD.open(source);
+  if (!entry) {
+    request->send(404, "text/plain", "Not found");
+    return;
+  }
+  bool isDir = entry.isDirectory();
+  uint64_t size = isDir ? 0 : entry.size();
+  entry.close();
+
+  if (!parentIsDirectory(destination)) {
+    request->send(409, "text/plain", "Parent collection does not exist");
+    return;
+  }
+
+  File existing = SD.open(destination);
+  bool overwrite = (bool)existing;
+  bool existingIsDir = overwrite && existing.isDirectory();
+  int64_t existingSize = overwrite && !existingIsDir ? existing.size() : 0;
+  existing.close();
+  if (overwrite) {
+    if (headerValue(request, "Overwrite").equalsIgnoreCase("F")) {
+      request->send(412, "text/plain", "Destination exists");
+      return;
+    }
+    // Replacing a whole tree would need a synchronous recursive delete
+    if (existingIsDir || !SD.remove(destination)) {
+      request->send(409, "text/plain", "Cannot replace destination");
+      return;
+    }
+    adjustSDCardUsage(destination, -existingSize);
+  }
+
+  if (!SD.rename(source, destination)) {
+    request->send(500, "text/plain", "Move failed");
+    return;
+  }
+
+  noteSDCardMove(source, destination, size);
+  LOG_INFO("WebDAV: Moved %s -> %s", source.c_str(), destination.c_str());
+  request->send(overwrite ? 204 : 201);
+}
+
+// ============================================
+// LOCK / UNLOCK
+// ============================================
+
+static void handleLock(AsyncWebServerRequest *request, const String& path) {
+  char token[48];
+  snprintf(token, sizeof(token), "opaquelocktoken:%08lx-%04lx-esp2go",
+           (unsigned long)esp_random(), (unsigned long)(esp_random() & 0xffff));
+
+  char href[DAV_ENTRY_MAX];
+  size_t hrefLen = 0;
+  href[0] = '\0';
+  appendHref(href, sizeof(href), hrefLen, path.c_str(), false);
+
+  String body = "<?xml version=\"1.0\" encoding=\"utf-8\"?><D:prop xmlns:D=\"DAV:\"><D:lockdiscovery>"
+                "<D:activelock><D:locktype><D:write/></D:locktype><D:lockscope><D:exclusive/></D:lockscope>"
+                "<D:depth>infinity</D:depth><D:timeout>Second-" + String(DAV_LOCK_TIMEOUT_SEC) +
+                "</D:timeout><D:locktoken><D:href>" + token + "</D:href></D:locktoken>"
+                "<D:lockroot><D:href>" + href + "</D:href></D:lockroot></D:activelock></D:lockdiscovery></D:prop>";
+
+  lockCount++;
+  AsyncWebServerResponse *response = request->beginResponse(200, DAV_XML_TYPE, body);
+  response->addHeader("Lock-Token", String("<") + token + ">");
+  request->send(response);
+}
+
+// ============================================
+// Dispatch
+// ============================================
+
+static void handleDavRequest(AsyncWebServerRequest *request) {
+  if (!admitRequest(request)) return;
+
+  String path = davPath(request->url());
+  if (path.length() == 0) {
+    request->send(400, "text/plain", "Invalid path");
+    return;
+  }
+
+  WebRequestMethodComposite method = request->method();
+  if (method == HTTP_PUT) {
+    finishPut(request, path);
+    return;
+  }
+
+  if (method == HTTP_OPTIONS) {
+    AsyncWebServerResponse *response = request->beginResponse(200);
+    response->addHeader("DAV", "1, 2");
+    response->addHeader("Allow", DAV_ALLOW);
+    response->addHeader("MS-Author-Via", "DAV");
+    request->send(response);
+  } else if (method == HTTP_PROPFIND) {
+    handlePropfind(request, path);
+  } else if (method == HTTP_GET || method == HTTP_HEAD) {
+    handleGet(request, path);
+  } else if (method == HTTP_MKCOL) {
+    handleMkcol(request, path);
+  } else if (method == HTTP_DELETE) {
+    handleDelete(request, path);
+  } else if (method == HTTP_MOVE) {
+    handleMove(request, path);
+  } else if (method == HTTP_LOCK) {
+    handleLock(request, path);
+  } else if (method == HTTP_UNLOCK) {
+    request->send(204);
+  } else {
+    AsyncWebServerResponse *response = request->beginResponse(405, "text/plain", "Method not allowed");
+    response->addHeader("Allow", DAV_ALLOW);
+    request->send(response);
+  }
+}
+
+static void handleDavBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  // PROPFIND and LOCK bodies are ignored: allprop and an exclusive write lock are assumed
+  if (request->method() == HTTP_PUT) {
+    receivePut(request, data, len, index, total);
+  }
+}
+
+void setupWebDAV(AsyncWebServer& server) {
+  // Matches DAV_PREFIX itself and everything below it
+  server.on(DAV_PREFIX, HTTP_ANY, handleDavRequest, nullptr, handleDavBody);
+  LOG_INFO("WebDAV ready at %s/", DAV_PREFIX);
+}
+
+void getWebDAVStats(JsonObject out) {
+  out["prefix"] = DAV_PREFIX "/";
+  out["propfinds"] = propfindCount;
+  out["entries_listed"] = propfindEntries;
+  out["gets"] = getCount;
+  out["range_gets"] = rangeCount;
+  out["puts"] = putCount;
+  out["put_bytes"] = putTotalBytes;
+  out["locks"] = lockCount;
+  out["put_in_progress"] = putOwner != nullptr;
+}
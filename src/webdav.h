@@ -0,0 +1,28 @@
+#ifndef WEBDAV_H
+#define WEBDAV_H
+
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+
+// WebDAV view of the SD card under DAV_PREFIX, so the card can be mounted
+// from Finder, Explorer, davfs2 or rclone instead of scripting the JSON API.
+//
+// PROPFIND (Depth 0/1) answers with a chunked 207 that is generated one
+// entry at a time as the connection drains, so a directory of any size is
+// listed in a fixed DAV_ENTRY_MAX buffer. GET/HEAD honour a single byte
+// range. PUT streams the body into DAV_PUT_SUFFIX next to the target and
+// renames it over the target once complete, so an aborted upload leaves the
+// old file in place. Directory DELETE is handed to the job engine (202).
+//
+// LOCK/UNLOCK are accepted but not enforced: Finder mounts read-only unless
+// the server advertises class 2, and this device has a single user.
+#define DAV_PREFIX "/dav"
+#define DAV_ENTRY_MAX 1280
+#define DAV_PUT_SUFFIX ".davput"
+#define DAV_LOCK_TIMEOUT_SEC 3600
+
+void setupWebDAV(AsyncWebServer& server);
+
+void getWebDAVStats(JsonObject out);
+
+#endif
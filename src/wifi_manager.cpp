@@ -1,5 +1,7 @@
 #include "wifi_manager.h"
 #include "config.h"
+#include "kv_store.h"
+#include "storage.h"
 #include <SD.h>
 #include <ArduinoJson.h>
 #include <ESPmDNS.h>
@@ -9,16 +11,27 @@ int networkCount = 0;
 String saved_ap_ssid = DEFAULT_AP_SSID;
 String saved_ap_password = DEFAULT_AP_PASSWORD;
 
-bool loadWiFiConfig() {
-  if (!SD.exists(WIFI_CONFIG_FILE)) {
-    LOG_WARN("WiFi config file not found on SD card");
-    return false;
-  }
+// Settings live in the KV store; each change is one small log append
+#define WIFI_KV_NETWORKS "wifi.networks"
+#define WIFI_KV_AP "wifi.ap"
+#define WIFI_KV_IMPORTED "wifi.imported"
+
+// wifi_config.json remains the way to provision from a PC: when the file
+// changes it is imported on boot, replacing the stored networks
+static void importWiFiConfigFile() {
+  if (!SD.exists(WIFI_CONFIG_FILE)) return;
   
   File file = SD.open(WIFI_CONFIG_FILE, FILE_READ);
   if (!file) {
     LOG_ERROR("Failed to open WiFi config file");
-    return false;
+    return;
+  }
+  
+  String stamp = String((uint32_t)file.getLastWrite());
+  String imported;
+  if (getKvValue(WIFI_KV_IMPORTED, imported) && imported == stamp) {
+    file.close();
+    return;
   }
   
   JsonDocument doc;
@@ -27,11 +40,62 @@ bool loadWiFiConfig() {
   
   if (error) {
     LOG_ERROR("Failed to parse WiFi config: %s", error.c_str());
+    return;
+  }
+  
+  JsonDocument ap;
+  ap["ssid"] = doc["ap_ssid"] | DEFAULT_AP_SSID;
+  ap["password"] = doc["ap_password"] | DEFAULT_AP_PASSWORD;
+  
+  String networks = "[]";
+  if (doc["networks"].is<JsonArray>()) {
+    networks = "";
+    serializeJson(doc["networks"], networks);
+  }
+  String apSettings;
+  serializeJson(ap, apSettings);
+  
+  KvOp ops[3] = {
+    {WIFI_KV_NETWORKS, networks, false},
+    {WIFI_KV_AP, apSettings, false},
+    {WIFI_KV_IMPORTED, stamp, false}
+  };
+  
+  String kvError;
+  if (applyKvBatch(ops, 3, kvError)) {
+    LOG_INFO("Imported WiFi config from %s", WIFI_CONFIG_FILE);
+  } else {
+    LOG_ERROR("Failed to import WiFi config: %s", kvError.c_str());
+  }
+}
+
+bool loadWiFiConfig() {
+  importWiFiConfigFile();
+  
+  String stored;
+  if (getKvValue(WIFI_KV_AP, stored)) {
+    JsonDocument ap;
+    if (!deserializeJson(ap, stored)) {
+      saved_ap_ssid = ap["ssid"] | DEFAULT_AP_SSID;
+      saved_ap_password = ap["password"] | DEFAULT_AP_PASSWORD;
+    }
+  }
+  
+  if (!getKvValue(WIFI_KV_NETWORKS, stored)) {
+    LOG_WARN("No WiFi networks stored");
+    return false;
+  }
+  
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, stored);
+  
+  if (error) {
+    LOG_ERROR("Failed to parse stored WiFi networks: %s", error.c_str());
     return false;
   }
   
   networkCount = 0;
-  JsonArray networks = doc["networks"];
+  JsonArray networks = doc.as<JsonArray>();
   for (JsonObject net : networks) {
     if (networkCount >= MAX_WIFI_NETWORKS) break;
     
@@ -48,20 +112,13 @@ bool loadWiFiConfig() {
     }
   }
   
-  if (doc["ap_ssid"].is<String>()) {
-    saved_ap_ssid = doc["ap_ssid"].as<String>();
-  }
-  if (doc["ap_password"].is<String>()) {
-    saved_ap_password = doc["ap_password"].as<String>();
-  }
-  
   LOG_INFO("Loaded %d WiFi networks from config", networkCount);
   return networkCount > 0;
 }
 
 bool saveWiFiConfig() {
   JsonDocument doc;
-  JsonArray networks = doc["networks"].to<JsonArray>();
+  JsonArray networks = doc.to<JsonArray>();
   
   for (int i = 0; i < networkCount; i++) {
     JsonObject net = networks.add<JsonObject>();
@@ -70,18 +127,15 @@ bool saveWiFiConfig() {
     net["priority"] = savedNetworks[i].priority;
   }
   
-  doc["ap_ssid"] = saved_ap_ssid;
-  doc["ap_password"] = saved_ap_password;
+  String value;
+  serializeJson(doc, value);
   
-  File file = SD.open(WIFI_CONFIG_FILE, FILE_WRITE);
-  if (!file) {
-    LOG_ERROR("Failed to open WiFi config for writing");
+  String error;
+  if (!putKvValue(WIFI_KV_NETWORKS, value, error)) {
+    LOG_ERROR("Failed to save WiFi networks: %s", error.c_str());
     return false;
   }
   
-  serializeJsonPretty(doc, file);
-  file.close();
-  
   LOG_INFO("Saved %d WiFi networks to config", networkCount);
   return true;
 }
@@ -175,6 +229,12 @@ void initWiFiConfig() {
     return;
   }
   
+  // Networks added from the serial console must not be replaced by a template
+  String stored;
+  if (getKvValue(WIFI_KV_NETWORKS, stored)) {
+    return;
+  }
+  
   LOG_INFO("Creating default WiFi config file...");
   
   // Ensure /os directory exists
@@ -205,6 +265,7 @@ void initWiFiConfig() {
   
   serializeJsonPretty(doc, file);
   file.close();
+  adjustSDCardUsage(WIFI_CONFIG_FILE, 0);
   
   LOG_INFO("Created WiFi config file: %s", WIFI_CONFIG_FILE);
 }
@@ -0,0 +1,136 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <unity.h>
+#include "storage.h"
+#include "kv_store.h"
+
+// Runs on the board against the real card:
+//   pio test -e m5stack-atoms3u -f embedded/test_kv_store
+// Every key lives under "test/" and is deleted in tearDown().
+
+// serializeJson() output for each value, so they compare as text
+static const char* const SAMPLE_VALUES[] = {
+  "{\"a\":[1,2.5,\"x\"],\"b\":true}",
+  "\"text\"",
+  "-7",
+  "true",
+  "[{}]",
+};
+#define SAMPLE_COUNT (sizeof(SAMPLE_VALUES) / sizeof(SAMPLE_VALUES[0]))
+
+static bool storeReady = false;
+
+static String sampleKey(size_t i) {
+  return "test/value" + String(i);
+}
+
+static void putSample(const String& key, const char* value) {
+  String error;
+  TEST_ASSERT_TRUE_MESSAGE(putKvValue(key, value, error), error.c_str());
+}
+
+void setUp() {
+  TEST_ASSERT_TRUE_MESSAGE(storeReady, "KV store did not start; is a card inserted?");
+}
+
+void tearDown() {
+  JsonDocument doc;
+  JsonArray keys = doc.to<JsonArray>();
+  listKvKeys("test/", keys);
+  String error;
+  for (JsonVariant key : keys) deleteKvValue(key.as<String>(), error);
+}
+
+// Puts test/fill<n> keys until the store refuses one
+static void fillStore() {
+  String error;
+  for (size_t i = 0; i <= KV_MAX_KEYS; i++) {
+    if (!putKvValue("test/fill" + String(i), "1", error)) {
+      TEST_ASSERT_EQUAL_STRING("Store full", error.c_str());
+      return;
+    }
+  }
+  TEST_FAIL_MESSAGE("store never filled up");
+}
+
+// GET /_api/kv builds its reply like this; it must survive either encoding
+void test_read_round_trips_through_msgpack() {
+  for (size_t i = 0; i < SAMPLE_COUNT; i++) {
+    String key = sampleKey(i);
+    putSample(key, SAMPLE_VALUES[i]);
+
+    JsonDocument doc;
+    doc["key"] = key;
+    TEST_ASSERT_TRUE(getKvValue(key, doc["value"].to<JsonVariant>()));
+
+    uint8_t packed[256];
+    size_t length = serializeMsgPack(doc, packed, sizeof(packed));
+    TEST_ASSERT_GREATER_THAN(0, length);
+
+    JsonDocument decoded;
+    TEST_ASSERT_FALSE(deserializeMsgPack(decoded, packed, length));
+    TEST_ASSERT_EQUAL_STRING(key.c_str(), decoded["key"] | "");
+
+    String value;
+    serializeJson(decoded["value"], value);
+    TEST_ASSERT_EQUAL_STRING(SAMPLE_VALUES[i], value.c_str());
+  }
+}
+
+void test_read_of_non_json_value_is_a_string() {
+  putSample("test/raw", "not json");
+
+  JsonDocument doc;
+  TEST_ASSERT_TRUE(getKvValue("test/raw", doc["value"].to<JsonVariant>()));
+  TEST_ASSERT_TRUE(doc["value"].is<const char*>());
+  TEST_ASSERT_EQUAL_STRING("not json", doc["value"] | "");
+}
+
+void test_read_of_missing_key_fails() {
+  JsonDocument doc;
+  TEST_ASSERT_FALSE(getKvValue("test/missing", doc["value"].to<JsonVariant>()));
+}
+
+void test_full_store_takes_a_put_after_a_remove() {
+  fillStore();
+
+  String error;
+  KvOp swap[2] = {{"test/fill0", String(), true}, {"test/new", "2", false}};
+  TEST_ASSERT_TRUE_MESSAGE(applyKvBatch(swap, 2, error), error.c_str());
+  String value;
+  TEST_ASSERT_TRUE(getKvValue("test/new", value));
+
+  // The put would run before the remove frees its slot
+  KvOp reversed[2] = {{"test/extra", "1", false}, {"test/fill1", String(), true}};
+  TEST_ASSERT_FALSE(applyKvBatch(reversed, 2, error));
+  TEST_ASSERT_EQUAL_STRING("Store full", error.c_str());
+}
+
+void test_key_set_twice_needs_one_slot() {
+  fillStore();
+
+  String error;
+  TEST_ASSERT_TRUE(deleteKvValue("test/fill0", error));
+  KvOp twice[2] = {{"test/twice", "1", false}, {"test/twice", "2", false}};
+  TEST_ASSERT_TRUE_MESSAGE(applyKvBatch(twice, 2, error), error.c_str());
+
+  String value;
+  TEST_ASSERT_TRUE(getKvValue("test/twice", value));
+  TEST_ASSERT_EQUAL_STRING("2", value.c_str());
+}
+
+void setup() {
+  delay(2000); // lets the test runner open the serial port
+  setupSDCard();
+  storeReady = initKvStore();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_read_round_trips_through_msgpack);
+  RUN_TEST(test_read_of_non_json_value_is_a_string);
+  RUN_TEST(test_read_of_missing_key_fails);
+  RUN_TEST(test_full_store_takes_a_put_after_a_remove);
+  RUN_TEST(test_key_set_twice_needs_one_slot);
+  UNITY_END();
+}
+
+void loop() {}
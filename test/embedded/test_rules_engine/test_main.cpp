@@ -0,0 +1,72 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <unity.h>
+#include "hardware.h"
+#include "rules_engine.h"
+
+// Runs on the board: pio test -e m5stack-atoms3u -f embedded/test_rules_engine
+// No card is needed; rules are loaded from the documents below, and an
+// empty rule set is loaded again in tearDown().
+
+// The rule set shipped in sd_card/os/rules.json, all disabled
+static const char* const SHIPPED_RULES = R"({"rules": [
+  {"name": "button-led", "enabled": false,
+   "trigger": {"type": "button", "edge": "press"},
+   "actions": [{"type": "led", "r": 0, "g": 0, "b": 255},
+               {"type": "log", "message": "button pressed"}]},
+  {"name": "loud-alarm", "enabled": false,
+   "trigger": {"type": "mic", "above": 60}, "cooldown": 2000,
+   "conditions": [{"type": "recording", "equals": false}],
+   "actions": [{"type": "gpio", "pin": 5, "value": 1},
+               {"type": "record_start", "file": "loud.wav"}]},
+  {"name": "heartbeat", "enabled": false,
+   "trigger": {"type": "timer", "interval": 1000},
+   "actions": [{"type": "gpio", "pin": 6, "value": "toggle"}]}
+]})";
+
+static void load(const char* json) {
+  JsonDocument doc;
+  TEST_ASSERT_FALSE(deserializeJson(doc, json));
+  JsonDocument result;
+  JsonArray errors = result.to<JsonArray>();
+  TEST_ASSERT_TRUE_MESSAGE(loadRules(doc, errors), errors[0] | "loadRules failed");
+}
+
+void setUp() {}
+
+void tearDown() {
+  load("{\"rules\": []}");
+}
+
+void test_disabled_rules_claim_nothing() {
+  load(SHIPPED_RULES);
+
+  JsonDocument status;
+  getRulesStatus(status.to<JsonObject>());
+  TEST_ASSERT_EQUAL(3, status["rules"].size());
+  TEST_ASSERT_EQUAL(-1, status["mic_level"].as<int>());
+  TEST_ASSERT_EQUAL(0, status["pins"].size());
+}
+
+void test_enabled_button_rule_claims_the_button() {
+  load("{\"rules\": [{\"name\": \"b\", \"trigger\": {\"type\": \"button\"},"
+       " \"actions\": [{\"type\": \"log\", \"message\": \"x\"}]}]}");
+
+  JsonDocument status;
+  getRulesStatus(status.to<JsonObject>());
+  TEST_ASSERT_EQUAL(-1, status["mic_level"].as<int>());
+  TEST_ASSERT_EQUAL(1, status["pins"].size());
+  TEST_ASSERT_EQUAL(getButtonPin(), status["pins"][0].as<int>());
+}
+
+void setup() {
+  delay(2000); // lets the test runner open the serial port
+  initRulesEngine();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_disabled_rules_claim_nothing);
+  RUN_TEST(test_enabled_button_rule_claims_the_button);
+  UNITY_END();
+}
+
+void loop() {}
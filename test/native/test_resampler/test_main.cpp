@@ -0,0 +1,196 @@
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include "audio_resampler.h"
+
+// Runs on the host: pio test -e native -f native/test_resampler
+//
+// Each tone is one second long; the first TONE_SETTLE outputs are skipped
+// so the filter's start-up transient does not count as noise.
+#define TONE_AMPLITUDE 16000.0
+#define TONE_SETTLE 400
+#define TONE_CHUNK 256
+#define MIN_SNR_DB 75.0
+#define MAX_PASSBAND_DROOP_DB 1.0
+#define MIN_ALIAS_REJECTION_DB 55.0
+
+struct RatePair {
+  uint32_t in;
+  uint32_t out;
+};
+
+// 2:1, 6:1 and both directions of 44.1 kHz <-> 48 kHz
+static const RatePair RATE_PAIRS[] = {
+  {16000, 8000},
+  {48000, 8000},
+  {48000, 44100},
+  {44100, 48000},
+};
+#define RATE_PAIR_COUNT (sizeof(RATE_PAIRS) / sizeof(RATE_PAIRS[0]))
+
+static std::vector<int32_t> resampleTone(const RatePair& pair, double hz) {
+  Resampler rs;
+  TEST_ASSERT_TRUE(beginResampler(rs, pair.in, pair.out));
+
+  std::vector<int16_t> in(pair.in);
+  for (size_t i = 0; i < in.size(); i++) {
+    in[i] = (int16_t)lround(TONE_AMPLITUDE * sin(2 * M_PI * hz * i / pair.in));
+  }
+
+  // Fed in chunks, as the capture path does
+  std::vector<int32_t> out(getResamplerMaxOutput(rs, in.size()));
+  size_t produced = 0;
+  for (size_t i = 0; i < in.size(); i += TONE_CHUNK) {
+    size_t count = in.size() - i < TONE_CHUNK ? in.size() - i : TONE_CHUNK;
+    produced += runResampler(rs, &in[i], count, &out[produced]);
+  }
+  endResampler(rs);
+
+  out.resize(produced);
+  TEST_ASSERT_GREATER_THAN(TONE_SETTLE * 2, produced);
+  return out;
+}
+
+// Least-squares fit of a sine at hz; everything left over is noise
+static double toneSnrDb(const RatePair& pair, double hz) {
+  std::vector<int32_t> out = resampleTone(pair, hz);
+
+  double ss = 0, cc = 0, sc = 0, ys = 0, yc = 0;
+  for (size_t i = TONE_SETTLE; i < out.size(); i++) {
+    double t = 2 * M_PI * hz * i / pair.out;
+    double s = sin(t), c = cos(t), y = out[i] / 256.0;
+    ss += s * s;
+    cc += c * c;
+    sc += s * c;
+    ys += y * s;
+    yc += y * c;
+  }
+  double det = ss * cc - sc * sc;
+  double a = (ys * cc - yc * sc) / det;
+  double b = (yc * ss - ys * sc) / det;
+
+  double signal = 0, noise = 0;
+  for (size_t i = TONE_SETTLE; i < out.size(); i++) {
+    double t = 2 * M_PI * hz * i / pair.out;
+    double fit = a * sin(t) + b * cos(t);
+    double error = out[i] / 256.0 - fit;
+    signal += fit * fit;
+    noise += error * error;
+  }
+  return 10 * log10(signal / noise);
+}
+
+// RMS output level relative to the input tone's
+static double toneLevelDb(const RatePair& pair, double hz) {
+  std::vector<int32_t> out = resampleTone(pair, hz);
+
+  double sum = 0;
+  for (size_t i = TONE_SETTLE; i < out.size(); i++) {
+    double y = out[i] / 256.0;
+    sum += y * y;
+  }
+  double rms = sqrt(sum / (out.size() - TONE_SETTLE));
+  return 20 * log10(rms / (TONE_AMPLITUDE / sqrt(2.0)) + 1e-12);
+}
+
+static double lowerNyquist(const RatePair& pair) {
+  return (pair.in < pair.out ? pair.in : pair.out) / 2.0;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_1khz_tone_snr() {
+  for (size_t i = 0; i < RATE_PAIR_COUNT; i++) {
+    double snr = toneSnrDb(RATE_PAIRS[i], 1000);
+    char message[64];
+    snprintf(message, sizeof(message), "%u -> %u: %.1f dB", (unsigned)RATE_PAIRS[i].in,
+             (unsigned)RATE_PAIRS[i].out, snr);
+    TEST_ASSERT_TRUE_MESSAGE(snr >= MIN_SNR_DB, message);
+  }
+}
+
+void test_passband_is_flat() {
+  for (size_t i = 0; i < RATE_PAIR_COUNT; i++) {
+    double level = toneLevelDb(RATE_PAIRS[i], 0.8 * lowerNyquist(RATE_PAIRS[i]));
+    char message[64];
+    snprintf(message, sizeof(message), "%u -> %u: %.2f dB at 0.8 Nyquist",
+             (unsigned)RATE_PAIRS[i].in, (unsigned)RATE_PAIRS[i].out, level);
+    TEST_ASSERT_TRUE_MESSAGE(fabs(level) <= MAX_PASSBAND_DROOP_DB, message);
+  }
+}
+
+// A tone above the output Nyquist rate must not fold back into the band
+void test_decimation_rejects_aliases() {
+  for (size_t i = 0; i < RATE_PAIR_COUNT; i++) {
+    const RatePair& pair = RATE_PAIRS[i];
+    if (pair.in <= pair.out) continue;
+    double hz = 1.5 * lowerNyquist(pair);
+    if (hz > 0.49 * pair.in) hz = 0.49 * pair.in;
+    double level = toneLevelDb(pair, hz);
+    char message[64];
+    snprintf(message, sizeof(message), "%u -> %u: %.1f dB at %.0f Hz", (unsigned)pair.in,
+             (unsigned)pair.out, level, hz);
+    TEST_ASSERT_TRUE_MESSAGE(level <= -MIN_ALIAS_REJECTION_DB, message);
+  }
+}
+
+void test_dc_passes_unchanged() {
+  Resampler rs;
+  TEST_ASSERT_TRUE(beginResampler(rs, 48000, 44100));
+  std::vector<int16_t> in(4800, 12345);
+  std::vector<int32_t> out(getResamplerMaxOutput(rs, in.size()));
+  size_t produced = runResampler(rs, in.data(), in.size(), out.data());
+  endResampler(rs);
+
+  for (size_t i = TONE_SETTLE; i < produced; i++) {
+    TEST_ASSERT_INT32_WITHIN(256, 12345 * 256, out[i]);
+  }
+}
+
+void test_unsupported_ratios_are_refused() {
+  Resampler rs;
+  TEST_ASSERT_FALSE(beginResampler(rs, 16000, 44100));
+  TEST_ASSERT_FALSE(beginResampler(rs, 48000, 0));
+  TEST_ASSERT_EQUAL(0, getResamplerBytes(32000, 44100));
+}
+
+// Not an assertion: host speed only tracks the on-device figure from
+// GET /_api/mic/format?bench=1 loosely, but a large jump shows up here first
+void test_report_speed() {
+  for (size_t i = 0; i < RATE_PAIR_COUNT; i++) {
+    const RatePair& pair = RATE_PAIRS[i];
+    Resampler rs;
+    TEST_ASSERT_TRUE(beginResampler(rs, pair.in, pair.out));
+
+    std::vector<int16_t> in(pair.in * 10);
+    for (size_t j = 0; j < in.size(); j++) in[j] = (int16_t)(rand() % 20000 - 10000);
+    std::vector<int32_t> out(getResamplerMaxOutput(rs, TONE_CHUNK));
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t j = 0; j + TONE_CHUNK <= in.size(); j += TONE_CHUNK) {
+      runResampler(rs, &in[j], TONE_CHUNK, out.data());
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    char message[80];
+    snprintf(message, sizeof(message), "%u -> %u: %.1f ns per input sample, %u taps",
+             (unsigned)pair.in, (unsigned)pair.out, ns / in.size(), (unsigned)rs.taps);
+    TEST_MESSAGE(message);
+    endResampler(rs);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_1khz_tone_snr);
+  RUN_TEST(test_passband_is_flat);
+  RUN_TEST(test_decimation_rejects_aliases);
+  RUN_TEST(test_dc_passes_unchanged);
+  RUN_TEST(test_unsupported_ratios_are_refused);
+  RUN_TEST(test_report_speed);
+  return UNITY_END();
+}
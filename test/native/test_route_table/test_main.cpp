@@ -0,0 +1,139 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "route_table.h"
+
+// Runs on the host: pio test -e native -f native/test_route_table
+//
+// The paths are the firmware's own /_api/* routes, one entry per method as
+// the router registers them. The benchmark times the table against the
+// first-match strcmp walk AsyncWebServer does over its handler list.
+#define BENCH_ROUNDS 20000
+
+static const char* const API_PATHS[] = {
+  "/_api/batch", "/_api/button/status", "/_api/files/archive", "/_api/files/delete",
+  "/_api/files/download", "/_api/files/extract", "/_api/files/info", "/_api/files/list",
+  "/_api/files/manifest", "/_api/files/mkdir", "/_api/files/move", "/_api/files/upload",
+  "/_api/gpio/analog", "/_api/gpio/mode", "/_api/gpio/pins", "/_api/gpio/read",
+  "/_api/gpio/write", "/_api/jobs", "/_api/jobs", "/_api/jobs/cancel",
+  "/_api/jobs/status", "/_api/kv", "/_api/kv", "/_api/kv",
+  "/_api/kv/batch", "/_api/kv/list", "/_api/kv/stats", "/_api/led/effect",
+  "/_api/led/effect", "/_api/led/set", "/_api/logic/cancel", "/_api/logic/capture",
+  "/_api/logic/status", "/_api/mic/durability", "/_api/mic/durability", "/_api/mic/format",
+  "/_api/mic/format", "/_api/mic/level", "/_api/mic/peaks", "/_api/mic/record/start",
+  "/_api/mic/record/status", "/_api/mic/record/stop", "/_api/ota/update", "/_api/rules",
+  "/_api/rules", "/_api/rules/reload", "/_api/sensors", "/_api/sensors/reload",
+  "/_api/storage/bench", "/_api/storage/bench", "/_api/storage/info", "/_api/system/bundle",
+  "/_api/system/cache", "/_api/system/cache", "/_api/system/codec", "/_api/system/governor",
+  "/_api/system/info", "/_api/system/power", "/_api/system/power", "/_api/system/routes",
+  "/_api/system/scheduler", "/_api/ts/list", "/_api/ts/query", "/_api/ts/write",
+  "/_api/wifi/status",
+};
+#define API_PATH_COUNT (sizeof(API_PATHS) / sizeof(API_PATHS[0]))
+
+static RouteTable table;
+
+static void fillTable(const std::vector<const char*>& paths) {
+  TEST_ASSERT_TRUE(paths.size() <= ROUTE_TABLE_MAX);
+  for (size_t i = 0; i < paths.size(); i++) table.paths[i] = paths[i];
+  buildRouteTable(table, paths.size());
+}
+
+static std::vector<const char*> sortedApiPaths() {
+  std::vector<const char*> paths(API_PATHS, API_PATHS + API_PATH_COUNT);
+  std::stable_sort(paths.begin(), paths.end(), [](const char* a, const char* b) {
+    return strcmp(a, b) < 0;
+  });
+  return paths;
+}
+
+static int linearFind(const char* path) {
+  for (size_t i = 0; i < table.count; i++) {
+    if (strcmp(table.paths[i], path) == 0) return i;
+  }
+  return -1;
+}
+
+void setUp() {
+  fillTable(sortedApiPaths());
+}
+
+void tearDown() {}
+
+void test_every_path_finds_its_first_entry() {
+  for (size_t i = 0; i < table.count; i++) {
+    int found = findRoutePath(table, table.paths[i]);
+    TEST_ASSERT_EQUAL(linearFind(table.paths[i]), found);
+    TEST_ASSERT_TRUE(found == 0 || strcmp(table.paths[found - 1], table.paths[found]) != 0);
+  }
+}
+
+void test_distinct_paths_are_counted_once() {
+  size_t distinct = 1;
+  for (size_t i = 1; i < table.count; i++) {
+    if (strcmp(table.paths[i - 1], table.paths[i]) != 0) distinct++;
+  }
+  TEST_ASSERT_EQUAL(distinct, table.distinct);
+}
+
+void test_unknown_paths_miss() {
+  TEST_ASSERT_EQUAL(-1, findRoutePath(table, "/_api/nope"));
+  TEST_ASSERT_EQUAL(-1, findRoutePath(table, "/_api/kv/"));
+  TEST_ASSERT_EQUAL(-1, findRoutePath(table, "/_api/"));
+  TEST_ASSERT_EQUAL(-1, findRoutePath(table, ""));
+}
+
+// A full table still terminates every probe: it is never more than half full
+void test_full_table() {
+  static char names[ROUTE_TABLE_MAX][16];
+  std::vector<const char*> paths;
+  for (size_t i = 0; i < ROUTE_TABLE_MAX; i++) {
+    snprintf(names[i], sizeof(names[i]), "/_api/r%03u", (unsigned)i);
+    paths.push_back(names[i]);
+  }
+  fillTable(paths);
+
+  TEST_ASSERT_EQUAL(ROUTE_TABLE_MAX, table.distinct);
+  for (size_t i = 0; i < ROUTE_TABLE_MAX; i++) {
+    TEST_ASSERT_EQUAL((int)i, findRoutePath(table, names[i]));
+  }
+  TEST_ASSERT_EQUAL(-1, findRoutePath(table, "/_api/r999"));
+}
+
+// Not an assertion: host speed only tracks the on-device figures from
+// GET /_api/system/routes?bench=1 loosely, but a large jump shows up here first
+void test_report_dispatch_speed() {
+  volatile int sink = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < BENCH_ROUNDS; n++) {
+    for (size_t i = 0; i < API_PATH_COUNT; i++) sink += findRoutePath(table, API_PATHS[i]);
+  }
+  double tableNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < BENCH_ROUNDS; n++) {
+    for (size_t i = 0; i < API_PATH_COUNT; i++) sink += linearFind(API_PATHS[i]);
+  }
+  double linearNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+  double lookups = (double)BENCH_ROUNDS * API_PATH_COUNT;
+  char message[96];
+  snprintf(message, sizeof(message), "%u routes, %u paths: table %.1f ns, linear %.1f ns per lookup",
+           (unsigned)table.count, (unsigned)table.distinct, tableNs / lookups, linearNs / lookups);
+  TEST_MESSAGE(message);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_every_path_finds_its_first_entry);
+  RUN_TEST(test_distinct_paths_are_counted_once);
+  RUN_TEST(test_unknown_paths_miss);
+  RUN_TEST(test_full_table);
+  RUN_TEST(test_report_dispatch_speed);
+  return UNITY_END();
+}
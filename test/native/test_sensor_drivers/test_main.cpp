@@ -0,0 +1,228 @@
+#include <unity.h>
+#include <string.h>
+#include "sensor_drivers.h"
+
+// Runs on the host: pio test -e native -f native/test_sensor_drivers
+//
+// The drivers only see SensorBus, so a small simulated bus stands in for
+// the I2C peripheral: a BMP280 register file at 0x76, an SHT3x or SHT4x at
+// 0x44 answering its own command set, and a BH1750 at 0x23. A device NACKs
+// commands it does not know, which is what autodetect relies on.
+#define SIM_SHT_ADDRESS 0x44
+#define SIM_BMP280_ADDRESS 0x76
+#define SIM_BH1750_ADDRESS 0x23
+
+struct SimBus {
+  bool sht4x;               // SHT4x command set instead of SHT3x
+  bool corruptCrc;
+  uint16_t shtWords[2];     // temperature, humidity
+  uint8_t shtCommand[2];
+  size_t shtCommandLen;
+  uint8_t bmp280[256];
+  uint16_t bh1750Raw;
+};
+
+static SimBus sim;
+
+static bool isCommand(const uint8_t* data, size_t len, uint8_t first, uint8_t second, size_t expected) {
+  return len == expected && data[0] == first && (expected == 1 || data[1] == second);
+}
+
+static bool simWrite(void* context, uint8_t address, const uint8_t* data, size_t len) {
+  SimBus* bus = (SimBus*)context;
+  if (address == SIM_BMP280_ADDRESS) {
+    if (len == 2) bus->bmp280[data[0]] = data[1];
+    return true;
+  }
+  if (address == SIM_SHT_ADDRESS) {
+    bool known = bus->sht4x
+      ? isCommand(data, len, 0x94, 0, 1) || isCommand(data, len, 0x89, 0, 1) ||
+        isCommand(data, len, 0xFD, 0, 1)
+      : isCommand(data, len, 0x30, 0xA2, 2) || isCommand(data, len, 0xF3, 0x2D, 2) ||
+        isCommand(data, len, 0x24, 0x00, 2);
+    if (!known) return false;
+    memcpy(bus->shtCommand, data, len);
+    bus->shtCommandLen = len;
+    return true;
+  }
+  return address == SIM_BH1750_ADDRESS;
+}
+
+static void putWord(uint8_t* out, uint16_t word, bool corrupt) {
+  out[0] = word >> 8;
+  out[1] = word & 0xFF;
+  out[2] = sensirionCrc8(out, 2) ^ (corrupt ? 0x01 : 0x00);
+}
+
+static bool simTransfer(void* context, uint8_t address, const uint8_t* out, size_t outLen,
+                        uint8_t* in, size_t inLen) {
+  SimBus* bus = (SimBus*)context;
+  if (address == SIM_BMP280_ADDRESS) {
+    if (outLen != 1 || out[0] + inLen > sizeof(bus->bmp280)) return false;
+    memcpy(in, bus->bmp280 + out[0], inLen);
+    return true;
+  }
+  if (address == SIM_SHT_ADDRESS) {
+    // Status register: one word; serial number and measurement: two
+    bool status = !bus->sht4x && bus->shtCommand[0] == 0xF3;
+    if (inLen != (status ? 3u : 6u)) return false;
+    putWord(in, bus->shtWords[0], bus->corruptCrc);
+    if (!status) putWord(in + 3, bus->shtWords[1], bus->corruptCrc);
+    return true;
+  }
+  if (address == SIM_BH1750_ADDRESS && inLen == 2) {
+    in[0] = bus->bh1750Raw >> 8;
+    in[1] = bus->bh1750Raw & 0xFF;
+    return true;
+  }
+  return false;
+}
+
+static void simDelay(void* context, uint32_t ms) {}
+
+static const SensorBus bus = { simWrite, simTransfer, simDelay, &sim };
+
+// Calibration and raw readings from the BMP280 datasheet's worked example
+// (section 3.12), which gives 25.08 C and 100653.27 Pa
+static void loadBmp280Example() {
+  static const int16_t calibration[12] = {
+    27504, 26435, -1000, (int16_t)36477, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000
+  };
+  for (int i = 0; i < 12; i++) {
+    sim.bmp280[0x88 + i * 2] = (uint16_t)calibration[i] & 0xFF;
+    sim.bmp280[0x89 + i * 2] = (uint16_t)calibration[i] >> 8;
+  }
+  sim.bmp280[0xD0] = 0x58;
+
+  uint32_t adcP = 415148, adcT = 519888;
+  sim.bmp280[0xF7] = adcP >> 12;
+  sim.bmp280[0xF8] = (adcP >> 4) & 0xFF;
+  sim.bmp280[0xF9] = (adcP & 0x0F) << 4;
+  sim.bmp280[0xFA] = adcT >> 12;
+  sim.bmp280[0xFB] = (adcT >> 4) & 0xFF;
+  sim.bmp280[0xFC] = (adcT & 0x0F) << 4;
+}
+
+// Runs begin at the driver's first address that answers, then one read
+static bool beginAndRead(const char* name, float* values) {
+  const SensorDriver* driver = findSensorDriver(name);
+  TEST_ASSERT_NOT_NULL(driver);
+  uint8_t state[SENSOR_STATE_BYTES];
+  for (uint8_t address : driver->addresses) {
+    if (driver->begin(bus, address, state)) return driver->read(bus, address, state, values);
+  }
+  return false;
+}
+
+void setUp() {
+  memset(&sim, 0, sizeof(sim));
+}
+
+void tearDown() {}
+
+void test_sensirion_crc_matches_datasheet() {
+  static const uint8_t data[] = { 0xBE, 0xEF };
+  TEST_ASSERT_EQUAL_UINT8(0x92, sensirionCrc8(data, 2));
+}
+
+void test_bmp280_datasheet_example() {
+  loadBmp280Example();
+  float values[SENSOR_MAX_VALUES];
+  TEST_ASSERT_TRUE(beginAndRead("bmp280", values));
+  TEST_ASSERT_FLOAT_WITHIN(0.005f, 25.08f, values[0]);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 1006.53f, values[1]);
+
+  // Normal mode, temperature x2, pressure x16, IIR 4, 125 ms standby
+  TEST_ASSERT_EQUAL_UINT8(0x57, sim.bmp280[0xF4]);
+  TEST_ASSERT_EQUAL_UINT8(0x48, sim.bmp280[0xF5]);
+}
+
+void test_bmp280_rejects_other_chips() {
+  loadBmp280Example();
+  sim.bmp280[0xD0] = 0x55;
+  uint8_t state[SENSOR_STATE_BYTES];
+  TEST_ASSERT_FALSE(findSensorDriver("bmp280")->begin(bus, SIM_BMP280_ADDRESS, state));
+}
+
+void test_bmp280_waits_for_first_conversion() {
+  loadBmp280Example();
+  const SensorDriver* driver = findSensorDriver("bmp280");
+  uint8_t state[SENSOR_STATE_BYTES];
+  TEST_ASSERT_TRUE(driver->begin(bus, SIM_BMP280_ADDRESS, state));
+
+  // 0x80000 is the data registers' reset value
+  sim.bmp280[0xFA] = 0x80;
+  sim.bmp280[0xFB] = 0x00;
+  sim.bmp280[0xFC] = 0x00;
+  float values[SENSOR_MAX_VALUES];
+  TEST_ASSERT_FALSE(driver->read(bus, SIM_BMP280_ADDRESS, state, values));
+}
+
+void test_sht3x_conversion() {
+  sim.shtWords[0] = 0x6666;
+  sim.shtWords[1] = 0x8000;
+  float values[SENSOR_MAX_VALUES];
+  TEST_ASSERT_TRUE(beginAndRead("sht3x", values));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 25.0f, values[0]);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 50.0f, values[1]);
+}
+
+void test_sht3x_rejects_bad_crc() {
+  uint8_t state[SENSOR_STATE_BYTES];
+  const SensorDriver* driver = findSensorDriver("sht3x");
+  TEST_ASSERT_TRUE(driver->begin(bus, SIM_SHT_ADDRESS, state));
+  sim.corruptCrc = true;
+  float values[SENSOR_MAX_VALUES];
+  TEST_ASSERT_FALSE(driver->read(bus, SIM_SHT_ADDRESS, state, values));
+}
+
+// Both answer at 0x44; only the identity commands tell them apart
+void test_sht4x_is_not_mistaken_for_sht3x() {
+  sim.sht4x = true;
+  sim.shtWords[0] = 0x6666;
+  sim.shtWords[1] = 0x8000;
+  uint8_t state[SENSOR_STATE_BYTES];
+  TEST_ASSERT_FALSE(findSensorDriver("sht3x")->begin(bus, SIM_SHT_ADDRESS, state));
+
+  float values[SENSOR_MAX_VALUES];
+  TEST_ASSERT_TRUE(beginAndRead("sht4x", values));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 25.0f, values[0]);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 56.5f, values[1]);
+}
+
+void test_sht4x_clamps_humidity() {
+  sim.sht4x = true;
+  sim.shtWords[1] = 0xFFFF;
+  float values[SENSOR_MAX_VALUES];
+  TEST_ASSERT_TRUE(beginAndRead("sht4x", values));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 100.0f, values[1]);
+}
+
+void test_bh1750_conversion() {
+  sim.bh1750Raw = 300;
+  float values[SENSOR_MAX_VALUES];
+  TEST_ASSERT_TRUE(beginAndRead("bh1750", values));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 250.0f, values[0]);
+}
+
+void test_registry_lookup() {
+  TEST_ASSERT_EQUAL(4, getSensorDriverCount());
+  TEST_ASSERT_NOT_NULL(findSensorDriver("bh1750"));
+  TEST_ASSERT_NULL(findSensorDriver("dht22"));
+  TEST_ASSERT_NULL(getSensorDriver(getSensorDriverCount()));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_sensirion_crc_matches_datasheet);
+  RUN_TEST(test_bmp280_datasheet_example);
+  RUN_TEST(test_bmp280_rejects_other_chips);
+  RUN_TEST(test_bmp280_waits_for_first_conversion);
+  RUN_TEST(test_sht3x_conversion);
+  RUN_TEST(test_sht3x_rejects_bad_crc);
+  RUN_TEST(test_sht4x_is_not_mistaken_for_sht3x);
+  RUN_TEST(test_sht4x_clamps_humidity);
+  RUN_TEST(test_bh1750_conversion);
+  RUN_TEST(test_registry_lookup);
+  return UNITY_END();
+}
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""Pack sd_card/ into a read-only flash bundle for the "bundle" partition.
+
+Text assets are stored gzip-compressed when that makes them smaller; the
+firmware sends them with Content-Encoding: gzip. The layout matches
+src/flash_bundle.h.
+
+Usage:
+    python tools/build_bundle.py                      # writes bundle.bin
+    python tools/build_bundle.py --flash --port /dev/ttyACM0
+"""
+
+import argparse
+import fnmatch
+import gzip
+import os
+import struct
+import subprocess
+import sys
+import time
+import zlib
+
+MAGIC = 0x4C444E42  # "BNDL"
+VERSION = 1
+FLAG_GZIP = 0x0001
+HEADER = struct.Struct("<IHHIIIIII")
+ENTRY = struct.Struct("<IIHHIII")
+
+COMPRESSIBLE = {".html", ".htm", ".css", ".js", ".json", ".svg", ".txt",
+                ".xml", ".yaml", ".csv", ".md", ".ico"}
+
+# Config files stay on the SD card where the device and user edit them
+DEFAULT_EXCLUDES = ["os/*.json", "*.md", ".*"]
+
+PARTITION_OFFSET = 0x310000
+PARTITION_SIZE = 0xE0000
+
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h ^= b
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def collect(root, excludes):
+    files = []
+    for dirpath, dirnames, filenames in os.walk(root):
+        dirnames[:] = sorted(d for d in dirnames if not d.startswith("."))
+        for name in sorted(filenames):
+            full = os.path.join(dirpath, name)
+            rel = os.path.relpath(full, root).replace(os.sep, "/")
+            if any(fnmatch.fnmatch(rel, pattern) or fnmatch.fnmatch(name, pattern)
+                   for pattern in excludes):
+                continue
+            files.append(("/" + rel, full))
+    return files
+
+
+def build(root, excludes):
+    items = []
+    for path, full in collect(root, excludes):
+        with open(full, "rb") as f:
+            raw = f.read()
+        data, flags = raw, 0
+        if os.path.splitext(path)[1].lower() in COMPRESSIBLE:
+            packed = gzip.compress(raw, compresslevel=9, mtime=0)
+            if len(packed) < len(raw):
+                data, flags = packed, FLAG_GZIP
+        items.append((fnv1a(path.encode()), path.encode(), flags, data, len(raw)))
+
+    items.sort(key=lambda item: (item[0], item[1]))
+
+    strings = bytearray()
+    path_offsets = []
+    for _, path, _, _, _ in items:
+        path_offsets.append(len(strings))
+        strings += path
+
+    strings_offset = HEADER.size + ENTRY.size * len(items)
+    data_offset = (strings_offset + len(strings) + 3) & ~3
+
+    blobs = bytearray()
+    table = bytearray()
+    for (hash_, path, flags, data, raw_size), path_offset in zip(items, path_offsets):
+        table += ENTRY.pack(hash_, path_offset, len(path), flags,
+                            data_offset + len(blobs), len(data), raw_size)
+        blobs += data
+        blobs += b"\0" * (-len(blobs) % 4)
+
+    body = bytes(table) + bytes(strings) + b"\0" * (data_offset - strings_offset - len(strings))
+    total = data_offset + len(blobs)
+    header = HEADER.pack(MAGIC, VERSION, len(items), strings_offset, data_offset,
+                         total, zlib.crc32(body), int(time.time()), 0)
+    return header + body + bytes(blobs), items
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", nargs="?", default="sd_card", help="directory to pack")
+    parser.add_argument("-o", "--output", default="bundle.bin")
+    parser.add_argument("--exclude", action="append", default=[],
+                        help="extra glob to leave out (relative path or file name)")
+    parser.add_argument("--size", type=lambda v: int(v, 0), default=PARTITION_SIZE,
+                        help="partition size (default 0x%X)" % PARTITION_SIZE)
+    parser.add_argument("--flash", action="store_true", help="write the bundle with esptool")
+    parser.add_argument("--port", help="serial port for --flash")
+    parser.add_argument("--offset", type=lambda v: int(v, 0), default=PARTITION_OFFSET,
+                        help="partition offset (default 0x%X)" % PARTITION_OFFSET)
+    args = parser.parse_args()
+
+    image, items = build(args.source, DEFAULT_EXCLUDES + args.exclude)
+    if len(image) > args.size:
+        sys.exit("bundle is %d bytes, partition holds %d" % (len(image), args.size))
+
+    with open(args.output, "wb") as f:
+        f.write(image)
+
+    raw_total = sum(item[4] for item in items)
+    print("%s: %d files, %d KB (%d KB uncompressed), %d%% of partition"
+          % (args.output, len(items), len(image) // 1024, raw_total // 1024,
+             100 * len(image) // args.size))
+
+    if args.flash:
+        cmd = [sys.executable, "-m", "esptool", "--chip", "esp32s3"]
+        if args.port:
+            cmd += ["--port", args.port]
+        cmd += ["write_flash", hex(args.offset), args.output]
+        sys.exit(subprocess.call(cmd))
+
+
+if __name__ == "__main__":
+    main()
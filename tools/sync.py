@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+"""Upload only the files that differ between a local tree and the device.
+
+The device's /_api/files/manifest lists path, size and SHA-256 for a remote
+tree; files whose size or hash differ from the local copy (or that are
+missing) are uploaded, everything else is left alone. Redeploying the stock
+apps after a small edit costs one manifest request plus the changed bytes.
+
+Usage:
+    python tools/sync.py                           # sd_card/ -> esp2go.local:/
+    python tools/sync.py sd_card/apps --dest /apps --host 192.168.4.1
+    python tools/sync.py --dry-run --delete
+"""
+
+import argparse
+import fnmatch
+import hashlib
+import json
+import os
+import sys
+import time
+import urllib.error
+import urllib.parse
+import urllib.request
+import uuid
+
+# Config and data the device owns; never uploaded over or deleted
+DEFAULT_EXCLUDES = ["os/*.json", "os/kv.log", "recordings/*", "captures/*", "data/*", "*.bin", ".*"]
+
+MAX_RETRIES = 5
+
+
+def sha256_file(path):
+    digest = hashlib.sha256()
+    with open(path, "rb") as f:
+        for chunk in iter(lambda: f.read(65536), b""):
+            digest.update(chunk)
+    return digest.hexdigest()
+
+
+def excluded(rel, excludes):
+    name = rel.rsplit("/", 1)[-1]
+    return any(fnmatch.fnmatch(rel, p) or fnmatch.fnmatch(name, p) for p in excludes)
+
+
+def collect(root, excludes):
+    files = {}
+    for dirpath, dirnames, filenames in os.walk(root):
+        dirnames[:] = sorted(d for d in dirnames if not d.startswith("."))
+        for name in sorted(filenames):
+            full = os.path.join(dirpath, name)
+            rel = os.path.relpath(full, root).replace(os.sep, "/")
+            if not excluded(rel, excludes):
+                files[rel] = full
+    return files
+
+
+class DeviceError(Exception):
+    def __init__(self, code, message):
+        super().__init__(message)
+        self.code = code
+
+
+class Device:
+    def __init__(self, host, timeout):
+        self.base = host if host.startswith("http") else "http://" + host
+        self.timeout = timeout
+
+    def request(self, method, path, query=None, body=None, headers=None):
+        url = self.base + path
+        if query:
+            url += "?" + urllib.parse.urlencode(query)
+
+        # The device answers 429/503 with Retry-After when it is busy
+        for attempt in range(MAX_RETRIES):
+            req = urllib.request.Request(url, data=body, method=method, headers=headers or {})
+            try:
+                with urllib.request.urlopen(req, timeout=self.timeout) as resp:
+                    data = resp.read()
+                    return json.loads(data) if data else {}
+            except urllib.error.HTTPError as err:
+                if err.code not in (429, 503) or attempt == MAX_RETRIES - 1:
+                    detail = err.read().decode(errors="replace")
+                    raise DeviceError(err.code, "%s %s failed: %d %s"
+                                      % (method, path, err.code, detail))
+                time.sleep(float(err.headers.get("Retry-After", "1")))
+
+    def manifest(self, root):
+        files, pending, offset = {}, 0, 0
+        while True:
+            page = self.request("GET", "/_api/files/manifest", {"path": root, "offset": offset})
+            for entry in page["files"]:
+                files[entry["path"]] = entry
+            pending += page.get("pending", 0)
+            if "next_offset" not in page:
+                return files, pending
+            offset = page["next_offset"]
+
+    def upload(self, remote_path, local_path):
+        directory, name = remote_path.rsplit("/", 1)
+        boundary = uuid.uuid4().hex
+        with open(local_path, "rb") as f:
+            content = f.read()
+        body = (("--%s\r\nContent-Disposition: form-data; name=\"file\"; filename=\"%s\"\r\n"
+                 "Content-Type: application/octet-stream\r\n\r\n") % (boundary, name)).encode()
+        body += content + ("\r\n--%s--\r\n" % boundary).encode()
+        self.request("POST", "/_api/files/upload", {"path": directory or "/"}, body,
+                     {"Content-Type": "multipart/form-data; boundary=" + boundary})
+
+    def delete(self, remote_path):
+        self.request("DELETE", "/_api/files/delete", {"path": remote_path})
+
+
+def remote_path(dest, rel):
+    return dest.rstrip("/") + "/" + rel
+
+
+def fetch_manifest(device, dest, wait):
+    """Polls until the device has hashed every file, or wait runs out."""
+    deadline = time.time() + wait
+    while True:
+        try:
+            remote, pending = device.manifest(dest)
+        except DeviceError as err:
+            if err.code == 404:
+                return {}
+            raise
+        if pending == 0 or time.time() >= deadline:
+            return remote
+        print("waiting for the device to hash %d files..." % pending)
+        time.sleep(1)
+
+
+def plan(local, remote, dest):
+    changed = []
+    for rel, full in local.items():
+        entry = remote.get(remote_path(dest, rel))
+        if entry is None or entry["size"] != os.path.getsize(full):
+            changed.append(rel)
+        elif entry.get("sha256") != sha256_file(full):
+            # Also covers a hash the device has not finished yet
+            changed.append(rel)
+    return changed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", nargs="?", default="sd_card", help="local directory")
+    parser.add_argument("--host", default="esp2go.local", help="device address")
+    parser.add_argument("--dest", default="/", help="remote directory (default /)")
+    parser.add_argument("--exclude", action="append", default=[],
+                        help="extra glob to leave out (relative path or file name)")
+    parser.add_argument("--delete", action="store_true",
+                        help="remove remote files that are not in the local tree")
+    parser.add_argument("--dry-run", action="store_true", help="only show what would change")
+    parser.add_argument("--wait", type=float, default=30,
+                        help="seconds to wait for the device to finish hashing")
+    parser.add_argument("--timeout", type=float, default=30, help="HTTP timeout in seconds")
+    args = parser.parse_args()
+
+    excludes = DEFAULT_EXCLUDES + args.exclude
+    device = Device(args.host, args.timeout)
+    dest = "/" + args.dest.strip("/") if args.dest.strip("/") else "/"
+
+    local = collect(args.source, excludes)
+    remote = fetch_manifest(device, dest, args.wait)
+    changed = plan(local, remote, dest)
+
+    prefix = dest.rstrip("/") + "/"
+    wanted = {remote_path(dest, rel) for rel in local}
+    stale = sorted(p for p in remote
+                   if p not in wanted and not excluded(p[len(prefix):], excludes))
+
+    changed_bytes = sum(os.path.getsize(local[rel]) for rel in changed)
+    print("%d local files, %d on device: %d to upload (%d KB), %d unchanged"
+          % (len(local), len(remote), len(changed), changed_bytes // 1024,
+             len(local) - len(changed)))
+
+    for rel in changed:
+        print("  upload %s" % remote_path(dest, rel))
+        if not args.dry_run:
+            device.upload(remote_path(dest, rel), local[rel])
+
+    if args.delete:
+        for path in stale:
+            print("  delete %s" % path)
+            if not args.dry_run:
+                device.delete(path)
+    elif stale:
+        print("%d remote files not in %s (use --delete to remove)" % (len(stale), args.source))
+
+    if args.dry_run or not changed:
+        return
+
+    # The upload endpoint replies before the file is known to be intact
+    remote = fetch_manifest(device, dest, args.wait)
+    mismatched = [rel for rel in changed
+                  if remote.get(remote_path(dest, rel), {}).get("sha256") != sha256_file(local[rel])]
+    if mismatched:
+        for rel in mismatched:
+            print("  MISMATCH %s" % remote_path(dest, rel))
+        sys.exit("%d files did not verify" % len(mismatched))
+    print("verified %d uploaded files" % len(changed))
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except (DeviceError, urllib.error.URLError) as err:
+        sys.exit(str(err))